@@ -72,11 +72,23 @@ The address is !_o2/dy, and the arguments are:
     tcp (int32)
 When a discovery is made, a TCP connection is made.
 When a TCP connection is connected or accepted, the
-process sends a list of services to !_o2/sv. Arguments 
+process sends a list of services to !_o2/sv. Arguments
 are all strings. The first argument is the process name,
 e.g. 128.2.100.50:4500; i.e. the ip and tcp server port
 number. The remaining arguments are service names.
 
+Bundles
+-------
+
+A bundle is a message whose address is "#" followed by the
+service name (padded like any address). There is no type string.
+Instead, the address is followed by the messages, each one an
+int32 length (in network order) and the message data from the
+timestamp on. All messages go to the service of the bundle, so
+a bundle is routed like a single message. When the bundle is
+delivered, find_and_call_handlers() dispatches the messages in
+order with the timestamp of the bundle.
+
 */
 
 
@@ -105,6 +117,14 @@ number. The remaining arguments are service names.
 #include "o2_send.h"
 #include "o2_sched.h"
 #include "o2_clock.h"
+#include "o2_registry.h"
+#include "o2_hub.h"
+#include "o2_rudp.h"
+#include "o2_stream.h"
+#include "o2_shmem.h"
+#include "o2_alias.h"
+#include "o2_compact.h"
+#include "o2_interoperation.h"
 
 #ifndef WIN32
 #include <sys/time.h>
@@ -183,13 +203,39 @@ int o2_initialize(char *application_name)
 	_snprintf(address, 32, "/%s/cs/cs", o2_process.name);
 #endif
     o2_add_method(address, "s", &o2_clocksynced_handler, NULL, FALSE, FALSE);
+#ifndef WIN32
+	snprintf(address, 32, "/%s/br", o2_process.name);
+#else
+	_snprintf(address, 32, "/%s/br", o2_process.name);
+#endif
+    o2_add_method(address, NULL, &o2_bridge_handler, NULL, FALSE, FALSE);
+#ifndef WIN32
+	snprintf(address, 32, "/%s/sc", o2_process.name);
+#else
+	_snprintf(address, 32, "/%s/sc", o2_process.name);
+#endif
+    o2_add_method(address, NULL, &o2_stream_credit_handler, NULL, FALSE, FALSE);
+#ifndef WIN32
+	snprintf(address, 32, "/%s/sr", o2_process.name);
+#else
+	_snprintf(address, 32, "/%s/sr", o2_process.name);
+#endif
+    o2_add_method(address, NULL, &o2_shmem_release_handler, NULL, FALSE, FALSE);
     o2_add_method("/_o2/ds", NULL, &o2_discovery_send_handler, NULL, FALSE, FALSE);
+    o2_add_method("/_o2/da", NULL, &o2_announce_handler, NULL, FALSE, FALSE);
+    o2_add_method("/_o2/lz", NULL, &o2_lazy_idle_handler, NULL, FALSE, FALSE);
     o2_time_init();
     o2_sched_init();
     o2_clock_init();
     
-    o2_discovery_send_handler(NULL, "", NULL, 0, NULL); // start sending discovery messages
+    // start sending discovery messages from the first o2_poll(), so that
+    // o2_hub() called right after o2_initialize() can still turn them off
+    if ((err = o2_start_send())) goto cleanup;
+    o2_schedule(&o2_ltsched, o2_finish_message(o2_local_time(), "!_o2/ds"));
     o2_ping_send_handler(NULL, "", NULL, 0, NULL); // start sending clock sync messages
+    if (o2_lazy_flag && o2_lazy_idle_timeout > 0) {
+        o2_lazy_idle_handler(NULL, "", NULL, 0, NULL); // start closing idle connections
+    }
     
     return O2_SUCCESS;
   cleanup:
@@ -217,17 +263,29 @@ int o2_add_service(char *service_name)
     // int wins2003_or_later = detect_windows_server_2003_or_later();
 #endif
     
-    // Add a o2_local_service structure for the o2 service.
-    DA_EXPAND(o2_process.services, service_table);
     service_name = o2_heapify(service_name);
-    DA_LAST(o2_process.services, service_table)->name = service_name;
-    
     if (!tree_insert_node(&path_tree_table, service_name)) {
         return O2_FAIL;
     }
+    return o2_announce_service(service_name);
+}
+
+
+// service_name is "owned" by o2_process.services (it is never freed)
+int o2_announce_service(char *service_name)
+{
+    // Add a o2_local_service structure for the o2 service.
+    DA_EXPAND(o2_process.services, service_table);
+    DA_LAST(o2_process.services, service_table)->name = service_name;
 
     // when we add a service to this process, we must tell all other
-    // processes about it. To find all other processes, use the o2_fds_info
+    // processes about it. With lazy connections, most processes are not
+    // connected, so announce to every known process:
+    if (o2_lazy_flag) {
+        o2_announce_all();
+        return O2_SUCCESS;
+    }
+    // Otherwise, to find all other processes, use the o2_fds_info
     // table since all but a few of the entries are connections to processes
     for (int i = 0; i < o2_fds_info.length; i++) {
         fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
@@ -259,6 +317,10 @@ int o2_poll()
     o2_deliver_pending();
     o2_recv(); // recieve and dispatch messages
     o2_deliver_pending();
+    o2_osc_send_bundles(); // timed messages to OSC servers
+    o2_coalesce_poll(); // messages held by o2_coalesce_messages()
+    o2_bulk_poll(); // large messages waiting in the bulk lane
+    o2_rudp_poll(); // reliable UDP heartbeats and NACKs
     return O2_SUCCESS;
 }
 
@@ -284,6 +346,7 @@ int o2_status(const char *service)
     if (!entry) return O2_FAIL;
     switch (entry->tag) {
         case O2_REMOTE_SERVICE:
+        case O2_BRIDGE_SERVICE: // parent is the hub
             if (o2_clock_is_synchronized &&
                 ((remote_service_entry_ptr) entry)->parent->status ==
                 PROCESS_OK) {
@@ -293,11 +356,10 @@ int o2_status(const char *service)
             }
         case PATTERN_NODE:
             return (o2_clock_is_synchronized ? O2_LOCAL : O2_LOCAL_NOTIME);
-        case O2_BRIDGE_SERVICE:
         default:
             return O2_FAIL; // not implemented yet
-        case OSC_REMOTE_SERVICE: // no timestamp synchronization with OSC
-            return O2_TO_OSC_NOTIME;
+        case OSC_REMOTE_SERVICE: // timed messages are held until due
+            return (o2_clock_is_synchronized ? O2_TO_OSC : O2_TO_OSC_NOTIME);
     }
 }
 
@@ -335,17 +397,33 @@ const char *o2_get_error(int i)
 
 int o2_finish()
 {
+    o2_registry_finish(); // remove our socket file from the registry
+    o2_flush(); // send messages held by o2_coalesce_messages() or queued
+                // in the bulk lane
     // Close all the sockets.
     for (int i = 0 ; i < o2_fds.length; i++) {
         closesocket(DA_GET(o2_fds, struct pollfd, i)->fd);
         fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
         if (info->message) O2_FREE(info->message);
-        if (info->tag == TCP_SOCKET) {
+        if (info->aliases) o2_alias_free(info->aliases);
+        if (info->types) o2_compact_free(info->types);
+        if (info->tag == OSC_SOCKET || info->tag == OSC_TCP_SERVER_SOCKET ||
+            info->tag == OSC_TCP_SOCKET) {
+            O2_FREE(info->u.osc_service_name);
+        }
+        // a process may have no connection or (with lazy connections)
+        // two, so free its services only once
+        if (info->tag == TCP_SOCKET && info->u.process_info &&
+            info->u.process_info->tcp_fd_index == i) {
             O2_FREE(info->u.process_info->services.array);
         }
     }
     DA_FINISH(o2_fds);
     DA_FINISH(o2_fds_info);
+    o2_blob_buffers_finish();
+    o2_foreign_hosts_finish();
+    o2_shmem_finish();
+    o2_frag_finish();
     
     free_node(&path_tree_table);
     free_node(&master_table);
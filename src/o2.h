@@ -243,12 +243,9 @@ extern int o2_debug;
 /// The service forwards messages to an OSC server, and this process
 /// is synchronized. The status of the OSC server is not reported by
 /// O2 (and in the typical UDP case, there is no way to determine if
-/// the OSC server is operational). Timed messages will be scheduled
-/// locally and sent according to the timestamp, resulting in some
-/// added network latency. If O2 timestamps can be converted to valid
-/// OSC timestamps, messages should be forwarded immediately and
-/// scheduled in the OSC server, but OSC clock synchronization is not
-/// standardized or commonly used, so do not expect this behavior.
+/// the OSC server is operational). Timed messages are forwarded
+/// immediately in OSC bundles, with O2 timestamps converted to
+/// wall clock timetags (see o2_delegate_to_osc()).
 #define O2_TO_OSC 7
 
 /** @} */
@@ -298,6 +295,33 @@ void *o2_calloc(size_t n, size_t s);
 typedef double o2_time;
 
 
+/** \brief flag for o2_message: a newer message to the same address
+ *  replaces this one while it waits to be sent or delivered (see
+ *  o2_send_latest())
+ */
+#define O2_LATEST 2
+
+/** \brief flag for o2_message: send this message in the bulk lane
+ *  (see o2_bulk_lane())
+ */
+#define O2_BULK 4
+
+/** \brief flag for o2_message: send by reliable UDP instead of UDP
+ *  (see o2_send_reliable())
+ */
+#define O2_RELIABLE 8
+
+/** \brief flag for o2_message: with #O2_RELIABLE, the receiver may
+ *  deliver the message before earlier ones (see o2_send_unordered())
+ */
+#define O2_UNORDERED 16
+
+
+/** \brief function called to release the memory of a blob added with
+ *  o2_add_blob_ref() when O2 no longer needs it
+ */
+typedef void (*o2_release_fn)(void *data, void *user_data);
+
 /** \brief an O2 message
  *
  */
@@ -305,6 +329,11 @@ typedef struct o2_message {
   struct o2_message *next; ///< links used for free list and scheduler
   int allocated;           ///< how many bytes allocated in data part
   int length;              ///< the length of the message in data part
+  int flags;               ///< #O2_LATEST, #O2_BULK, #O2_RELIABLE, etc.
+                           ///< or 0 (not transmitted)
+  struct o2_blob_ref *refs; ///< blobs in application memory that are
+                           ///< not in data (see o2_add_blob_ref()),
+                           ///< or NULL
   struct {
     o2_time timestamp;   ///< the message delivery time (0 for immediate)
     /** \brief the message address string
@@ -332,6 +361,46 @@ typedef struct o2_blob {
 } o2_blob, *o2_blob_ptr;
 
 
+/**
+ *  \brief A reference to data in shared memory.
+ *
+ *  An O2 message can pass data in a shared memory segment to another
+ *  process on the same host using the 'H' type. Added to messages by
+ *  o2_add_shmem().
+ */
+typedef struct o2_shmem_arg {
+  int32_t owner;    ///< TCP port of the process that owns the segment
+  int32_t segment;  ///< segment id, assigned by the owner
+  uint32_t offset;  ///< where the data starts in the segment
+  uint32_t size;    ///< size of the data
+  union {
+    void *data;     ///< the data as mapped in the receiving process,
+                    ///< or NULL if it could not be mapped
+    int64_t reserved; ///< (the field is 8 bytes in every process)
+  };
+} o2_shmem_arg, *o2_shmem_arg_ptr;
+
+
+/**
+ *  \brief A vector of numbers of one type.
+ *
+ *  A vector can be passed in an O2 message using the 'v' type followed
+ *  by the element type, e.g. "vf" for a vector of floats. Added to
+ *  messages by o2_add_vector().
+ */
+typedef struct o2_vector {
+  int32_t len;      ///< number of elements
+  int32_t typ;      ///< element type: #O2_INT32, #O2_INT64, #O2_FLOAT
+                    ///< or #O2_DOUBLE
+  union {           ///< the elements, actually of length len
+    int32_t vi[1];
+    int64_t vh[1];
+    float vf[1];
+    double vd[1];
+  };
+} o2_vector, *o2_vector_ptr;
+
+
 /**
  *  \brief An enumeration of the O2 message types.
  */
@@ -355,7 +424,9 @@ typedef enum {
   O2_INFINITUM = 'I',     ///< Sybol representing the value Infinitum.
 
   // O2 types
-  O2_BOOL =      'B'      ///< Boolean value returned as either 0 or 1
+  O2_BOOL =      'B',     ///< Boolean value returned as either 0 or 1
+  O2_SHMEM =     'H',     ///< data in shared memory (see o2_add_shmem())
+  O2_VECTOR =    'v'      ///< vector, followed by the element type
 } o2_type, *o2_type_ptr;
 
 
@@ -397,6 +468,8 @@ typedef union {
   o2_time    t;    ///< TimeTag value.
   o2_blob    b;    ///< a blob (unstructured bytes)
   int32_t    B;    ///< a boolean value, either 0 or 1
+  o2_shmem_arg H;  ///< data in shared memory
+  o2_vector  v;    ///< a vector of numbers
 } o2_arg, *o2_arg_ptr;
 
 
@@ -441,6 +514,7 @@ extern int o2_stop_flag;
  *             not set in the method creation call, argv will be NULL.)
  * @param argc The number of arguments received. (This is valid even if
  *             parse_args was not set in the method creation call.)
+ *             A vector is one argument, although it has two type codes.
  * @param user_data This contains the user_data value passed in the call
  *             to the method creation call.
  * @return O2_SUCCESS (0) indicates that the message was succesfully
@@ -490,6 +564,312 @@ int o2_initialize(char *application_name);
 int o2_memory(void *((*malloc)(size_t size)), void ((*free)(void *)));
 
 
+/**
+ * \brief Connect to other processes only when needed.
+ *
+ * By default, every pair of processes with matching application names
+ * opens a TCP connection as soon as they discover each other. With
+ * lazy connections, processes only exchange small UDP announcements
+ * listing their services and clock synchronization state. A TCP
+ * connection to a remote process is opened when the first message is
+ * sent to one of its services with o2_send_cmd(). (Messages sent with
+ * o2_send() go by UDP and never need a connection.)
+ *
+ * Call this function before o2_initialize(). All processes of an
+ * application should make the same choice.
+ *
+ * @param idle_timeout a connection that has not been used for this
+ *     many seconds is closed, and reopened when needed. Use 0 to
+ *     keep connections open once they are made.
+ *
+ * @return O2_SUCCESS if succeed, #O2_RUNNING if O2 is already
+ *     initialized.
+ */
+int o2_lazy_connections(double idle_timeout);
+
+
+/**
+ * \brief Send messages to each remote process in groups.
+ *
+ * Normally, every message to a remote process is sent in its own UDP
+ * datagram or TCP message. With coalescing, messages to the same
+ * process are held and sent together in one datagram (up to the
+ * Ethernet MTU) or one TCP message (up to 16KB). This saves system
+ * calls and packets when many messages go to one process, at the cost
+ * of delaying them. Each message keeps its own timestamp, and messages
+ * sent by TCP stay in order. Messages to O2's own services are never
+ * held.
+ *
+ * Held messages are sent when no more fit, when the oldest has waited
+ * max_latency (checked at the end of o2_poll()), or when o2_flush() is
+ * called.
+ *
+ * @param max_latency how long a message may be held, in seconds. With
+ *     0, messages are sent at the end of each o2_poll(). A negative
+ *     value (the default) turns coalescing off and sends any held
+ *     messages.
+ *
+ * @return #O2_SUCCESS
+ */
+int o2_coalesce_messages(double max_latency);
+
+
+/**
+ * \brief Send all messages held by o2_coalesce_messages() or queued
+ * by o2_bulk_lane() now.
+ *
+ * @return #O2_SUCCESS
+ */
+int o2_flush();
+
+
+/**
+ * \brief Send large messages in a separate, lower priority lane.
+ *
+ * Normally, a large message sent by TCP (e.g. a blob of audio) holds
+ * up all later messages to the same process, including O2's clock
+ * synchronization, until it has been transmitted. With a bulk lane,
+ * messages to remote processes that are longer than threshold bytes,
+ * or marked with #O2_BULK (set the flags field of a message and send
+ * it with o2_send_message()), are queued instead. Each o2_poll() sends
+ * up to bytes_per_poll bytes of queued messages to each process, in
+ * chunks that are interleaved with other messages on the same TCP
+ * connection. Other messages are sent immediately, so they wait for
+ * at most one chunk (8KB).
+ *
+ * Bulk messages to a process arrive in the order sent, but possibly
+ * after other messages that were sent later. Messages sent by UDP and
+ * messages to O2's own services never use the bulk lane. Like other
+ * TCP messages, a bulk message can be at most 1MB; use o2_stream_open()
+ * for more data.
+ *
+ * @param threshold messages longer than this go in the bulk lane. Use
+ *     0 for only messages marked #O2_BULK, or a negative value (the
+ *     default) for no bulk lane. Queued messages are still sent.
+ * @param bytes_per_poll the share of each o2_poll() for the bulk lane
+ *     of each process. Bulk messages are sent at most bytes_per_poll
+ *     times the polling rate per second.
+ *
+ * @return #O2_SUCCESS
+ */
+int o2_bulk_lane(int threshold, int bytes_per_poll);
+
+
+/**
+ * \brief Send short aliases instead of addresses over TCP.
+ *
+ * Every message carries its whole address, which can be longer than
+ * its arguments. With aliases, the first message to an address that
+ * is sent over a TCP connection gives the address a number, and later
+ * messages to it carry only the number (4 bytes for the first 256
+ * addresses, 8 after that). The receiver finds the handler for an
+ * alias without looking up the address, and handlers still see the
+ * whole address. Aliases belong to a connection, and are forgotten
+ * when it closes.
+ *
+ * Only the sender needs to call this: every O2 process understands
+ * aliases. Messages sent by UDP, messages to O2's own services,
+ * address patterns, and messages in the bulk lane (see
+ * o2_bulk_lane()) keep their addresses.
+ *
+ * @param max_aliases the most addresses that get aliases on each
+ *     connection (at most 65536). Use 0 (the default) to send whole
+ *     addresses. Aliases that were already sent are still used.
+ *
+ * @return #O2_SUCCESS
+ */
+int o2_address_aliases(int max_aliases);
+
+
+/**
+ * \brief Send messages over TCP in a compact encoding.
+ *
+ * The usual encoding pads every string and the type string to 4
+ * bytes, sends every int32 in 4 bytes, and gives every message an
+ * 8-byte timestamp even when it is 0. In the compact encoding, ints
+ * take as few bytes as their values need, strings and blobs are not
+ * padded, a timestamp of 0 is left out, and a type string that was
+ * sent before over the same connection is sent as a number. The
+ * receiver decodes messages before they are delivered, so handlers
+ * get the same arguments as always.
+ *
+ * Only the sender needs to call this: every O2 process understands
+ * both encodings, and a message is only sent compact if that makes
+ * it shorter. Messages sent by UDP, messages to O2's own services,
+ * bundles, messages coalesced by o2_coalesce_messages(), and messages
+ * with blobs or shared memory arguments keep the usual encoding.
+ *
+ * @param flag TRUE to send compact messages, FALSE (the default) for
+ *     the usual encoding.
+ *
+ * @return #O2_SUCCESS
+ */
+int o2_compact_encoding(int flag);
+
+
+/** \brief a stream of data sent in chunks (see o2_stream_open()) */
+typedef struct o2_stream *o2_stream_ptr;
+
+
+/**
+ * \brief Open a stream for sending a large amount of data.
+ *
+ * Instead of building one large blob message, data written to a
+ * stream with o2_stream_write() is sent in chunks of at most 8KB.
+ * Each chunk is a message to path with types "ihb": a stream id, the
+ * offset of the chunk in the stream, and a blob with the data. The
+ * handler for path receives the chunks in order, and other messages
+ * can be delivered between them. o2_stream_close() sends a final
+ * message with an empty blob. The stream id is unique among the open
+ * streams of the sending process.
+ *
+ * Streams to a remote service are flow controlled: at most 64KB of
+ * data can be sent but not yet handled by the receiver, and
+ * o2_stream_write() sends no more than that. If the receiving process
+ * goes away, the stream fails: writes return #O2_FAIL even if the
+ * service is offered again, since the new receiver would not get the
+ * start of the stream.
+ *
+ * @param path the address of the messages that carry the data
+ *
+ * @return the stream, or NULL if O2 is not initialized, path is not a
+ *     valid address, or memory cannot be allocated.
+ */
+o2_stream_ptr o2_stream_open(const char *path);
+
+
+/**
+ * \brief Send data on a stream.
+ *
+ * Sends as much of data as the receiver has room for, without
+ * blocking or buffering. If fewer than len bytes are sent, call
+ * o2_poll() (so that the receiver's credit can arrive) and write the
+ * rest later.
+ *
+ * @param stream a stream from o2_stream_open()
+ * @param data the bytes to send
+ * @param len the number of bytes
+ *
+ * @return the number of bytes sent, which is less than len (possibly
+ *     0) when the receiver is behind, or #O2_FAIL if the service is
+ *     not available or is an OSC server, or the stream failed.
+ */
+int o2_stream_write(o2_stream_ptr stream, const void *data, int len);
+
+
+/**
+ * \brief How many bytes can be written to a remote stream now.
+ *
+ * @param stream a stream from o2_stream_open()
+ *
+ * @return the number of bytes o2_stream_write() can send now
+ *     (streams to local services are not limited), or #O2_FAIL if
+ *     the stream failed
+ */
+int o2_stream_space(o2_stream_ptr stream);
+
+
+/**
+ * \brief Send the end of a stream and free it.
+ *
+ * @param stream a stream from o2_stream_open(), which may no longer be
+ *     used
+ *
+ * @return #O2_SUCCESS, or #O2_FAIL if the final message could not
+ *     be sent or the stream failed.
+ */
+int o2_stream_close(o2_stream_ptr stream);
+
+
+/**
+ * \brief Set the largest UDP packet sent to other O2 processes.
+ *
+ * UDP messages to remote O2 processes that are longer than mtu bytes
+ * are split into numbered fragments that fit in one packet each, and
+ * put back together by the receiver. Unlike IP fragmentation, this
+ * works for messages longer than 64KB (up to 1MB), but the message is
+ * still lost if any fragment is lost, and a message that is not
+ * complete after 1 second is dropped. The default is 1472 bytes, an
+ * Ethernet packet less the IP and UDP headers. Messages to OSC
+ * servers are never split.
+ *
+ * @param mtu the largest message (or fragment) sent in one packet,
+ *     at least 256 bytes, or 0 to send every message in one packet.
+ *
+ * @return #O2_SUCCESS, or #O2_FAIL if mtu is too small.
+ */
+int o2_udp_mtu(int mtu);
+
+
+/** \brief function that provides memory for a received blob (see
+ *  o2_blob_buffer())
+ */
+typedef void *(*o2_blob_buffer_fn)(const char *path, uint32_t size,
+                                   void *user_data);
+
+/**
+ * \brief Receive blobs for an address directly into application memory.
+ *
+ * When a message to path arrives over TCP, provider is called with
+ * the message address, the size of its first blob argument and
+ * user_data, as soon as the start of the message has been read. If
+ * provider returns the address of size bytes, the blob data is read
+ * from the socket into that memory, and the message given to the
+ * handler has an empty blob (size 0) in its place, so O2 neither
+ * allocates nor copies the data. If provider returns NULL, the
+ * message is received as usual. provider must not call O2 functions.
+ *
+ * Only messages longer than 512 bytes that arrive directly by TCP are
+ * received this way; messages that are held by
+ * o2_coalesce_messages(), sent in the bulk lane (see
+ * o2_bulk_lane()), or sent by UDP are not. If the connection closes
+ * before the blob is complete, the handler is not called.
+ *
+ * @param path the address of the messages, e.g. "/synth/samples"
+ * @param provider the function that provides memory, or NULL to
+ *     receive messages to path as usual again
+ * @param user_data passed to provider
+ *
+ * @return #O2_SUCCESS if success, #O2_FAIL if not.
+ */
+int o2_blob_buffer(const char *path, o2_blob_buffer_fn provider,
+                   void *user_data);
+
+
+/**
+ * \brief Make this process a hub that relays messages for others.
+ *
+ * In large deployments, connecting every pair of processes is costly.
+ * Instead, processes can attach to hubs with o2_hub(). A hub tells
+ * each attached process about the services of all the others, and
+ * forwards messages addressed to them without copying. Hubs discover
+ * and connect to each other like ordinary processes.
+ *
+ * Call this function before o2_initialize().
+ *
+ * @return O2_SUCCESS if succeed, #O2_RUNNING if O2 is already
+ *     initialized.
+ */
+int o2_become_hub();
+
+
+/**
+ * \brief Reach other processes through a hub.
+ *
+ * Connect to the hub at the given address. This process stops taking
+ * part in discovery and only talks to its hubs, which forward
+ * messages to and from services of other processes. Call this
+ * function after o2_initialize(), before the first o2_poll(), and
+ * once for each hub.
+ *
+ * @param ip the IP address of the hub, e.g. "192.168.1.50"
+ * @param tcp_port the TCP port of the hub
+ *
+ * @return O2_SUCCESS if succeed, O2_FAIL if not.
+ */
+int o2_hub(const char *ip, int tcp_port);
+
+
 /**
  *  \brief Add a service to the current application.
  *
@@ -516,7 +896,9 @@ int o2_add_service(char *service_name);
  *
  * @param path      the address including the service name
  * @param typespec  the types of parameters, use "" for no parameters and
- *                      NULL for no type checking
+ *                      NULL for no type checking. With coercion, a
+ *                      vector ("vi", "vh", "vf" or "vd") is converted
+ *                      to the element type given here.
  * @param h         the handler
  * @param user_data pointer saved and passed to handler
  * @param coerce    is true if you want to allow automatic coercion of types.
@@ -531,6 +913,24 @@ int o2_add_method(const char *path, const char *typespec,
                   o2_method_handler h, void *user_data, int coerce, int parse);
 
 
+/**
+ * \brief Keep only the latest queued message for a method.
+ *
+ * Call this after o2_add_method(). While messages for path wait in
+ * O2's queue of local messages to deliver, a newer message to the
+ * same address replaces an older one in place, as if it had been sent
+ * with o2_send_latest(). Only messages addressed to exactly path (not
+ * to a pattern) are replaced.
+ *
+ * @param path  the address of the method, as given to o2_add_method()
+ * @param flag  TRUE to replace queued messages, FALSE to deliver all
+ *
+ * @return #O2_SUCCESS if success, #O2_FAIL if there is no method for
+ *     path.
+ */
+int o2_method_latest(const char *path, int flag);
+
+
 /**
  *  \brief Process current O2 messages.
  *
@@ -729,6 +1129,68 @@ int o2_send_marker(char *path, double time, int tcp_flag, char *typestring, ...)
     o2_send_marker(path, time, TRUE, typestring, __VA_ARGS__, O2_MARKER_A, O2_MARKER_B)
 
 
+/**
+ * \brief Send an O2 message where only the latest value matters.
+ *
+ * Like o2_send(), but the message is marked with #O2_LATEST: while it
+ * waits to be sent (see o2_coalesce_messages()) or to be delivered
+ * locally, a newer message to the same address replaces it in place.
+ * While it waits to be sent, only a message with the same timestamp
+ * replaces it, so values scheduled for different times all arrive.
+ * This suits continuous controls such as faders and sensors that
+ * update faster than receivers can use the values. Receivers can
+ * ask for the same treatment of queued incoming messages with
+ * o2_method_latest().
+ */
+/** \hideinitializer */ // turn off Doxygen report on o2_send_marker()
+#define o2_send_latest(path, time, typestring, ...) \
+    o2_send_marker(path, time, O2_LATEST, typestring, __VA_ARGS__, \
+                   O2_MARKER_A, O2_MARKER_B)
+
+
+/**
+ * \brief Send an O2 message by TCP where only the latest value matters.
+ *
+ * Like o2_send_cmd(), but see o2_send_latest().
+ */
+/** \hideinitializer */ // turn off Doxygen report on o2_send_marker()
+#define o2_send_cmd_latest(path, time, typestring, ...) \
+    o2_send_marker(path, time, TRUE | O2_LATEST, typestring, __VA_ARGS__, \
+                   O2_MARKER_A, O2_MARKER_B)
+
+
+/**
+ * \brief Send an O2 message by reliable UDP.
+ *
+ * Like o2_send(), but the message is marked with #O2_RELIABLE. Messages
+ * to a remote process travel by UDP with sequence numbers. The receiver
+ * asks for lost messages to be sent again and delivers messages in the
+ * order sent. Unlike o2_send_cmd(), a lost packet does not hold up
+ * other traffic to the process, and sending never blocks. The sender
+ * keeps only the last 512 messages for retransmission, and a receiver
+ * gives up on a message after about 0.1 seconds of asking, so a high
+ * rate stream over a very lossy network can still lose messages.
+ * (Use o2_send_cmd() when every message must arrive.) Local messages
+ * and messages to OSC servers are delivered as by o2_send().
+ */
+/** \hideinitializer */ // turn off Doxygen report on o2_send_marker()
+#define o2_send_reliable(path, time, typestring, ...) \
+    o2_send_marker(path, time, O2_RELIABLE, typestring, __VA_ARGS__, \
+                   O2_MARKER_A, O2_MARKER_B)
+
+
+/**
+ * \brief Send an O2 message by reliable UDP, without ordering.
+ *
+ * Like o2_send_reliable(), but the receiver delivers the message as
+ * soon as it arrives, even if earlier messages are still missing.
+ */
+/** \hideinitializer */ // turn off Doxygen report on o2_send_marker()
+#define o2_send_unordered(path, time, typestring, ...) \
+    o2_send_marker(path, time, O2_RELIABLE | O2_UNORDERED, typestring, \
+                   __VA_ARGS__, O2_MARKER_A, O2_MARKER_B)
+
+
 /**
  * \brief Send an O2 message. (See also macros #o2_send and #o2_send_cmd).
  *
@@ -794,8 +1256,19 @@ int o2_finish();
  *  `/foo/x`, then the message is directed to and handled by
  *  `/maxmsp/foo/x`.
  *
+ *  The service may be local or remote. Messages are delivered
+ *  immediately (timestamp 0). The elements of an OSC bundle are
+ *  timestamped with the bundle timetag, taken as wall clock (NTP)
+ *  time and converted to global time; before clock sync they are
+ *  also delivered immediately. Call after o2_initialize().
+ *
  *  @param service_name The name of the service to which messages are delivered
  *  @param port_num     Port number.
+ *  @param udp_flag     Receive OSC over UDP if true, otherwise accept
+ *                      TCP connections on port_num. On each connection,
+ *                      packets may be preceded by their length (OSC 1.0)
+ *                      or SLIP encoded (OSC 1.1); the first byte tells
+ *                      which.
  *
  *  @return #O2_SUCCESS if success, #O2_FAIL if not.
  */
@@ -809,11 +1282,11 @@ int o2_create_osc_port(const char *service_name, int port_num, int udp_flag);
  *  and sends it directly via UDP to an OSC server.
  *
  *  Note: Before calling o2_send_osc_message(), you should first use
- *  o2_add_osc_service() to add in the osc service and give it a
+ *  o2_delegate_to_osc() to add in the osc service and give it a
  *  service name. Then you can use the service name to send the message.
  *
  *  @param service_name The o2 name for the remote osc server, named by calling
- *                      o2_add_osc_service().
+ *                      o2_delegate_to_osc().
  *  @param path         The osc path.
  *  @param typestring   The type string for the message
  *  @param ...          The data values to be transmitted.
@@ -823,13 +1296,18 @@ int o2_create_osc_port(const char *service_name, int port_num, int udp_flag);
 /** \hideinitializer */
 #define o2_send_osc_message(service_name, path, typestring, ...) \
     o2_send_osc_message_marker(service_name, path, typestring, \
-                               O2_MARKER_A, O2_MARKER_B)
+                               __VA_ARGS__, O2_MARKER_A, O2_MARKER_B)
 
 /** \cond INTERNAL */ \
 int o2_send_osc_message_marker(char *service_name, const char *path,
                                const char *typestring, ...);
 /** \endcond */
 
+/// \brief value for the tcp_flag of o2_delegate_to_osc(): send OSC
+/// over TCP with SLIP framing (OSC 1.1). With `TRUE`, each packet is
+/// preceded by its length instead (OSC 1.0).
+#define O2_OSC_SLIP 2
+
 /**
  *  \brief Create a service that forwards O2 messages to an OSC server.
  *
@@ -838,19 +1316,24 @@ int o2_send_osc_message_marker(char *service_name, const char *path,
  *  @param port_num     The port number of the osc server.
  *  @param tcp_flag     Send OSC message via TCP protocol, in which case
  *                      port_num is the TCP server port, not a connection.
+ *                      Use #O2_OSC_SLIP for SLIP framing.
  *
  *  @return #O2_SUCCESS if success, #O2_FAIL if not.
  *
  *  If `tcp_flag` is set, a TCP connection will be established with
- *  the OSC server.
+ *  the OSC server, and each message is preceded by its length as a
+ *  4-byte integer (OSC 1.0 framing), or with #O2_OSC_SLIP, SLIP
+ *  encoded with an END byte before and after it (OSC 1.1 framing).
+ *  If the connection fails, it is opened again by the next message.
  *  When the created service receives any O2 messages, it will
- *  send the message to the OSC server. If the incoming message has
- *  a timestamp for some future time, the message will be held until
- *  that time, then sent to the OSC server. (Ideally, O2 will convert
- *  the message to an OSC timestamped bundle and send it immediately
- *  to achieve precise forward-synchronous timing, but this requires
- *  clock synchronization with the OSC server, which is normally
- *  unimplemented.)
+ *  send the message to the OSC server. If a message sent by this
+ *  process has a timestamp for some future time, it is sent at once
+ *  in an OSC bundle whose timetag is the corresponding wall clock
+ *  (NTP) time, so the OSC server should share the wall clock of this
+ *  host, e.g. through NTP. Messages with the same timestamp sent
+ *  before the next o2_poll() share one bundle. A future message from
+ *  another process is held until its time, then sent to the OSC
+ *  server. Without clock sync, timestamped messages are dropped.
  */
 int o2_delegate_to_osc(char *service_name, char *ip, int port_num, int tcp_flag);
 
@@ -915,6 +1398,54 @@ int o2_delegate_to_osc(char *service_name, char *ip, int port_num, int tcp_flag)
 o2_blob_ptr o2_blob_new(uint32_t size);
 
 
+/** \brief a shared memory segment created by o2_shmem_new() */
+typedef struct o2_shmem *o2_shmem_ptr;
+
+/**
+ * \brief Create a shared memory segment for passing data to other
+ *        processes on the same host.
+ *
+ * Put data in the segment (see o2_shmem_data()) and send it with
+ * o2_add_shmem(). Receivers on the same host map the segment instead
+ * of receiving a copy of the data. Other receivers, including OSC
+ * servers, get the data as an ordinary blob ('b') instead.
+ *
+ * The segment is counted as in use by its creator until
+ * o2_shmem_release() is called, and by every message sent with it
+ * until the message has been delivered (see o2_shmem_refs()). It is
+ * freed when it is no longer in use. Messages with segments to other
+ * processes on this host are always sent by TCP, since receivers only
+ * map segments of the process of a TCP connection. Messages to
+ * processes that go away leave the segment in use.
+ *
+ * @param size The size of the segment in bytes.
+ *
+ * @return the segment, or NULL if it cannot be created (always on
+ *     Windows).
+ */
+o2_shmem_ptr o2_shmem_new(uint32_t size);
+
+/// \brief get the address of the data of a shared memory segment
+void *o2_shmem_data(o2_shmem_ptr shm);
+
+/**
+ * \brief get the number of uses of a shared memory segment: 1 for
+ *        its creator until o2_shmem_release() is called, and 1 for each
+ *        message sent with it that has not been delivered yet.
+ *
+ * Data in the segment should not be changed while messages with it
+ * are being delivered, so a segment can be reused for new data when
+ * o2_shmem_refs() returns 1.
+ */
+int o2_shmem_refs(o2_shmem_ptr shm);
+
+/**
+ * \brief give up the creator's use of a shared memory segment. The
+ *        segment is freed when messages sent with it are delivered.
+ */
+void o2_shmem_release(o2_shmem_ptr shm);
+
+
 /**
  * \brief Prepare to build a message
  *
@@ -947,6 +1478,63 @@ int o2_add_blob(o2_blob *b);
 ///        the blob is specified by a size and a data address.
 int o2_add_blob_data(uint32_t size, void *data);
 
+/**
+ * \brief add an `o2_blob` to the message (see o2_start_send()) without
+ *        copying the data
+ *
+ * @param size The size of the blob in bytes.
+ * @param data The address of the blob data, which must not change
+ *        until it is released.
+ * @param release A function called with data and user_data when O2
+ *        no longer needs the data, or NULL.
+ * @param user_data Passed to release.
+ *
+ * @return #O2_SUCCESS if success, #O2_FAIL if not.
+ *
+ * The message refers to the data instead of holding a copy. When the
+ * message is sent directly to a remote process by TCP or UDP, the blob
+ * is written to the socket from data together with the rest of the
+ * message (see `writev()`), and release is called when the message is
+ * sent. Otherwise, e.g. for local services, OSC services, coalesced
+ * and reliable messages, and bundles, the message is copied with the
+ * blob in it as if o2_add_blob_data() had been used, and release is
+ * called then. Local handlers always get an ordinary #o2_blob. If
+ * the message is never sent, release is called by o2_free_message().
+ * A message may refer to at most 8 blobs; more are copied.
+ */
+int o2_add_blob_ref(uint32_t size, void *data, o2_release_fn release,
+                    void *user_data);
+
+/**
+ * \brief add data in a shared memory segment to the message (see
+ *        o2_start_send())
+ *
+ * The message gets an #O2_SHMEM ('H') argument that refers to size
+ * bytes at offset in shm, passed to handlers as an #o2_shmem_arg. The
+ * data field of the argument points to the data, which is mapped
+ * read-only in processes other than the creator of shm. Messages to
+ * other hosts and OSC servers get a blob ('b') with a copy instead.
+ *
+ * @return #O2_SUCCESS if success, #O2_FAIL if not.
+ */
+int o2_add_shmem(o2_shmem_ptr shm, uint32_t offset, uint32_t size);
+
+/**
+ * \brief add a vector to the message (see o2_start_send())
+ *
+ * @param element_type #O2_INT32, #O2_INT64, #O2_FLOAT or #O2_DOUBLE
+ * @param len The number of elements.
+ * @param data The address of the elements, which are copied.
+ *
+ * @return #O2_SUCCESS if success, #O2_FAIL if not.
+ *
+ * The type string gets 'v' followed by element_type, and handlers get
+ * an #o2_vector. Vectors can also be given to o2_send() as a length
+ * (int32_t) and a pointer, e.g. `o2_send("/synth/env", 0, "vf", 512,
+ * env)`. OSC servers do not understand vectors.
+ */
+int o2_add_vector(char element_type, int32_t len, void *data);
+
 /// \brief add an `int64` to the message (see o2_start_send())
 int o2_add_int64(int64_t i);
 
@@ -1023,6 +1611,107 @@ int o2_finish_send(o2_time time, char *address);
  */
 int o2_finish_send_cmd(o2_time time, char *address);
 
+/**
+ * \brief Prepare to build a bundle.
+ *
+ * A bundle carries several messages to one service in a single
+ * UDP datagram or TCP message. The receiver dispatches them in order,
+ * one after another, all at the timestamp of the bundle (the
+ * timestamps of the messages are ignored). Build each message with
+ * o2_start_send() and o2_finish_message() and add it with
+ * o2_add_message(), then send the bundle with o2_finish_bundle() or
+ * o2_finish_bundle_cmd(). Bundles sent by UDP must fit in one
+ * datagram. Bundles may contain bundles, nested up to 8 deep; a
+ * receiver drops a message with deeper nesting.
+ *
+ * @return #O2_SUCCESS if success, #O2_FAIL if not.
+ */
+int o2_start_bundle();
+
+/**
+ * \brief Add a message to the bundle (see o2_start_bundle()).
+ *
+ * All messages in a bundle must be addressed to the same service.
+ * The bundle takes ownership of msg, which is freed.
+ *
+ * @return #O2_SUCCESS if success, #O2_FAIL if not.
+ */
+int o2_add_message(o2_message_ptr msg);
+
+/**
+ * \brief Finish a bundle (see o2_start_bundle()) without sending it.
+ *
+ * The address of the bundle is "#" followed by the service name.
+ * The bundle must be freed using o2_free_message() or by calling
+ * o2_send_message().
+ *
+ * @return the bundle, or NULL if no messages were added.
+ */
+o2_message_ptr o2_finish_bundle_message(o2_time time);
+
+/**
+ * \brief Send the bundle (see o2_start_bundle()) using UDP.
+ *
+ * @return #O2_SUCCESS if success, #O2_FAIL if not.
+ */
+int o2_finish_bundle(o2_time time);
+
+/**
+ * \brief Send the bundle (see o2_start_bundle()) using TCP.
+ *
+ * @return #O2_SUCCESS if success, #O2_FAIL if not.
+ */
+int o2_finish_bundle_cmd(o2_time time);
+
+
+/** \brief a message template created by o2_template_create() */
+typedef struct o2_template *o2_template_ptr;
+
+/**
+ * \brief Create a template for sending many messages to one address.
+ *
+ * The address and type string are put in a message once, so that
+ * o2_template_send() only has to store the arguments. Only types with
+ * a fixed size are allowed: "ifhtdcmTFNI" (no strings, blobs,
+ * vectors or shared memory).
+ *
+ * @param address the full address, e.g. "/synth/freq".
+ * @param types the type string, e.g. "if".
+ *
+ * @return the template, or NULL if the address or types are not valid.
+ */
+o2_template_ptr o2_template_create(const char *address, const char *types);
+
+/// free a template created by o2_template_create()
+void o2_template_free(o2_template_ptr tmpl);
+
+/**
+ * \brief Send a message made from a template, using UDP.
+ *
+ * Like o2_send(), but the address and type string come from tmpl.
+ * There is one parameter after time for each type code, as for
+ * o2_send().
+ *
+ * @return #O2_SUCCESS if success, #O2_FAIL if not.
+ */
+/** \hideinitializer */ // turn off Doxygen report on o2_template_send_marker()
+#define o2_template_send(tmpl, ...) \
+    o2_template_send_marker(tmpl, FALSE, __VA_ARGS__, O2_MARKER_A, O2_MARKER_B)
+
+/**
+ * \brief Send a message made from a template, using TCP.
+ *
+ * Like o2_send_cmd(), but see o2_template_send().
+ */
+/** \hideinitializer */ // turn off Doxygen report on o2_template_send_marker()
+#define o2_template_send_cmd(tmpl, ...) \
+    o2_template_send_marker(tmpl, TRUE, __VA_ARGS__, O2_MARKER_A, O2_MARKER_B)
+
+/** \cond INTERNAL */ \
+int o2_template_send_marker(o2_template_ptr tmpl, int tcp_flag,
+                            o2_time time, ...);
+/** \endcond */
+
 /** @} */
 
 /**
@@ -1050,6 +1739,17 @@ int o2_finish_send_cmd(o2_time time, char *address);
  */
 int o2_start_extract(o2_message_ptr msg);
 
+/**
+ * \brief like o2_start_extract(), but starting from the type string
+ *
+ * A handler can pass its `types` parameter, which points into msg
+ * just after the ',', so the address is not scanned again to find
+ * the arguments.
+ *
+ * @return the number of arguments.
+ */
+int o2_start_extract_types(o2_message_ptr msg, const char *types);
+
 /**
  * \brief get the next message parameter
  *
@@ -1136,6 +1836,36 @@ from o2_get_next(), where NULL indicates incompatible types.
 */
 o2_arg_ptr o2_get_next(char type_code);
 
+/**
+ * \brief get the next message parameter, a vector, converted to
+ *        element_type
+ *
+ * Like o2_get_next(O2_VECTOR), but the elements are converted to
+ * element_type (#O2_INT32, #O2_INT64, #O2_FLOAT or #O2_DOUBLE) if they
+ * are of another type. A converted vector is valid until the next call
+ * to o2_start_extract() or until the handler returns.
+ *
+ * @return the vector, or NULL if the next parameter is not a vector,
+ *         element_type is not valid, or there is no more memory.
+ */
+o2_arg_ptr o2_get_next_vector(char element_type);
+
+/**
+ * \brief get a message argument by position
+ *
+ * Returns argument i of msg (counting from 0, with a vector as one
+ * argument, as in argc) without type conversion, in any order, and
+ * without o2_start_extract(). The first call for a message finds
+ * every argument, and their offsets are kept in unused space at the
+ * end of the message when it has room, so later calls take constant
+ * time. The type of the argument is given by the `types` string
+ * passed to the handler.
+ *
+ * @return the argument, or NULL if msg has fewer than i + 1 arguments
+ *         or is malformed.
+ */
+o2_arg_ptr o2_get_arg(o2_message_ptr msg, int i);
+
 /** @} */
 
 
@@ -0,0 +1,449 @@
+//  o2_alias.c -- address aliases
+//
+//  agent, 2026
+//
+/* Design notes:
+ *    Every message carries its whole address, e.g.
+ * "/server/benchmark/17", which can be longer than its arguments, and
+ * the receiver hashes the address again to find the handler. With
+ * o2_address_aliases(), each TCP connection has a table of aliases
+ * for the addresses sent over it. The sender gives an address the
+ * next alias number when it is first sent, and after that sends
+ * "^" and the number in hex (padded, so "^1f" takes 4 bytes) instead.
+ * Addresses to O2's own services, patterns, and addresses that would
+ * not get shorter are sent as they are.
+ *
+ *    New aliases are sent just before the message that uses them, in
+ * a message addressed to "=" (padded), followed by pairs of padded
+ * strings: the alias ("^1f") and the address. TCP keeps them in
+ * order, so the receiver always knows an alias before it sees it,
+ * and nothing needs to be acknowledged. Aliases belong to the
+ * connection: when it closes, both tables are freed with its
+ * fds_info, and a new connection starts over.
+ *
+ *    Addresses are replaced in place by o2_alias_send(), called by
+ * send_by_tcp_to_process() just before writing, so messages held in
+ * frames (see o2_coalesce_messages()) are aliased for the connection
+ * they are actually sent on. Bulk chunks ("%") are sent as they are.
+ *
+ *    The receiver keeps aliases in an array indexed by number. Each
+ * remembers the handler found for its address, which stays valid as
+ * long as o2_method_generation does not change, so
+ * tcp_recv_handler() can restore the address (in place if the message
+ * has room) and call the handler without looking up the address.
+ */
+
+#include "ctype.h"
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+#include "o2_send.h"
+#include "o2_alias.h"
+
+#define ALIAS_LIMIT 0x10000  // most aliases a connection can have, so
+                             //   that an alias fits in 8 bytes
+
+// the bytes taken by an alias: "^", hex digits and at least one zero
+#define ALIAS_SIZE(alias) ((alias) < 0x100 ? 4 : 8)
+
+// an alias for an address we send, in the out table
+typedef struct alias_entry {
+    int tag;   // must be ADDRESS_ALIAS
+    char *key; // the address, "owned" by this alias_entry struct
+    generic_entry_ptr next;
+    char code[8];  // "^" and the alias in hex, padded with zeros
+    int code_size; // 4 or 8
+} alias_entry, *alias_entry_ptr;
+
+// an alias for an address we receive, in the in array
+typedef struct alias_in {
+    char *address;             // the padded address
+    int size;                  // bytes taken by address
+    handler_entry_ptr handler; // handler for address, or NULL if there
+    int generation;            //   is none, as of this o2_method_generation
+} alias_in, *alias_in_ptr;
+
+typedef struct alias_table {
+    node_entry_ptr out; // alias_entry for each address we sent, or NULL
+    int out_count;      // how many aliases we sent
+    dyn_array in;       // alias_in for each alias we received
+} alias_table, *alias_table_ptr;
+
+int o2_alias_max = 0;
+
+
+int o2_address_aliases(int max_aliases)
+{
+    o2_alias_max = (max_aliases < 0 ? 0 : max_aliases > ALIAS_LIMIT ?
+                    ALIAS_LIMIT : max_aliases);
+    return O2_SUCCESS;
+}
+
+
+static alias_table_ptr alias_table_new()
+{
+    alias_table_ptr aliases = (alias_table_ptr) O2_MALLOC(sizeof(alias_table));
+    if (!aliases) return NULL;
+    aliases->out = NULL;
+    aliases->out_count = 0;
+    DA_INIT(aliases->in, alias_in, 0);
+    return aliases;
+}
+
+
+void o2_alias_free(alias_table_ptr aliases)
+{
+    if (aliases->out) free_node(aliases->out);
+    for (int i = 0; i < aliases->in.length; i++) {
+        O2_FREE(DA_GET(aliases->in, alias_in, i)->address);
+    }
+    if (aliases->in.array) DA_FINISH(aliases->in);
+    O2_FREE(aliases);
+}
+
+
+// Append len bytes at data to *msg, which is made bigger if needed.
+//
+static void append_data(o2_message_ptr *msg, const char *data, int len)
+{
+    if ((*msg)->allocated < (*msg)->length + len) {
+        *msg = alloc_bigger_message(*msg, len);
+    }
+    memcpy(((char *) &(*msg)->data) + (*msg)->length, data, len);
+    (*msg)->length += len;
+}
+
+
+// Give address the next alias in the out table of aliases, and add
+//   it to *defs, a message to "=" that is created if needed. index
+//   is where lookup() looked for address. Returns the new entry, or
+//   NULL if address does not get one.
+//
+static alias_entry_ptr new_alias(alias_table_ptr aliases, char *address,
+                                 int size, int index, o2_message_ptr *defs)
+{
+    int alias = aliases->out_count;
+    if (alias >= o2_alias_max || size <= ALIAS_SIZE(alias) ||
+        strpbrk(address, "*?[{")) {
+        return NULL;
+    }
+    alias_entry_ptr entry = (alias_entry_ptr) O2_MALLOC(sizeof(alias_entry));
+    if (!entry) return NULL;
+    entry->tag = ADDRESS_ALIAS;
+    entry->key = o2_heapify(address);
+    memset(entry->code, 0, sizeof(entry->code));
+    snprintf(entry->code, sizeof(entry->code), "^%x", alias);
+    entry->code_size = ALIAS_SIZE(alias);
+    aliases->out_count++;
+    add_entry_at(aliases->out,
+                 DA_GET(aliases->out->children, generic_entry_ptr, index),
+                 (generic_entry_ptr) entry);
+    if (!*defs) {
+        *defs = alloc_message();
+        (*defs)->data.timestamp = 0.0;
+        memcpy((*defs)->data.address, "=\0\0\0", 4);
+        (*defs)->length = sizeof(double) + 4;
+    }
+    append_data(defs, entry->code, entry->code_size);
+    append_data(defs, address, size);
+    return entry;
+}
+
+
+// Replace the address of the message at data, which is len bytes
+//   long, by its alias. Returns how many bytes shorter it is.
+//
+static int alias_message(alias_table_ptr aliases, char *data, int len,
+                         o2_message_ptr *defs)
+{
+    char *address = data + sizeof(double);
+    // O2's own messages keep their addresses, so do bundles
+    if ((address[0] != '/' && address[0] != '!') || address[1] == '_' ||
+        isdigit(address[1])) {
+        return 0;
+    }
+    int size = o2_strsize(address);
+    if (size <= 4) return 0; // an alias would not be shorter
+    int index;
+    generic_entry_ptr *ptr = lookup(aliases->out, address, &index);
+    alias_entry_ptr entry = ptr ? (alias_entry_ptr) *ptr :
+                            new_alias(aliases, address, size, index, defs);
+    if (!entry) return 0;
+    memcpy(address, entry->code, entry->code_size);
+    memmove(address + entry->code_size, address + size,
+            len - sizeof(double) - size);
+    return size - entry->code_size;
+}
+
+
+o2_message_ptr o2_alias_send(process_info_ptr proc, o2_message_ptr msg)
+{
+    char c = msg->data.address[0];
+    if (c != '/' && c != '!' && (c != '#' || msg->data.address[1])) {
+        return msg; // chunks, bundles, and our own "=" messages
+    }
+    fds_info_ptr info = DA_GET(o2_fds_info, fds_info, proc->tcp_fd_index);
+    if (!info->aliases && !(info->aliases = alias_table_new())) return msg;
+    alias_table_ptr aliases = info->aliases;
+    if (!aliases->out && !(aliases->out = create_node(""))) return msg;
+    o2_message_ptr defs = NULL;
+    char *data = (char *) &msg->data;
+    if (c == '#') { // a frame: alias each message and close up the gaps
+        int from = sizeof(double) + 4; // after the "#" frame address
+        int to = from;
+        while (from + 4 <= msg->length) {
+            int32_t len;
+            memcpy(&len, data + from, 4);
+            len = ntohl(len);
+            if (len < (int32_t) sizeof(double) + 4 ||
+                len > msg->length - from - 4) {
+                break; // not a frame we made, leave the rest alone
+            }
+            if (to < from) memmove(data + to + 4, data + from + 4, len);
+            from += 4 + len;
+            len -= alias_message(aliases, data + to + 4, len, &defs);
+            int32_t wire_len = htonl(len);
+            memcpy(data + to, &wire_len, 4);
+            to += 4 + len;
+        }
+        if (to < from) {
+            memmove(data + to, data + from, msg->length - from);
+            msg->length -= from - to;
+        }
+    } else {
+        int shorter = alias_message(aliases, data, msg->length, &defs);
+        msg->length -= shorter;
+        // blobs in application memory go after the address
+        for (o2_blob_ref_ptr ref = msg->refs; ref; ref = ref->next) {
+            ref->offset -= shorter;
+        }
+    }
+    if (defs && send_by_tcp_to_process(proc, defs)) {
+        o2_free_message(msg);
+        return NULL;
+    }
+    return msg;
+}
+
+
+// Record the aliases in msg, a message to "=".
+//
+static void define_aliases(alias_table_ptr aliases, o2_message_ptr msg)
+{
+    char *data = (char *) &msg->data;
+    char *end = data + msg->length;
+    char *pos = data + sizeof(double) + 4; // after "="
+    while (pos < end && memchr(pos, 0, end - pos)) {
+        char *address = pos + o2_strsize(pos);
+        if (address >= end || !memchr(address, 0, end - address)) break;
+        int size = o2_strsize(address);
+        if (pos[0] != '^' || address + size > end ||
+            aliases->in.length >= ALIAS_LIMIT) {
+            break;
+        }
+        int alias = (int) strtol(pos + 1, NULL, 16);
+        if (alias != aliases->in.length) break; // aliases come in order
+        alias_in entry;
+        entry.address = O2_MALLOC(size);
+        if (!entry.address) break;
+        memcpy(entry.address, address, size);
+        entry.size = size;
+        entry.handler = NULL;
+        entry.generation = o2_method_generation - 1; // not looked up yet
+        DA_APPEND(aliases->in, alias_in, entry);
+        O2_DB(printf("O2: alias %s for %s\n", pos, address));
+        pos = address + size;
+    }
+}
+
+
+// Get the padded size of the alias code (e.g. "^1f") at address, or 0
+//   if it does not end, with its padding, before end. Checked before
+//   find_alias() because aliases are restored before o2_msg_validate().
+//
+static int alias_code_size(const char *address, const char *end)
+{
+    const char *zero = (address < end ? memchr(address, 0, end - address) :
+                        NULL);
+    if (!zero) return 0;
+    int size = (int) (zero - address + 4) & ~3;
+    return size <= end - address ? size : 0;
+}
+
+
+// Find the alias for code (e.g. "^1f"), or NULL if there is none.
+//
+static alias_in_ptr find_alias(alias_table_ptr aliases, const char *code)
+{
+    int alias = 0;
+    const char *p = code + 1;
+    if (!*p) return NULL;
+    for (; *p; p++) {
+        int digit = (isdigit(*p) ? *p - '0' :
+                     (*p >= 'a' && *p <= 'f') ? *p - 'a' + 10 : -1);
+        if (digit < 0) return NULL;
+        alias = alias * 16 + digit;
+        if (alias >= aliases->in.length) return NULL;
+    }
+    return DA_GET(aliases->in, alias_in, alias);
+}
+
+
+const char *o2_alias_address(fds_info_ptr info, const char *alias)
+{
+    if (!info->aliases) return NULL;
+    alias_in_ptr entry = find_alias(info->aliases, alias);
+    return entry ? entry->address : NULL;
+}
+
+
+// Find the handler of the address of entry, as dispatch_message()
+//   does for "!" addresses, unless it is already known.
+//
+static handler_entry_ptr alias_handler(alias_in_ptr entry)
+{
+    if (entry->generation != o2_method_generation) {
+        int index;
+        char c = entry->address[0];
+        entry->address[0] = '/'; // master_table keys start with '/'
+        generic_entry_ptr *ptr = lookup(&master_table, entry->address, &index);
+        entry->address[0] = c;
+        entry->handler = (ptr && (*ptr)->tag == PATTERN_HANDLER) ?
+                         (handler_entry_ptr) *ptr : NULL;
+        entry->generation = o2_method_generation;
+    }
+    return entry->handler;
+}
+
+
+// Copy the aliased message at data, len bytes long, to to, with the
+//   address of entry in place of its alias (code_size bytes). to may
+//   be data if there is room.
+//
+static void restore(char *to, char *data, int len, int code_size,
+                    alias_in_ptr entry)
+{
+    char *address = data + sizeof(double);
+    memmove(to + sizeof(double) + entry->size, address + code_size,
+            len - sizeof(double) - code_size);
+    if (to != data) memcpy(to, data, sizeof(double)); // the timestamp
+    memcpy(to + sizeof(double), entry->address, entry->size);
+}
+
+
+// Restore the addresses of the aliased messages in frame, which is
+//   freed. Messages with unknown aliases are dropped.
+//
+static o2_message_ptr restore_frame(alias_table_ptr aliases,
+                                    o2_message_ptr frame)
+{
+    char *data = (char *) &frame->data;
+    int start = sizeof(double) + 4; // after "#"
+    // find the length with the addresses restored
+    int length = start;
+    int pos;
+    int32_t len;
+    for (pos = start; pos + 4 <= frame->length; pos += 4 + len) {
+        memcpy(&len, data + pos, 4);
+        len = ntohl(len);
+        if (len < (int32_t) sizeof(double) + 4 ||
+            len > frame->length - pos - 4) {
+            break;
+        }
+        char *address = data + pos + 4 + sizeof(double);
+        if (address[0] == '^') {
+            int code_size = alias_code_size(address, data + pos + 4 + len);
+            alias_in_ptr entry = code_size ? find_alias(aliases, address) :
+                                             NULL;
+            if (entry) length += 4 + len - code_size + entry->size;
+        } else {
+            length += 4 + len;
+        }
+    }
+    if (length == pos) return frame; // nothing was aliased
+    o2_message_ptr msg = alloc_size_message(length);
+    if (!msg) {
+        o2_free_message(frame);
+        return NULL;
+    }
+    msg->flags = frame->flags;
+    char *to = (char *) &msg->data;
+    memcpy(to, data, start);
+    msg->length = start;
+    for (pos = start; pos + 4 <= frame->length; pos += 4 + len) {
+        memcpy(&len, data + pos, 4);
+        len = ntohl(len);
+        if (len < (int32_t) sizeof(double) + 4 ||
+            len > frame->length - pos - 4) {
+            break;
+        }
+        char *element = data + pos + 4;
+        char *address = element + sizeof(double);
+        int32_t new_len = len;
+        if (address[0] == '^') {
+            int code_size = alias_code_size(address, element + len);
+            alias_in_ptr entry = code_size ? find_alias(aliases, address) :
+                                             NULL;
+            if (!entry) continue;
+            new_len += entry->size - code_size;
+            restore(to + msg->length + 4, element, len, code_size, entry);
+        } else {
+            memcpy(to + msg->length + 4, element, len);
+        }
+        int32_t wire_len = htonl(new_len);
+        memcpy(to + msg->length, &wire_len, 4);
+        msg->length += 4 + new_len;
+    }
+    o2_free_message(frame);
+    return msg;
+}
+
+
+o2_message_ptr o2_alias_receive(fds_info_ptr info, o2_message_ptr msg,
+                                handler_entry_ptr *handler)
+{
+    *handler = NULL;
+    char *address = msg->data.address;
+    if (!info->aliases && !(info->aliases = alias_table_new())) {
+        o2_free_message(msg);
+        return NULL;
+    }
+    alias_table_ptr aliases = info->aliases;
+    if (address[0] == '=') {
+        define_aliases(aliases, msg);
+        o2_free_message(msg);
+        return NULL;
+    } else if (address[0] == '#' && address[1] == 0) {
+        return restore_frame(aliases, msg);
+    } else if (address[0] != '^') {
+        return msg;
+    }
+    char *data = (char *) &msg->data;
+    int code_size = alias_code_size(address, data + msg->length);
+    alias_in_ptr entry = code_size ? find_alias(aliases, address) : NULL;
+    if (!entry) {
+        O2_DB(printf("O2: unknown alias %s\n", code_size ? address : "?"));
+        o2_free_message(msg);
+        return NULL;
+    }
+    int length = msg->length + entry->size - code_size;
+    if (length <= msg->allocated) { // restore the address in place
+        restore(data, data, msg->length, code_size, entry);
+    } else {
+        o2_message_ptr copy = alloc_size_message(length);
+        if (!copy) {
+            o2_free_message(msg);
+            return NULL;
+        }
+        copy->flags = msg->flags;
+        restore((char *) &copy->data, data, msg->length, code_size, entry);
+        o2_free_message(msg);
+        msg = copy;
+    }
+    msg->length = length;
+    *handler = alias_handler(entry);
+    return msg;
+}
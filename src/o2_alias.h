@@ -0,0 +1,46 @@
+//  o2_alias.h -- address aliases
+//
+//  Short aliases for the addresses of messages sent over a TCP
+//  connection. See o2_alias.c.
+
+#ifndef o2_alias_h
+#define o2_alias_h
+
+/// most aliases for each connection (see o2_address_aliases()), or 0
+/// to send full addresses
+extern int o2_alias_max;
+
+/**
+ *  Replace the address of msg (or of each message in a frame from
+ *  o2_coalesce_messages()) by its alias before msg is sent to proc
+ *  over TCP. New aliases are sent to proc first. Called by
+ *  send_by_tcp_to_process() when o2_alias_max > 0.
+ *
+ *  @return msg, or NULL if the new aliases could not be sent, in which
+ *          case msg is freed and proc may have been removed.
+ */
+o2_message_ptr o2_alias_send(process_info_ptr proc, o2_message_ptr msg);
+
+/**
+ *  Handle msg, received on the connection of info: record the aliases
+ *  of a message addressed to "=", or restore the address of an aliased
+ *  message (or of the aliased messages in a frame). Called by
+ *  tcp_recv_handler() when the connection has aliases or msg is
+ *  addressed to "=".
+ *
+ *  @param handler set to the handler of the restored address when it
+ *                 is known, otherwise NULL
+ *
+ *  @return the message to deliver (which may be a new one, in which
+ *          case msg is freed), or NULL if there is nothing to deliver.
+ */
+o2_message_ptr o2_alias_receive(fds_info_ptr info, o2_message_ptr msg,
+                                handler_entry_ptr *handler);
+
+/// the address for alias (e.g. "^1f") on the connection of info, or NULL
+const char *o2_alias_address(fds_info_ptr info, const char *alias);
+
+/// free the aliases of a connection (called by o2_remove_socket())
+void o2_alias_free(struct alias_table *aliases);
+
+#endif /* o2_alias_h */
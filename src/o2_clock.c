@@ -8,6 +8,7 @@
 #include "o2_search.h"
 #include "o2_internal.h"
 #include "o2_sched.h"
+#include "o2_discovery.h"
 
 // get the master clock - clock time is estimated as
 //   global_time_base + elapsed_time * clock_rate, where
@@ -177,11 +178,19 @@ int o2_send_clocksync(process_info_ptr process)
 void announce_synchronized()
 {
     // when clock becomes synchronized, we must tell all other
-    // processes about it. To find all other processes, use the o2_fds_info
+    // processes about it. With lazy connections, most processes are not
+    // connected, so announce to every known process:
+    if (o2_lazy_flag) {
+        o2_announce_all();
+        O2_DB(printf("O2: obtained clock sync at %g\n", o2_get_time()));
+        return;
+    }
+    // Otherwise, to find all other processes, use the o2_fds_info
     // table since all but a few of the entries are connections to processes
     for (int i = 0; i < o2_fds_info.length; i++) {
         fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
-        if (info->tag == TCP_SOCKET) {
+        // accepted sockets have no process until the /in message arrives
+        if (info->tag == TCP_SOCKET && info->u.process_info) {
             o2_send_clocksync(info->u.process_info);
         }
     }
@@ -192,7 +201,7 @@ void announce_synchronized()
 int o2_clocksynced_handler(o2_message_ptr msg, const char *types,
                            o2_arg_ptr *argv, int argc, void *user_data)
 {
-    o2_start_extract(msg);
+    o2_start_extract_types(msg, types);
     o2_arg_ptr arg = o2_get_next('s');
     if (!arg) return O2_FAIL;
     char *name = arg->s;
@@ -217,7 +226,7 @@ int cs_ping_reply_handler(o2_message_ptr msg, const char *types,
                           o2_arg_ptr *argv, int argc, void *user_data)
 {
     o2_arg_ptr arg;
-    o2_start_extract(msg);
+    o2_start_extract_types(msg, types);
     if (!(arg = o2_get_next('i'))) {
         return O2_FAIL;
     }
@@ -347,7 +356,7 @@ int cs_ping_handler(o2_message_ptr msg, const char *types,
                     o2_arg_ptr *argv, int argc, void *user_data)
 {
     o2_arg_ptr serial_no_arg, reply_to_arg;
-    o2_start_extract(msg);
+    o2_start_extract_types(msg, types);
     if (!(serial_no_arg = o2_get_next('i')) ||
         !(reply_to_arg = o2_get_next('s'))) {
         return O2_FAIL;
@@ -0,0 +1,521 @@
+//  o2_compact.c -- compact encoding
+//
+//  agent, 2026
+//
+/* Design notes:
+ *    The OSC-style encoding pads every string to 4 bytes, sends every
+ * int32 in 4 bytes, and gives every message an 8-byte timestamp even
+ * when it is 0. With o2_compact_encoding(), messages sent over TCP
+ * use a shorter encoding instead:
+ *
+ *     flags      one byte: COMPACT_TIME if a timestamp follows
+ *     timestamp  8 bytes (sender's byte order), only if not 0
+ *     address    length (varint), then the characters
+ *     types      see below
+ *     arguments  'i', 'h' and 'c': zigzag varints; 's', 'S': length
+ *                (varint) and characters; 'f', 'd', 't' and 'm' as
+ *                they are, without padding; 'v': length (varint), the
+ *                element type, then the elements as above; 'T', 'F',
+ *                'N', 'I': none
+ *
+ * A varint is 7 bits per byte, low bits first, with the high bit set
+ * in all but the last byte. Zigzag maps 0, -1, 1, -2... to 0, 1, 2,
+ * 3..., so small negative numbers are short too.
+ *
+ *    Type strings are interned: each connection numbers the first
+ * TYPES_LIMIT type strings sent over it. The types are a varint n: if
+ * n is odd, n >> 1 is the number of a type string sent before;
+ * otherwise n >> 1 characters follow (without the ','), and both
+ * sides give them the next number if there are fewer than
+ * TYPES_LIMIT. TCP keeps messages in order, so the receiver knows
+ * every number it sees, and nothing else needs to be sent.
+ *
+ *    The receiver knows a compact message because the high bit of its
+ * length (O2_COMPACT_LENGTH) is set, which an ordinary length never
+ * has. Each message is encoded only if it gets shorter, so a
+ * connection can carry both kinds, and every O2 process can read
+ * both: only the sender needs to call o2_compact_encoding().
+ *
+ *    o2_compact_send() is called by send_by_tcp_to_process() just
+ * before writing, after address aliases (see o2_alias.c). Bundles,
+ * coalesced frames, bulk chunks, O2's own messages, and messages with
+ * blobs or shared memory ('H') arguments are sent as they are: a blob
+ * gains little, and the receiver may want it in an application buffer
+ * (see o2_blob_buffer()), which read_whole_message() only does for
+ * ordinary messages. o2_compact_receive() decodes into an ordinary
+ * message in host order, so tcp_recv_handler() does not mark it with
+ * O2_SWAP, and handlers get the same o2_arg view as always.
+ */
+
+#include "ctype.h"
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+#include "o2_vector.h"
+#include "o2_compact.h"
+
+#define TYPES_LIMIT 256 // most type strings a connection numbers
+
+#define COMPACT_TIME 1 // flag: the message has a timestamp
+
+// a varint for x, an int32 or int64, so that small negatives are short
+#define ZIGZAG(x) ((((uint64_t) (x)) << 1) ^ (uint64_t) ((int64_t) (x) >> 63))
+#define UNZIGZAG(u) ((int64_t) (((u) >> 1) ^ (0 - ((u) & 1))))
+
+// a type string we send, in the out table
+typedef struct type_entry {
+    int tag;   // must be INTERNED_TYPES
+    char *key; // the type string, "owned" by this type_entry struct
+    generic_entry_ptr next;
+    int number;
+} type_entry, *type_entry_ptr;
+
+typedef struct type_table {
+    node_entry_ptr out; // type_entry for each type string we sent
+    int out_count;      // how many type strings we numbered
+    dyn_array in;       // each type string we received (char *, with ',')
+} type_table, *type_table_ptr;
+
+int o2_compact_flag = FALSE;
+
+
+int o2_compact_encoding(int flag)
+{
+    o2_compact_flag = flag;
+    return O2_SUCCESS;
+}
+
+
+static type_table_ptr type_table_new()
+{
+    type_table_ptr types = (type_table_ptr) O2_MALLOC(sizeof(type_table));
+    if (!types) return NULL;
+    types->out = NULL;
+    types->out_count = 0;
+    DA_INIT(types->in, char *, 0);
+    return types;
+}
+
+
+void o2_compact_free(type_table_ptr types)
+{
+    if (types->out) free_node(types->out);
+    for (int i = 0; i < types->in.length; i++) {
+        O2_FREE(*DA_GET(types->in, char *, i));
+    }
+    if (types->in.array) DA_FINISH(types->in);
+    O2_FREE(types);
+}
+
+
+static char *put_varint(char *to, uint64_t x)
+{
+    while (x >= 0x80) {
+        *to++ = (char) (x | 0x80);
+        x >>= 7;
+    }
+    *to++ = (char) x;
+    return to;
+}
+
+
+// Read a varint at src into *x. Returns the address after it, or NULL
+//   if it does not end before end.
+//
+static const char *get_varint(const char *src, const char *end, uint64_t *x)
+{
+    uint64_t u = 0;
+    for (int shift = 0; src < end && shift < 64; shift += 7) {
+        uint8_t byte = (uint8_t) *src++;
+        u |= ((uint64_t) (byte & 0x7f)) << shift;
+        if (!(byte & 0x80)) {
+            *x = u;
+            return src;
+        }
+    }
+    return NULL;
+}
+
+
+// Encode the arguments at arg (up to end), of the types after the ','
+//   of typestr, at to. Returns the address after them, or NULL if
+//   there is a type that is not encoded or the message is malformed.
+//
+static char *encode_args(const char *typestr, const char *arg,
+                         const char *end, char *to)
+{
+    for (const char *t = typestr + 1; *t; t++) {
+        switch (*t) {
+          case O2_INT32:
+          case O2_CHAR: {
+            int32_t i;
+            if (end - arg < 4) return NULL;
+            memcpy(&i, arg, 4);
+            to = put_varint(to, ZIGZAG(i));
+            arg += 4;
+            break;
+          }
+          case O2_INT64: {
+            int64_t h;
+            if (end - arg < 8) return NULL;
+            memcpy(&h, arg, 8);
+            to = put_varint(to, ZIGZAG(h));
+            arg += 8;
+            break;
+          }
+          case O2_FLOAT:
+          case O2_MIDI:
+            if (end - arg < 4) return NULL;
+            memcpy(to, arg, 4);
+            to += 4;
+            arg += 4;
+            break;
+          case O2_DOUBLE:
+          case O2_TIME:
+            if (end - arg < 8) return NULL;
+            memcpy(to, arg, 8);
+            to += 8;
+            arg += 8;
+            break;
+          case O2_STRING:
+          case O2_SYMBOL: {
+            const char *zero = (const char *) memchr(arg, 0, end - arg);
+            if (!zero) return NULL;
+            int len = (int) (zero - arg);
+            to = put_varint(to, len);
+            memcpy(to, arg, len);
+            to += len;
+            arg += (len + 4) & ~3;
+            break;
+          }
+          case O2_TRUE:
+          case O2_FALSE:
+          case O2_NIL:
+          case O2_INFINITUM:
+            break;
+          case O2_VECTOR: {
+            char element_type = *++t;
+            int size = o2_vector_elem_size(element_type);
+            int32_t len;
+            if (!size || end - arg < 8) return NULL;
+            memcpy(&len, arg, 4);
+            arg += 8; // the length and element type
+            if (len < 0 || len > (end - arg) / size) return NULL;
+            to = put_varint(to, len);
+            *to++ = element_type;
+            if (element_type == O2_INT32) {
+                for (int i = 0; i < len; i++, arg += 4) {
+                    int32_t x;
+                    memcpy(&x, arg, 4);
+                    to = put_varint(to, ZIGZAG(x));
+                }
+            } else if (element_type == O2_INT64) {
+                for (int i = 0; i < len; i++, arg += 8) {
+                    int64_t x;
+                    memcpy(&x, arg, 8);
+                    to = put_varint(to, ZIGZAG(x));
+                }
+            } else {
+                memcpy(to, arg, len * size);
+                to += len * size;
+                arg += len * size;
+            }
+            break;
+          }
+          default: // blobs and shared memory ('H') are sent as they are
+            return NULL;
+        }
+    }
+    return to;
+}
+
+
+// Encode msg with the type strings of types. Returns the compact
+//   message, or NULL if msg is not encoded.
+//
+static o2_message_ptr compact(type_table_ptr types, o2_message_ptr msg)
+{
+    char *data = (char *) &msg->data;
+    char *end = data + msg->length;
+    char *address = msg->data.address;
+    char *zero = (char *) memchr(address, 0, end - address);
+    if (!zero) return NULL;
+    int address_len = (int) (zero - address);
+    char *typestr = address + ((address_len + 4) & ~3);
+    if (typestr >= end || *typestr != ',' ||
+        !(zero = (char *) memchr(typestr, 0, end - typestr))) {
+        return NULL; // no type string
+    }
+    int types_len = (int) (zero - typestr) - 1; // without the ','
+    char *arg = typestr + ((types_len + 5) & ~3);
+    // each argument grows by at most 4 bytes (strings with long
+    // varints), or a quarter (varints of int32s and int64s)
+    o2_message_ptr cmsg = alloc_size_message(msg->length + msg->length / 4 +
+                                             4 * types_len + 16);
+    if (!cmsg) return NULL;
+    char *start = (char *) &cmsg->data;
+    char *to = start;
+    if (msg->data.timestamp == 0.0) {
+        *to++ = 0;
+    } else {
+        *to++ = COMPACT_TIME;
+        memcpy(to, &msg->data.timestamp, sizeof(double));
+        to += sizeof(double);
+    }
+    to = put_varint(to, address_len);
+    memcpy(to, address, address_len);
+    to += address_len;
+    int index;
+    generic_entry_ptr *ptr = lookup(types->out, typestr, &index);
+    if (ptr) {
+        to = put_varint(to, ((type_entry_ptr) *ptr)->number * 2 + 1);
+    } else {
+        to = put_varint(to, types_len * 2);
+        memcpy(to, typestr + 1, types_len);
+        to += types_len;
+    }
+    to = encode_args(typestr, arg, end, to);
+    if (!to || to - start >= msg->length) { // not encoded, or not shorter
+        o2_free_message(cmsg);
+        return NULL;
+    }
+    cmsg->length = (int32_t) (to - start);
+    cmsg->flags = msg->flags | O2_COMPACT;
+    // the receiver numbers the type string when it gets the message
+    if (!ptr && types->out_count < TYPES_LIMIT) {
+        type_entry_ptr entry = (type_entry_ptr) O2_MALLOC(sizeof(type_entry));
+        if (entry) {
+            entry->tag = INTERNED_TYPES;
+            entry->key = o2_heapify(typestr);
+            entry->number = types->out_count;
+            add_entry_at(types->out,
+                         DA_GET(types->out->children, generic_entry_ptr,
+                                index),
+                         (generic_entry_ptr) entry);
+        }
+        // count it even if there was no memory, to stay in step
+        types->out_count++;
+    }
+    return cmsg;
+}
+
+
+o2_message_ptr o2_compact_send(process_info_ptr proc, o2_message_ptr msg)
+{
+    char *address = msg->data.address;
+    // O2's own messages keep the usual encoding; aliased ("^")
+    // addresses are never O2's own (see o2_alias.c)
+    if ((address[0] != '/' && address[0] != '!' && address[0] != '^') ||
+        (address[0] != '^' && (address[1] == '_' || isdigit(address[1]))) ||
+        msg->refs) {
+        return msg;
+    }
+    fds_info_ptr info = DA_GET(o2_fds_info, fds_info, proc->tcp_fd_index);
+    if (!info->types && !(info->types = type_table_new())) return msg;
+    type_table_ptr types = info->types;
+    if (!types->out && !(types->out = create_node(""))) return msg;
+    o2_message_ptr cmsg = compact(types, msg);
+    if (!cmsg) return msg;
+    o2_free_message(msg);
+    return cmsg;
+}
+
+
+// Decode the arguments at src (up to end), of the types after the ','
+//   of typestr, into dst, or just measure them if dst is NULL. swap
+//   tells if 'f', 'd' and 't' arguments are in the other byte order.
+//   Returns the bytes they take in an ordinary message, or -1 if they
+//   are malformed.
+//
+static int decode_args(const char *typestr, const char *src, const char *end,
+                       char *dst, int swap)
+{
+    int len = 0;
+    uint64_t u;
+    for (const char *t = typestr + 1; *t; t++) {
+        switch (*t) {
+          case O2_INT32:
+          case O2_CHAR:
+            if (!(src = get_varint(src, end, &u))) return -1;
+            if (dst) {
+                int32_t i = (int32_t) UNZIGZAG(u);
+                memcpy(dst + len, &i, 4);
+            }
+            len += 4;
+            break;
+          case O2_INT64:
+            if (!(src = get_varint(src, end, &u))) return -1;
+            if (dst) {
+                int64_t h = UNZIGZAG(u);
+                memcpy(dst + len, &h, 8);
+            }
+            len += 8;
+            break;
+          case O2_FLOAT:
+          case O2_MIDI:
+            if (end - src < 4) return -1;
+            if (dst) {
+                memcpy(dst + len, src, 4);
+                if (swap && *t == O2_FLOAT) o2_swap32_array(dst + len, 1);
+            }
+            src += 4;
+            len += 4;
+            break;
+          case O2_DOUBLE:
+          case O2_TIME:
+            if (end - src < 8) return -1;
+            if (dst) {
+                memcpy(dst + len, src, 8);
+                if (swap) o2_swap64_array(dst + len, 1);
+            }
+            src += 8;
+            len += 8;
+            break;
+          case O2_STRING:
+          case O2_SYMBOL: {
+            if (!(src = get_varint(src, end, &u)) ||
+                u > (uint64_t) (end - src)) {
+                return -1;
+            }
+            int size = ((int) u + 4) & ~3; // with at least one zero
+            if (dst) {
+                memcpy(dst + len, src, (size_t) u);
+                memset(dst + len + u, 0, size - (int) u);
+            }
+            src += u;
+            len += size;
+            break;
+          }
+          case O2_TRUE:
+          case O2_FALSE:
+          case O2_NIL:
+          case O2_INFINITUM:
+            break;
+          case O2_VECTOR: {
+            char element_type = *++t;
+            int size = o2_vector_elem_size(element_type);
+            if (!size || !(src = get_varint(src, end, &u)) ||
+                u >= (uint64_t) (end - src) || // each element takes a byte
+                src[0] != element_type) {
+                return -1;
+            }
+            src++;
+            int32_t n = (int32_t) u;
+            char *elements = dst ? dst + len + 8 : NULL;
+            if (dst) {
+                int32_t element_int = element_type;
+                memcpy(dst + len, &n, 4);
+                memcpy(dst + len + 4, &element_int, 4);
+            }
+            len += 8 + n * size;
+            if (element_type == O2_INT32 || element_type == O2_INT64) {
+                for (int i = 0; i < n; i++) {
+                    if (!(src = get_varint(src, end, &u))) return -1;
+                    if (!elements) continue;
+                    if (size == 4) {
+                        int32_t x = (int32_t) UNZIGZAG(u);
+                        memcpy(elements + 4 * i, &x, 4);
+                    } else {
+                        int64_t x = UNZIGZAG(u);
+                        memcpy(elements + 8 * i, &x, 8);
+                    }
+                }
+            } else {
+                if (n > (end - src) / size) return -1;
+                if (elements) {
+                    memcpy(elements, src, n * size);
+                    if (swap && size == 4) o2_swap32_array(elements, n);
+                    if (swap && size == 8) o2_swap64_array(elements, n);
+                }
+                src += n * size;
+            }
+            break;
+          }
+          default:
+            return -1;
+        }
+    }
+    return src == end ? len : -1;
+}
+
+
+o2_message_ptr o2_compact_receive(fds_info_ptr info, o2_message_ptr msg)
+{
+    const char *src = (const char *) &msg->data;
+    const char *end = src + msg->length;
+    char *new_types = NULL;
+    uint64_t u;
+    if (!info->types && !(info->types = type_table_new())) goto malformed;
+    type_table_ptr types = info->types;
+    int swap = info->u.process_info &&
+               info->u.process_info->little_endian != IS_LITTLE_ENDIAN;
+    if (src >= end) goto malformed;
+    int flags = *src++;
+    double timestamp = 0.0;
+    if (flags & COMPACT_TIME) {
+        if (end - src < (int) sizeof(double)) goto malformed;
+        memcpy(&timestamp, src, sizeof(double));
+        if (swap) o2_swap64_array((char *) &timestamp, 1);
+        src += sizeof(double);
+    }
+    // the address
+    if (!(src = get_varint(src, end, &u)) || u == 0 ||
+        u >= (uint64_t) (end - src)) {
+        goto malformed;
+    }
+    const char *address = src;
+    int address_len = (int) u;
+    src += u;
+    // the type string: a number, or characters that get the next one
+    if (!(src = get_varint(src, end, &u))) goto malformed;
+    const char *typestr;
+    if (u & 1) {
+        if ((u >> 1) >= (uint64_t) types->in.length) goto malformed;
+        typestr = *DA_GET(types->in, char *, (int) (u >> 1));
+    } else {
+        u >>= 1;
+        if (u > (uint64_t) (end - src)) goto malformed;
+        new_types = (char *) O2_MALLOC((size_t) u + 2);
+        if (!new_types) goto malformed;
+        new_types[0] = ',';
+        memcpy(new_types + 1, src, (size_t) u);
+        new_types[u + 1] = 0;
+        src += u;
+        typestr = new_types;
+        if (types->in.length < TYPES_LIMIT) {
+            DA_APPEND(types->in, char *, new_types);
+            new_types = NULL; // now owned by types
+        }
+    }
+    int args_len = decode_args(typestr, src, end, NULL, swap);
+    if (args_len < 0) goto malformed;
+    int address_size = (address_len + 4) & ~3;
+    int types_len = (int) strlen(typestr);
+    int types_size = (types_len + 4) & ~3;
+    int length = sizeof(double) + address_size + types_size + args_len;
+    o2_message_ptr decoded = alloc_size_message(length);
+    if (!decoded) goto malformed;
+    char *dst = (char *) &decoded->data;
+    decoded->data.timestamp = timestamp;
+    dst += sizeof(double);
+    memcpy(dst, address, address_len);
+    memset(dst + address_len, 0, address_size - address_len);
+    dst += address_size;
+    memcpy(dst, typestr, types_len);
+    memset(dst + types_len, 0, types_size - types_len);
+    dst += types_size;
+    decode_args(typestr, src, end, dst, swap);
+    decoded->length = length;
+    decoded->flags = msg->flags & ~O2_COMPACT;
+    if (new_types) O2_FREE(new_types);
+    o2_free_message(msg);
+    return decoded;
+  malformed:
+    O2_DB(printf("O2: malformed compact message\n"));
+    if (new_types) O2_FREE(new_types);
+    o2_free_message(msg);
+    return NULL;
+}
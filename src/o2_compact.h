@@ -0,0 +1,40 @@
+//  o2_compact.h -- compact encoding
+//
+//  A shorter encoding for messages sent over a TCP connection. See
+//  o2_compact.c.
+
+#ifndef o2_compact_h
+#define o2_compact_h
+
+/// TRUE to send messages in the compact encoding (see
+/// o2_compact_encoding())
+extern int o2_compact_flag;
+
+/// set in the length of a compact message sent over TCP, which
+/// read_whole_message() marks with O2_COMPACT
+#define O2_COMPACT_LENGTH 0x80000000
+
+/**
+ *  Encode msg, which is about to be sent to proc over TCP, in the
+ *  compact encoding. Called by send_by_tcp_to_process() when
+ *  o2_compact_flag is set.
+ *
+ *  @return a new message marked with O2_COMPACT, in which case msg is
+ *          freed, or msg if it is not encoded (it would not be
+ *          shorter, or cannot be encoded).
+ */
+o2_message_ptr o2_compact_send(process_info_ptr proc, o2_message_ptr msg);
+
+/**
+ *  Decode msg, a compact message received on the connection of info.
+ *  The decoded message is in host order. Called by tcp_recv_handler().
+ *
+ *  @return the decoded message (msg is freed), or NULL if msg is
+ *          malformed.
+ */
+o2_message_ptr o2_compact_receive(fds_info_ptr info, o2_message_ptr msg);
+
+/// free the type strings of a connection (called by o2_remove_socket())
+void o2_compact_free(struct type_table *types);
+
+#endif /* o2_compact_h */
@@ -14,6 +14,8 @@
 #include "o2_discovery.h"
 #include "o2_send.h"
 #include "o2_clock.h"
+#include "o2_registry.h"
+#include "o2_hub.h"
 
 // o2_discover:
 //   initially send a discovery message every 0.133s, but increase the
@@ -32,6 +34,18 @@ struct sockaddr_in local_to_addr; // address for sending local discovery msgs
 SOCKET broadcast_sock = INVALID_SOCKET;
 int broadcast_recv_port = -1; // port we grabbed
 
+// lazy connections: instead of connecting to every discovered process,
+//   processes exchange announcements (!_o2/da) with their services and
+//   clock state, and connect when the first TCP message is sent. If
+//   o2_lazy_idle_timeout > 0, unused connections are closed by
+//   o2_lazy_idle_handler().
+// number of discovery messages (!_o2/dy and !_o2/da) sent, including
+// through the local registry; see test/discoverybench.c
+long o2_discovery_sent = 0;
+
+int o2_lazy_flag = FALSE;
+double o2_lazy_idle_timeout = 0.0;
+
 // From Wikipedia: The range 49152–65535 (215+214 to 216−1) contains
 //   dynamic or private ports that cannot be registered with IANA.[198]
 //   This range is used for private, or customized services or temporary
@@ -80,7 +94,10 @@ int o2_discovery_init()
 
     // Create socket to receive broadcasts
     // Try to find an available port number from the discover port map.
-    // If there are no available port number, print the error and return O2_FAIL.
+    // If there are no available port number, we can still be discovered
+    // by processes on this host through the local registry (see
+    // o2_registry.c), but not by other hosts. Without the registry
+    // (WIN32), print the error and return O2_FAIL.
     int ret;
     for (i = 0; i < PORT_MAX; i++) {
         broadcast_recv_port = o2_port_map[i];
@@ -89,8 +106,14 @@ int o2_discovery_init()
     }
     if (i >= PORT_MAX) {
         broadcast_recv_port = -1; // no port to receive discovery messages
-        printf("The ports are not enough."); // TODO: error message to stderr
+#ifdef WIN32
+        fprintf(stderr, "O2: no free discovery port (all %d in use)\n",
+                PORT_MAX);
         return ret;
+#else
+        fprintf(stderr, "O2 warning: no free discovery port, only "
+                "processes on this host can discover this one\n");
+#endif
     }
 
     //printf("%s: discovery receive port is %d\n", debug_prefix, broadcast_recv_port);
@@ -112,6 +135,15 @@ int o2_discovery_init()
 }
 
 
+int o2_lazy_connections(double idle_timeout)
+{
+    if (o2_application_name) return O2_RUNNING;
+    o2_lazy_flag = TRUE;
+    o2_lazy_idle_timeout = idle_timeout;
+    return O2_SUCCESS;
+}
+
+
 /*
 */
 
@@ -127,6 +159,8 @@ void o2_broadcast_message(int port, SOCKET sock, o2_message_ptr message)
                (struct sockaddr *) &broadcast_to_addr,
                sizeof(broadcast_to_addr)) < 0) {
             perror("Error attempting to broadcast discovery message");
+        } else {
+            o2_discovery_sent++;
         }
     }
     // assume that broadcast messages are not received on the local machine
@@ -139,6 +173,8 @@ void o2_broadcast_message(int port, SOCKET sock, o2_message_ptr message)
                    (struct sockaddr *) &local_to_addr,
                    sizeof(local_to_addr)) < 0) {
             perror("Error attempting to send discovery message locally");
+        } else {
+            o2_discovery_sent++;
         }
         // printf("%s: sent to local port %d\n", debug_prefix, port);
     }
@@ -199,6 +235,10 @@ int o2_discovery_msg_init()
     }
     memcpy(o2_discovery_msg, outmsg, size);
     o2_free_message(outmsg);
+    // the registry socket is named by o2_process.name, which is now known
+    if (o2_registry_init() && broadcast_recv_port < 0) {
+        return O2_FAIL; // no way to be discovered at all
+    }
     O2_DB(printf("O2: in o2_initialize,\n    name is %s, local IP is %s, \n"
             "    udp receive port is %d,\n"
             "    tcp connection port is %d,\n    broadcast recv port is %d\n",
@@ -215,10 +255,16 @@ int o2_discovery_msg_init()
 int o2_discovery_send_handler(o2_message_ptr msg, const char *types,
                               o2_arg_ptr *argv, int argc, void *user_data)
 {
+    // processes attached to hubs do not take part in discovery, so stop
+    // here without scheduling another call
+    if (o2_using_hub) return O2_SUCCESS;
     next_discovery_index = (next_discovery_index + 1) % PORT_MAX;
     o2_broadcast_message(o2_port_map[next_discovery_index],
             DA_GET(o2_fds, struct pollfd, next_discovery_index)->fd,
                          o2_discovery_msg);
+    // processes on this host are reached directly through the registry;
+    // the UDP ports are still used for processes without a registry
+    o2_registry_announce(o2_discovery_msg);
     //printf("Discovery broadcasts %p to port %d\n",
     //       outmsg, o2_port_map[next_discovery_index]);
     o2_time next_time = o2_local_time() + o2_discovery_send_interval;
@@ -289,6 +335,217 @@ int o2_send_services(process_info_ptr process)
 }
 
 
+// construct an announcement for lazy connections. Arguments are "b" or
+//    "l" for big- or little-endian, application name, ip, tcp port, udp
+//    port, clock synchronized flag, reply flag (nonzero if the receiver
+//    should announce itself in return), then the local services
+//
+static o2_message_ptr make_announcement(int reply)
+{
+    int err = o2_start_send() ||
+        o2_add_string(IS_BIG_ENDIAN ? "b" : "l") ||
+        o2_add_string(o2_application_name) ||
+        o2_add_string(o2_local_ip) ||
+        o2_add_int32(o2_local_tcp_port) ||
+        o2_add_int32(o2_process.udp_port) ||
+        o2_add_int32(o2_clock_is_synchronized) ||
+        o2_add_int32(reply);
+    if (err) return NULL;
+    for (int i = 0; i < o2_process.services.length; i++) {
+        char *service = *DA_GET(o2_process.services, char *, i);
+        // ugly, but just a fast test if service is _o2:
+        if ((*((int32_t *) service) != *((int32_t *) "_o2"))) {
+            o2_add_string(service);
+        }
+    }
+    return o2_finish_message(0.0, "!_o2/da");
+}
+
+
+static void send_announcement(o2_message_ptr msg, struct sockaddr_in *sa)
+{
+    if (sendto(local_send_sock, &msg->data, msg->length, 0,
+               (struct sockaddr *) sa, sizeof(struct sockaddr_in)) < 0) {
+        perror("Error attempting to send announcement");
+    } else {
+        o2_discovery_sent++;
+    }
+}
+
+
+static void set_udp_address(process_info_ptr process, const char *ip,
+                            int udp_port)
+{
+    process->udp_sa.sin_family = AF_INET;
+    process->udp_port = udp_port;
+    inet_pton(AF_INET, ip, &(process->udp_sa.sin_addr.s_addr));
+    process->udp_sa.sin_port = htons(udp_port);
+}
+
+
+// answer a discovery message from a process we do not know with an
+//    announcement that asks for the sender's announcement in return.
+//    udp is the sender's discovery port, -1 if it has none.
+//
+static int announce_to_discovered(const char *name, const char *ip, int udp)
+{
+    o2_message_ptr msg = make_announcement(TRUE);
+    if (!msg) return O2_FAIL;
+    if (o2_registry_send(name, msg) != O2_SUCCESS && udp >= 0) {
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        inet_pton(AF_INET, ip, &(sa.sin_addr.s_addr));
+        sa.sin_port = htons(udp);
+        send_announcement(msg, &sa);
+    }
+    o2_free_message(msg);
+    return O2_SUCCESS;
+}
+
+
+void o2_announce_all()
+{
+    o2_message_ptr msg = make_announcement(FALSE);
+    if (!msg) return;
+    // every process is entered in path_tree_table under its name
+    enumerate en;
+    enumerate_begin(&en, &(path_tree_table.children));
+    generic_entry_ptr entry;
+    while ((entry = enumerate_next(&en))) {
+        if (entry->tag == O2_REMOTE_SERVICE) {
+            process_info_ptr process = ((remote_service_entry_ptr) entry)->parent;
+            if (streql(entry->key, process->name)) {
+                send_announcement(msg, &(process->udp_sa));
+            }
+        }
+    }
+    o2_free_message(msg);
+}
+
+
+// /_o2/da handler, see make_announcement() for parameters. Creates or
+//    updates the sender's process descriptor without connecting to it.
+//
+int o2_announce_handler(o2_message_ptr msg, const char *types,
+                        o2_arg_ptr *argv, int argc, void *user_data)
+{
+    (void) argv; (void) argc; (void) user_data;
+    o2_arg_ptr endian_arg, app_arg, ip_arg, tcp_arg, udp_arg,
+               clocksync_arg, reply_arg, arg;
+    o2_start_extract_types(msg, types);
+    if (!(endian_arg = o2_get_next('s')) ||
+        !(app_arg = o2_get_next('s')) ||
+        !(ip_arg = o2_get_next('s')) ||
+        !(tcp_arg = o2_get_next('i')) ||
+        !(udp_arg = o2_get_next('i')) ||
+        !(clocksync_arg = o2_get_next('i')) ||
+        !(reply_arg = o2_get_next('i'))) {
+        return O2_FAIL;
+    }
+    if (!streql(app_arg->s, o2_application_name))
+        return O2_FAIL;
+    char *ip = ip_arg->s;
+    int is_little_endian = (endian_arg->s[0] == 'l');
+    int tcp = tcp_arg->i32;
+    int udp = udp_arg->i32;
+    if (is_little_endian != IS_LITTLE_ENDIAN) {
+        tcp = swap32(tcp);
+        udp = swap32(udp);
+    }
+    char name[32];
+    // ip:port + pad with zeros
+#ifndef WIN32
+	snprintf(name, 32, "%s:%d%c%c%c%c", ip, tcp, 0, 0, 0, 0);
+#else
+	_snprintf(name, 32, "%s:%d%c%c%c%c", ip, tcp, 0, 0, 0, 0);
+#endif
+    if (streql(name, o2_process.name)) return O2_SUCCESS;
+
+    // no byte-swap check needed for flags because they are zero/non-zero
+    int status = (clocksync_arg->i32 ? PROCESS_OK : PROCESS_NO_CLOCK);
+    int index;
+    process_info_ptr process;
+    generic_entry_ptr *entry = lookup(&path_tree_table, name, &index);
+    if (entry && (*entry)->tag == O2_REMOTE_SERVICE) {
+        process = ((remote_service_entry_ptr) *entry)->parent;
+        process->status = status;
+    } else { // unknown, or known only through a hub
+        if (!(process = o2_add_remote_process(name, status, is_little_endian))) {
+            return O2_FAIL;
+        }
+        set_udp_address(process, ip, udp);
+        O2_DB(printf("O2: discovered %s (lazy connection)\n", name));
+    }
+    // insert services we do not know about yet; strings in the
+    // message are padded with zeros as lookup() requires
+    while ((arg = o2_get_next('s'))) {
+        if (!o2_direct_route(arg->s)) {
+            O2_DB(printf("O2: found service /%s offered by /%s\n", arg->s, process->name));
+            add_remote_service(process, arg->s);
+        }
+    }
+    if (reply_arg->i32) {
+        o2_message_ptr reply = make_announcement(FALSE);
+        if (!reply) return O2_FAIL;
+        send_announcement(reply, &(process->udp_sa));
+        o2_free_message(reply);
+    }
+    return O2_SUCCESS;
+}
+
+
+int o2_lazy_connect(process_info_ptr process)
+{
+    // the process name is "ip:tcp_port"
+    char ip[32];
+    strncpy(ip, process->name, 31);
+    ip[31] = 0;
+    char *colon = strchr(ip, ':');
+    if (!colon) return O2_FAIL;
+    *colon = 0;
+    int tcp_port = atoi(colon + 1);
+    int status = process->status; // make_tcp_connection() changes status
+    int err;
+    if ((err = make_tcp_connection(process, ip, tcp_port))) {
+        // the process is gone, so forget it and its services
+        o2_remove_remote_process(process);
+        return err;
+    }
+    process->status = status;
+    process->last_used = o2_local_now;
+    O2_DB(printf("O2: connected on demand to %s\n", process->name));
+    // the /in message lets the other process link the connection
+    return o2_send_init(process);
+}
+
+
+/// callback function that closes idle connections
+//
+int o2_lazy_idle_handler(o2_message_ptr msg, const char *types,
+                         o2_arg_ptr *argv, int argc, void *user_data)
+{
+    (void) msg; (void) types; (void) argv; (void) argc; (void) user_data;
+    o2_time now = o2_local_time();
+    // go backward because o2_close_tcp_socket() moves the last socket
+    for (int i = o2_fds_info.length - 1; i >= 0; i--) {
+        fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
+        process_info_ptr process = info->u.process_info;
+        if (info->tag == TCP_SOCKET && process &&
+            now - process->last_used > o2_lazy_idle_timeout) {
+            o2_close_tcp_socket(i);
+        }
+    }
+    // check again after half the timeout
+    int err = o2_start_send();
+    if (err) return err;
+    o2_message_ptr outmsg = o2_finish_message(now + o2_lazy_idle_timeout * 0.5,
+                                              "!_o2/lz");
+    o2_schedule(&o2_ltsched, outmsg);
+    return O2_SUCCESS;
+}
+
+
 // /o2_/dy handler, parameters are: big/little endian, application name, ip, tcp, and upd
 // 
 int o2_discovery_handler(o2_message_ptr msg, const char *types,
@@ -297,7 +554,7 @@ int o2_discovery_handler(o2_message_ptr msg, const char *types,
     o2_arg_ptr endian_arg, app_arg, ip_arg, tcp_arg, udp_arg;
     // get the arguments: endian, application name, ip as string,
     //                    tcp port, discovery port
-    o2_start_extract(msg);
+    o2_start_extract_types(msg, types);
     if (!(endian_arg = o2_get_next('s')) ||
         !(app_arg = o2_get_next('s')) ||
         !(ip_arg = o2_get_next('s')) ||
@@ -316,17 +573,18 @@ int o2_discovery_handler(o2_message_ptr msg, const char *types,
     
     if (!streql(app_arg->s, o2_application_name))
         return O2_FAIL;
+    if (o2_using_hub) return O2_SUCCESS; // only connect to hubs
     
     char name[32];
     // ip:port + pad with zeros
 #ifndef WIN32
-	snprintf(name, 32, "%s:%d%c%c%c%c", ip, tcp_arg->i32, 0, 0, 0, 0);
+	snprintf(name, 32, "%s:%d%c%c%c%c", ip, tcp, 0, 0, 0, 0);
 #else
-	_snprintf(name, 32, "%s:%d%c%c%c%c", ip, tcp_arg->i32, 0, 0, 0, 0);
+	_snprintf(name, 32, "%s:%d%c%c%c%c", ip, tcp, 0, 0, 0, 0);
 #endif
-    int index;
     // printf("%s: o2_discovery_handler: lookup %s\n", debug_prefix, name);
-    if (lookup(&path_tree_table, name, &index)) {
+    // a process known only through a hub is connected to directly
+    if (o2_direct_route(name)) {
         // printf("%s: discovery handler: %s exists\n", debug_prefix, name);
         return O2_SUCCESS;
     }
@@ -334,17 +592,26 @@ int o2_discovery_handler(o2_message_ptr msg, const char *types,
     // printf("%s: o2_discovery_handler name %s local name %s\n", debug_prefix, name, o2_process.name);
     if (compare == 0) { // the "discovered process" is this one
         return O2_SUCCESS;
+    } else if (o2_lazy_flag) { // exchange announcements, connect later
+        return announce_to_discovered(name, ip, udp);
     } else if (compare > 0) { // the other party should connect
         // send a discover message back to sender
         // sender's IP and port are known, so we can send a UDP message
         // directly.
         // printf("+    sending discovery msg to %s to encourage connection\n", debug_prefix);
+        // if the sender is in our local registry, reply through it
+        if (o2_registry_send(name, o2_discovery_msg) == O2_SUCCESS) {
+            return O2_SUCCESS;
+        }
+        if (udp < 0) return O2_SUCCESS; // sender has no discovery port
         local_to_addr.sin_port = htons(udp);
         if (sendto(local_send_sock, &o2_discovery_msg->data,
                    o2_discovery_msg->length, 0,
                    (struct sockaddr *) &local_to_addr,
                    sizeof(local_to_addr)) < 0) {
             perror("Error attepting to send discovery message directly");
+        } else {
+            o2_discovery_sent++;
         }
         return O2_SUCCESS;
     }
@@ -376,7 +643,7 @@ int o2_discovery_init_handler(o2_message_ptr msg, const char *types,
     o2_arg_ptr endian_arg, ip_arg, tcp_arg, udp_arg, clocksync_arg;
     // get the arguments: endian, application name, ip as string,
     //                    tcp port, udp port
-    if (o2_start_extract(msg) != 5 ||
+    if (o2_start_extract_types(msg, types) != 5 ||
         !(endian_arg = o2_get_next('s')) ||
         !(ip_arg = o2_get_next('s')) ||
         !(tcp_arg = o2_get_next('i')) ||
@@ -409,7 +676,7 @@ int o2_discovery_init_handler(o2_message_ptr msg, const char *types,
     // no byte-swap check needed for clocksync because it is just zero/non-zero
     int status = (clocksync_arg->i32 ? PROCESS_OK : PROCESS_NO_CLOCK);
     process_info_ptr process;
-    if (!entry) {
+    if (!entry || (*entry)->tag == O2_BRIDGE_SERVICE) {
         if (!(process = o2_add_remote_process(name, status, is_little_endian))) {
             return O2_FAIL;
         }
@@ -430,8 +697,16 @@ int o2_discovery_init_handler(o2_message_ptr msg, const char *types,
         remote_service_entry_ptr service = (remote_service_entry_ptr) *entry;
         process = service->parent;
         process->status = status;
+        // with lazy connections, the process is known from its
+        // announcement before it connects to us: link the socket
+        fds_info_ptr info = (fds_info_ptr) user_data;
+        if (info && !info->u.process_info) {
+            info->u.process_info = process;
+            process->tcp_fd_index = info - (fds_info_ptr) o2_fds_info.array;
+        }
     }
-    assert(((fds_info_ptr) user_data)->u.process_info);
+    assert(!user_data || ((fds_info_ptr) user_data)->u.process_info);
+    process->last_used = o2_local_now;
     process->udp_sa.sin_family = AF_INET;
     process->udp_port = udp_port;
     assert(udp_port != 0);
@@ -446,6 +721,8 @@ int o2_discovery_init_handler(o2_message_ptr msg, const char *types,
     O2_DB(printf("O2: connected from %s (udp port %ld) to local socket %ld\n",
                  name, (long) udp_port, (long) (DA_GET(o2_fds, struct pollfd,
                                                 process->tcp_fd_index)->fd)));
+    // a hub tells the new process about everyone else's services
+    if (o2_hub_flag) o2_hub_welcome(process);
     return O2_SUCCESS;
 }
 
@@ -456,7 +733,7 @@ int o2_discovery_init_handler(o2_message_ptr msg, const char *types,
 int o2_services_handler(o2_message_ptr msg, const char *types,
                         o2_arg_ptr *argv, int argc, void *user_data)
 {
-    o2_start_extract(msg);
+    o2_start_extract_types(msg, types);
     o2_arg_ptr arg = o2_get_next('s');
     if (!arg) return O2_FAIL;
     char *name = arg->s;
@@ -469,11 +746,17 @@ int o2_services_handler(o2_message_ptr msg, const char *types,
         process_info_ptr process = service->parent;
 
         // insert the services
+        int first = process->services.length;
         while ((arg = o2_get_next('s'))) {
-            char *service_name = o2_heapify(arg->s);
-            O2_DB(printf("O2: found service /%s offered by /%s\n", service_name, process->name));
-            add_remote_service(process, service_name);
+            // the service may be known already, e.g. from a second
+            // connection to the same process; a route through a hub
+            // is replaced
+            if (o2_direct_route(arg->s)) continue;
+            O2_DB(printf("O2: found service /%s offered by /%s\n", arg->s, process->name));
+            add_remote_service(process, arg->s);
         }
+        // a hub passes the new services on to its other processes
+        if (o2_hub_flag) o2_hub_add_services(process, first);
     }
     return O2_SUCCESS;
 }
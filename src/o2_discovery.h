@@ -14,6 +14,13 @@
 extern SOCKET o2_discovery_socket;
 extern int o2_port_map[16];
 
+// count of discovery messages sent, for benchmarking
+extern long o2_discovery_sent;
+
+// lazy connections, see o2_lazy_connections()
+extern int o2_lazy_flag;
+extern double o2_lazy_idle_timeout;
+
 /**
  *  Initialize for discovery 
  *
@@ -77,6 +84,32 @@ int o2_services_handler(o2_message_ptr msg, const char *types,
 
 int make_tcp_connection(process_info_ptr process, char *ip, int tcp_port);
 
+int o2_send_init(process_info_ptr process);
+
+int o2_send_services(process_info_ptr process);
+
+// callback for lazy connection announcements (!_o2/da)
+int o2_announce_handler(o2_message_ptr msg, const char *types,
+                        o2_arg_ptr *argv, int argc, void *user_data);
+
+// callback that periodically closes idle connections (!_o2/lz)
+int o2_lazy_idle_handler(o2_message_ptr msg, const char *types,
+                         o2_arg_ptr *argv, int argc, void *user_data);
+
+/**
+ *  Send our services and clock state to every known process. Used
+ *  with lazy connections instead of /sv and /cs/cs messages.
+ */
+void o2_announce_all();
+
+/**
+ *  Open the TCP connection to a process that was discovered with
+ *  lazy connections.
+ *
+ *  @return O2_SUCCESS if succeed, O2_FAIL if not.
+ */
+int o2_lazy_connect(process_info_ptr process);
+
 
 
 #endif /* O2_discovery_h */
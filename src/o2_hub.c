@@ -0,0 +1,254 @@
+//  o2_hub.c -- hub/relay topology
+//
+//  agent, 2026
+//
+/* Design notes:
+ *    In the default full mesh, every process connects to every other
+ * process, so N processes need O(N^2) connections and every process
+ * receives every discovery message. For large deployments, a few
+ * processes can instead be made hubs with o2_become_hub(). Other
+ * processes call o2_hub(ip, port) to attach to one or more hubs. They
+ * stop sending and answering discovery messages and only connect to
+ * their hubs. Hubs discover each other and connect in the usual way.
+ *
+ *    A hub tells every process it is connected to about the services
+ * of all its other processes with !ip:port/br messages. Arguments are
+ * the hub's process name, an add (1) or remove (0) flag, and service
+ * names. The receiver enters each new service in path_tree_table with
+ * the tag O2_BRIDGE_SERVICE and the hub as parent, so o2_send() sends
+ * messages for it to the hub. An existing entry, e.g. a direct
+ * connection, takes precedence, and a direct connection made later
+ * replaces the bridged entry (see add_remote_service()), so messages
+ * do not keep taking the longer route. Process names are bridged too, so
+ * replies addressed to !ip:port/... reach processes behind a hub. A
+ * hub receiving a /br message from another hub passes it on, so hubs
+ * can be chained.
+ *
+ *    When a message arrives at a hub for a service that is not local,
+ * deliver_or_schedule() hands it to o2_hub_forward(), which sends
+ * the received message as is: no re-serialization or copy. Messages
+ * that arrived by TCP are forwarded by TCP, and UDP by UDP.
+ * Timestamped messages are forwarded immediately; the destination
+ * schedules them.
+ *
+ *    When a process connected to the hub is removed, the hub sends a
+ * /br remove message so that its services disappear everywhere.
+ *
+ *    o2_status() of a bridged service is based on the hub's clock
+ * synchronization state, which is the best a process behind a hub
+ * can know.
+ */
+
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+#include "o2_discovery.h"
+#include "o2_send.h"
+#include "o2_clock.h"
+#include "o2_hub.h"
+#include "o2_shmem.h"
+
+int o2_hub_flag = FALSE;
+int o2_using_hub = FALSE;
+
+
+int o2_become_hub()
+{
+    if (o2_application_name) return O2_RUNNING;
+    o2_hub_flag = TRUE;
+    return O2_SUCCESS;
+}
+
+
+// Undo a failed o2_hub(): remove the hub process, unless the failed
+//   send has removed it already, and restore o2_using_hub. Returns err.
+//
+static int hub_failed(const char *name, process_info_ptr hub, int using_hub,
+                      int err)
+{
+    int index;
+    generic_entry_ptr *entry = lookup(&path_tree_table, name, &index);
+    if (entry && (*entry)->tag == O2_REMOTE_SERVICE &&
+        ((remote_service_entry_ptr) *entry)->parent == hub) {
+        o2_remove_remote_process(hub);
+    }
+    o2_using_hub = using_hub;
+    return err;
+}
+
+
+int o2_hub(const char *ip, int tcp_port)
+{
+    if (!o2_application_name) return O2_FAIL;
+    char name[32];
+    // ip:port + pad with zeros
+#ifndef WIN32
+	snprintf(name, 32, "%s:%d%c%c%c%c", ip, tcp_port, 0, 0, 0, 0);
+#else
+	_snprintf(name, 32, "%s:%d%c%c%c%c", ip, tcp_port, 0, 0, 0, 0);
+#endif
+    if (o2_direct_route(name)) {
+        return O2_SUCCESS; // already connected to this hub
+    }
+    int using_hub = o2_using_hub;
+    o2_using_hub = TRUE; // stops discovery, see o2_discovery_send_handler()
+    process_info_ptr hub =
+        o2_add_remote_process(name, PROCESS_CONNECTING, IS_LITTLE_ENDIAN);
+    if (!hub) return hub_failed(name, NULL, using_hub, O2_NO_MEMORY);
+    int err;
+    if ((err = make_tcp_connection(hub, (char *) ip, tcp_port)) ||
+        (err = o2_send_init(hub)) ||
+        (err = o2_send_services(hub)) ||
+        (err = o2_send_clocksync(hub))) {
+        return hub_failed(name, hub, using_hub, err);
+    }
+    O2_DB(printf("O2: attached to hub %s\n", name));
+    return O2_SUCCESS;
+}
+
+
+// send a /br message to process "to" with n service names from keys
+//
+static int send_bridge(process_info_ptr to, int add_flag, char **keys, int n)
+{
+    if (n <= 0) return O2_SUCCESS;
+    int err = o2_start_send() ||
+        o2_add_string(o2_process.name) ||
+        o2_add_int32(add_flag);
+    if (err) return O2_FAIL;
+    for (int i = 0; i < n; i++) {
+        o2_add_string(keys[i]);
+    }
+    char address[32];
+#ifndef WIN32
+	snprintf(address, 32, "!%s/br", to->name);
+#else
+	_snprintf(address, 32, "!%s/br", to->name);
+#endif
+    return o2_finish_send_cmd(0.0, address);
+}
+
+
+// send a /br message to every connected process except from
+//
+static void send_bridge_to_all(process_info_ptr from, int add_flag,
+                               char **keys, int n)
+{
+    for (int i = 0; i < o2_fds_info.length; i++) {
+        fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
+        process_info_ptr to = info->u.process_info;
+        // a process may have two connections; use only the main one
+        if (info->tag == TCP_SOCKET && to && to != from &&
+            to->tcp_fd_index == i) {
+            send_bridge(to, add_flag, keys, n);
+        }
+    }
+}
+
+
+int o2_hub_forward(o2_message_ptr msg, int tcp_flag)
+{
+    generic_entry_ptr service = o2_find_service(msg->data.address + 1);
+    if (!service || (service->tag != O2_REMOTE_SERVICE &&
+                     service->tag != O2_BRIDGE_SERVICE)) {
+        return FALSE;
+    }
+    O2_DB2(printf("O2: hub forwarding %s\n", msg->data.address));
+    // receivers only trust segments of the process that sends them
+    // a message, so shared memory is copied (see o2_shmem.c)
+    if (!(msg = o2_shmem_forward(msg))) return TRUE;
+    o2_send_to_service(service, msg, tcp_flag);
+    return TRUE;
+}
+
+
+void o2_hub_welcome(process_info_ptr process)
+{
+    // collect every service offered by some other process
+    dyn_array keys;
+    DA_INIT(keys, char *, 16);
+    enumerate en;
+    enumerate_begin(&en, &(path_tree_table.children));
+    generic_entry_ptr entry;
+    while ((entry = enumerate_next(&en))) {
+        if ((entry->tag == O2_REMOTE_SERVICE ||
+             entry->tag == O2_BRIDGE_SERVICE) &&
+            ((remote_service_entry_ptr) entry)->parent != process) {
+            DA_APPEND(keys, char *, entry->key);
+        }
+    }
+    send_bridge(process, TRUE, (char **) keys.array, keys.length);
+    DA_FINISH(keys);
+}
+
+
+void o2_hub_add_services(process_info_ptr process, int first)
+{
+    send_bridge_to_all(process, TRUE,
+                       DA_GET(process->services, char *, first),
+                       process->services.length - first);
+}
+
+
+void o2_hub_remove_process(process_info_ptr process)
+{
+    send_bridge_to_all(process, FALSE, (char **) process->services.array,
+                       process->services.length);
+}
+
+
+int o2_bridge_handler(o2_message_ptr msg, const char *types,
+                      o2_arg_ptr *argv, int argc, void *user_data)
+{
+    (void) argv; (void) argc; (void) user_data; // extracted below
+    o2_arg_ptr hub_arg, add_arg, arg;
+    o2_start_extract_types(msg, types);
+    if (!(hub_arg = o2_get_next('s')) ||
+        !(add_arg = o2_get_next('i'))) {
+        return O2_FAIL;
+    }
+    int index;
+    // note that the name is padded with zeros to 32-bit boundary
+    generic_entry_ptr *entry = lookup(&path_tree_table, hub_arg->s, &index);
+    if (!entry || (*entry)->tag != O2_REMOTE_SERVICE) return O2_FAIL;
+    process_info_ptr hub = ((remote_service_entry_ptr) *entry)->parent;
+
+    // no byte-swap check needed for add_arg because it is just zero/non-zero
+    if (add_arg->i32) {
+        int first = hub->services.length;
+        while ((arg = o2_get_next('s'))) {
+            // keep an existing route, in particular a direct connection
+            if (!lookup(&path_tree_table, arg->s, &index)) {
+                O2_DB(printf("O2: found service /%s through hub /%s\n",
+                             arg->s, hub->name));
+                add_bridge_service(hub, arg->s);
+            }
+        }
+        // a hub passes the new services on to its other processes
+        if (o2_hub_flag) o2_hub_add_services(hub, first);
+    } else {
+        dyn_array gone;
+        DA_INIT(gone, char *, 4);
+        while ((arg = o2_get_next('s'))) {
+            entry = lookup(&path_tree_table, arg->s, &index);
+            if (entry && (*entry)->tag == O2_BRIDGE_SERVICE &&
+                ((remote_service_entry_ptr) *entry)->parent == hub) {
+                DA_APPEND(gone, char *, (*entry)->key);
+            }
+        }
+        // pass the removal on while the keys are still allocated
+        if (o2_hub_flag) {
+            send_bridge_to_all(hub, FALSE, (char **) gone.array, gone.length);
+        }
+        for (int i = 0; i < gone.length; i++) {
+            O2_DB(printf("O2: removing service /%s behind hub /%s\n",
+                         *DA_GET(gone, char *, i), hub->name));
+            remove_bridge_service(hub, *DA_GET(gone, char *, i));
+        }
+        DA_FINISH(gone);
+    }
+    return O2_SUCCESS;
+}
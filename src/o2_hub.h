@@ -0,0 +1,42 @@
+//  o2_hub.h -- hub/relay topology
+//
+//  A hub forwards messages between the processes attached to it so
+//  that they do not need connections to each other. See o2_hub.c.
+
+#ifndef o2_hub_h
+#define o2_hub_h
+
+/// TRUE if this process forwards messages for others (o2_become_hub())
+extern int o2_hub_flag;
+
+/// TRUE if this process reaches others through hubs (o2_hub()); such
+/// a process does not take part in discovery
+extern int o2_using_hub;
+
+/**
+ *  Forward msg if it is addressed to a remote service. The message
+ *  is sent as received, without re-serialization, by TCP if tcp_flag
+ *  is set and by UDP otherwise.
+ *
+ *  @return TRUE if msg was forwarded (and is now freed), FALSE if it
+ *          should be delivered locally.
+ */
+int o2_hub_forward(o2_message_ptr msg, int tcp_flag);
+
+/// send the services of all other known processes to a newly
+/// connected process
+void o2_hub_welcome(process_info_ptr process);
+
+/// tell the other connected processes that process now offers the
+/// services in process->services, starting at index first
+void o2_hub_add_services(process_info_ptr process, int first);
+
+/// tell the other connected processes that the services of process,
+/// which is about to be removed, are gone
+void o2_hub_remove_process(process_info_ptr process);
+
+/// /ip:port/br handler: services that are reachable through a hub
+int o2_bridge_handler(o2_message_ptr msg, const char *types,
+                      o2_arg_ptr *argv, int argc, void *user_data);
+
+#endif /* o2_hub_h */
@@ -89,9 +89,21 @@ extern int o2_gtsched_started;
 /** Default max send and recieve buffer. */
 #define MAX_BUFFER 1024
 
-/* \brief Maximum length of UDP messages in bytes
+/* \brief Maximum length of messages in bytes. UDP messages longer than
+ * the MTU are sent in fragments (see o2_udp_mtu()). A TCP frame that
+ * is longer is not sent, and a process that receives one drops the
+ * connection rather than allocate it.
  */
-#define O2_MAX_MSG_SIZE 32768
+#define O2_MAX_MSG_SIZE 1048576
+
+/* \brief Maximum nesting of bundles in a received message (see
+ * o2_msg_validate())
+ */
+#define O2_MAX_BUNDLE_DEPTH 8
+
+/* \brief Requested receive buffer size of the UDP message socket
+ */
+#define UDP_RECV_BUFFER_SIZE (1 << 20)
 
 /* \brief A set of macros to represent different communications transports
  */
@@ -170,6 +182,15 @@ int ping(o2_message_ptr msg, const char *types,
 
 void o2_sched_init();
 
+/**
+ *  Add service_name to the services of this process and tell all
+ *  other processes about it. Used by o2_add_service() and
+ *  o2_delegate_to_osc().
+ *
+ *  @return O2_SUCCESS if succeed, O2_FAIL if not.
+ */
+int o2_announce_service(char *service_name);
+
 // used by o2_get_next() for storage when parameters are coerced.
 // Used in dispatch code (o2_search.c) to detect when coercion
 // has taken place.
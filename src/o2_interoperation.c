@@ -17,12 +17,78 @@
  * service name. Finally, we just send the message, resulting in
  * either a local dispatch or forwarding to an O2 service.
  *
+ *   The offset is the length of "/service" rounded up to a word. The
+ * OSC address is then moved down to follow "/service". The new address
+ * pads to either the same end as the OSC address or one word less; in
+ * the second case the type string and arguments move down by 4 bytes.
+ * Otherwise, nothing is copied. On Linux, recvmmsg() receives up to
+ * OSC_BATCH_MAX datagrams per call, each into its own message of
+ * OSC_BATCH_BYTES. The sizes of the datagrams after the first are not
+ * known in advance, so each message is followed by a shared overflow
+ * buffer that can hold any datagram; a larger datagram is copied into
+ * a message of its own size. If more than one datagram of a batch is
+ * larger, only the last overflow is intact, and the others are
+ * dropped.
+ *
  *   We handle outgoing OSC messages using
  * o2_delegate_to_osc(service_name, ip, port_num), which puts an
- * entry in the top-level hash table with the OSC socket.
+ * osc_entry in the top-level hash table (path_tree_table) with the
+ * server address and, for TCP, a connected socket. The service is
+ * announced like a local one, so other processes send to it here.
+ * Messages sent to the service from this process go through
+ * o2_send_osc(); messages that arrive from other processes, and
+ * timed messages when they are due, are dispatched by
+ * find_and_call_handlers(), which finds the osc_entry.
+ *
+ *   Timed messages sent from this process go out ahead of time in
+ * OSC bundles. o2_send_osc() appends each one to a list in its
+ * osc_entry; a message with a different timestamp, or one that would
+ * make the bundle larger than OSC_BATCH_BYTES, sends the list first.
+ * The lists are sent at the end of o2_poll(), so messages with the
+ * same timestamp and destination share one packet. The timetag is
+ * the NTP (wall clock) time that corresponds to the timestamp now,
+ * which assumes the server clock is close to ours. Timed messages
+ * from other processes are scheduled on arrival (see
+ * deliver_or_schedule()) and sent when due. Without clock sync,
+ * timed messages are dropped.
+ *
+ *   Incoming bundles are unpacked by osc_deliver_bundle(): each
+ * element is copied to its own message, timestamped with the timetag
+ * converted to global time the same way, and sent, so that local
+ * services schedule it on o2_gtsched. Timetag 1 ("immediately") and
+ * bundles received before clock sync are delivered at once.
+ *
+ *   An O2 message becomes an OSC message by dropping the timestamp
+ * and the service name: "/service/osc/addr" -> "/osc/addr". Only the
+ * address padding changes, so the message is sent with sendmsg()
+ * from three pieces -- the OSC address, up to 4 zero bytes of pad,
+ * and the type string and arguments -- with no copy. Arguments are
+ * converted to network order in place, so the message is not used
+ * after sending. Over TCP, a 4-byte length precedes each message
+ * (OSC 1.0 framing), or with O2_OSC_SLIP, the packet is SLIP encoded
+ * into a buffer that is kept for the next packet (OSC 1.1 framing).
+ * If a TCP send fails, the connection is closed and reopened by the
+ * next send.
+ *
+ *   An OSC TCP port is a server socket (OSC_TCP_SERVER_SOCKET); each
+ * accepted connection is an OSC_TCP_SOCKET with its own copy of the
+ * prefix. The first byte received picks the framing. Data is read in
+ * chunks of OSC_TCP_CHUNK bytes and decoded into info->message, which
+ * has room for the prefix like a UDP message; complete packets are
+ * delivered after the chunk, since handlers may move info.
+ *
+ *   SLIP encoding and decoding look for END and ESC bytes with
+ * slip_scan(), and copy the runs between them with memcpy(). The scan
+ * is o2_find_either() (see o2_vector.c), which tests 16 bytes per
+ * instruction with SSE2, or 8 bytes at a time with word operations
+ * elsewhere, so long runs without special bytes, the common case, go
+ * quickly.
  */
 
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for recvmmsg()
+#endif
 #include "o2.h"
 #include "o2_dynamic.h"
 #include "o2_socket.h"
@@ -31,51 +97,455 @@
 #include "o2_message.h"
 #include "o2_sched.h"
 #include "o2_send.h"
+#include "o2_interoperation.h"
+#include "o2_vector.h"
+#ifndef WIN32
+#include "sys/ioctl.h"
+#include "sys/time.h"
+#include "netinet/tcp.h"
+#else
+int gettimeofday(struct timeval *tp, struct timezone *tzp); // in o2.c
+#endif
+
+// largest OSC datagram received in a batch: the UDP payload of an
+// unfragmented packet on Ethernet. A larger datagram at the head of the
+// queue is received by itself into a message of the right size.
+#define OSC_BATCH_BYTES 1472
+#define OSC_BATCH_MAX 16
+
+#ifdef __linux__
+// the rest of a datagram of a batch that is larger than OSC_BATCH_BYTES
+static char osc_overflow[0x10000];
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SO_NOSIGPIPE is set on the socket instead
+#endif
 
 /* create a port to receive OSC messages. 
  * Messages are directed to service_name. 
  *
- * Algorithm: Create 
+ * Algorithm: Create a UDP socket bound to port_num, or a TCP server
+ * socket listening on port_num. Its fds_info holds "/service_name",
+ * the prefix that is put in front of each incoming OSC address.
  */
 int o2_create_osc_port(const char *service_name, int port_num, int udp_flag)
 {
-    osc_entry_ptr osc_entry = O2_MALLOC(sizeof(osc_entry));
-    osc_entry->tag = OSC_LOCAL_SERVICE;
-    osc_entry->key = o2_heapify(service_name);
-    osc_entry->port = port_num;
+    if (!o2_application_name) return O2_FAIL;
+    SOCKET sock = socket(AF_INET, udp_flag ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (sock == INVALID_SOCKET) return O2_FAIL;
+    if (bind_recv_socket(sock, &port_num, TRUE) ||
+        (!udp_flag && listen(sock, SOMAXCONN))) {
+        closesocket(sock);
+        return O2_FAIL;
+    }
+    char *prefix = (char *) O2_MALLOC(strlen(service_name) + 2);
+    if (!prefix) {
+        closesocket(sock);
+        return O2_NO_MEMORY;
+    }
+    prefix[0] = '/';
+    strcpy(prefix + 1, service_name);
     if (udp_flag) {
-        // TODO: set osc_entry->udp_sa for sending messages
+        add_new_socket(sock, OSC_SOCKET, NULL, &osc_udp_recv_handler);
     } else {
-        assert(FALSE); // need to implement TCP
-        DA_EXPAND(o2_fds, struct pollfd);
-        struct pollfd *fdptr = DA_LAST(o2_fds, struct pollfd);
-        /* TODO: 
-        fdptr->fd = sock;
-        fdptr->events = POLLIN;
-        if (o2_bind(sock, port_num) == -1) {
-            perror("Bind udp socket");
-            return O2_FAIL;
+        add_new_socket(sock, OSC_TCP_SERVER_SOCKET, NULL,
+                       &osc_tcp_accept_handler);
+    }
+    DA_LAST(o2_fds_info, fds_info)->u.osc_service_name = prefix;
+    O2_DB(printf("O2: OSC messages to %s port %d go to service %s\n",
+                 udp_flag ? "UDP" : "TCP", port_num, service_name));
+    return O2_SUCCESS;
+}
+
+
+// Turn the OSC message received at msg->data.address + (prefix
+//   length rounded up to a word) into an O2 message in place: move the
+//   OSC address down to follow the prefix, write the prefix, and move
+//   the type string and arguments if the new address pads differently.
+//   Arguments are converted to host byte order. Returns FALSE if the
+//   data is not an OSC message or is malformed (see o2_msg_validate()).
+//
+static int osc_to_o2_in_place(o2_message_ptr msg, const char *prefix,
+                              int n)
+{
+    int prefix_len = (int) strlen(prefix);
+    int offset = (prefix_len + 3) & ~3;
+    char *osc = msg->data.address + offset;
+    if (n < 4 || osc[0] != '/') {
+        return FALSE; // bundles (#bundle) are handled by osc_deliver()
+    }
+    int addr_len = (int) strnlen(osc, n);
+    if (addr_len >= n) return FALSE; // address is not terminated
+    int osc_addr_size = (addr_len + 4) & ~3;
+    int o2_addr_size = (prefix_len + addr_len + 4) & ~3;
+    char *address = msg->data.address;
+    memmove(address + prefix_len, osc, addr_len);
+    memcpy(address, prefix, prefix_len);
+    // o2_addr_size is either offset + osc_addr_size or 4 less
+    if (o2_addr_size != offset + osc_addr_size) {
+        memmove(address + o2_addr_size, osc + osc_addr_size,
+                n - osc_addr_size);
+    }
+    memset(address + prefix_len + addr_len, 0,
+           o2_addr_size - (prefix_len + addr_len));
+    msg->data.timestamp = 0.0;
+    msg->length = sizeof(double) + o2_addr_size + n - osc_addr_size;
+    // OSC arguments are big-endian
+    if (IS_LITTLE_ENDIAN && o2_msg_swap_endian(msg, TRUE)) return FALSE;
+    return o2_msg_validate(msg) == O2_SUCCESS;
+}
+
+
+static o2_time timetag_to_o2_time(const uint32_t *timetag);
+
+// Deliver each element of the OSC bundle in data as an O2 message
+//   timestamped with the bundle's timetag. Elements are copied into
+//   new messages; nested bundles are delivered recursively.
+//
+static void osc_deliver_bundle(char *data, int n, const char *prefix)
+{
+    if (o2_validate_bundle(data, n) < 0) return;
+    int offset = ((int) strlen(prefix) + 3) & ~3;
+    o2_time timestamp = timetag_to_o2_time((uint32_t *) (data + 8));
+    char *end = data + n;
+    char *element = data + 16; // after "#bundle" and timetag
+    while (element < end) {
+        int32_t size;
+        memcpy(&size, element, sizeof(size));
+        size = ntohl(size);
+        element += sizeof(size);
+        if (size >= 16 && streql(element, "#bundle")) {
+            osc_deliver_bundle(element, size, prefix);
+        } else {
+            o2_message_ptr msg = alloc_size_message(sizeof(double) +
+                                                    offset + size);
+            if (!msg) return;
+            memcpy(msg->data.address + offset, element, size);
+            if (osc_to_o2_in_place(msg, prefix, size)) {
+                msg->data.timestamp = timestamp;
+                o2_send_message(msg, FALSE);
+            } else {
+                o2_free_message(msg);
+            }
+        }
+        element += size;
+    }
+}
+
+
+// the prefix is sent on as part of the message address: deliver it
+//   locally or forward it to a remote service
+//
+static void osc_deliver(o2_message_ptr msg, const char *prefix, int n)
+{
+    int offset = ((int) strlen(prefix) + 3) & ~3;
+    char *osc = msg->data.address + offset;
+    if (n >= 16 && streql(osc, "#bundle")) {
+        osc_deliver_bundle(osc, n, prefix);
+        o2_free_message(msg);
+    } else if (osc_to_o2_in_place(msg, prefix, n)) {
+        o2_send_message(msg, FALSE);
+    } else {
+        o2_free_message(msg);
+    }
+}
+
+
+/* Receive OSC messages from a UDP socket directly into o2_messages,
+ * leaving room in front of each for the timestamp and service name.
+ * Where recvmmsg() is available, up to OSC_BATCH_MAX datagrams are
+ * received with one system call.
+ */
+int osc_udp_recv_handler(SOCKET sock, struct fds_info *info)
+{
+    const char *prefix = info->u.osc_service_name;
+    int offset = ((int) strlen(prefix) + 3) & ~3;
+    int len;
+#ifndef WIN32
+    if (ioctl(sock, FIONREAD, &len) == -1) {
+#else
+    if (ioctlsocket(sock, FIONREAD, &len) == -1) {
+#endif
+        perror("osc_udp_recv_handler");
+        return O2_FAIL;
+    }
+#ifdef __linux__
+    if (len <= OSC_BATCH_BYTES) {
+        o2_message_ptr msgs[OSC_BATCH_MAX];
+        struct mmsghdr hdrs[OSC_BATCH_MAX];
+        struct iovec iovs[OSC_BATCH_MAX * 2]; // message, then overflow
+        int i;
+        for (i = 0; i < OSC_BATCH_MAX; i++) {
+            msgs[i] = alloc_size_message(sizeof(double) + offset +
+                                         OSC_BATCH_BYTES);
+            if (!msgs[i]) break;
+            iovs[2 * i].iov_base = msgs[i]->data.address + offset;
+            iovs[2 * i].iov_len = OSC_BATCH_BYTES;
+            iovs[2 * i + 1].iov_base = osc_overflow;
+            iovs[2 * i + 1].iov_len = sizeof(osc_overflow);
+            memset(&hdrs[i].msg_hdr, 0, sizeof(struct msghdr));
+            hdrs[i].msg_hdr.msg_iov = &iovs[2 * i];
+            hdrs[i].msg_hdr.msg_iovlen = 2;
         }
-        */
-        DA_EXPAND(o2_fds_info, struct fds_info);
-        struct fds_info *info = DA_LAST(o2_fds_info, struct fds_info);
-        info->tag = OSC_SOCKET;
-        // info->port = port_num;
-        info->length = 0;
-        info->length_got = 0;
-        info->u.osc_service_name = o2_heapify(service_name);
-    }
-    // TODO: what happens to o2_osc_service that we created above?
-    // TODO: What does this do?
-    //     add_local_osc_to_hash(path, port_num, o2_osc_service_num);
-    // TODO: this implies there's an o2_socket table; probably wrong:
-    //     o2_socket_num++;
-    
+        int count = i;
+        int n = count ? recvmmsg(sock, hdrs, count, MSG_DONTWAIT, NULL) : 0;
+        if (n < 0) {
+            perror("recvmmsg in osc_udp_recv_handler");
+            n = 0;
+        }
+        // only the last datagram that overflowed is intact
+        int last_big = -1;
+        for (i = 0; i < n; i++) {
+            if (hdrs[i].msg_len > OSC_BATCH_BYTES) last_big = i;
+        }
+        // handlers may add or remove sockets, so info is not used below
+        for (i = 0; i < n; i++) {
+            int size = hdrs[i].msg_len;
+            if (size <= OSC_BATCH_BYTES) {
+                osc_deliver(msgs[i], prefix, size);
+                continue;
+            }
+            o2_message_ptr big = NULL;
+            if (i == last_big && !(hdrs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+                big = alloc_size_message(sizeof(double) + offset + size);
+            }
+            if (big) {
+                memcpy(big->data.address + offset,
+                       msgs[i]->data.address + offset, OSC_BATCH_BYTES);
+                memcpy(big->data.address + offset + OSC_BATCH_BYTES,
+                       osc_overflow, size - OSC_BATCH_BYTES);
+                osc_deliver(big, prefix, size);
+            } else {
+                O2_DB(printf("O2: dropped OSC message over %d bytes\n",
+                             OSC_BATCH_BYTES));
+            }
+            o2_free_message(msgs[i]);
+        }
+        for (i = n; i < count; i++) {
+            o2_free_message(msgs[i]);
+        }
+        return O2_SUCCESS;
+    }
+#endif
+    o2_message_ptr msg = alloc_size_message(sizeof(double) + offset + len);
+    if (!msg) return O2_FAIL;
+    int n;
+    if ((n = recvfrom(sock, msg->data.address + offset, len, 0,
+                      NULL, NULL)) <= 0) {
+        // like udp_recv_handler, just report errors
+        perror("recvfrom in osc_udp_recv_handler");
+        o2_free_message(msg);
+        return O2_FAIL;
+    }
+    osc_deliver(msg, prefix, n);
     return O2_SUCCESS;
 }
 
 
-size_t o2_arg_size(o2_type type, void *data);
+// From http://tools.ietf.org/html/rfc1055
+#define SLIP_END        0300    /* indicates end of packet */
+#define SLIP_ESC        0333    /* indicates byte stuffing */
+#define SLIP_ESC_END    0334    /* ESC ESC_END means END data byte */
+#define SLIP_ESC_ESC    0335    /* ESC ESC_ESC means ESC data byte */
+
+// fds_info.framing for OSC_TCP_SOCKET, set by the first byte received
+#define OSC_FRAMING_UNKNOWN 0
+#define OSC_FRAMING_LENGTH 1   // each packet is preceded by its length
+#define OSC_FRAMING_SLIP 2     // packets are delimited by SLIP_END
+#define OSC_FRAMING_SLIP_ESC 3 // SLIP, and the last byte was SLIP_ESC
+
+// largest OSC packet accepted over TCP
+#define OSC_TCP_MAX_BYTES 0x100000
+// bytes received from an OSC TCP connection with one recv()
+#define OSC_TCP_CHUNK 4096
+
+// Find the first SLIP_END or SLIP_ESC byte from p to end, or return
+//   end (special bytes are rare in OSC data, so most of the time goes
+//   to this scan).
+//
+static const char *slip_scan(const char *p, const char *end)
+{
+    return o2_find_either(p, end, (char) SLIP_END, (char) SLIP_ESC);
+}
+
+
+// Make room in info->message for a packet of size bytes, which
+//   starts at offset in the address. A message is allocated when the
+//   packet starts, and a bigger one when it is full. Returns FALSE if
+//   the packet is too big. size is unsigned so that a length from the
+//   client cannot pass the test by being negative.
+//
+static int osc_tcp_reserve(fds_info_ptr info, int offset, uint32_t size)
+{
+    o2_message_ptr msg = info->message;
+    if (size > OSC_TCP_MAX_BYTES) return FALSE;
+    int needed = sizeof(double) + offset + (int) size;
+    if (!msg || msg->allocated < needed) {
+        int allocated = MESSAGE_ALLOCATED_FROM_SIZE(MESSAGE_DEFAULT_SIZE);
+        while (allocated < needed) allocated *= 2;
+        o2_message_ptr bigger = alloc_size_message(allocated);
+        if (!bigger) return FALSE;
+        if (msg) {
+            memcpy(bigger->data.address + offset, msg->data.address + offset,
+                   info->message_got);
+            o2_free_message(msg);
+        }
+        info->message = bigger;
+    }
+    return TRUE;
+}
+
+
+// Append len bytes to the packet being received into info->message.
+//
+static int osc_tcp_append(fds_info_ptr info, int offset, const char *data,
+                          int len)
+{
+    if (len < 0 ||
+        !osc_tcp_reserve(info, offset, (uint32_t) (info->message_got + len))) {
+        return FALSE;
+    }
+    memcpy(info->message->data.address + offset + info->message_got,
+           data, len);
+    info->message_got += len;
+    return TRUE;
+}
+
+
+/* Accept a connection to an OSC TCP port. The connection gets its
+ * own copy of the service prefix.
+ */
+int osc_tcp_accept_handler(SOCKET sock, struct fds_info *info)
+{
+    SOCKET connection = accept(sock, NULL, NULL);
+    if (connection == INVALID_SOCKET) return O2_FAIL;
+    char *prefix = (char *) O2_MALLOC(strlen(info->u.osc_service_name) + 1);
+    if (!prefix) {
+        closesocket(connection);
+        return O2_NO_MEMORY;
+    }
+    strcpy(prefix, info->u.osc_service_name);
+    // add_new_socket() may move info, which is not used below
+    add_new_socket(connection, OSC_TCP_SOCKET, NULL, &osc_tcp_recv_handler);
+    DA_LAST(o2_fds_info, fds_info)->u.osc_service_name = prefix;
+    return O2_SUCCESS;
+}
+
+
+/* Receive OSC packets from a TCP connection. Packets are either
+ * preceded by their length (OSC 1.0) or SLIP encoded (OSC 1.1); the
+ * first byte tells which, since a length starts with a zero byte and
+ * a SLIP packet starts with SLIP_END or an OSC address. Data is read
+ * in chunks, so many small packets take one recv(). Packets are
+ * decoded into messages, leaving room for the service prefix, and
+ * delivered after the chunk is processed.
+ */
+int osc_tcp_recv_handler(SOCKET sock, struct fds_info *info)
+{
+    char chunk[OSC_TCP_CHUNK];
+    int n = recvfrom(sock, chunk, OSC_TCP_CHUNK, 0, NULL, NULL);
+    if (n == 0) return O2_TCP_HUP; // orderly shutdown by the client
+    if (n < 0) {
+#ifndef WIN32
+        if (errno == EAGAIN || errno == EINTR) return O2_SUCCESS;
+#else
+        if (GetLastError() == WSAEWOULDBLOCK ||
+            GetLastError() == WSAEINTR) return O2_SUCCESS;
+#endif
+        return O2_TCP_HUP;
+    }
+    const char *prefix = info->u.osc_service_name;
+    int offset = ((int) strlen(prefix) + 3) & ~3;
+    // complete packets, linked by next, with the packet size in length
+    o2_message_ptr ready = NULL;
+    o2_message_ptr *ready_tail = &ready;
+    const char *p = chunk;
+    const char *end = chunk + n;
+    int ok = TRUE;
+    while (p < end && ok) {
+        if (info->framing == OSC_FRAMING_UNKNOWN) {
+            info->framing = (*p == 0 ? OSC_FRAMING_LENGTH :
+                                       OSC_FRAMING_SLIP);
+        }
+        const char *special;
+        int done = FALSE; // true when a packet is complete
+        switch (info->framing) {
+          case OSC_FRAMING_LENGTH:
+            if (info->length_got < 4) {
+                int len = 4 - info->length_got;
+                if (len > end - p) len = (int) (end - p);
+                memcpy(((char *) &info->length) + info->length_got, p, len);
+                p += len;
+                info->length_got += len;
+                if (info->length_got == 4) {
+                    info->length = ntohl(info->length);
+                    // a length over the limit is not trusted at all:
+                    // the connection is dropped before allocating
+                    if (info->length > OSC_TCP_MAX_BYTES) {
+                        ok = FALSE;
+                        break;
+                    }
+                    // allocate the whole message at once
+                    ok = osc_tcp_reserve(info, offset, info->length);
+                    done = (info->length == 0);
+                }
+            } else {
+                int len = (int) info->length - info->message_got;
+                if (len > end - p) len = (int) (end - p);
+                ok = osc_tcp_append(info, offset, p, len);
+                p += len;
+                done = (info->message_got == (int) info->length);
+            }
+            break;
+          case OSC_FRAMING_SLIP_ESC: {
+            char c = *p++;
+            if ((unsigned char) c == SLIP_ESC_END) c = (char) SLIP_END;
+            else if ((unsigned char) c == SLIP_ESC_ESC) c = (char) SLIP_ESC;
+            ok = osc_tcp_append(info, offset, &c, 1);
+            info->framing = OSC_FRAMING_SLIP;
+            break;
+          }
+          case OSC_FRAMING_SLIP:
+            special = slip_scan(p, end);
+            if (special > p) {
+                ok = osc_tcp_append(info, offset, p, (int) (special - p));
+            }
+            p = special;
+            if (p < end) {
+                if ((unsigned char) *p++ == SLIP_ESC) {
+                    info->framing = OSC_FRAMING_SLIP_ESC;
+                } else { // SLIP_END; the first of a double END is empty
+                    done = (info->message_got > 0);
+                }
+            }
+            break;
+        }
+        if (done && info->message_got > 0) {
+            info->message->length = info->message_got;
+            *ready_tail = info->message;
+            ready_tail = &info->message->next;
+            info->message = NULL;
+            info->message_got = 0;
+            info->length_got = 0;
+        } else if (done) { // empty packet
+            info->length_got = 0;
+        }
+    }
+    *ready_tail = NULL;
+    // deliver: handlers may add or remove sockets, so info is not used
+    // below, and the prefix is copied (the connection may be closed)
+    char name[MAX_SERVICE_LEN + 2];
+    strncpy(name, prefix, MAX_SERVICE_LEN + 1);
+    name[MAX_SERVICE_LEN + 1] = 0;
+    while (ready) {
+        o2_message_ptr msg = ready;
+        ready = msg->next;
+        osc_deliver(msg, name, msg->length);
+    }
+    return ok ? O2_SUCCESS : O2_TCP_HUP; // drop a bad connection
+}
+
 
 /** send an OSC message directly. The service_name is the O2 equivalent
  * of an address. path is a normal OSC address string and is not prefixed
@@ -84,29 +554,414 @@ size_t o2_arg_size(o2_type type, void *data);
 int o2_send_osc_message_marker(char *service_name, const char *path,
                                const char *typestring, ...)
 {
+    generic_entry_ptr service = o2_find_service(service_name);
+    if (!service || service->tag != OSC_REMOTE_SERVICE) return O2_FAIL;
     va_list ap;
     va_start(ap, typestring);
-    
-    o2_message_ptr msg = o2_build_message(0.0, service_name, path, typestring, ap);
-    // TODO: send the message
+    o2_message_ptr msg = o2_build_message(0.0, service_name, path,
+                                          typestring, ap);
+    va_end(ap);
+    if (!msg) return O2_FAIL;
+    return o2_send_osc((osc_entry_ptr) service, msg);
+}
 
+
+// open the TCP connection to the OSC server of entry
+//
+static int osc_tcp_connect(osc_entry_ptr entry)
+{
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == INVALID_SOCKET) return O2_FAIL;
+    int set = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *) &set, sizeof(set));
+#ifdef SO_NOSIGPIPE
+    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (void *) &set, sizeof(set));
+#endif
+    if (connect(sock, (struct sockaddr *) &entry->udp_sa,
+                sizeof(entry->udp_sa)) == -1) {
+        perror("o2_delegate_to_osc connect");
+        closesocket(sock);
+        return O2_FAIL;
+    }
+    entry->tcp_socket = sock;
     return O2_SUCCESS;
 }
 
+
 int o2_delegate_to_osc(char *service_name, char *ip, int port_num, int tcp_flag)
 {
-    // make a description for fds_info
-    osc_entry_ptr entry = O2_MALLOC(sizeof(osc_entry));
-    
+    if (!o2_application_name) return O2_FAIL;
+    if (strlen(ip) >= sizeof(((osc_entry_ptr) 0)->ip)) return O2_FAIL;
+    if (o2_find_service(service_name)) {
+        return O2_FAIL; // the service already exists
+    }
+    osc_entry_ptr entry = (osc_entry_ptr) O2_MALLOC(sizeof(osc_entry));
+    if (!entry) return O2_NO_MEMORY;
     entry->tag = OSC_REMOTE_SERVICE;
-    char *key = o2_heapify(service_name);
-    entry->key = key;
-    // TODO: set up upb_sa
-    strncpy(entry->ip, 20, ip);
+    entry->key = o2_heapify(service_name);
+    entry->next = NULL;
+    memset(&entry->udp_sa, 0, sizeof(entry->udp_sa));
+    entry->udp_sa.sin_family = AF_INET;
+    if (inet_pton(AF_INET, ip, &entry->udp_sa.sin_addr) != 1) {
+        O2_FREE(entry->key);
+        O2_FREE(entry);
+        return O2_FAIL;
+    }
+    entry->udp_sa.sin_port = htons(port_num);
+    strcpy(entry->ip, ip);
     entry->port = port_num;
-    
-    // put the entry in the master table
-    // add_entry(&path_tree_table, entry);
+    entry->tcp_socket = INVALID_SOCKET;
+    entry->tcp_flag = tcp_flag;
+    entry->bundle = NULL;
+    entry->bundle_count = 0;
+    entry->bundle_listed = FALSE;
+    if (tcp_flag && osc_tcp_connect(entry)) {
+        O2_FREE(entry->key);
+        O2_FREE(entry);
+        return O2_FAIL;
+    }
+    // put the entry in the top-level table, where it is found by
+    // o2_send_message() and by dispatch of incoming messages
+    add_entry(&path_tree_table, (generic_entry_ptr) entry);
+    // other processes see this as a service offered by this process
+    return o2_announce_service(o2_heapify(service_name));
+}
+
+
+// zeros to pad the OSC address
+static const char osc_pad[4] = { 0, 0, 0, 0 };
+
+// a piece of an outgoing OSC packet, gathered by osc_sendv()
+#ifndef WIN32
+typedef struct iovec osc_iovec;
+#define OSC_IOV_SET(v, base, n) \
+    ((v).iov_base = (void *) (base), (v).iov_len = (n))
+#define OSC_IOV_BASE(v) ((char *) (v).iov_base)
+#define OSC_IOV_LEN(v) ((int) (v).iov_len)
+#else
+typedef WSABUF osc_iovec;
+#define OSC_IOV_SET(v, base, n) ((v).buf = (char *) (base), (v).len = (n))
+#define OSC_IOV_BASE(v) ((v).buf)
+#define OSC_IOV_LEN(v) ((int) (v).len)
+#endif
+
+
+// buffer for SLIP encoding, reused for every packet
+static char *slip_buffer = NULL;
+static int slip_allocated = 0;
+
+// SLIP encode the packet of len bytes in iov[0..n-1] into slip_buffer
+//   with an END before and after it (OSC 1.1). Runs of plain bytes
+//   are found by slip_scan() and copied with memcpy().
+//   Returns the encoded length, or -1 if out of memory.
+//
+static int slip_encode(osc_iovec *iov, int n, int len)
+{
+    int needed = 2 * len + 2; // worst case: every byte is escaped
+    if (needed > slip_allocated) {
+        if (slip_buffer) O2_FREE(slip_buffer);
+        slip_allocated = needed > 1024 ? needed : 1024;
+        slip_buffer = (char *) O2_MALLOC(slip_allocated);
+        if (!slip_buffer) {
+            slip_allocated = 0;
+            return -1;
+        }
+    }
+    char *out = slip_buffer;
+    *out++ = (char) SLIP_END;
+    for (int i = 0; i < n; i++) {
+        const char *p = OSC_IOV_BASE(iov[i]);
+        const char *end = p + OSC_IOV_LEN(iov[i]);
+        while (p < end) {
+            const char *special = slip_scan(p, end);
+            memcpy(out, p, special - p);
+            out += special - p;
+            if (special == end) break;
+            *out++ = (char) SLIP_ESC;
+            *out++ = (char) ((unsigned char) *special == SLIP_END ?
+                             SLIP_ESC_END : SLIP_ESC_ESC);
+            p = special + 1;
+        }
+    }
+    *out++ = (char) SLIP_END;
+    return (int) (out - slip_buffer);
+}
+
+
+// Set iov[0..2] to the pieces of the OSC message in msg: the OSC
+//   address (the O2 address after the service name), its padding,
+//   and the type string with arguments. Returns the OSC message
+//   length, or -1 if there is no OSC address after the service name.
+//
+static int osc_pieces(o2_message_ptr msg, osc_iovec *iov)
+{
+    char *address = msg->data.address;
+    char *osc_address = strchr(address + 1, '/');
+    if (!osc_address) return -1;
+    int o2_addr_len = (int) strlen(address);
+    int osc_addr_len = o2_addr_len - (int) (osc_address - address);
+    int osc_addr_size = (osc_addr_len + 4) & ~3;
+    char *types = address + ((o2_addr_len + 4) & ~3);
+    int types_len = (int) (((char *) &msg->data + msg->length) - types);
+    OSC_IOV_SET(iov[0], osc_address, osc_addr_len);
+    OSC_IOV_SET(iov[1], osc_pad, osc_addr_size - osc_addr_len);
+    OSC_IOV_SET(iov[2], types, types_len);
+    return osc_addr_size + types_len;
+}
+
+
+// Send the OSC packet of len bytes in iov[1..n-1] to the server of
+//   entry. iov[0] is reserved for the length that precedes each
+//   packet over TCP, unless the packet is SLIP encoded.
+//
+static int osc_sendv(osc_entry_ptr entry, osc_iovec *iov, int n, int len)
+{
+    int tcp = entry->tcp_flag;
+    // if the connection failed before, reconnect or drop the packet
+    if (tcp && entry->tcp_socket == INVALID_SOCKET &&
+        osc_tcp_connect(entry)) {
+        return O2_FAIL;
+    }
+    int32_t len_net = htonl(len);
+    if (tcp == O2_OSC_SLIP) { // OSC 1.1: send one SLIP encoded buffer
+        int slip_len = slip_encode(iov + 1, n - 1, len);
+        if (slip_len < 0) return O2_NO_MEMORY;
+        OSC_IOV_SET(iov[0], slip_buffer, slip_len);
+        n = 1;
+    } else if (tcp) { // OSC 1.0: each packet is preceded by its length
+        OSC_IOV_SET(iov[0], &len_net, sizeof(len_net));
+    } else {
+        iov++;
+        n--;
+    }
+#ifndef WIN32
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = n;
+    ssize_t sent;
+    if (tcp) {
+        sent = sendmsg(entry->tcp_socket, &mh, MSG_NOSIGNAL);
+    } else {
+        mh.msg_name = &entry->udp_sa;
+        mh.msg_namelen = sizeof(entry->udp_sa);
+        sent = sendmsg(local_send_sock, &mh, 0);
+    }
+#else
+    DWORD count;
+    long long sent = -1;
+    if ((tcp ? WSASend(entry->tcp_socket, iov, n, &count, 0, NULL, NULL) :
+               WSASendTo(local_send_sock, iov, n, &count, 0,
+                         (struct sockaddr *) &entry->udp_sa,
+                         sizeof(entry->udp_sa), NULL, NULL)) == 0) {
+        sent = count;
+    }
+#endif
+    if (sent < 0) {
+        perror("osc_sendv");
+        if (tcp) { // the server went away: reconnect on the next send
+            closesocket(entry->tcp_socket);
+            entry->tcp_socket = INVALID_SOCKET;
+        }
+        return O2_FAIL;
+    }
     return O2_SUCCESS;
 }
 
+
+/* Send msg to the OSC server of entry now. msg is translated in place:
+ * arguments are converted to network byte order, so msg cannot be
+ * used afterward. msg is not freed.
+ */
+int o2_send_osc_now(osc_entry_ptr entry, o2_message_ptr msg)
+{
+    osc_iovec iov[4];
+    // the OSC message is gathered from the message: there is no copy
+    int len = osc_pieces(msg, iov + 1);
+    if (len < 0) return O2_FAIL; // no OSC address after service
+    if (IS_LITTLE_ENDIAN && o2_msg_swap_endian(msg, FALSE)) {
+        return O2_FAIL;
+    }
+    return osc_sendv(entry, iov, 4, len);
+}
+
+
+// seconds from 1900 (NTP time 0) to 1970 (Unix time 0)
+#define NTP_UNIX_OFFSET 2208988800.0
+
+// the current wall clock time in NTP seconds, as used by OSC timetags
+//
+static double ntp_now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + NTP_UNIX_OFFSET + tv.tv_usec * 1e-6;
+}
+
+
+// Convert global time t to an OSC timetag in network order. OSC
+//   timetags are wall clock times, so t is converted through the
+//   offset from the current global time to the current wall clock.
+//
+static void o2_time_to_timetag(o2_time t, uint32_t *timetag)
+{
+    double ntp = ntp_now() + (t - o2_get_time());
+    uint32_t secs = (uint32_t) ntp;
+    timetag[0] = htonl(secs);
+    timetag[1] = htonl((uint32_t) ((ntp - secs) * 4294967296.0));
+}
+
+
+// Convert an OSC timetag in network order to global time. The
+//   timetag 1 means "immediately" and is converted to 0, as is any
+//   timetag received before clock sync.
+//
+static o2_time timetag_to_o2_time(const uint32_t *timetag)
+{
+    uint32_t secs = ntohl(timetag[0]);
+    uint32_t frac = ntohl(timetag[1]);
+    if ((secs == 0 && frac <= 1) || !o2_gtsched_started) return 0.0;
+    double ntp = secs + frac / 4294967296.0;
+    return o2_get_time() + (ntp - ntp_now());
+}
+
+
+// most messages in one outgoing bundle
+#define OSC_BUNDLE_MAX 64
+
+// entries with timed messages waiting to be sent as a bundle
+static dyn_array osc_bundle_entries;
+
+// Send the timed messages of entry as one OSC bundle and free them.
+//
+static int osc_send_bundle(osc_entry_ptr entry)
+{
+    // the bundle: [length] "#bundle" timetag, then size and 3 pieces
+    // for each message, all gathered from the messages with no copy
+    osc_iovec iov[2 + 4 * OSC_BUNDLE_MAX];
+    int32_t sizes[OSC_BUNDLE_MAX];
+    char header[16] = "#bundle";
+    o2_time_to_timetag(entry->bundle_time, (uint32_t *) (header + 8));
+    OSC_IOV_SET(iov[1], header, sizeof(header));
+    int n = 2;
+    int len = sizeof(header);
+    int count = 0;
+    for (o2_message_ptr msg = entry->bundle; msg; msg = msg->next) {
+        int size = osc_pieces(msg, iov + n + 1);
+        if (IS_LITTLE_ENDIAN && o2_msg_swap_endian(msg, FALSE)) {
+            continue; // malformed message: leave it out
+        }
+        sizes[count] = htonl(size);
+        OSC_IOV_SET(iov[n], &sizes[count], sizeof(int32_t));
+        n += 4;
+        len += 4 + size;
+        count++;
+    }
+    int err = count ? osc_sendv(entry, iov, n, len) : O2_SUCCESS;
+    while (entry->bundle) {
+        o2_message_ptr msg = entry->bundle;
+        entry->bundle = msg->next;
+        o2_free_message(msg);
+    }
+    entry->bundle_len = 0;
+    entry->bundle_count = 0;
+    return err;
+}
+
+
+// Hold msg, which has a future timestamp, to be sent in a bundle with
+//   the other messages for entry with the same timestamp.
+//
+static int osc_add_to_bundle(osc_entry_ptr entry, o2_message_ptr msg)
+{
+    osc_iovec iov[3];
+    int size = osc_pieces(msg, iov);
+    if (size < 0) {
+        o2_free_message(msg);
+        return O2_FAIL;
+    }
+    if (entry->bundle && (entry->bundle_time != msg->data.timestamp ||
+                          entry->bundle_count >= OSC_BUNDLE_MAX ||
+                          entry->bundle_len + 4 + size > OSC_BATCH_BYTES)) {
+        osc_send_bundle(entry); // entry stays in osc_bundle_entries
+    }
+    if (!entry->bundle) {
+        if (!entry->bundle_listed) {
+            DA_APPEND(osc_bundle_entries, osc_entry_ptr, entry);
+            entry->bundle_listed = TRUE;
+        }
+        entry->bundle_time = msg->data.timestamp;
+        entry->bundle_len = 16; // "#bundle" and timetag
+        entry->bundle_tail = &entry->bundle;
+    }
+    msg->next = NULL;
+    *entry->bundle_tail = msg;
+    entry->bundle_tail = &msg->next;
+    entry->bundle_len += 4 + size;
+    entry->bundle_count++;
+    return O2_SUCCESS;
+}
+
+
+void o2_osc_send_bundles()
+{
+    for (int i = 0; i < osc_bundle_entries.length; i++) {
+        osc_entry_ptr entry = *DA_GET(osc_bundle_entries, osc_entry_ptr, i);
+        osc_send_bundle(entry);
+        entry->bundle_listed = FALSE;
+    }
+    osc_bundle_entries.length = 0;
+}
+
+
+void o2_osc_entry_finish(osc_entry_ptr entry)
+{
+    if (entry->bundle_listed) {
+        for (int i = 0; i < osc_bundle_entries.length; i++) {
+            if (*DA_GET(osc_bundle_entries, osc_entry_ptr, i) == entry) {
+                *DA_GET(osc_bundle_entries, osc_entry_ptr, i) =
+                        *DA_LAST(osc_bundle_entries, osc_entry_ptr);
+                osc_bundle_entries.length--;
+                break;
+            }
+        }
+    }
+    while (entry->bundle) {
+        o2_message_ptr msg = entry->bundle;
+        entry->bundle = msg->next;
+        o2_free_message(msg);
+    }
+    if (entry->tcp_socket != INVALID_SOCKET) {
+        closesocket(entry->tcp_socket);
+    }
+}
+
+
+int o2_send_osc(osc_entry_ptr entry, o2_message_ptr msg)
+{
+    if (msg->data.address[0] == '#') { // O2 bundle: forward each message
+        // timed messages share the timestamp of the bundle, so they go
+        // out together in one OSC bundle
+        int err = O2_SUCCESS;
+        int pos = 0;
+        o2_message_ptr element;
+        while ((element = o2_bundle_next(msg, &pos))) {
+            if (o2_send_osc(entry, element)) err = O2_FAIL;
+        }
+        o2_free_message(msg);
+        return err;
+    }
+    if (msg->data.timestamp > 0.0) {
+        if (!o2_gtsched_started) { // cannot convert: drop the message
+            o2_free_message(msg);
+            return O2_FAIL;
+        }
+        if (msg->data.timestamp > o2_global_now) {
+            // sent ahead in a bundle by o2_osc_send_bundles()
+            return osc_add_to_bundle(entry, msg);
+        }
+    }
+    int err = o2_send_osc_now(entry, msg);
+    o2_free_message(msg);
+    return err;
+}
@@ -0,0 +1,64 @@
+//  o2_interoperation.h -- OSC input and output
+//
+//  See o2_interoperation.c for the design.
+
+#ifndef o2_interoperation_h
+#define o2_interoperation_h
+
+/**
+ *  Handler for a UDP port created by o2_create_osc_port(). Receives
+ *  OSC messages and delivers them to the port's service as O2 messages.
+ *
+ *  @return O2_SUCCESS if succeed, O2_FAIL if not.
+ */
+int osc_udp_recv_handler(SOCKET sock, struct fds_info *info);
+
+/**
+ *  Handler for a TCP server socket created by o2_create_osc_port().
+ *  Accepts a connection, which is handled by osc_tcp_recv_handler().
+ *
+ *  @return O2_SUCCESS if succeed, O2_FAIL if not.
+ */
+int osc_tcp_accept_handler(SOCKET sock, struct fds_info *info);
+
+/**
+ *  Handler for an OSC TCP connection. Receives OSC packets, either
+ *  length-prefixed or SLIP encoded, and delivers them to the service
+ *  of the port as O2 messages.
+ *
+ *  @return O2_SUCCESS, or O2_TCP_HUP if the connection should be closed.
+ */
+int osc_tcp_recv_handler(SOCKET sock, struct fds_info *info);
+
+/**
+ *  Send msg to an OSC server now: the timestamp and service name are
+ *  removed and arguments are converted to network byte order in
+ *  place. msg is not freed (find_and_call_handlers() frees it).
+ *
+ *  @return O2_SUCCESS if succeed, O2_FAIL if not.
+ */
+int o2_send_osc_now(osc_entry_ptr entry, o2_message_ptr msg);
+
+/**
+ *  Send msg to an OSC server. A message with a future timestamp is
+ *  held to be sent in a bundle by o2_osc_send_bundles(). Timed
+ *  messages are dropped if the clock is not synchronized. msg is
+ *  freed or held.
+ *
+ *  @return O2_SUCCESS if succeed, O2_FAIL if not.
+ */
+int o2_send_osc(osc_entry_ptr entry, o2_message_ptr msg);
+
+/**
+ *  Send the bundles of timed OSC messages collected by o2_send_osc().
+ *  Called at the end of o2_poll().
+ */
+void o2_osc_send_bundles();
+
+/**
+ *  Free the held messages and close the socket of an osc_entry that
+ *  is being removed.
+ */
+void o2_osc_entry_finish(osc_entry_ptr entry);
+
+#endif /* o2_interoperation_h */
@@ -13,6 +13,8 @@
 #include "o2_internal.h"
 #include "o2_message.h"
 #include "o2_discovery.h"
+#include "o2_shmem.h"
+#include "o2_vector.h"
 
 /// end of message must be zero to prevent strlen from running off the
 /// end of malformed message
@@ -34,6 +36,8 @@ o2_message_ptr alloc_message()
 		message_freelist = message_freelist->next;
 	}
 	msg->length = sizeof(double); // skip over timestamp, point to address
+	msg->flags = 0;
+	msg->refs = NULL;
 	return msg;
 }
 
@@ -43,14 +47,16 @@ o2_message_ptr alloc_message()
     (msg)->length += sizeof(typ)
 
 /// append len bytes of data to msg
-#define MESSAGE_APPEND_DATA(msg, address, len) \
-    memcpy(((char *) &((msg)->data)) + (msg)->length, (address), (len))
+#define MESSAGE_APPEND_DATA(msg, address, len) { \
+    memcpy(((char *) &((msg)->data)) + (msg)->length, (address), (len)); \
+    (msg)->length += (len); }
 
 /// append len bytes of data to msg, and pad with 1 to 4 zeros
 #define MESSAGE_APPEND_PAD_DATA(msg, address, len) { \
     int new_len = ((msg)->length + (len) + 4) & ~3; \
-    *((int32_t *) (((char *) &((msg)->data)) + new_len - 4)) = 0; \
     memcpy(((char *) &((msg)->data)) + (msg)->length, (address), (len)); \
+    memset(((char *) &((msg)->data)) + (msg)->length + (len), 0, \
+           new_len - ((msg)->length + (len))); \
     (msg)->length = new_len; }
 
 /// append 1 byte to msg, and pad with 3 zeros
@@ -61,12 +67,18 @@ o2_message_ptr alloc_message()
 
 /// make sure there is room to add needed bytes
 #define MESSAGE_CHECK_LENGTH(msg, needed)  \
-    if ((msg)->allocated < (msg)->length + (needed)) \
+    if ((msg)->allocated < (int) ((msg)->length + (needed))) \
         (msg) = alloc_bigger_message((msg), (needed))
 
 
 void o2_free_message(o2_message_ptr msg)
 {
+	while (msg->refs) { // release blobs in application memory
+		o2_blob_ref_ptr ref = msg->refs;
+		msg->refs = ref->next;
+		if (ref->release) (*ref->release)(ref->data, ref->user_data);
+		O2_FREE(ref);
+	}
 	if (msg->allocated == MESSAGE_ALLOCATED_FROM_SIZE(MESSAGE_DEFAULT_SIZE)) {
 		msg->next = message_freelist;
 		message_freelist = msg;
@@ -91,6 +103,9 @@ o2_message_ptr alloc_bigger_message(o2_message_ptr msg, int needed)
 	o2_message_ptr newmsg = (o2_message_ptr)o2_malloc(size);
 	newmsg->allocated = new_allocated;
 	newmsg->length = msg->length;
+	newmsg->flags = msg->flags & ~O2_ARG_INDEX; // the index moved
+	newmsg->refs = msg->refs; // offsets do not change
+	msg->refs = NULL;
 	memcpy(&(newmsg->data), &(msg->data), msg->length);
 	MSG_ZERO_END(newmsg, size);
 	o2_free_message(msg);
@@ -105,8 +120,54 @@ o2_message_ptr alloc_size_message(int size)
 		return alloc_message();
 	}
 	else {
-		return (o2_message_ptr)o2_malloc(MESSAGE_SIZE_FROM_ALLOCATED(size));
+		o2_message_ptr msg =
+			(o2_message_ptr)o2_malloc(MESSAGE_SIZE_FROM_ALLOCATED(size));
+		if (!msg) return NULL;
+		// o2_free_message() uses allocated to decide where msg goes
+		msg->allocated = size;
+		MSG_ZERO_END(msg, MESSAGE_SIZE_FROM_ALLOCATED(size));
+		msg->length = sizeof(double);
+		msg->flags = 0;
+		msg->refs = NULL;
+		return msg;
+	}
+}
+
+
+int o2_message_wire_length(o2_message_ptr msg)
+{
+	int length = msg->length;
+	for (o2_blob_ref_ptr ref = msg->refs; ref; ref = ref->next) {
+		length += (ref->size + 3) & ~3;
+	}
+	return length;
+}
+
+
+o2_message_ptr o2_flatten_message(o2_message_ptr msg)
+{
+	if (!msg->refs) return msg;
+	int length = o2_message_wire_length(msg);
+	o2_message_ptr flat = alloc_size_message(length);
+	if (flat) {
+		char *src = (char *) &msg->data;
+		char *dst = (char *) &flat->data;
+		int pos = 0;
+		for (o2_blob_ref_ptr ref = msg->refs; ref; ref = ref->next) {
+			memcpy(dst, src + pos, ref->offset - pos);
+			dst += ref->offset - pos;
+			pos = ref->offset;
+			int realsize = (ref->size + 3) & ~3;
+			if (realsize > 0) *((int32_t *) (dst + realsize - 4)) = 0;
+			memcpy(dst, ref->data, ref->size);
+			dst += realsize;
+		}
+		memcpy(dst, src + pos, msg->length - pos);
+		flat->length = length;
+		flat->flags = msg->flags & ~O2_ARG_INDEX;
 	}
+	o2_free_message(msg); // releases the blobs
+	return flat;
 }
 
 
@@ -115,6 +176,17 @@ int o2_strsize(const char *s)
 	return (strlen(s) + 4) & ~3;
 }
 
+
+int o2_arg_count(const char *types)
+{
+	int n = 0;
+	while (*types) {
+		if (*types++ == O2_VECTOR && *types) types++; // element type
+		n++;
+	}
+	return n;
+}
+
 /*
 size_t o2_arg_size(o2_type type, void *data)
 {
@@ -343,14 +415,251 @@ void o2_arg_swap_endian(o2_type type, void *data)
 }
 
 
+// Convert the arguments of the message with address at address and
+//   ending at end (see o2_msg_swap_endian()).
+//
+static int swap_args(char *address, char *end, int to_host)
+{
+	char *types = address;
+	types += (strnlen(types, end - types) + 4) & ~3;
+	if (types >= end || *types != ',') return O2_FAIL;
+	char *data = types + ((strnlen(types, end - types) + 4) & ~3);
+	for (char *t = types + 1; *t; t++) {
+		switch (*t) {
+		case O2_INT32:
+		case O2_FLOAT:
+		case O2_CHAR: { // swap the whole run of 4-byte arguments
+			int n = 1;
+			while (t[n] == O2_INT32 || t[n] == O2_FLOAT || t[n] == O2_CHAR) {
+				n++;
+			}
+			if (data + 4 * n > end) return O2_FAIL;
+			o2_swap32_array(data, n);
+			data += 4 * n;
+			t += n - 1;
+			break;
+		}
+		case O2_MIDI: // 4 bytes, no swap
+			data += 4;
+			break;
+		case O2_SHMEM: // 4 int32s, then the receiver's address
+			if (data + sizeof(o2_shmem_arg) > end) return O2_FAIL;
+			for (int i = 0; i < 4; i++) {
+				o2_arg_swap_endian(O2_INT32, data + 4 * i);
+			}
+			data += sizeof(o2_shmem_arg);
+			break;
+		case O2_VECTOR: // the elements are swapped in one pass
+			data = o2_vector_swap_endian(data, end, *++t, to_host);
+			if (!data) return O2_FAIL;
+			break;
+		case O2_BLOB: {
+			if (data + 4 > end) return O2_FAIL;
+			// the size tells where the next argument is, so read it
+			// while it is in host order
+			if (to_host) o2_arg_swap_endian(*t, data);
+			int32_t size = ((o2_blob_ptr) data)->size;
+			if (!to_host) o2_arg_swap_endian(*t, data);
+			if (size < 0) return O2_FAIL;
+			data += 4 + ((size + 3) & ~3);
+			break;
+		}
+		case O2_INT64:
+		case O2_TIME:
+		case O2_DOUBLE: { // swap the whole run of 8-byte arguments
+			int n = 1;
+			while (t[n] == O2_INT64 || t[n] == O2_TIME || t[n] == O2_DOUBLE) {
+				n++;
+			}
+			if (data + 8 * n > end) return O2_FAIL;
+			o2_swap64_array(data, n);
+			data += 8 * n;
+			t += n - 1;
+			break;
+		}
+		case O2_STRING:
+		case O2_SYMBOL:
+			if (data >= end) return O2_FAIL;
+			data += (strnlen(data, end - data) + 4) & ~3;
+			break;
+		case O2_TRUE:
+		case O2_FALSE:
+		case O2_NIL:
+		case O2_INFINITUM:
+			break;
+		default:
+			return O2_FAIL;
+		}
+		if (data > end) return O2_FAIL;
+	}
+	return O2_SUCCESS;
+}
+
+
+int o2_msg_swap_endian(o2_message_ptr msg, int to_host)
+{
+	return swap_args(msg->data.address, ((char *) &msg->data) + msg->length,
+		to_host);
+}
+
+
+// Convert the message at data (its timestamp) of length bytes from the
+//   other byte order (see o2_msg_swap_received()). The message is
+//   nested depth bundles deep.
+//
+static int swap_received(char *data, int length, int depth)
+{
+	char *end = data + length;
+	char *address = data + sizeof(double);
+	if (length < (int) sizeof(double) + 4 ||
+		!memchr(address, 0, end - address)) {
+		return O2_FAIL;
+	}
+	// discovery messages give the sender's byte order in an argument,
+	// and their handlers swap what they need
+	if (strncmp(address + 1, "_o2/", 4) == 0) return O2_SUCCESS;
+	o2_swap64_array(data, 1); // the timestamp
+	if (address[0] != '#') return swap_args(address, end, TRUE);
+	// a bundle: element lengths are in network order already. This
+	// runs before o2_msg_validate(), so it limits the depth the same way
+	if (depth >= O2_MAX_BUNDLE_DEPTH) return O2_FAIL;
+	char *pos = address + o2_strsize(address);
+	while (pos + 4 <= end) {
+		int32_t len;
+		memcpy(&len, pos, 4);
+		len = ntohl(len);
+		if (len < 0 || len > end - pos - 4 ||
+			swap_received(pos + 4, len, depth + 1)) {
+			return O2_FAIL;
+		}
+		pos += 4 + len;
+	}
+	return O2_SUCCESS;
+}
+
+
+int o2_msg_swap_received(o2_message_ptr msg)
+{
+	return swap_received((char *) &msg->data, msg->length, 0);
+}
+
+
+// Get the size of the string at data, with padding, or 0 if it does
+//   not end (with its padding) before end.
+//
+static int padded_size(const char *data, const char *end)
+{
+	const char *zero = o2_find_zero(data, end);
+	if (!zero) return 0;
+	int size = (int) (zero - data + 4) & ~3;
+	return size <= end - data ? size : 0;
+}
+
+
+// Get the number of bytes taken by the argument at pos whose type
+//   code is at *t, or -1 if the type is unknown or the size cannot be
+//   found before end. For a vector, *t is advanced to the element type.
+//
+static int arg_size(const char **t, const char *pos, const char *end)
+{
+	int need;
+	switch (**t) {
+	case O2_INT32:
+	case O2_FLOAT:
+	case O2_MIDI:
+	case O2_CHAR:
+		return 4;
+	case O2_INT64:
+	case O2_TIME:
+	case O2_DOUBLE:
+		return 8;
+	case O2_STRING:
+	case O2_SYMBOL:
+		need = padded_size(pos, end);
+		return need ? need : -1;
+	case O2_BLOB: {
+		int32_t blob_size;
+		if (end - pos < 4) return -1;
+		memcpy(&blob_size, pos, 4);
+		if (blob_size < 0 || blob_size > end - pos - 4) return -1;
+		return 4 + ((blob_size + 3) & ~3);
+	}
+	case O2_SHMEM:
+		return sizeof(o2_shmem_arg);
+	case O2_VECTOR: {
+		int elem_size = o2_vector_elem_size(*++*t);
+		int32_t len;
+		if (!elem_size || end - pos < 8) return -1;
+		memcpy(&len, pos, 4);
+		if (len < 0 || len > (end - pos - 8) / elem_size) return -1;
+		return 8 + len * elem_size;
+	}
+	case O2_TRUE:
+	case O2_FALSE:
+	case O2_NIL:
+	case O2_INFINITUM:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+
+// Check the message at data of length bytes (see o2_msg_validate()),
+//   which is nested depth bundles deep.
+//
+static int validate(const char *data, int length, int depth)
+{
+	const char *end = data + length;
+	const char *address = data + sizeof(double);
+	if (length < (int) sizeof(double) + 4) return O2_FAIL;
+	int size = padded_size(address, end);
+	if (!size) return O2_FAIL;
+	const char *pos = address + size;
+	if (address[0] == '#') { // a bundle of messages, each with its length
+		// the depth is limited so that a crafted message cannot
+		// exhaust the stack here or in dispatch
+		if (depth >= O2_MAX_BUNDLE_DEPTH) return O2_FAIL;
+		while (pos + 4 <= end) {
+			int32_t len;
+			memcpy(&len, pos, 4);
+			len = ntohl(len);
+			if (len < 0 || len > end - pos - 4 ||
+				validate(pos + 4, len, depth + 1)) {
+				return O2_FAIL;
+			}
+			pos += 4 + len;
+		}
+		return pos == end ? O2_SUCCESS : O2_FAIL;
+	}
+	if (address[0] != '/' && address[0] != '!') return O2_FAIL;
+	const char *types = pos;
+	if (types >= end || *types != ',' || !(size = padded_size(types, end))) {
+		return O2_FAIL;
+	}
+	pos = types + size;
+	for (const char *t = types + 1; *t; t++) {
+		int need = arg_size(&t, pos, end); // bytes taken by the argument
+		if (need < 0 || need > end - pos) return O2_FAIL;
+		pos += need;
+	}
+	return O2_SUCCESS;
+}
+
+
+int o2_msg_validate(o2_message_ptr msg)
+{
+	return validate((const char *) &msg->data, msg->length, 0);
+}
+
+
 o2_message_ptr o2_build_message(o2_time timestamp, const char *service_name,
 	const char *path, const char *typestring, va_list ap)
 {
-	int ret = 0;
 	int s;
 
 	o2_message_ptr msg = alloc_message();
-	if (!msg) return O2_FAIL;
+	if (!msg) return NULL;
 	msg->data.timestamp = timestamp;
 
 	// special case: if service name is given, prepend it to the path
@@ -453,6 +762,27 @@ o2_message_ptr o2_build_message(o2_time timestamp, const char *service_name,
 			break;
 		}
 
+		case O2_VECTOR: { // length and address of the elements
+			int32_t len = va_arg(ap, int32_t);
+			void *v = va_arg(ap, void *);
+			int32_t typ = *typestring;
+			int size = o2_vector_elem_size(typ) * len;
+			if (!o2_vector_elem_size(typ) || len < 0) {
+				// the arguments after it cannot be found: send nothing
+				fprintf(stderr, "o2 warning: bad vector '%c' or length %d\n",
+					typ, len);
+				o2_free_message(msg);
+				va_end(ap);
+				return NULL;
+			}
+			typestring++; // the element type
+			MESSAGE_CHECK_LENGTH(msg, 8 + size);
+			MESSAGE_APPEND(msg, int32_t, len);
+			MESSAGE_APPEND(msg, int32_t, typ);
+			MESSAGE_APPEND_DATA(msg, v, size);
+			break;
+		}
+
 		case O2_TRUE:
 		case O2_FALSE:
 		case O2_NIL:
@@ -467,13 +797,16 @@ o2_message_ptr o2_build_message(o2_time timestamp, const char *service_name,
 				return 0;
 			}
 
-			// fall through to unknown type
+			// otherwise an unknown type
+			// fall through
 		default: {
-			ret = -1;       // unknown type
+			// the arguments after it cannot be found: send nothing
 			fprintf(stderr,
-				"o2 warning: unknown type '%c'",
+				"o2 warning: unknown type '%c'\n",
 				*(typestring - 1));
-			break;
+			o2_free_message(msg);
+			va_end(ap);
+			return NULL;
 		}
 		}
 	}
@@ -482,7 +815,6 @@ o2_message_ptr o2_build_message(o2_time timestamp, const char *service_name,
 	void *i = va_arg(ap, void *);
 	if (((unsigned long)i & 0xFFFFFFFFUL)
 		!= ((unsigned long)O2_MARKER_A & 0xFFFFFFFFUL)) {
-		ret = -2;               // bad format/args
 		fprintf(stderr,
 			"o2 error: o2_send, o2_message_add, or o2_message_add_varargs called with mismatching types and data at\n exiting.\n");
 		va_end(ap);
@@ -544,11 +876,17 @@ int add_argument(int size, void *data, char typecode)
 	int needed = temp_msg->length + realsize;
 	// expand if there is no room for either types or data
 	if ((temp_msg->allocated < needed) || (temp_type_end >= temp_start)) {
+		int data_len = temp_end - temp_start;
 		int new_allocated = temp_msg->allocated * 2;
-		if (new_allocated < needed) new_allocated = needed + 64;
+		// data goes 1/5 of the way in, so the last 4/5 must hold it
+		int least = ((data_len + realsize) * 5) / 4 + 64;
+		if (new_allocated < least) new_allocated = least;
 		o2_message_ptr newmsg = (o2_message_ptr)
 			O2_MALLOC(MESSAGE_SIZE_FROM_ALLOCATED(new_allocated));
 		newmsg->allocated = new_allocated;
+		newmsg->flags = 0;
+		newmsg->refs = temp_msg->refs; // offsets are from temp_start
+		temp_msg->refs = NULL;
 		// copy typestring
 		memcpy(newmsg->data.address, temp_msg->data.address,
 			temp_type_end - temp_msg->data.address);
@@ -559,8 +897,8 @@ int add_argument(int size, void *data, char typecode)
 		temp_type_end = newmsg->data.address +
 			(temp_type_end - temp_msg->data.address);
 		temp_start = new_start;
-		temp_end = newmsg->data.address +
-			((char *)temp_end - temp_msg->data.address);
+		temp_end = temp_start + data_len;
+		newmsg->length = (temp_start - (char *) &(newmsg->data)) + data_len;
 		// free temp_msg
 		o2_free_message(temp_msg);
 		temp_msg = newmsg;
@@ -610,11 +948,59 @@ int o2_add_blob_data(uint32_t size, void *data)
 	return add_argument(size, data, 'b');
 }
 
+int o2_add_blob_ref(uint32_t size, void *data, o2_release_fn release,
+                    void *user_data)
+{
+	// the size goes in the message as for o2_add_blob_data(); the ref
+	// records where the data belongs, as an offset from temp_start
+	// until add_time_address() knows where the data will end up
+	int count = 0;
+	o2_blob_ref_ptr *last = &temp_msg->refs;
+	while (*last) {
+		last = &(*last)->next;
+		count++;
+	}
+	if (count >= O2_MAX_BLOB_REFS) { // too many: copy this one
+		int rslt = o2_add_blob_data(size, data);
+		if (release) (*release)(data, user_data);
+		return rslt;
+	}
+	o2_blob_ref_ptr ref = (o2_blob_ref_ptr) O2_MALLOC(sizeof(o2_blob_ref));
+	if (!ref) return O2_FAIL;
+	int rslt = add_argument(sizeof(size), &size, 'b');
+	if (rslt != O2_SUCCESS) {
+		O2_FREE(ref);
+		return rslt;
+	}
+	ref->next = NULL;
+	ref->offset = temp_end - temp_start;
+	ref->size = size;
+	ref->data = data;
+	ref->release = release;
+	ref->user_data = user_data;
+	*last = ref;
+	return O2_SUCCESS;
+}
+
 int o2_add_blob(o2_blob *b)
 {
 	return o2_add_blob_data(b->size, b->data);
 }
 
+int o2_add_vector(char element_type, int32_t len, void *data)
+{
+	// like blobs (see o2_add_blob_data()), but the second typecode is
+	// the element type
+	int size = o2_vector_elem_size(element_type);
+	if (size == 0 || len < 0 || len > O2_MAX_MSG_SIZE / size) {
+		return O2_FAIL;
+	}
+	int32_t header[2] = { len, element_type };
+	int rslt = add_argument(sizeof(header), header, O2_VECTOR);
+	if (rslt != O2_SUCCESS) return rslt;
+	return add_argument(len * size, data, element_type);
+}
+
 int o2_add_int64(int64_t i)
 {
 	return add_argument(sizeof(int64_t), &i, 'h');
@@ -717,6 +1103,9 @@ int add_time_address(o2_time time, char *address)
 			o2_malloc(MESSAGE_SIZE_FROM_ALLOCATED(new_allocated));
 		if (!newmsg) return O2_FAIL;
 		newmsg->allocated = new_allocated;
+		newmsg->flags = 0;
+		newmsg->refs = temp_msg->refs;
+		temp_msg->refs = NULL;
 		*((int32_t *)(newmsg->data.address + addrspace - 4)) = 0;
 		memcpy(newmsg->data.address, address, addrlen);
 		*((int32_t *)(newmsg->data.address + addrspace + typespace - 4)) = 0;
@@ -741,6 +1130,12 @@ int add_time_address(o2_time time, char *address)
 			addrspace + typespace + (temp_end - temp_start);
 	}
 	temp_msg->data.timestamp = time;
+	// referenced blob offsets become offsets from &temp_msg->data
+	int data_offset = (temp_msg->data.address + addrspace + typespace) -
+	                  (char *) &(temp_msg->data);
+	for (o2_blob_ref_ptr ref = temp_msg->refs; ref; ref = ref->next) {
+		ref->offset += data_offset;
+	}
 	return O2_SUCCESS;
 }
 
@@ -777,21 +1172,178 @@ int o2_finish_send_cmd(o2_time time, char *address)
 }
 
 
+// the bundle being built by o2_start_bundle() and o2_add_message()
+static o2_message_ptr bundle_msg = NULL;
+
+int o2_start_bundle()
+{
+    if (bundle_msg) o2_free_message(bundle_msg);
+    bundle_msg = alloc_message();
+    return bundle_msg ? O2_SUCCESS : O2_FAIL;
+}
+
+
+int o2_add_message(o2_message_ptr msg)
+{
+    if (!bundle_msg) {
+        o2_free_message(msg);
+        return O2_FAIL;
+    }
+    // the bundle holds a copy of msg, blobs and all (including the
+    // data of shared memory arguments, see o2_shmem.c)
+    if (msg->refs && !(msg = o2_flatten_message(msg))) return O2_FAIL;
+    if (o2_shmem_count > 0 && !(msg = o2_shmem_inline(msg))) return O2_FAIL;
+    // the service of msg: its address up to the first '/' after the
+    // leading '/' or '!'
+    char *service = msg->data.address + 1;
+    char *slash = strchr(service, '/');
+    int service_len = (int) (slash ? (size_t) (slash - service) :
+                                     strlen(service));
+    char *bundle_address = bundle_msg->data.address;
+    if (bundle_msg->length == sizeof(double)) { // first message
+        // the bundle address is "#service"
+        MESSAGE_CHECK_LENGTH(bundle_msg, service_len + 5);
+        MESSAGE_APPEND_PAD_DATA(bundle_msg, service - 1, service_len + 1);
+        bundle_msg->data.address[0] = '#';
+    } else if (strncmp(bundle_address + 1, service, service_len) ||
+               bundle_address[service_len + 1]) {
+        o2_free_message(msg); // all messages must go to one service
+        return O2_FAIL;
+    }
+    bundle_msg = o2_bundle_append(bundle_msg, msg);
+    return O2_SUCCESS;
+}
+
+
+o2_message_ptr o2_bundle_append(o2_message_ptr bundle, o2_message_ptr msg)
+{
+    // append the length (in network order) and the whole message
+    MESSAGE_CHECK_LENGTH(bundle, 4 + msg->length);
+    int32_t len = htonl(msg->length);
+    MESSAGE_APPEND_DATA(bundle, &len, 4);
+    MESSAGE_APPEND_DATA(bundle, &msg->data, msg->length);
+    o2_free_message(msg);
+    return bundle;
+}
+
+
+o2_message_ptr o2_finish_bundle_message(o2_time time)
+{
+    o2_message_ptr msg = bundle_msg;
+    bundle_msg = NULL;
+    if (!msg) return NULL;
+    if (msg->length == sizeof(double)) { // no messages were added
+        o2_free_message(msg);
+        return NULL;
+    }
+    msg->data.timestamp = time;
+    return msg;
+}
+
+
+int o2_finish_bundle(o2_time time)
+{
+    o2_message_ptr msg = o2_finish_bundle_message(time);
+    return msg ? o2_send_message(msg, FALSE) : O2_FAIL;
+}
+
+
+int o2_finish_bundle_cmd(o2_time time)
+{
+    o2_message_ptr msg = o2_finish_bundle_message(time);
+    return msg ? o2_send_message(msg, TRUE) : O2_FAIL;
+}
+
+
+o2_message_ptr o2_bundle_replace(o2_message_ptr bundle, o2_message_ptr msg)
+{
+    char *data = (char *) &bundle->data;
+    int pos = sizeof(double) + o2_strsize(bundle->data.address);
+    while (pos + 4 <= bundle->length) {
+        int32_t len;
+        memcpy(&len, data + pos, 4);
+        len = ntohl(len);
+        char *element = data + pos + 4;
+        double timestamp;
+        memcpy(&timestamp, element, sizeof(double));
+        // a message for another time is not an older value of msg
+        if (timestamp == msg->data.timestamp &&
+            streql(element + sizeof(double), msg->data.address)) {
+            // the old message will not be sent (see o2_shmem.c)
+            o2_shmem_detach_data(element, len);
+            // resize the space of the old message, then overwrite it
+            int delta = msg->length - len;
+            if (delta > 0) {
+                MESSAGE_CHECK_LENGTH(bundle, delta);
+                data = (char *) &bundle->data;
+                element = data + pos + 4;
+            }
+            memmove(element + msg->length, element + len,
+                    bundle->length - (pos + 4 + len));
+            bundle->length += delta;
+            len = htonl(msg->length);
+            memcpy(data + pos, &len, 4);
+            memcpy(element, &msg->data, msg->length);
+            o2_free_message(msg);
+            return bundle;
+        }
+        pos += 4 + len;
+    }
+    return o2_bundle_append(bundle, msg);
+}
+
+
+o2_message_ptr o2_bundle_next(o2_message_ptr bundle, int *pos)
+{
+    char *data = (char *) &bundle->data;
+    if (*pos == 0) { // skip the timestamp and "#service"
+        *pos = sizeof(double) + o2_strsize(bundle->data.address);
+    }
+    int32_t len;
+    if (*pos + 4 > bundle->length) return NULL;
+    memcpy(&len, data + *pos, 4);
+    len = ntohl(len);
+    // an element has at least a timestamp and an address
+    if (len < (int32_t) sizeof(double) + 4 ||
+        len > bundle->length - *pos - 4) {
+        return NULL;
+    }
+    o2_message_ptr msg = alloc_size_message(len);
+    if (!msg) return NULL;
+    memcpy(&msg->data, data + *pos + 4, len);
+    msg->length = len;
+    // messages coalesced by o2_coalesce_messages() are in a bundle
+    // with no service ("#") and keep their own timestamps
+    if (bundle->data.address[1]) {
+        msg->data.timestamp = bundle->data.timestamp;
+    }
+    *pos += 4 + len;
+    return msg;
+}
+
+
 /// get ready to extract args with o2_get_next
 /// returns number of arguments in message
 //
 int o2_start_extract(o2_message_ptr msg)
+{
+	// point to the first type code byte: skip over padding and ','
+	return o2_start_extract_types(msg, WORD_ALIGN_PTR(msg->data.address +
+		strlen(msg->data.address) + 4) + 1);
+}
+
+
+int o2_start_extract_types(o2_message_ptr msg, const char *types)
 {
 	temp_msg = msg;
-	// point temp_type_end to the first type code byte.
-	// skip over padding and ','
-	temp_type_end = WORD_ALIGN_PTR(msg->data.address +
-		strlen(msg->data.address) + 4) + 1;
+	temp_type_end = (char *) types;
 	// point temp_end to the first argument in message
 	int n_args = strlen(temp_type_end);
 	temp_end = WORD_ALIGN_PTR(temp_type_end + n_args + 4);
 	temp_barrier = WORD_ALIGN_PTR(((char *)& (msg->data)) + msg->length);
-	return n_args;
+	// vectors converted since the last extraction are no longer used
+	o2_free_coerced_vectors(o2_take_coerced_vectors());
+	return o2_arg_count(temp_type_end);
 }
 
 
@@ -896,7 +1448,9 @@ o2_arg_ptr o2_get_next(char type_code)
         if (type_code != O2_BLOB) {
             rslt = NULL; // type mismatch
         }
-        temp_end += sizeof(uint32_t) + rslt->b.size;
+        // blob data is padded to a multiple of 4 bytes
+        temp_end += sizeof(uint32_t) +
+                    ((((o2_blob_ptr) temp_end)->size + 3) & ~3);
         break;
       case O2_INT64:
         if (type_code != O2_INT64) {
@@ -917,6 +1471,28 @@ o2_arg_ptr o2_get_next(char type_code)
         }
         temp_end += 4;
         break;
+      case O2_SHMEM:
+        if (type_code != O2_SHMEM) {
+            rslt = NULL; // type mismatch
+        }
+        temp_end += sizeof(o2_shmem_arg);
+        break;
+      case O2_VECTOR: {
+        // the element type follows 'v' in the type string
+        o2_vector_ptr v = (o2_vector_ptr) temp_end;
+        int size = o2_vector_elem_size(*temp_type_end);
+        if (!size || temp_end + 8 > temp_barrier || v->len < 0 ||
+            v->len > (temp_barrier - temp_end - 8) / size ||
+            v->typ != *temp_type_end++) {
+            temp_end = temp_barrier; // malformed
+            return NULL;
+        }
+        if (type_code != O2_VECTOR) {
+            rslt = NULL; // type mismatch (see o2_get_next_vector())
+        }
+        temp_end += 8 + v->len * size;
+        break;
+      }
       case O2_TRUE:
         rslt = convert_int(type_code, 1);
         break;
@@ -939,6 +1515,79 @@ o2_arg_ptr o2_get_next(char type_code)
 }
 
 
+o2_arg_ptr o2_get_next_vector(char element_type)
+{
+    int vector = (temp_type_end < temp_barrier &&
+                  *temp_type_end == O2_VECTOR);
+    o2_arg_ptr rslt = o2_get_next(O2_VECTOR);
+    if (!vector || !rslt || rslt->v.typ == element_type) return rslt;
+    return o2_vector_coerce(&rslt->v, element_type);
+}
+
+
+/// where o2_get_arg() keeps the argument count of msg followed by the
+/// offset of each argument from msg->data: in the unused space after
+/// the data (the same place call_handler() puts argv)
+#define ARG_INDEX(msg) ((int32_t *) WORD_ALIGN_PTR(((char *) (msg)) + \
+        MESSAGE_SIZE_FROM_ALLOCATED((msg)->length)))
+
+// Find the offsets of the arguments of msg from msg->data, stopping
+//   after argument last. If all, offsets gets every offset, otherwise
+//   offsets[0] gets the offset of the last argument found. Returns
+//   the number of arguments found, or -1 if msg is malformed.
+//
+static int find_args(o2_message_ptr msg, int32_t *offsets, int last,
+                     int all)
+{
+    const char *data = (const char *) &msg->data;
+    const char *end = data + msg->length;
+    const char *address = msg->data.address;
+    int size = padded_size(address, end);
+    if (!size) return -1;
+    const char *types = address + size;
+    if (types >= end || *types != ',' || !(size = padded_size(types, end))) {
+        return -1;
+    }
+    const char *pos = types + size;
+    int n = 0;
+    for (const char *t = types + 1; *t && n <= last; t++) {
+        int need = arg_size(&t, pos, end);
+        if (need < 0 || need > end - pos) return -1;
+        offsets[all ? n : 0] = (int32_t) (pos - data);
+        pos += need;
+        n++;
+    }
+    return n;
+}
+
+
+o2_arg_ptr o2_get_arg(o2_message_ptr msg, int i)
+{
+    if (i < 0) return NULL;
+    int32_t *index = ARG_INDEX(msg);
+    if (!(msg->flags & O2_ARG_INDEX)) {
+        // the index must fit before the 4 zero bytes at the end of
+        // msg, and not overwrite argv from call_handler()
+        int room = (msg->allocated - msg->length) / 4 - 2;
+        const char *address = msg->data.address;
+        int argc = o2_arg_count(WORD_ALIGN_PTR(address +
+                                               strlen(address) + 4) + 1);
+        if (argc > room || (msg->flags & O2_ARGV_SLACK)) {
+            // no room to keep the offsets, so find argument i each time
+            int32_t offset;
+            if (find_args(msg, &offset, i, FALSE) != i + 1) return NULL;
+            return (o2_arg_ptr) (((char *) &msg->data) + offset);
+        }
+        if ((index[0] = find_args(msg, index + 1, argc, TRUE)) < 0) {
+            return NULL;
+        }
+        msg->flags |= O2_ARG_INDEX;
+    }
+    if (i >= index[0]) return NULL;
+    return (o2_arg_ptr) (((char *) &msg->data) + index[i + 1]);
+}
+
+
 void o2_print_msg(o2_message_ptr msg)
 {
     int i;
@@ -950,6 +1599,16 @@ void o2_print_msg(o2_message_ptr msg)
             printf("(%gs late)", o2_global_now - msg->data.timestamp);
         }
     }
+    if (msg->data.address[0] == '#') { // bundle: print each message
+        int pos = 0;
+        o2_message_ptr element;
+        while ((element = o2_bundle_next(msg, &pos))) {
+            printf("\n    ");
+            o2_print_msg(element);
+            o2_free_message(element);
+        }
+        return;
+    }
     o2_start_extract(msg);
     char *types = temp_type_end;
     while (*types) {
@@ -969,7 +1628,7 @@ void o2_print_msg(o2_message_ptr msg)
             if (arg->b.size > 12) {
                 printf("%d byte blob", arg->b.size);
             } else {
-                for (i = 0; i < arg->b.size; i++) {
+                for (i = 0; i < (int) arg->b.size; i++) {
                     if (i > 0) printf(" ");
                     printf("%#02x", *((unsigned char *)(arg->b.data)+4 + i));
                 }
@@ -977,7 +1636,7 @@ void o2_print_msg(o2_message_ptr msg)
             }
             break;
           case O2_INT64:
-            printf(" %lld", arg->i64);
+            printf(" %lld", (long long) arg->i64);
             break;
           case O2_TIME:
             printf(" %g", arg->d);
@@ -999,6 +1658,28 @@ void o2_print_msg(o2_message_ptr msg)
             }
             printf("]");
             break;
+          case O2_SHMEM:
+            printf(" [%d bytes of shared memory %d:%d]", arg->H.size,
+                   arg->H.owner, arg->H.segment);
+            break;
+          case O2_VECTOR:
+            types++; // skip the element type
+            if (!arg) break;
+            printf(" <");
+            for (i = 0; i < arg->v.len && i < 8; i++) {
+                if (i > 0) printf(" ");
+                switch (arg->v.typ) {
+                  case O2_INT32: printf("%d", arg->v.vi[i]); break;
+                  case O2_INT64:
+                    printf("%lld", (long long) arg->v.vh[i]);
+                    break;
+                  case O2_FLOAT: printf("%f", arg->v.vf[i]); break;
+                  case O2_DOUBLE: printf("%g", arg->v.vd[i]); break;
+                }
+            }
+            if (arg->v.len > 8) printf(" ... (%d elements)", arg->v.len);
+            printf(">");
+            break;
           case O2_TRUE:
             printf(" #T");
             break;
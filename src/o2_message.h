@@ -13,6 +13,21 @@ extern o2_message_ptr message_freelist;
 
 #define MAX_SERVICE_LEN 64
 
+/// most blobs a message may refer to (see o2_add_blob_ref())
+#define O2_MAX_BLOB_REFS 8
+
+/// a blob of a message that is not in the message data. The blob
+/// size is in the data as usual, but the blob bytes (and padding)
+/// belong at offset from &msg->data. Refs are in order of offset.
+typedef struct o2_blob_ref {
+    struct o2_blob_ref *next;
+    int offset;
+    uint32_t size;
+    void *data;
+    o2_release_fn release;
+    void *user_data;
+} o2_blob_ref, *o2_blob_ref_ptr;
+
 #ifdef WIN32
 #define ssize_t long long
 #endif
@@ -26,6 +41,10 @@ o2_message_ptr alloc_size_message(int size);
 /** used by CHECK_MESSAGE_LENGTH to expand message */
 o2_message_ptr alloc_bigger_message(o2_message_ptr msg, int needed);
 
+/** append an argument of size bytes at data to the message being built
+ *  by o2_start_send(), with type code typecode */
+int add_argument(int size, void *data, char typecode);
+
 o2_message_ptr o2_build_message(o2_time timestamp, const char *service_name,
                        const char *path, const char *typestring, va_list ap);
 
@@ -50,8 +69,123 @@ int o2_recv();
  */
 /*void o2_arg_swap_endian(o2_type type, void *data);*/
 
+/**
+ *  Convert endianness of all arguments of msg in place, following its
+ *  type string. Used for OSC, which is always big-endian.
+ *
+ *  @param msg     The message.
+ *  @param to_host TRUE to convert from network to host order, FALSE
+ *                 for host to network order (this matters for blob
+ *                 sizes, which are needed to find the next argument).
+ *
+ *  @return O2_SUCCESS if succeed, O2_FAIL if the message is malformed.
+ */
+int o2_msg_swap_endian(o2_message_ptr msg, int to_host);
+
+/// flag for o2_message: the message came from a host with the other
+/// byte order, and must be converted by o2_msg_swap_received() (this
+/// flag is never transmitted)
+#define O2_SWAP 256
+
+/// flag for o2_message: the message is in the compact encoding (see
+/// o2_compact.c), which is marked in its length when it is sent over
+/// TCP
+#define O2_COMPACT 512
+
+/// flag for o2_message: the offsets of its arguments are after its
+/// data (see o2_get_arg())
+#define O2_ARG_INDEX 1024
+
+/// flag for o2_message: call_handler() put argv after its data, so
+/// o2_get_arg() cannot keep offsets there
+#define O2_ARGV_SLACK 2048
+
+/**
+ *  Convert the timestamp and arguments of msg, which came from a host
+ *  with the other byte order, in place. The elements of bundles are
+ *  converted too. Messages to the _o2 service are not converted
+ *  because they give the sender's byte order as an argument.
+ *
+ *  @return O2_SUCCESS, or O2_FAIL if the message is malformed.
+ */
+int o2_msg_swap_received(o2_message_ptr msg);
+
+/**
+ *  Check that msg, which came from another process or from OSC, can
+ *  be dispatched safely: the address and type string end within
+ *  msg->length, and so does every argument the type string names
+ *  (strings must end with their padding, and blob sizes and vector
+ *  lengths must fit). Each element of a bundle is checked, and
+ *  bundles may be nested at most O2_MAX_BUNDLE_DEPTH deep. Called for
+ *  every message received, in host order.
+ *
+ *  @return O2_SUCCESS, or O2_FAIL if msg is malformed.
+ */
+int o2_msg_validate(o2_message_ptr msg);
+
+/**
+ *  Check the structure of an OSC bundle: "#bundle", a timetag, and
+ *  elements that each start with their size.
+ *
+ *  @return size if the bundle is valid, otherwise a negative error code.
+ */
+ssize_t o2_validate_bundle(void *data, ssize_t size);
+
+/**
+ *  Append msg to bundle, which may be moved to make room. msg is freed.
+ *
+ *  @return the bundle.
+ */
+o2_message_ptr o2_bundle_append(o2_message_ptr bundle, o2_message_ptr msg);
+
+/**
+ *  Like o2_bundle_append(), but if the bundle has a message with the
+ *  address and timestamp of msg, msg replaces it in place (see
+ *  #O2_LATEST).
+ *
+ *  @return the bundle.
+ */
+o2_message_ptr o2_bundle_replace(o2_message_ptr bundle, o2_message_ptr msg);
+
+/**
+ *  Get the next message in a bundle (see o2_start_bundle()). This
+ *  also unpacks messages coalesced by o2_coalesce_messages(), which
+ *  are sent as a bundle addressed to "#" and keep their timestamps.
+ *
+ *  @param bundle The bundle.
+ *  @param pos    Where the next message starts: set *pos to 0 before
+ *                the first call.
+ *
+ *  @return a copy of the message with the timestamp of the bundle
+ *          (except for coalesced messages), which the caller must free, or NULL after the last message
+ *          or if the bundle is malformed.
+ */
+o2_message_ptr o2_bundle_next(o2_message_ptr bundle, int *pos);
+
 int o2_strsize(const char *s);
 
+/**
+ *  Count the arguments described by types (without the ','). A vector
+ *  is one argument with two type codes.
+ */
+int o2_arg_count(const char *types);
+
+/**
+ *  The length of msg as sent, including blobs that msg refers to (see
+ *  o2_add_blob_ref()). This is msg->length if msg->refs is NULL.
+ */
+int o2_message_wire_length(o2_message_ptr msg);
+
+/**
+ *  Replace msg by a message that holds its referenced blobs in the
+ *  data, like any other message. msg is freed (releasing the blobs).
+ *  Returns msg itself if msg->refs is NULL.
+ *
+ *  @return the message, or NULL if memory cannot be allocated, in
+ *          which case msg is freed.
+ */
+o2_message_ptr o2_flatten_message(o2_message_ptr msg);
+
 /**
  * Print an O2 message to stdout
  *
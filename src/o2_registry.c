@@ -0,0 +1,266 @@
+//  o2_registry.c -- host-local discovery registry
+//
+//  agent, 2026
+//
+/* Design notes:
+ *    Discovery between processes on one host used to rely on each
+ * process grabbing one of PORT_MAX UDP ports from o2_port_map, with
+ * every process sending to all of them on localhost. The sixth
+ * process on a host found no free port and could not be discovered.
+ *
+ *    The registry is a directory, o2_registry_path/o2-<application>,
+ * holding one Unix domain datagram socket per process, named by the
+ * process name (IP:PORT). When a process starts, it binds its socket
+ * and then sends its discovery message (!_o2/dy) to every socket
+ * already in the directory. Because a process binds before it scans
+ * the directory, of any two processes starting at the same time, at
+ * least one sees the other. Arriving discovery messages go through
+ * the normal udp_recv_handler() and o2_discovery_handler(), so the
+ * registry only replaces the transport, not the protocol. There is
+ * no limit on the number of processes and no port probing.
+ *
+ *    Sockets left behind by processes that exit without calling
+ * o2_finish() are detected when a send fails with ECONNREFUSED and
+ * are removed. The directory is shared by all users, so like /tmp it
+ * is sticky (01777): anyone can add a socket, but only its owner can
+ * remove it. A stale socket of another user stays until that user's
+ * next process with the same name replaces it; sending to it fails
+ * at once and costs one system call per tick.
+ *
+ *    The directory is not read on every discovery tick. The names in
+ * it are kept in registry_names and read again after REGISTRY_RESCAN
+ * seconds or after a send fails. A new process reads the directory
+ * when it first announces itself, so the processes already there
+ * learn about it from its discovery message, not from their lists.
+ * Processes that are already in path_tree_table are skipped, since
+ * o2_discovery_handler() ignores discovery messages from known
+ * processes, so a host with N processes does not send N^2 discovery
+ * messages per tick once they have found each other.
+ *
+ *    The directory is polled rather than watched (inotify on Linux,
+ * kqueue on macOS). Watching would only tell us sooner about new
+ * processes, but a new process announces itself to every socket it
+ * finds when it starts, so the processes already here never need to
+ * find it in the directory. The cached names matter only for
+ * processes that have not yet answered, and re-reading them every
+ * REGISTRY_RESCAN seconds is cheap, portable, and adds no socket to
+ * o2_fds.
+ *
+ *    Windows has no usable AF_UNIX datagram sockets, so there the
+ * registry is never active and discovery uses UDP ports only.
+ */
+
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+#include "o2_discovery.h"
+#include "o2_registry.h"
+
+char *o2_registry_path = "/tmp";
+int o2_registry_active = FALSE;
+
+#ifndef WIN32
+
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <ctype.h>
+
+#define REGISTRY_RESCAN 10.0 // seconds between reads of registry_dir
+
+static char registry_dir[96]; // e.g. /tmp/o2-myapp
+static struct sockaddr_un registry_addr; // our own socket address
+static SOCKET registry_send_sock = INVALID_SOCKET;
+static dyn_array registry_names; // other processes' names (char *,
+                                 // padded as keys for lookup())
+static double registry_scan_time = -1; // when registry_names was read
+static int registry_stale = TRUE; // read registry_names again
+
+
+// registry messages are handled exactly like UDP discovery messages
+static int registry_recv_handler(SOCKET sock, struct fds_info *info)
+{
+    return udp_recv_handler(sock, info);
+}
+
+
+// fill in addr with the socket path for process name,
+// return O2_FAIL if the path does not fit in sun_path
+static int registry_sockaddr(struct sockaddr_un *addr, const char *name)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    int len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s",
+                       registry_dir, name);
+    return (len < (int) sizeof(addr->sun_path) ? O2_SUCCESS : O2_FAIL);
+}
+
+
+// send msg to the registry socket at addr. Returns O2_FAIL if there
+// is no live process behind addr, in which case a stale socket file
+// is removed if we may. registry_stale is set if the directory has
+// changed.
+static int registry_sendto(struct sockaddr_un *addr, o2_message_ptr msg)
+{
+    if (sendto(registry_send_sock, &msg->data, msg->length, MSG_DONTWAIT,
+               (struct sockaddr *) addr, sizeof(struct sockaddr_un)) < 0) {
+        if (errno == ECONNREFUSED) { // process is gone, socket is stale
+            // fails (EPERM) if another user owns the socket
+            if (unlink(addr->sun_path) == 0) registry_stale = TRUE;
+        } else if (errno == ENOENT) { // removed by someone else
+            registry_stale = TRUE;
+        } else if (errno != EAGAIN) {
+            perror("Error attempting to send to local registry");
+        }
+        return O2_FAIL;
+    }
+    o2_discovery_sent++;
+    return O2_SUCCESS;
+}
+
+
+int o2_registry_init()
+{
+    // one directory per application so that applications never see
+    // each other's discovery messages. Names with '/' are flattened.
+    int len = snprintf(registry_dir, sizeof(registry_dir), "%s/o2-%s",
+                       o2_registry_path, o2_application_name);
+    if (len >= (int) sizeof(registry_dir)) return O2_FAIL;
+    for (char *p = registry_dir + strlen(o2_registry_path) + 1; *p; p++) {
+        if (*p == '/') *p = '_';
+    }
+    // the directory is shared by all users' processes of the
+    // application; sticky, so users cannot remove each other's sockets
+    if (mkdir(registry_dir, 01777) && errno != EEXIST) {
+        perror("Create local registry directory");
+        return O2_FAIL;
+    }
+    chmod(registry_dir, 01777); // mkdir is subject to umask
+    if (registry_sockaddr(&registry_addr, o2_process.name)) return O2_FAIL;
+
+    SOCKET sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sock == INVALID_SOCKET) {
+        perror("Create local registry socket");
+        return O2_FAIL;
+    }
+    unlink(registry_addr.sun_path); // a previous process had our name
+    if (bind(sock, (struct sockaddr *) &registry_addr,
+             sizeof(registry_addr))) {
+        perror("Bind local registry socket");
+        closesocket(sock);
+        return O2_FAIL;
+    }
+    if ((registry_send_sock = socket(AF_UNIX, SOCK_DGRAM, 0)) ==
+        INVALID_SOCKET) {
+        perror("Create local registry send socket");
+        closesocket(sock);
+        unlink(registry_addr.sun_path);
+        return O2_FAIL;
+    }
+    add_new_socket(sock, REGISTRY_SOCKET, &o2_process,
+                   &registry_recv_handler);
+    DA_INIT(registry_names, char *, 4);
+    registry_stale = TRUE;
+    o2_registry_active = TRUE;
+    O2_DB(printf("O2: registered in local registry %s\n", registry_dir));
+    return O2_SUCCESS;
+}
+
+
+static void free_registry_names()
+{
+    for (int i = 0; i < registry_names.length; i++) {
+        O2_FREE(*DA_GET(registry_names, char *, i));
+    }
+    registry_names.length = 0;
+}
+
+
+// read the names of the other processes in registry_dir
+static void scan_registry()
+{
+    free_registry_names();
+    registry_scan_time = o2_local_now;
+    registry_stale = FALSE;
+    DIR *dir = opendir(registry_dir);
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        // process names begin with a digit; skip ".", ".." and ourself
+        if (isdigit(entry->d_name[0]) &&
+            !streql(entry->d_name, o2_process.name)) {
+            char *name = o2_heapify(entry->d_name);
+            DA_APPEND(registry_names, char *, name);
+        }
+    }
+    closedir(dir);
+}
+
+
+void o2_registry_announce(o2_message_ptr msg)
+{
+    if (!o2_registry_active) return;
+    if (registry_stale || o2_local_now - registry_scan_time >=
+                          REGISTRY_RESCAN) {
+        scan_registry();
+    }
+    struct sockaddr_un addr;
+    for (int i = 0; i < registry_names.length; i++) {
+        char *name = *DA_GET(registry_names, char *, i);
+        int index;
+        // a known process would ignore the message
+        if (lookup(&path_tree_table, name, &index) ||
+            registry_sockaddr(&addr, name)) {
+            continue;
+        }
+        registry_sendto(&addr, msg);
+    }
+}
+
+
+int o2_registry_send(const char *name, o2_message_ptr msg)
+{
+    struct sockaddr_un addr;
+    if (!o2_registry_active || registry_sockaddr(&addr, name)) {
+        return O2_FAIL;
+    }
+    return registry_sendto(&addr, msg);
+}
+
+
+void o2_registry_finish()
+{
+    if (!o2_registry_active) return;
+    // our socket in o2_fds is closed by o2_finish(); remove its file
+    unlink(registry_addr.sun_path);
+    closesocket(registry_send_sock);
+    registry_send_sock = INVALID_SOCKET;
+    free_registry_names();
+    DA_FINISH(registry_names);
+    o2_registry_active = FALSE;
+}
+
+#else // WIN32: no registry, discovery uses UDP ports only
+
+int o2_registry_init()
+{
+    return O2_FAIL;
+}
+
+void o2_registry_announce(o2_message_ptr msg)
+{
+}
+
+int o2_registry_send(const char *name, o2_message_ptr msg)
+{
+    return O2_FAIL;
+}
+
+void o2_registry_finish()
+{
+}
+
+#endif
@@ -0,0 +1,40 @@
+//  o2_registry.h -- host-local discovery registry
+//
+//  Processes on the same host find each other through a directory of
+//  Unix domain datagram sockets rather than by probing the PORT_MAX
+//  discovery ports. See o2_registry.c for details.
+
+#ifndef o2_registry_h
+#define o2_registry_h
+
+/// directory in which per-application registries are created,
+/// "/tmp" unless set before o2_initialize()
+extern char *o2_registry_path;
+
+/// TRUE if this process has a socket in the local registry
+extern int o2_registry_active;
+
+/**
+ *  Create this process's socket in the registry. Called once the
+ *  TCP port (and hence the process name) is known. Other processes
+ *  learn about us from o2_registry_announce().
+ *
+ *  @return O2_SUCCESS, or O2_FAIL if the registry is not available,
+ *          in which case discovery falls back to UDP ports only.
+ */
+int o2_registry_init();
+
+/// send msg to every other process in the registry
+void o2_registry_announce(o2_message_ptr msg);
+
+/**
+ *  Send msg to the registered process with the given name
+ *  ("ip:port"). Returns O2_FAIL if the process is not registered
+ *  on this host.
+ */
+int o2_registry_send(const char *name, o2_message_ptr msg);
+
+/// remove this process from the registry
+void o2_registry_finish();
+
+#endif /* o2_registry_h */
@@ -0,0 +1,400 @@
+//  o2_rudp.c -- reliable UDP
+//
+//  agent, 2026
+//
+/* Design notes:
+ *    o2_send() uses UDP: messages may be lost or arrive out of order.
+ * o2_send_cmd() uses TCP: a lost packet holds up everything behind it
+ * until it is retransmitted, and send() can block. Messages sent with
+ * o2_send_reliable() (marked O2_RELIABLE) take a third path: a
+ * sequenced UDP channel to the remote process, which the receiver
+ * repairs by asking for lost packets.
+ *
+ *    Every packet of a channel is a message addressed to "&" (padded),
+ * followed by the name of the sending process (a padded string), a
+ * sequence number and a packet kind (int32s in network order), and
+ * then the data of the packet:
+ *    RUDP_DATA      - data is a message, deliver it in sequence order
+ *    RUDP_UNORDERED - data is a message, deliver it as soon as it arrives
+ *    RUDP_HEARTBEAT - no data; seq is the sender's next sequence number
+ *    RUDP_SKIP      - no data; packets before seq cannot be resent
+ *    RUDP_NACK      - data is a count: please resend count packets from
+ *                     seq. Sent by the receiver of the channel.
+ * The name lets the receiver find the process_info of the sender, since
+ * UDP messages are not sent from the port that the sender receives on.
+ *
+ *    The sender keeps the last RUDP_WINDOW packets in sent, indexed by
+ * sequence number. After its last packet, it sends a few heartbeats
+ * so that the receiver notices when the last packets are lost.
+ *
+ *    The receiver delivers packets in order. A packet that arrives
+ * early waits in held, and the receiver sends NACKs for the missing
+ * ones at the next o2_poll() and then every RUDP_NACK_INTERVAL. After
+ * RUDP_MAX_NACKS without progress, or when a packet arrives that is
+ * RUDP_WINDOW or more ahead, it gives up on the missing packets and
+ * delivers what it has.
+ * RUDP_UNORDERED packets are delivered on arrival; they are still
+ * tracked, so that lost ones are resent and duplicates dropped.
+ *
+ *    Channel state is allocated on the first packet to or from a
+ * process and freed when the process is removed. Messages to deliver
+ * are collected before any handler runs, so a handler that removes
+ * the process (and its channel) does no harm.
+ */
+
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+#include "o2_send.h"
+#include "o2_rudp.h"
+
+#define RUDP_WINDOW 512          // packets kept for retransmission, and
+                                 //   how far ahead a receiver holds packets
+#define RUDP_NACK_INTERVAL 0.01  // seconds between NACKs for a gap, and
+                                 //   between heartbeats
+#define RUDP_MAX_NACKS 10        // NACKs before giving up on a gap
+#define RUDP_NACK_RUNS 8         // most NACK packets sent at a time
+#define RUDP_HEARTBEATS 3        // heartbeats after the last packet
+
+// packet kinds
+#define RUDP_DATA 0
+#define RUDP_UNORDERED 1
+#define RUDP_HEARTBEAT 2
+#define RUDP_SKIP 3
+#define RUDP_NACK 4
+
+// how far sequence number a is after b (negative if before)
+#define SEQ_DIFF(a, b) ((int32_t) ((uint32_t) (a) - (uint32_t) (b)))
+
+typedef struct rudp_channel {
+    // sending
+    uint32_t seq_out;     // sequence number of the next packet
+    o2_message_ptr sent[RUDP_WINDOW]; // recent packets by seq % RUDP_WINDOW
+    o2_time sent_time;    // local time of the last packet
+    int heartbeats;       // heartbeats sent since the last packet
+    // receiving
+    uint32_t seq_in;      // sequence number of the next packet to deliver
+    uint32_t seq_end;     // one past the highest sequence number known
+    o2_message_ptr held[RUDP_WINDOW]; // early packets by seq % RUDP_WINDOW
+    char got[RUDP_WINDOW]; // TRUE if the packet has arrived
+    o2_time nack_time;    // local time of the last NACK or progress
+    int nacks;            // NACKs sent without progress
+} rudp_channel, *rudp_channel_ptr;
+
+// processes with channel state
+static dyn_array rudp_procs;
+
+
+static rudp_channel_ptr get_channel(process_info_ptr proc)
+{
+    if (!proc->rudp) {
+        proc->rudp = (rudp_channel_ptr) O2_CALLOC(1, sizeof(rudp_channel));
+        if (!proc->rudp) return NULL;
+        if (!rudp_procs.allocated) {
+            DA_INIT(rudp_procs, process_info_ptr, 4);
+        }
+        DA_APPEND(rudp_procs, process_info_ptr, proc);
+    }
+    return proc->rudp;
+}
+
+
+// Make a packet of the given kind with len bytes of data.
+//
+static o2_message_ptr make_packet(int kind, uint32_t seq, void *data, int len)
+{
+    int header = O2_WRAP_HEADER_SIZE;
+    o2_message_ptr packet = alloc_size_message(header + len);
+    if (!packet) return NULL;
+    char *p = o2_wrap_header(packet, '&', seq, kind);
+    if (len) memcpy(p, data, len);
+    packet->length = header + len;
+    return packet;
+}
+
+
+// Send packet to proc. packet is not freed.
+//
+static int send_packet(process_info_ptr proc, o2_message_ptr packet)
+{
+    return o2_send_udp(proc, packet);
+}
+
+
+// Send a packet with no data to proc.
+//
+static void send_control(process_info_ptr proc, int kind, uint32_t seq)
+{
+    o2_message_ptr packet = make_packet(kind, seq, NULL, 0);
+    if (!packet) return;
+    send_packet(proc, packet);
+    o2_free_message(packet);
+}
+
+
+int o2_rudp_send(process_info_ptr proc, o2_message_ptr msg)
+{
+    rudp_channel_ptr ch = get_channel(proc);
+    o2_message_ptr packet = NULL;
+    if (ch) {
+        packet = make_packet((msg->flags & O2_UNORDERED) ? RUDP_UNORDERED :
+                                                           RUDP_DATA,
+                             ch->seq_out, &msg->data, msg->length);
+    }
+    o2_free_message(msg);
+    if (!packet) return O2_FAIL;
+    // the packet replaces the oldest one kept for retransmission
+    int slot = ch->seq_out % RUDP_WINDOW;
+    if (ch->sent[slot]) o2_free_message(ch->sent[slot]);
+    ch->sent[slot] = packet;
+    ch->seq_out++;
+    ch->sent_time = o2_local_now;
+    ch->heartbeats = 0;
+    // if sending fails, the receiver will ask for the packet again
+    return send_packet(proc, packet);
+}
+
+
+// Resend count packets from seq, or tell the receiver that they are
+//   no longer kept.
+//
+static void resend(process_info_ptr proc, uint32_t seq, int count)
+{
+    rudp_channel_ptr ch = proc->rudp;
+    if (!ch) return;
+    if (count > RUDP_WINDOW) count = RUDP_WINDOW;
+    int skipped = FALSE;
+    for (int i = 0; i < count; i++) {
+        int age = SEQ_DIFF(ch->seq_out, seq + i);
+        if (age <= 0) { // never sent
+            break;
+        } else if (age <= RUDP_WINDOW) {
+            send_packet(proc, ch->sent[(seq + i) % RUDP_WINDOW]);
+        } else if (!skipped) {
+            send_control(proc, RUDP_SKIP, ch->seq_out - RUDP_WINDOW);
+            skipped = TRUE;
+        }
+    }
+}
+
+
+// append msg to the list of messages to deliver
+//
+static void add_to_list(o2_message_ptr *head, o2_message_ptr *tail,
+                        o2_message_ptr msg)
+{
+    msg->next = NULL;
+    if (*head) {
+        (*tail)->next = msg;
+    } else {
+        *head = msg;
+    }
+    *tail = msg;
+}
+
+
+// Move the packets that are now in order from held to the list.
+//
+static void advance(rudp_channel_ptr ch, o2_message_ptr *head,
+                    o2_message_ptr *tail)
+{
+    while (ch->seq_in != ch->seq_end && ch->got[ch->seq_in % RUDP_WINDOW]) {
+        int slot = ch->seq_in % RUDP_WINDOW;
+        if (ch->held[slot]) add_to_list(head, tail, ch->held[slot]);
+        ch->held[slot] = NULL;
+        ch->got[slot] = FALSE;
+        ch->seq_in++;
+        ch->nacks = 0;
+        ch->nack_time = o2_local_now;
+    }
+}
+
+
+// Give up on the packets before seq: deliver what arrived of them.
+//
+static void skip_to(rudp_channel_ptr ch, uint32_t seq, o2_message_ptr *head,
+                    o2_message_ptr *tail)
+{
+    while (SEQ_DIFF(seq, ch->seq_in) > 0) {
+        int slot = ch->seq_in % RUDP_WINDOW;
+        if (ch->held[slot]) add_to_list(head, tail, ch->held[slot]);
+        ch->held[slot] = NULL;
+        ch->got[slot] = FALSE;
+        ch->seq_in++;
+    }
+    if (SEQ_DIFF(ch->seq_in, ch->seq_end) > 0) ch->seq_end = ch->seq_in;
+    ch->nacks = 0;
+    ch->nack_time = o2_local_now;
+    advance(ch, head, tail);
+}
+
+
+// Note that packets up to (not including) seq exist.
+//
+static void extend(rudp_channel_ptr ch, uint32_t seq)
+{
+    if (SEQ_DIFF(seq, ch->seq_end) > 0) {
+        if (ch->seq_in == ch->seq_end) { // a new gap: NACK on next poll
+            ch->nack_time = o2_local_now - RUDP_NACK_INTERVAL;
+            ch->nacks = 0;
+        }
+        ch->seq_end = seq;
+    }
+}
+
+
+static void deliver_list(o2_message_ptr msg)
+{
+    while (msg) {
+        o2_message_ptr next = msg->next;
+        deliver_or_schedule(msg, FALSE);
+        msg = next;
+    }
+}
+
+
+void o2_rudp_receive(o2_message_ptr packet)
+{
+    o2_message_ptr head = NULL, tail = NULL;
+    char *p = packet->data.address;
+    int avail = packet->length - (int) sizeof(double);
+    // the name must end within the packet
+    char *name_end = avail > 4 ? memchr(p + 4, 0, avail - 4) : NULL;
+    if (!name_end) goto drop;
+    int header = 4 + o2_strsize(p + 4) + 8;
+    if (header > avail) goto drop;
+    generic_entry_ptr entry = o2_find_service(p + 4);
+    if (!entry || entry->tag != O2_REMOTE_SERVICE) goto drop;
+    process_info_ptr proc = ((remote_service_entry_ptr) entry)->parent;
+    int32_t word;
+    memcpy(&word, p + header - 8, 4);
+    uint32_t seq = ntohl(word);
+    memcpy(&word, p + header - 4, 4);
+    int kind = ntohl(word);
+    int len = avail - header; // length of the data
+
+    if (kind == RUDP_NACK) {
+        if (len < 4) goto drop;
+        memcpy(&word, p + header, 4);
+        resend(proc, seq, ntohl(word));
+        goto drop;
+    }
+    rudp_channel_ptr ch = get_channel(proc);
+    if (!ch) goto drop;
+    if (kind == RUDP_HEARTBEAT) {
+        extend(ch, seq);
+        goto drop;
+    } else if (kind == RUDP_SKIP) {
+        skip_to(ch, seq, &head, &tail);
+        goto drop;
+    } else if (kind != RUDP_DATA && kind != RUDP_UNORDERED) {
+        goto drop;
+    }
+    int ahead = SEQ_DIFF(seq, ch->seq_in);
+    if (ahead < 0) goto drop; // delivered or given up already
+    if (ahead >= RUDP_WINDOW) { // too far ahead to hold: give up on gaps
+        skip_to(ch, seq - RUDP_WINDOW + 1, &head, &tail);
+    }
+    int slot = seq % RUDP_WINDOW;
+    if (ch->got[slot]) goto drop; // a duplicate
+    ch->got[slot] = TRUE;
+    extend(ch, seq + 1);
+    // the message replaces the packet header in place
+    if (len >= (int) sizeof(double) + 4) {
+        memmove(&packet->data, p + header, len);
+        packet->length = len;
+        if (kind == RUDP_UNORDERED) {
+            add_to_list(&head, &tail, packet);
+        } else {
+            ch->held[slot] = packet;
+        }
+        packet = NULL;
+    }
+    advance(ch, &head, &tail);
+  drop:
+    if (packet) o2_free_message(packet);
+    deliver_list(head);
+}
+
+
+// Send NACKs for up to RUDP_NACK_RUNS runs of missing packets.
+//
+static void send_nacks(process_info_ptr proc, rudp_channel_ptr ch)
+{
+    int runs = 0;
+    uint32_t seq = ch->seq_in;
+    while (seq != ch->seq_end && runs < RUDP_NACK_RUNS) {
+        if (ch->got[seq % RUDP_WINDOW]) {
+            seq++;
+            continue;
+        }
+        uint32_t first = seq;
+        while (seq != ch->seq_end && !ch->got[seq % RUDP_WINDOW]) seq++;
+        int32_t count = htonl(SEQ_DIFF(seq, first));
+        o2_message_ptr nack = make_packet(RUDP_NACK, first, &count, 4);
+        if (!nack) return;
+        send_packet(proc, nack);
+        o2_free_message(nack);
+        runs++;
+    }
+}
+
+
+void o2_rudp_poll()
+{
+    for (int i = rudp_procs.length - 1; i >= 0; i--) {
+        if (i >= rudp_procs.length) continue; // list got shorter
+        process_info_ptr proc = *DA_GET(rudp_procs, process_info_ptr, i);
+        rudp_channel_ptr ch = proc->rudp;
+        // sending: heartbeats let the receiver find lost last packets
+        if (ch->seq_out != 0 && ch->heartbeats < RUDP_HEARTBEATS &&
+            o2_local_now - ch->sent_time >=
+            RUDP_NACK_INTERVAL * (ch->heartbeats + 1)) {
+            send_control(proc, RUDP_HEARTBEAT, ch->seq_out);
+            ch->heartbeats++;
+        }
+        // receiving: ask for missing packets, or give up on them
+        if (ch->seq_in != ch->seq_end &&
+            o2_local_now - ch->nack_time >= RUDP_NACK_INTERVAL) {
+            if (ch->nacks < RUDP_MAX_NACKS) {
+                send_nacks(proc, ch);
+                ch->nacks++;
+                ch->nack_time = o2_local_now;
+            } else { // skip the first run of missing packets
+                uint32_t seq = ch->seq_in;
+                while (seq != ch->seq_end && !ch->got[seq % RUDP_WINDOW]) {
+                    seq++;
+                }
+                O2_DB(printf("O2: reliable UDP from %s lost %d packets\n",
+                             proc->name, SEQ_DIFF(seq, ch->seq_in)));
+                o2_message_ptr head = NULL, tail = NULL;
+                skip_to(ch, seq, &head, &tail);
+                deliver_list(head);
+            }
+        }
+    }
+}
+
+
+void o2_rudp_remove(process_info_ptr proc)
+{
+    rudp_channel_ptr ch = proc->rudp;
+    if (!ch) return;
+    for (int i = 0; i < rudp_procs.length; i++) {
+        if (*DA_GET(rudp_procs, process_info_ptr, i) == proc) {
+            *DA_GET(rudp_procs, process_info_ptr, i) =
+                    *DA_LAST(rudp_procs, process_info_ptr);
+            rudp_procs.length--;
+            break;
+        }
+    }
+    for (int i = 0; i < RUDP_WINDOW; i++) {
+        if (ch->sent[i]) o2_free_message(ch->sent[i]);
+        if (ch->held[i]) o2_free_message(ch->held[i]);
+    }
+    O2_FREE(ch);
+    proc->rudp = NULL;
+}
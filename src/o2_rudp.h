@@ -0,0 +1,35 @@
+//  o2_rudp.h -- reliable UDP
+//
+//  Sequenced UDP channels between processes, with retransmission of
+//  lost packets on request. See o2_rudp.c.
+
+#ifndef o2_rudp_h
+#define o2_rudp_h
+
+/**
+ *  Send msg to proc over the reliable UDP channel to proc. msg is
+ *  freed, but a copy is kept for retransmission.
+ *
+ *  @return O2_SUCCESS if succeed, O2_FAIL if not.
+ */
+int o2_rudp_send(process_info_ptr proc, o2_message_ptr msg);
+
+/**
+ *  Handle a packet of a reliable UDP channel (a message addressed to
+ *  "&"), and deliver the messages that are now in order. packet is
+ *  freed or delivered.
+ */
+void o2_rudp_receive(o2_message_ptr packet);
+
+/**
+ *  Send heartbeats and NACKs, and give up on packets that do not
+ *  arrive. Called at the end of o2_poll().
+ */
+void o2_rudp_poll();
+
+/**
+ *  Free the reliable UDP channel state of proc, which is being removed.
+ */
+void o2_rudp_remove(process_info_ptr proc);
+
+#endif /* o2_rudp_h */
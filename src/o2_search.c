@@ -12,7 +12,14 @@
 #include "o2_search.h"
 #include "o2_internal.h"
 #include "o2_message.h"
+#include "o2_send.h"
 #include "o2_discovery.h"
+#include "o2_hub.h"
+#include "o2_rudp.h"
+#include "o2_stream.h"
+#include "o2_shmem.h"
+#include "o2_vector.h"
+#include "o2_interoperation.h"
 
 #ifdef WIN32
 #include "malloc.h"
@@ -273,6 +280,8 @@ int o2_pattern_match(const char *str, const char *p)
 node_entry master_table;
 node_entry path_tree_table;
 
+int o2_method_generation = 0;
+
 
 // Declaration
 int add_entry(node_entry_ptr node, generic_entry_ptr entry);
@@ -357,6 +366,7 @@ void free_entry(generic_entry_ptr entry)
         return free_node((node_entry_ptr) entry);
     } else if (entry->tag == PATTERN_HANDLER) {
         handler_entry_ptr handler = (handler_entry_ptr) entry;
+        o2_method_generation++;
         // if we remove a leaf node from the tree, remove the
         //  corresponding full path:
         if (handler->full_path) {
@@ -368,11 +378,12 @@ void free_entry(generic_entry_ptr entry)
         }
         if (handler->type_string)
             O2_FREE(handler->type_string);
-    } else if (entry->tag == O2_REMOTE_SERVICE) {
+    } else if (entry->tag == O2_REMOTE_SERVICE ||
+               entry->tag == O2_BRIDGE_SERVICE) {
         // nothing special to do here. "parent" is a process,
         // but it is "owned" by pointer in o2_fds_info.
     } else if (entry->tag == OSC_REMOTE_SERVICE) {
-        // TODO: maybe close the TCP connection
+        o2_osc_entry_finish((osc_entry_ptr) entry);
     } // TODO: could there be an OSC_LOCAL_SERVICE here?
     O2_FREE(entry->key);
     O2_FREE(entry);
@@ -667,11 +678,23 @@ int o2_remove_method(const char *path)
 void o2_init_process(process_info_ptr process, int status, int is_little_endian)
 {
     process->name = NULL;
-    process->status = PROCESS_DISCOVERED;
+    process->status = status;
     DA_INIT(process->services, char *, 0);
+    process->little_endian = is_little_endian;
     process->udp_port = 0;
     memset(&process->udp_sa, 0, sizeof(process->udp_sa));
     process->tcp_fd_index = -1;
+    process->last_used = 0.0;
+    process->udp_frame = NULL;
+    process->tcp_frame = NULL;
+    process->frame_time = 0.0;
+    process->frame_listed = FALSE;
+    process->bulk_head = process->bulk_tail = NULL;
+    process->bulk_sent = 0;
+    process->bulk_listed = FALSE;
+    process->bulk_in = NULL;
+    process->bulk_in_got = 0;
+    process->rudp = NULL;
 }
 
 int remove_remote_services(process_info_ptr proc)
@@ -702,7 +725,23 @@ int remove_remote_service(process_info_ptr proc)
 
 int o2_remove_remote_process(process_info_ptr proc)
 {
-    o2_remove_socket(proc->tcp_fd_index); // close the TCP socket
+    // a hub tells the processes it serves that proc's services are gone
+    if (o2_hub_flag) o2_hub_remove_process(proc);
+    // close the TCP socket(s); with lazy connections there may be none,
+    // or two if both processes connected at the same time
+    for (int i = o2_fds_info.length - 1; i >= 0; i--) {
+        fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
+        if (info->tag == TCP_SOCKET && info->u.process_info == proc) {
+            closesocket(DA_GET(o2_fds, struct pollfd, i)->fd);
+            if (info->message) o2_free_message(info->message);
+            o2_remove_socket(i);
+        }
+    }
+    o2_coalesce_remove(proc); // drop messages that were held for proc
+    o2_bulk_remove(proc);
+    o2_rudp_remove(proc);
+    o2_frag_remove(proc);
+    o2_stream_remove(proc);
     // remove the remote services provided by the proc
     remove_remote_services(proc);
     // remove the remote service associated with the ip_port string
@@ -735,6 +774,7 @@ process_info_ptr o2_add_remote_process(const char *ip_port, int status,
         process->name = o2_heapify(ip_port);
         // put a remote service entry in the path_tree_table
         add_remote_service(process, ip_port);
+        if (is_little_endian != IS_LITTLE_ENDIAN) o2_foreign_host(ip_port);
     }
     // printf("%s: added remote process %s\n", debug_prefix, ip_port);
     return process;
@@ -745,13 +785,14 @@ process_info_ptr o2_add_remote_process(const char *ip_port, int status,
 //
 // service is "owned" by the caller
 //
-int add_remote_service(process_info_ptr process, const char *service)
+static int add_service_entry(process_info_ptr process, const char *service,
+                             int tag)
 {
     // make an entry for the path table
     remote_service_entry_ptr entry = (remote_service_entry_ptr)
                                      O2_MALLOC(sizeof(remote_service_entry));
     
-    entry->tag = O2_REMOTE_SERVICE;
+    entry->tag = tag;
     entry->key = o2_heapify(service);
     entry->next = NULL;
     entry->parent = process;
@@ -766,6 +807,56 @@ int add_remote_service(process_info_ptr process, const char *service)
     return O2_SUCCESS;
 }
 
+
+int add_remote_service(process_info_ptr process, const char *service)
+{
+    // a direct route replaces a route through a hub
+    int index;
+    generic_entry_ptr *entry = lookup(&path_tree_table, service, &index);
+    if (entry && (*entry)->tag == O2_BRIDGE_SERVICE) {
+        remove_bridge_service(((remote_service_entry_ptr) *entry)->parent,
+                              service);
+    }
+    return add_service_entry(process, service, O2_REMOTE_SERVICE);
+}
+
+
+int o2_direct_route(const char *service)
+{
+    int index;
+    generic_entry_ptr *entry = lookup(&path_tree_table, service, &index);
+    return entry && (*entry)->tag != O2_BRIDGE_SERVICE;
+}
+
+
+int add_bridge_service(process_info_ptr hub, const char *service)
+{
+    // like a remote service, the key is also kept in hub->services, so
+    // bridged services are removed along with the hub
+    return add_service_entry(hub, service, O2_BRIDGE_SERVICE);
+}
+
+
+int remove_bridge_service(process_info_ptr hub, const char *service)
+{
+    int index;
+    generic_entry_ptr *entry = lookup(&path_tree_table, service, &index);
+    if (!entry || (*entry)->tag != O2_BRIDGE_SERVICE ||
+        ((remote_service_entry_ptr) *entry)->parent != hub) {
+        return O2_FAIL;
+    }
+    // the key is shared with hub->services, so remove it there first
+    for (int i = 0; i < hub->services.length; i++) {
+        if (*DA_GET(hub->services, char *, i) == (*entry)->key) {
+            *DA_GET(hub->services, char *, i) =
+                    *DA_LAST(hub->services, char *);
+            hub->services.length--;
+            break;
+        }
+    }
+    return remove_entry(&path_tree_table, entry, TRUE);
+}
+
 // add a service for OSC
 // path is "owned" by the caller
 int add_local_osc(const char *path, int port, SOCKET tcp_socket)
@@ -838,11 +929,13 @@ int o2_add_method(const char *path, const char *typespec,
     handler->user_data = user_data;
     handler->full_path = key; // key will also be master_table key
     char *types_copy = (typespec ? o2_heapify(typespec) : NULL);
-    int arg_count = (typespec ? strlen(typespec) : 0);
+    int arg_count = (typespec ? o2_arg_count(typespec) : 0);
     handler->type_string = types_copy;
     handler->argc = arg_count;
     handler->coerce_flag = coerce;
     handler->parse_args = parse;
+    handler->latest = FALSE;
+    o2_method_generation++;
     int ret = add_entry(table, (generic_entry_ptr) handler);
     if (ret) {
         // TODO CLEANUP
@@ -863,12 +956,52 @@ int o2_add_method(const char *path, const char *typespec,
     handler->argc = arg_count;
     handler->coerce_flag = coerce;
     handler->parse_args = parse;
+    handler->latest = FALSE;
     
     // put the entry in the master table
     return add_entry(&master_table, (generic_entry_ptr) handler);
 }
 
 
+// how many methods have the latest flag (so if there are none, queued
+// messages are not looked up)
+static int latest_methods = 0;
+
+int o2_method_latest(const char *path, int flag)
+{
+    int index;
+    char *key = o2_heapify(path); // padded, as lookup() needs
+    if (!key) return O2_FAIL;
+    *key = '/'; // as in o2_add_method()
+    generic_entry_ptr *entry = lookup(&master_table, key, &index);
+    O2_FREE(key);
+    if (!entry || (*entry)->tag != PATTERN_HANDLER) return O2_FAIL;
+    handler_entry_ptr handler = (handler_entry_ptr) *entry;
+    flag = (flag != 0);
+    latest_methods += flag - handler->latest;
+    handler->latest = flag;
+    return O2_SUCCESS;
+}
+
+
+// is msg marked O2_LATEST or addressed to a method with the latest flag?
+//
+static int message_is_latest(o2_message_ptr msg)
+{
+    if (msg->flags & O2_LATEST) return TRUE;
+    if (!latest_methods) return FALSE;
+    char *address = msg->data.address;
+    char first = address[0];
+    if (first != '/' && first != '!') return FALSE; // a bundle
+    int index;
+    address[0] = '/'; // must start with '/' to get consistent hash value
+    generic_entry_ptr *entry = lookup(&master_table, address, &index);
+    address[0] = first;
+    return entry && (*entry)->tag == PATTERN_HANDLER &&
+           ((handler_entry_ptr) *entry)->latest;
+}
+
+
 //Recieving messages.
 
 ssize_t o2_get_length(o2_type type, void *data)
@@ -939,9 +1072,10 @@ void call_handler(handler_entry_ptr handler, o2_message_ptr msg,
                   char *types)
 {
     o2_arg_ptr *argv = NULL;
-    int argc = strlen(types);
+    int argc = o2_arg_count(types);
     int free_argv_flag = FALSE; // boolean says that we need to free argv
     double *coerced; // array for coerced values
+    void *vectors = NULL; // converted vectors, freed after the handler
 
     // type checking
     if (handler->type_string && // mismatch detection needs type_string
@@ -964,11 +1098,13 @@ void call_handler(handler_entry_ptr handler, o2_message_ptr msg,
         if (needed <= msg->allocated - msg->length) {
             argv = (o2_arg_ptr *) (WORD_ALIGN_PTR(((char *) msg) +
                     MESSAGE_SIZE_FROM_ALLOCATED(msg->length)));
+            // argv replaces any index built by o2_get_arg()
+            msg->flags = (msg->flags & ~O2_ARG_INDEX) | O2_ARGV_SLACK;
         } else {
             argv = (o2_arg_ptr *) o2_malloc(needed);
             free_argv_flag = TRUE;
         }
-        o2_start_extract(msg);
+        o2_start_extract_types(msg, types);
         // double is big enough for any coerced value, so we'll pretend
         // all coerced values are doubles, even though some could be 
         coerced = (double *) (argv + argc);
@@ -976,23 +1112,31 @@ void call_handler(handler_entry_ptr handler, o2_message_ptr msg,
         char *desired_type = handler->type_string;
         int i = 0;
         for (typ = types; *typ; typ++) {
-            if (*typ == *desired_type) {
+            if (*desired_type == O2_VECTOR && desired_type[1]) {
+                // vector elements are converted to the desired type
+                argv[i] = o2_get_next_vector(*++desired_type);
+            } else if (*typ == *desired_type) {
                 argv[i] = o2_get_next(*typ);
             } else { // if no type match, type will be coerced and may
                 // be copied to o2_coerced_value. If this happens, we
                 // must copy from this temporary value to allocated
                 // storage pointed to by coerced.
-                if ((argv[i] = o2_get_next(*desired_type) ==
-                     &o2_coerced_value)) {
+                argv[i] = o2_get_next(*desired_type);
+                if (argv[i] == &o2_coerced_value) {
                     *coerced = o2_coerced_value.d;
                     argv[i] = (o2_arg_ptr) (coerced++);
                 }
             }
+            if (*typ == O2_VECTOR && typ[1]) typ++; // skip element type
             desired_type++;
             i++;
         }
+        vectors = o2_take_coerced_vectors();
     }
     (*(handler->handler))(msg, types, argv, argc, handler->user_data);
+    msg->flags &= ~O2_ARGV_SLACK;
+    if (free_argv_flag) O2_FREE(argv);
+    if (vectors) o2_free_coerced_vectors(vectors);
 }
 
 
@@ -1045,6 +1189,9 @@ void find_and_call_handlers_rec(char *remaining, char *name,
                 char *path_end = remaining + strlen(remaining);
                 path_end = WORD_ALIGN_PTR(path_end);
                 call_handler((handler_entry_ptr) *entry_ptr, msg, path_end + 5);
+            } else if ((*entry_ptr)->tag == OSC_REMOTE_SERVICE) {
+                // only in path_tree_table: the service forwards to OSC
+                o2_send_osc_now((osc_entry_ptr) *entry_ptr, msg);
             }
         }
     }
@@ -1058,21 +1205,21 @@ static int in_find_and_call_handlers = FALSE;
 static o2_message_ptr pending_head = NULL;
 static o2_message_ptr pending_tail = NULL;
 
-// dispatch msg to all matching handlers
+// dispatch msg to all matching handlers, but do not free it
 //
-void find_and_call_handlers(o2_message_ptr msg)
+static void dispatch_message(o2_message_ptr msg)
 {
-    if (in_find_and_call_handlers) { // enqueue the message and return
-        if (pending_tail) {
-            pending_tail->next = msg;
-        } else {
-            pending_head = pending_tail = msg;
-        }
-        return;
-    }
-    in_find_and_call_handlers = TRUE;
     char *address = msg->data.address;
-    if ((address[0]) == '!') { // do full path lookup
+    // map shared memory (see o2_shmem.c) for the handlers
+    int shmem = (address[0] != '#' && o2_shmem_attach(msg));
+    if (address[0] == '#') { // bundle: deliver each message in order
+        int pos = 0;
+        o2_message_ptr element;
+        while ((element = o2_bundle_next(msg, &pos))) {
+            dispatch_message(element);
+            o2_free_message(element);
+        }
+    } else if ((address[0]) == '!') { // do full path lookup
         int index;
         address[0] = '/'; // must start with '/' to get consistent hash value
         generic_entry_ptr *handler = lookup(&master_table, address, &index);
@@ -1081,17 +1228,80 @@ void find_and_call_handlers(o2_message_ptr msg)
             char *path_end = address;
             while (path_end[3]) path_end += 4; // find end of path
             call_handler((handler_entry_ptr) (*handler), msg, path_end + 5);
+        } else if (!handler) { // the service may forward to an OSC server
+            char name[NAME_BUF_LEN];
+            char *slash = strchr(address + 1, '/');
+            if (slash) *slash = 0;
+            string_pad(name, address + 1, NAME_BUF_LEN);
+            if (slash) *slash = '/';
+            generic_entry_ptr *service = lookup(&path_tree_table, name,
+                                                &index);
+            if (service && (*service)->tag == OSC_REMOTE_SERVICE) {
+                o2_send_osc_now((osc_entry_ptr) *service, msg);
+            }
         }
     } else {
         char name[NAME_BUF_LEN];
         find_and_call_handlers_rec(address + 1, name, &path_tree_table, msg);
     }
+    if (shmem) o2_shmem_detach(msg);
+}
+
+
+// dispatch msg to all matching handlers and free it
+//
+void find_and_call_handlers(o2_message_ptr msg)
+{
+    if (in_find_and_call_handlers) { // enqueue the message and return
+        if (message_is_latest(msg)) { // replace an older message in place
+            o2_message_ptr *m_ptr = &pending_head;
+            while (*m_ptr) {
+                o2_message_ptr old = *m_ptr;
+                if (streql(old->data.address, msg->data.address)) {
+                    msg->next = old->next;
+                    *m_ptr = msg;
+                    if (pending_tail == old) pending_tail = msg;
+                    o2_shmem_detach(old); // it will not be delivered
+                    o2_free_message(old);
+                    return;
+                }
+                m_ptr = &old->next;
+            }
+        }
+        msg->next = NULL;
+        if (pending_tail) {
+            pending_tail->next = msg;
+            pending_tail = msg;
+        } else {
+            pending_head = pending_tail = msg;
+        }
+        return;
+    }
+    in_find_and_call_handlers = TRUE;
+    dispatch_message(msg);
     o2_free_message(msg);
     in_find_and_call_handlers = FALSE;
     return;
 }
 
 
+void o2_deliver_to_handler(handler_entry_ptr handler, o2_message_ptr msg)
+{
+    if (in_find_and_call_handlers) { // wait in the queue as usual
+        find_and_call_handlers(msg);
+        return;
+    }
+    in_find_and_call_handlers = TRUE;
+    int shmem = o2_shmem_attach(msg);
+    char *path_end = msg->data.address;
+    while (path_end[3]) path_end += 4; // find end of path
+    call_handler(handler, msg, path_end + 5);
+    if (shmem) o2_shmem_detach(msg);
+    o2_free_message(msg);
+    in_find_and_call_handlers = FALSE;
+}
+
+
 void o2_deliver_pending()
 {
     while (pending_head) {
@@ -18,6 +18,8 @@
 #define OSC_REMOTE_SERVICE 4
 #define O2_PROCESS 5
 #define OSC_LOCAL_SERVICE 6 // TODO: is this used?
+#define ADDRESS_ALIAS 7 // only in alias tables (see o2_alias.c)
+#define INTERNED_TYPES 8 // only in type tables (see o2_compact.c)
 
 /**
  *  Structures for hash look up.
@@ -58,6 +60,8 @@ typedef struct handler_entry {
                        ///<   to copies of type-coerced data as needed
                        ///<   (coerce_flag is only set if parse_args is true.)
     int parse_args;    ///< boolean - send argc and argv to handler?
+    int latest;        ///< boolean - replace queued messages? Only set in
+                       ///<   the master_table entry (see o2_method_latest)
 } handler_entry, *handler_entry_ptr;
 
 
@@ -83,13 +87,28 @@ typedef struct process_info {
     // port numbers are here so that in discovery, we can check for any changes
     int udp_port;       // current udp port number
     struct sockaddr_in udp_sa;  // address for sending UDP messages
-    int tcp_fd_index;   // index in o2_fds of tcp socket
+    int tcp_fd_index;   // index in o2_fds of tcp socket, -1 if not connected
+    o2_time last_used;  // local time of last TCP send or receive; used to
+                        //    close idle connections (see o2_lazy_connections)
+    // outgoing messages held by o2_coalesce_messages():
+    o2_message_ptr udp_frame;  // messages to send by UDP, or NULL
+    o2_message_ptr tcp_frame;  // messages to send by TCP, or NULL
+    o2_time frame_time;        // local time of the oldest held message
+    int frame_listed;          // true if in the list of processes to flush
+    // bulk lane (see o2_bulk_lane()):
+    o2_message_ptr bulk_head;  // queue of bulk messages to send by TCP
+    o2_message_ptr bulk_tail;  // last message in the queue
+    int bulk_sent;             // bytes of bulk_head sent so far
+    int bulk_listed;           // true if in the list of processes to serve
+    o2_message_ptr bulk_in;    // bulk message being received, or NULL
+    int bulk_in_got;           // bytes of bulk_in received so far
+    struct rudp_channel *rudp; // reliable UDP state (see o2_rudp.c), or NULL
 } process_info, *process_info_ptr;
 
 
 // Hash table's entry for a remote service
 typedef struct remote_service_entry {
-    int tag;   // must be O2_REMOTE_SERVICE
+    int tag;   // must be O2_REMOTE_SERVICE or O2_BRIDGE_SERVICE
     char *key; // key is "owned" by this remote_service_entry struct
     generic_entry_ptr next;
     process_info_ptr parent;   // points to its host process for the service
@@ -106,6 +125,14 @@ typedef struct osc_entry {
     char ip[20];
     int port;
     SOCKET tcp_socket; // socket connection for sending TCP messages
+    int tcp_flag; // send by TCP (tcp_socket is reopened if it fails)
+    // timed messages with the same timestamp, to be sent as one bundle:
+    o2_message_ptr bundle;
+    o2_message_ptr *bundle_tail; // where to append the next message
+    o2_time bundle_time; // timestamp of the bundle messages
+    int bundle_len; // size of the OSC bundle
+    int bundle_count; // number of messages in the bundle
+    int bundle_listed; // entry is on the list for o2_osc_send_bundles()
 } osc_entry, *osc_entry_ptr;
 
 
@@ -126,9 +153,16 @@ typedef struct enumerate {
 
 
 // typedef struct enumerate enumerate, *enumerate_ptr;
+void enumerate_begin(enumerate *enumerator, dyn_array_ptr dict);
+generic_entry_ptr enumerate_next(enumerate_ptr enumerator);
+
 extern node_entry path_tree_table;
 extern node_entry master_table;
 
+/// changes whenever a method is added or removed, so that handlers
+/// found earlier (see o2_alias.c) can be looked up again
+extern int o2_method_generation;
+
 /** copy a string into the heap  */
 char *o2_heapify(const char *path);
 
@@ -183,6 +217,16 @@ node_entry_ptr initialize_node(node_entry_ptr node, char *key);
  */
 generic_entry_ptr *lookup(node_entry_ptr dict, const char *key, int *index);
 
+/// allocate a node with key (which is copied) and an empty table
+node_entry_ptr create_node(char *key);
+
+/// insert entry at loc, found by lookup(), in the table of node
+int add_entry_at(node_entry_ptr node, generic_entry_ptr *loc,
+                 generic_entry_ptr entry);
+
+/// insert entry in the table of node, replacing any entry with its key
+int add_entry(node_entry_ptr node, generic_entry_ptr entry);
+
 
 void o2_init_process(process_info_ptr process, int status, int is_little_endian);
       
@@ -205,6 +249,24 @@ int o2_remove_remote_process(process_info_ptr proc);
  */
 int add_remote_service(process_info_ptr process, const char *service);
 
+/**
+ *  TRUE if service is local or offered by a connected process, FALSE
+ *  if it is unknown or reached through a hub. add_remote_service()
+ *  replaces a route through a hub, so that messages go directly.
+ *  service must be padded as for lookup().
+ */
+int o2_direct_route(const char *service);
+
+/**
+ *  Add a service that is reached by sending to hub, which forwards
+ *  the messages (see o2_hub.c). The entry has the tag O2_BRIDGE_SERVICE
+ *  and is otherwise the same as a remote_service_entry.
+ */
+int add_bridge_service(process_info_ptr hub, const char *service);
+
+/// remove a service added by add_bridge_service(), O2_FAIL if not found
+int remove_bridge_service(process_info_ptr hub, const char *service);
+
 
 node_entry_ptr tree_insert_node(node_entry_ptr node, char *key);
 
@@ -237,6 +299,12 @@ void find_and_call_handlers(o2_message_ptr msg);
 
 void o2_deliver_pending();
 
+/**
+ *  Like find_and_call_handlers(), but the handler for the address of
+ *  msg is already known (see o2_alias_receive()). msg is freed.
+ */
+void o2_deliver_to_handler(handler_entry_ptr handler, o2_message_ptr msg);
+
 int dispatch_osc_message(void *msg);
 
 int remove_node(node_entry_ptr dict, const char *key);
@@ -15,6 +15,11 @@
 #include "o2_send.h"
 #include "o2_sched.h"
 #include "o2_message.h"
+#include "o2_interoperation.h"
+#include "o2_rudp.h"
+#include "o2_shmem.h"
+#include "o2_alias.h"
+#include "o2_compact.h"
 #include <errno.h>
 
 //#if defined(WIN32) || defined(_MSC_VER)
@@ -35,6 +40,66 @@
 int initWSock();
 #endif
 
+#ifdef WIN32
+#define SEND_REFS FALSE // no writev() or sendmsg(): copy referenced blobs
+#else
+#include <sys/uio.h>
+#define SEND_REFS TRUE
+
+// most pieces of a message: the length word, and data, blob and
+// padding for each blob reference, then the rest of the data
+#define MESSAGE_IOVECS (2 + 3 * O2_MAX_BLOB_REFS)
+
+// Fill iov with the pieces of msg: its data, with the blobs it refers
+//   to (see o2_add_blob_ref()) and their padding in between. Returns
+//   the number of pieces.
+//
+static int message_iovecs(o2_message_ptr msg, struct iovec *iov)
+{
+    static char zeros[4] = {0, 0, 0, 0};
+    char *data = (char *) &msg->data;
+    int n = 0;
+    int pos = 0;
+    for (o2_blob_ref_ptr ref = msg->refs; ref; ref = ref->next) {
+        iov[n].iov_base = data + pos;
+        iov[n++].iov_len = ref->offset - pos;
+        iov[n].iov_base = ref->data;
+        iov[n++].iov_len = ref->size;
+        int pad = ((ref->size + 3) & ~3) - ref->size;
+        if (pad) {
+            iov[n].iov_base = zeros;
+            iov[n++].iov_len = pad;
+        }
+        pos = ref->offset;
+    }
+    iov[n].iov_base = data + pos;
+    iov[n++].iov_len = msg->length - pos;
+    return n;
+}
+
+
+// Write all n pieces in iov to fd, which may take more than one
+//   writev(). Returns -1 if writing fails.
+//
+static int write_iovecs(SOCKET fd, struct iovec *iov, int n)
+{
+    while (n > 0) {
+        ssize_t sent = writev(fd, iov, n);
+        if (sent < 0) return -1;
+        while (n > 0 && sent >= (ssize_t) iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = ((char *) iov->iov_base) + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+#endif
+
 generic_entry_ptr o2_find_service(const char *service_name)
 {
     // all callers are passing in (possibly) unaligned strings, so we
@@ -64,6 +129,7 @@ generic_entry_ptr o2_find_service(const char *service_name)
     // TODO: can anything else be in the path_tree_table? I guess /o2_ and IP addresses
     if ((*entry)->tag == PATTERN_NODE ||
         (*entry)->tag == O2_REMOTE_SERVICE ||
+        (*entry)->tag == O2_BRIDGE_SERVICE ||
         (*entry)->tag == OSC_REMOTE_SERVICE) {
         return *entry;
     }
@@ -71,13 +137,17 @@ generic_entry_ptr o2_find_service(const char *service_name)
 }
 
 
-// The macro form of o2_sends
+// The macro form of o2_sends. tcp_flag may include O2_LATEST,
+// O2_RELIABLE and O2_UNORDERED
 int o2_send_marker(char *path, double time, int tcp_flag, char *typestring, ...)
 {
     va_list ap;
     va_start(ap, typestring);
 
     o2_message_ptr msg = o2_build_message(time, NULL, path, typestring, ap);
+    if (!msg) return O2_FAIL;
+    msg->flags = tcp_flag & (O2_LATEST | O2_RELIABLE | O2_UNORDERED);
+    tcp_flag &= ~msg->flags;
 #ifndef O2_NO_DEBUGGING
     if (o2_debug > 2 || // non-o2-system messages only if o2_debug <= 2
         (o2_debug > 1 && msg->data.address[1] != '_' &&
@@ -124,12 +194,40 @@ osc_entry_ptr o2_find_remote_osc(const char *service_name)
 size_t o2_arg_size(o2_type type, void *data);
 
 
+// send msg to proc over its TCP connection. msg is freed.
+//
 int send_by_tcp_to_process(process_info_ptr proc, o2_message_ptr msg)
 {
     // printf("+    %s send by tcp %s\n", debug_prefix, msg->data.address);
-    // Send the length of the message
-    int32_t len = htonl(msg->length);
+    if (o2_message_wire_length(msg) > O2_MAX_MSG_SIZE) {
+        o2_free_message(msg); // the receiver would drop the connection
+        return O2_FAIL;
+    }
+    if (o2_alias_max > 0 && !(msg = o2_alias_send(proc, msg))) {
+        return O2_FAIL;
+    }
+    if (o2_compact_flag) msg = o2_compact_send(proc, msg);
+    // Send the length of the message, marked if it is compact
+    int32_t len = htonl(msg->flags & O2_COMPACT ?
+                        msg->length | O2_COMPACT_LENGTH :
+                        (uint32_t) msg->length);
     SOCKET fd = DA_GET(o2_fds, struct pollfd, proc->tcp_fd_index)->fd;
+    proc->last_used = o2_local_now;
+#ifndef WIN32
+    if (msg->refs) { // send the length, data and blobs in place
+        struct iovec iov[MESSAGE_IOVECS];
+        len = htonl(o2_message_wire_length(msg));
+        iov[0].iov_base = &len;
+        iov[0].iov_len = sizeof(int32_t);
+        int n = 1 + message_iovecs(msg, iov + 1);
+        if (write_iovecs(fd, iov, n) < 0) {
+            perror("o2_send_message writing data");
+            goto send_error;
+        }
+        o2_free_message(msg); // releases the blobs
+        return O2_SUCCESS;
+    }
+#endif
     if (send(fd, &len, sizeof(int32_t), 0) < 0) {
         perror("o2_send_message writing length");
         goto send_error;
@@ -139,15 +237,693 @@ int send_by_tcp_to_process(process_info_ptr proc, o2_message_ptr msg)
         perror("o2_send_message writing data");
         goto send_error;
     }
+    o2_free_message(msg);
     return O2_SUCCESS;
   send_error:
+    o2_free_message(msg);
 	if (errno != EAGAIN && errno != EINTR) {
-        o2_remove_remote_process(proc);
+        if (o2_lazy_flag) { // keep the process, reconnect on next send
+            o2_close_tcp_socket(proc->tcp_fd_index);
+        } else {
+            o2_remove_remote_process(proc);
+        }
     }
     return O2_FAIL;
 }    
 
 
+/* Fragmentation
+
+A UDP message to a remote process that is longer than o2_udp_mtu
+bytes is sent in fragments that each fit in one packet, so that it
+is not left to IP fragmentation, where losing any piece loses the
+whole datagram (and datagrams cannot exceed 64KB). A fragment is a
+message addressed to "$" (padded), followed by the name of the
+sending process (padded), then the id of the message, its length,
+and the index of the fragment and number of fragments (int32s in
+network order), then the bytes of the fragment. All fragments but
+the last hold the same number of bytes, so the receiver can compute
+where each one goes.
+
+The receiver puts messages together in a pool of FRAG_SLOTS slots
+(see o2_frag_receive()), found by sending process and id. No sender
+holds more than FRAG_SENDER_SLOTS of them, so one sender cannot push
+out the messages of all the others: a new message from a sender at
+its limit replaces that sender's oldest one. A message that is still
+incomplete after FRAG_TIMEOUT seconds is dropped when the next
+fragment arrives, even if that is one of its own. Messages up to
+O2_MAX_MSG_SIZE bytes can be sent this way.
+
+A slot keeps its table of received fragments from one message to
+the next, and also the buffer of a message that is dropped, if it is
+no larger than FRAG_KEEP_SIZE, which the next message reuses if it
+fits. The buffer of a complete message
+is not kept: it is the message that is delivered, so it is handed
+over rather than copied, and the next message needs a new one.
+*/
+
+#define FRAG_MIN_MTU 256 // smaller MTUs leave too little room for data
+#define FRAG_SLOTS 16
+#define FRAG_SENDER_SLOTS 4 // at most this many slots per sender
+#define FRAG_TIMEOUT 1.0
+#define FRAG_KEEP_SIZE 65536 // larger buffers of dropped messages are freed
+
+int o2_udp_mtu_bytes = 1500 - 20 - 8; // Ethernet MTU less IP and UDP
+
+static uint32_t frag_id = 0; // id of the next fragmented message
+
+typedef struct frag_slot {
+    process_info_ptr proc; // sender, or NULL if the slot is free
+    uint32_t id;           // message id
+    int count;             // number of fragments
+    int missing;           // fragments not yet received
+    o2_time start;         // local time of the first fragment
+    o2_message_ptr msg;    // the message being put together
+    char *got;             // got[i] is TRUE if fragment i arrived
+    int got_size;          // bytes allocated for got
+} frag_slot, *frag_slot_ptr;
+
+static frag_slot frag_slots[FRAG_SLOTS];
+
+
+int o2_udp_mtu(int mtu)
+{
+    if (mtu != 0 && mtu < FRAG_MIN_MTU) return O2_FAIL;
+    o2_udp_mtu_bytes = mtu;
+    return O2_SUCCESS;
+}
+
+
+static int send_udp_packet(process_info_ptr proc, void *data, int len)
+{
+    if (sendto(local_send_sock, data, len, 0,
+               (struct sockaddr *) &(proc->udp_sa),
+               sizeof(proc->udp_sa)) < 0) {
+        perror("o2_send_message");
+        return O2_FAIL;
+    }
+    return O2_SUCCESS;
+}
+
+
+#ifndef WIN32
+// Send msg, which refers to blobs, to proc in one UDP packet.
+//
+static int send_udp_iovecs(process_info_ptr proc, o2_message_ptr msg)
+{
+    struct iovec iov[MESSAGE_IOVECS];
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = &proc->udp_sa;
+    mh.msg_namelen = sizeof(proc->udp_sa);
+    mh.msg_iov = iov;
+    mh.msg_iovlen = message_iovecs(msg, iov);
+    if (sendmsg(local_send_sock, &mh, 0) < 0) {
+        perror("o2_send_message");
+        return O2_FAIL;
+    }
+    return O2_SUCCESS;
+}
+#endif
+
+
+char *o2_wrap_header(o2_message_ptr msg, char marker, int32_t a, int32_t b)
+{
+    msg->data.timestamp = 0.0;
+    // the name is past the end of the data.address member, so find it
+    // from the start of the data
+    char *p = ((char *) &msg->data) + sizeof(double);
+    memset(p, 0, 4);
+    p[0] = marker;
+    // o2_process.name is from o2_heapify(), so it is already padded
+    int name_len = o2_strsize(o2_process.name);
+    memcpy(p + 4, o2_process.name, name_len);
+    p += 4 + name_len;
+    int32_t word = htonl(a);
+    memcpy(p, &word, 4);
+    word = htonl(b);
+    memcpy(p + 4, &word, 4);
+    return p + 8;
+}
+
+
+int o2_send_udp(process_info_ptr proc, o2_message_ptr msg)
+{
+    // printf(" +    %s normal udp msg to %s, port %d, ip %x\n", debug_prefix, msg->data.address, ntohs(proc->udp_sa.sin_port), ntohl(proc->udp_sa.sin_addr.s_addr));
+#ifndef WIN32
+    if (msg->refs) { // not fragmented: see send_to_process()
+        return send_udp_iovecs(proc, msg);
+    }
+#endif
+    if (o2_udp_mtu_bytes <= 0 || msg->length <= o2_udp_mtu_bytes) {
+        return send_udp_packet(proc, &msg->data, msg->length);
+    }
+    if (msg->length > O2_MAX_MSG_SIZE) return O2_FAIL;
+    int header = O2_WRAP_HEADER_SIZE + 8;
+    int chunk = o2_udp_mtu_bytes - header;
+    int count = (msg->length + chunk - 1) / chunk;
+    chunk = (msg->length + count - 1) / count; // even out the fragments
+    o2_message_ptr frag = alloc_size_message(header + chunk);
+    if (!frag) return O2_FAIL;
+    // id and length, then index and count
+    int32_t *words = (int32_t *) o2_wrap_header(frag, '$', frag_id++,
+                                                msg->length);
+    words[1] = htonl(count);
+    char *data = (char *) &msg->data;
+    int err = O2_SUCCESS;
+    for (int i = 0; i < count && !err; i++) {
+        int n = (i < count - 1 ? chunk : msg->length - i * chunk);
+        words[0] = htonl(i);
+        memcpy(((char *) &frag->data) + header, data + i * chunk, n);
+        err = send_udp_packet(proc, &frag->data, header + n);
+    }
+    o2_free_message(frag);
+    return err;
+}
+
+
+// Free the slot. Its message buffer is kept for the next message
+// unless it is large.
+//
+static void frag_free(frag_slot_ptr slot)
+{
+    if (slot->msg && slot->msg->allocated > FRAG_KEEP_SIZE) {
+        o2_free_message(slot->msg);
+        slot->msg = NULL;
+    }
+    slot->proc = NULL;
+}
+
+
+// Find the slot for message id from proc, or start one.
+//
+static frag_slot_ptr frag_find(process_info_ptr proc, uint32_t id,
+                               int total, int count)
+{
+    frag_slot_ptr slot = NULL;
+    frag_slot_ptr oldest_own = NULL; // proc's oldest slot
+    int own = 0; // number of slots held by proc
+    for (int i = 0; i < FRAG_SLOTS; i++) {
+        frag_slot_ptr s = &frag_slots[i];
+        // check for expiration first so that a late fragment cannot
+        // complete a message that has timed out
+        if (s->proc && o2_local_now - s->start > FRAG_TIMEOUT) {
+            frag_free(s); // expired: some fragment was lost
+        } else if (s->proc == proc && s->id == id) {
+            return s;
+        } else if (s->proc == proc) {
+            own++;
+            if (!oldest_own || s->start < oldest_own->start) oldest_own = s;
+        }
+        // use a free slot, or else the oldest one
+        if (!slot || (slot->proc && (!s->proc || s->start < slot->start))) {
+            slot = s;
+        }
+    }
+    if (own >= FRAG_SENDER_SLOTS) slot = oldest_own;
+    frag_free(slot);
+    if (slot->got_size < count) {
+        if (slot->got) O2_FREE(slot->got);
+        slot->got_size = 0;
+        slot->got = (char *) O2_MALLOC(count);
+        if (!slot->got) return NULL;
+        slot->got_size = count;
+    }
+    if (slot->msg && slot->msg->allocated < total) {
+        o2_free_message(slot->msg);
+        slot->msg = NULL;
+    }
+    if (!slot->msg && !(slot->msg = alloc_size_message(total))) return NULL;
+    slot->msg->length = total;
+    memset(slot->got, 0, count);
+    slot->proc = proc;
+    slot->id = id;
+    slot->count = count;
+    slot->missing = count;
+    slot->start = o2_local_now;
+    return slot;
+}
+
+
+o2_message_ptr o2_frag_receive(o2_message_ptr frag)
+{
+    o2_message_ptr msg = NULL;
+    char *p = frag->data.address;
+    int avail = frag->length - (int) sizeof(double);
+    // the name must end within the fragment
+    if (avail <= 4 || !memchr(p + 4, 0, avail - 4)) goto done;
+    int header = 4 + o2_strsize(p + 4) + 16;
+    if (header > avail) goto done;
+    generic_entry_ptr entry = o2_find_service(p + 4);
+    if (!entry || entry->tag != O2_REMOTE_SERVICE) goto done;
+    process_info_ptr proc = ((remote_service_entry_ptr) entry)->parent;
+    int32_t words[4];
+    memcpy(words, p + header - 16, 16);
+    uint32_t id = ntohl(words[0]);
+    int total = ntohl(words[1]);
+    int index = ntohl(words[2]);
+    int count = ntohl(words[3]);
+    int n = avail - header;
+    if (total < (int) sizeof(double) + 4 || total > O2_MAX_MSG_SIZE ||
+        count < 1 || count > total || index < 0 || index >= count) {
+        goto done; // malformed
+    }
+    int chunk = (total + count - 1) / count;
+    if (n != (index < count - 1 ? chunk : total - index * chunk)) goto done;
+    frag_slot_ptr slot = frag_find(proc, id, total, count);
+    if (!slot || slot->msg->length != total || slot->count != count ||
+        slot->got[index]) {
+        goto done; // no memory, inconsistent, or a duplicate
+    }
+    memcpy(((char *) &slot->msg->data) + index * chunk, p + header, n);
+    slot->got[index] = TRUE;
+    if (--slot->missing == 0) {
+        msg = slot->msg;
+        slot->msg = NULL;
+        frag_free(slot);
+    }
+  done:
+    o2_free_message(frag);
+    return msg;
+}
+
+
+void o2_frag_remove(process_info_ptr proc)
+{
+    for (int i = 0; i < FRAG_SLOTS; i++) {
+        if (frag_slots[i].proc == proc) frag_free(&frag_slots[i]);
+    }
+}
+
+
+void o2_frag_finish()
+{
+    for (int i = 0; i < FRAG_SLOTS; i++) {
+        frag_slot_ptr slot = &frag_slots[i];
+        if (slot->msg) o2_free_message(slot->msg);
+        if (slot->got) O2_FREE(slot->got);
+        memset(slot, 0, sizeof(frag_slot));
+    }
+}
+
+
+// send msg to proc now, by TCP or UDP. msg is freed.
+//
+static int send_to_process(process_info_ptr proc, o2_message_ptr msg,
+                           int tcp_flag)
+{
+    if (tcp_flag) {
+        return send_by_tcp_to_process(proc, msg);
+    }
+    // fragments are copies, so a message that is fragmented can hold
+    // its blobs as well
+    if (msg->refs && o2_udp_mtu_bytes > 0 &&
+        o2_message_wire_length(msg) > o2_udp_mtu_bytes &&
+        !(msg = o2_flatten_message(msg))) {
+        return O2_FAIL;
+    }
+    int err = o2_send_udp(proc, msg);
+    o2_free_message(msg);
+    return err;
+}
+
+
+/* Coalescing
+
+With o2_coalesce_messages(), messages to a remote process are held
+in a frame, one for UDP and one for TCP, instead of being sent one
+at a time. A frame is a bundle addressed to "#" (no service) whose
+messages keep their own timestamps; the receiver takes it apart in
+deliver_or_schedule(). A frame is sent when the next message does
+not fit, when its oldest message has waited o2_coalesce_latency
+(checked by o2_coalesce_poll() at the end of o2_poll()), or by
+o2_flush(). UDP frames fit in one Ethernet packet; TCP frames can
+be larger since TCP splits them anyway. A message marked O2_LATEST
+replaces a held message to the same address with the same timestamp
+in its frame; a message for another time is still sent.
+*/
+
+// most bytes of message data (after the timestamp) in a UDP frame:
+// the Ethernet MTU less IP and UDP headers, less the timestamp
+#define COALESCE_UDP_BYTES (1500 - 20 - 8 - 8)
+// most bytes of message data in a TCP frame
+#define COALESCE_TCP_BYTES 16384
+// the frame address "#" padded to 4 bytes
+#define COALESCE_HEADER 4
+
+double o2_coalesce_latency = -1.0; // negative: do not coalesce
+
+// processes with frames to send
+static dyn_array coalesce_procs;
+
+
+// Send the frame at *frame_ptr (if any) to proc. The frame is freed
+//   and *frame_ptr is set to NULL.
+//
+static int send_frame(process_info_ptr proc, o2_message_ptr *frame_ptr,
+                      int tcp_flag)
+{
+    o2_message_ptr frame = *frame_ptr;
+    if (!frame) return O2_SUCCESS;
+    *frame_ptr = NULL;
+    // the connection may have closed since the messages were sent
+    if (tcp_flag && proc->tcp_fd_index < 0 && o2_lazy_connect(proc)) {
+        o2_free_message(frame);
+        return O2_FAIL;
+    }
+    return send_to_process(proc, frame, tcp_flag);
+}
+
+
+// Add msg to the UDP or TCP frame for proc. msg is freed.
+//
+static int coalesce(process_info_ptr proc, o2_message_ptr msg, int tcp_flag)
+{
+    o2_message_ptr *frame_ptr = tcp_flag ? &proc->tcp_frame :
+                                           &proc->udp_frame;
+    int limit = tcp_flag ? COALESCE_TCP_BYTES : COALESCE_UDP_BYTES;
+    int size = 4 + msg->length; // the length, then the message
+    if (*frame_ptr &&
+        (*frame_ptr)->length + size > limit + (int) sizeof(double) &&
+        send_frame(proc, frame_ptr, tcp_flag)) {
+        o2_free_message(msg); // proc may be gone
+        return O2_FAIL;
+    }
+    if (COALESCE_HEADER + size > limit) { // too big to share a frame
+        return send_to_process(proc, msg, tcp_flag);
+    }
+    if (!*frame_ptr) {
+        o2_message_ptr frame = alloc_message();
+        if (!frame) {
+            o2_free_message(msg);
+            return O2_FAIL;
+        }
+        frame->data.timestamp = 0.0;
+        memcpy(frame->data.address, "#\0\0\0", COALESCE_HEADER);
+        frame->length = sizeof(double) + COALESCE_HEADER;
+        *frame_ptr = frame;
+        if (!proc->udp_frame || !proc->tcp_frame) { // no older frame
+            proc->frame_time = o2_local_time();
+        }
+        if (!proc->frame_listed) {
+            DA_APPEND(coalesce_procs, process_info_ptr, proc);
+            proc->frame_listed = TRUE;
+        }
+    }
+    // a newer value replaces a held one to the same address
+    *frame_ptr = (msg->flags & O2_LATEST) ?
+                 o2_bundle_replace(*frame_ptr, msg) :
+                 o2_bundle_append(*frame_ptr, msg);
+    return O2_SUCCESS;
+}
+
+
+// Send the frames of the process at index i in coalesce_procs and
+//   remove it from the list.
+//
+static void flush_process(int i)
+{
+    process_info_ptr proc = *DA_GET(coalesce_procs, process_info_ptr, i);
+    *DA_GET(coalesce_procs, process_info_ptr, i) =
+            *DA_LAST(coalesce_procs, process_info_ptr);
+    coalesce_procs.length--;
+    proc->frame_listed = FALSE;
+    send_frame(proc, &proc->udp_frame, FALSE);
+    send_frame(proc, &proc->tcp_frame, TRUE);
+}
+
+
+int o2_coalesce_messages(double max_latency)
+{
+    if (max_latency < 0) {
+        o2_flush();
+    }
+    if (!coalesce_procs.allocated) {
+        DA_INIT(coalesce_procs, process_info_ptr, 4);
+    }
+    o2_coalesce_latency = max_latency;
+    return O2_SUCCESS;
+}
+
+
+int o2_flush()
+{
+    // sending may remove a process (see send_by_tcp_to_process()),
+    // which takes it out of the list, so always take the last one
+    while (coalesce_procs.length > 0) {
+        flush_process(coalesce_procs.length - 1);
+    }
+    o2_bulk_drain();
+    return O2_SUCCESS;
+}
+
+
+void o2_coalesce_poll()
+{
+    for (int i = coalesce_procs.length - 1; i >= 0; i--) {
+        if (i >= coalesce_procs.length) continue; // list got shorter
+        process_info_ptr proc = *DA_GET(coalesce_procs, process_info_ptr, i);
+        if (o2_local_now - proc->frame_time >= o2_coalesce_latency) {
+            flush_process(i);
+        }
+    }
+}
+
+
+void o2_coalesce_remove(process_info_ptr proc)
+{
+    if (proc->frame_listed) {
+        for (int i = 0; i < coalesce_procs.length; i++) {
+            if (*DA_GET(coalesce_procs, process_info_ptr, i) == proc) {
+                *DA_GET(coalesce_procs, process_info_ptr, i) =
+                        *DA_LAST(coalesce_procs, process_info_ptr);
+                coalesce_procs.length--;
+                break;
+            }
+        }
+        proc->frame_listed = FALSE;
+    }
+    if (proc->udp_frame) o2_free_message(proc->udp_frame);
+    if (proc->tcp_frame) o2_free_message(proc->tcp_frame);
+    proc->udp_frame = proc->tcp_frame = NULL;
+}
+
+
+/* Bulk lane
+
+With o2_bulk_lane(), large TCP messages to a remote process (and
+those marked O2_BULK) do not go straight into the TCP stream, where
+a megabyte blob would hold up every message behind it. They wait in
+the bulk queue of the process and are sent in chunks of at most
+BULK_CHUNK bytes, o2_bulk_bytes_per_poll bytes per process each time
+o2_poll() runs. Other messages are sent immediately as before, so
+they wait behind at most one chunk, and bulk data gets a fixed share
+of each poll period.
+
+A chunk is a message addressed to "%" (padded), followed by the
+length of the whole message and the offset of the chunk (int32s in
+network order), then the bytes of the chunk. The receiver puts the
+message together in bulk_in of the process (see o2_bulk_receive())
+and delivers it after the last chunk. A process sends one bulk
+message at a time over one connection, so chunks arrive in order.
+*/
+
+#define BULK_CHUNK 8192
+#define BULK_HEADER 12 // "%" padded, length, offset
+
+int o2_bulk_threshold = -1; // negative: no bulk lane
+int o2_bulk_bytes_per_poll = 0;
+
+// processes with bulk messages to send
+static dyn_array bulk_procs;
+
+
+// Send the next chunk of the first message in proc's bulk queue.
+//   Returns the number of bytes sent, or -1 if sending failed, in
+//   which case proc may have been removed.
+//
+static int send_bulk_chunk(process_info_ptr proc)
+{
+    o2_message_ptr msg = proc->bulk_head;
+    if (proc->tcp_fd_index < 0 && o2_lazy_connect(proc)) {
+        return -1;
+    }
+    int offset = proc->bulk_sent;
+    int n = msg->length - offset;
+    if (n > BULK_CHUNK) n = BULK_CHUNK;
+    o2_message_ptr chunk = alloc_size_message(sizeof(double) +
+                                              BULK_HEADER + n);
+    if (!chunk) return -1;
+    chunk->data.timestamp = 0.0;
+    char *data = chunk->data.address;
+    memcpy(data, "%\0\0\0", 4);
+    int32_t word = htonl(msg->length);
+    memcpy(data + 4, &word, 4);
+    word = htonl(offset);
+    memcpy(data + 8, &word, 4);
+    memcpy(data + BULK_HEADER, ((char *) &msg->data) + offset, n);
+    chunk->length = sizeof(double) + BULK_HEADER + n;
+    if (send_by_tcp_to_process(proc, chunk)) {
+        // without lazy connections, proc and its queue are gone. With
+        // them, proc remains and msg is still first in the queue: start
+        // it over on the next connection, where its first chunk
+        // replaces what the receiver has put together so far
+        if (o2_lazy_flag) proc->bulk_sent = 0;
+        return -1;
+    }
+    // msg leaves the queue only after its last chunk is sent
+    proc->bulk_sent += n;
+    if (proc->bulk_sent >= msg->length) {
+        proc->bulk_head = msg->next;
+        proc->bulk_sent = 0;
+        o2_free_message(msg);
+    }
+    return n;
+}
+
+
+// Send up to budget bytes (all if budget < 0) from the bulk queue of
+//   the process at index i in bulk_procs, and take the process off
+//   the list when its queue is empty.
+//
+static void serve_bulk(int i, int budget)
+{
+    process_info_ptr proc = *DA_GET(bulk_procs, process_info_ptr, i);
+    int sent = 0;
+    while (proc->bulk_head && (budget < 0 || sent < budget)) {
+        int n = send_bulk_chunk(proc);
+        if (n < 0) return; // proc may be gone; try again next poll
+        sent += n;
+    }
+    if (!proc->bulk_head) {
+        *DA_GET(bulk_procs, process_info_ptr, i) =
+                *DA_LAST(bulk_procs, process_info_ptr);
+        bulk_procs.length--;
+        proc->bulk_listed = FALSE;
+    }
+}
+
+
+// Put msg at the end of proc's bulk queue.
+//
+static int bulk_enqueue(process_info_ptr proc, o2_message_ptr msg)
+{
+    if (msg->length > O2_MAX_MSG_SIZE) { // see o2_bulk_receive()
+        o2_free_message(msg);
+        return O2_FAIL;
+    }
+    msg->next = NULL;
+    if (proc->bulk_head) {
+        proc->bulk_tail->next = msg;
+    } else {
+        proc->bulk_head = msg;
+        proc->bulk_sent = 0;
+    }
+    proc->bulk_tail = msg;
+    if (!proc->bulk_listed) {
+        DA_APPEND(bulk_procs, process_info_ptr, proc);
+        proc->bulk_listed = TRUE;
+    }
+    return O2_SUCCESS;
+}
+
+
+int o2_bulk_lane(int threshold, int bytes_per_poll)
+{
+    if (!bulk_procs.allocated) {
+        DA_INIT(bulk_procs, process_info_ptr, 4);
+    }
+    if (threshold < 0) { // no more lane: send what is queued
+        o2_bulk_drain();
+    }
+    o2_bulk_threshold = threshold;
+    o2_bulk_bytes_per_poll = (bytes_per_poll > 0 ? bytes_per_poll :
+                              BULK_CHUNK);
+    return O2_SUCCESS;
+}
+
+
+void o2_bulk_poll()
+{
+    for (int i = bulk_procs.length - 1; i >= 0; i--) {
+        if (i >= bulk_procs.length) continue; // list got shorter
+        serve_bulk(i, o2_bulk_bytes_per_poll);
+    }
+}
+
+
+void o2_bulk_drain()
+{
+    // if a connection fails, the rest is left for o2_bulk_poll()
+    for (int i = bulk_procs.length - 1; i >= 0; i--) {
+        if (i >= bulk_procs.length) continue; // list got shorter
+        serve_bulk(i, -1);
+    }
+}
+
+
+void o2_bulk_remove(process_info_ptr proc)
+{
+    if (proc->bulk_listed) {
+        for (int i = 0; i < bulk_procs.length; i++) {
+            if (*DA_GET(bulk_procs, process_info_ptr, i) == proc) {
+                *DA_GET(bulk_procs, process_info_ptr, i) =
+                        *DA_LAST(bulk_procs, process_info_ptr);
+                bulk_procs.length--;
+                break;
+            }
+        }
+        proc->bulk_listed = FALSE;
+    }
+    while (proc->bulk_head) {
+        o2_message_ptr msg = proc->bulk_head;
+        proc->bulk_head = msg->next;
+        o2_free_message(msg);
+    }
+    if (proc->bulk_in) o2_free_message(proc->bulk_in);
+    proc->bulk_in = NULL;
+}
+
+
+o2_message_ptr o2_bulk_receive(process_info_ptr proc, o2_message_ptr chunk)
+{
+    char *data = chunk->data.address;
+    int n = chunk->length - (int) sizeof(double) - BULK_HEADER;
+    int32_t total, offset;
+    o2_message_ptr msg = NULL;
+    if (!proc || n < 0) goto done; // malformed chunk: no header
+    memcpy(&total, data + 4, 4);
+    total = ntohl(total);
+    memcpy(&offset, data + 8, 4);
+    offset = ntohl(offset);
+    // total is not allocated unless it is a size that could be sent
+    if (total < (int) sizeof(double) + 4 || total > O2_MAX_MSG_SIZE ||
+        offset < 0 || offset > total - n) {
+        goto done; // malformed chunk
+    }
+    if (offset == 0) { // first chunk: a new message
+        if (proc->bulk_in) o2_free_message(proc->bulk_in);
+        proc->bulk_in = alloc_size_message(total);
+        if (!proc->bulk_in) goto done;
+        proc->bulk_in->length = total;
+        proc->bulk_in_got = 0;
+    }
+    if (!proc->bulk_in || proc->bulk_in->length != total ||
+        proc->bulk_in_got != offset) { // lost the start of the message
+        goto done;
+    }
+    memcpy(((char *) &proc->bulk_in->data) + offset, data + BULK_HEADER, n);
+    proc->bulk_in_got += n;
+    if (proc->bulk_in_got == total) {
+        msg = proc->bulk_in;
+        proc->bulk_in = NULL;
+    }
+  done:
+    o2_free_message(chunk);
+    return msg;
+}
+
+
 int o2_send_message(o2_message_ptr msg, int tcp_flag)
 {
     // Find the remote service, note that we skip over the leading '/':
@@ -156,32 +932,76 @@ int o2_send_message(o2_message_ptr msg, int tcp_flag)
         o2_free_message(msg);
         return O2_FAIL;
     }
+    return o2_send_to_service(service, msg, tcp_flag);
+}
+
+
+int o2_send_to_service(generic_entry_ptr service, o2_message_ptr msg,
+                       int tcp_flag)
+{
+    // count uses of shared memory, or copy it for other hosts
+    if (o2_shmem_count > 0 &&
+        !(msg = o2_shmem_send_prepare(msg, service, &tcp_flag))) {
+        return O2_FAIL;
+    }
     // Local delivery?
     if (service->tag == PATTERN_NODE) {
-        // TODO: test if o2_get_time() is operational?
-        // future?
-        if (msg->data.timestamp > o2_get_time()) {
-            o2_schedule(&o2_ltsched, msg);
+        // handlers get blobs in the message
+        if (msg->refs && !(msg = o2_flatten_message(msg))) return O2_FAIL;
+        // timestamps are global time: as in deliver_or_schedule(),
+        // future messages wait on o2_gtsched (before clock sync,
+        // there is no global time, so the message is delivered now)
+        if (msg->data.timestamp > 0.0 && o2_gtsched_started &&
+            msg->data.timestamp > o2_global_now) {
+            o2_schedule(&o2_gtsched, msg);
         } else { // send it now
             find_and_call_handlers(msg);
         }
         return O2_SUCCESS;
-    } else if (service->tag == O2_REMOTE_SERVICE) { // send the message to remote process
+    } else if (service->tag == O2_REMOTE_SERVICE ||
+               service->tag == O2_BRIDGE_SERVICE) {
+        // send the message to remote process, or for a bridged
+        // service, to the hub that forwards it
         remote_service_entry_ptr rse = (remote_service_entry_ptr) service;
         process_info_ptr proc = rse->parent;
-        if (tcp_flag) {
-            send_by_tcp_to_process(proc, msg);
-        } else { // send via UDP
-            // printf(" +    %s normal udp msg to %s, port %d, ip %x\n", debug_prefix, msg->data.address, ntohs(proc->udp_sa.sin_port), ntohl(proc->udp_sa.sin_addr.s_addr));
-            if (sendto(local_send_sock, &(msg->data), msg->length,
-                       0, (struct sockaddr *) &(proc->udp_sa),
-                       sizeof(proc->udp_sa)) < 0) {
-                perror("o2_send_message");
-                return O2_FAIL;
-            }
+        // with lazy connections, connect on first use
+        if (tcp_flag && proc->tcp_fd_index < 0 && o2_lazy_connect(proc)) {
+            o2_free_message(msg);
+            return O2_FAIL;
+        }
+        // O2's own messages (services "_o2", "_cs", ip:port, ...) are
+        // never held or put in the bulk lane, so that clock sync round
+        // trips are not delayed
+        char c = msg->data.address[1];
+        // only messages sent directly by send_to_process() can send
+        // referenced blobs from the application's memory: the others
+        // are copied into packets, frames and chunks anyway
+        if (msg->refs && (!SEND_REFS || o2_bulk_threshold >= 0 ||
+                          o2_coalesce_latency >= 0 ||
+                          (!tcp_flag && (msg->flags & O2_RELIABLE))) &&
+            !(msg = o2_flatten_message(msg))) {
+            return O2_FAIL;
         }
+        if (!tcp_flag && (msg->flags & O2_RELIABLE)) {
+            return o2_rudp_send(proc, msg);
+        }
+        if (tcp_flag && o2_bulk_threshold >= 0 && c != '_' && !isdigit(c) &&
+            ((msg->flags & O2_BULK) ||
+             (o2_bulk_threshold > 0 && msg->length > o2_bulk_threshold))) {
+            return bulk_enqueue(proc, msg);
+        }
+        if (o2_coalesce_latency >= 0 && c != '_' && !isdigit(c)) {
+            return coalesce(proc, msg, tcp_flag);
+        }
+        if (tcp_flag && proc->tcp_frame && // keep TCP messages in order
+            send_frame(proc, &proc->tcp_frame, TRUE)) {
+            o2_free_message(msg); // proc may be gone
+            return O2_FAIL;
+        }
+        return send_to_process(proc, msg, tcp_flag);
     } else if (service->tag == OSC_REMOTE_SERVICE) {
-        send_osc(service, msg);
+        if (msg->refs && !(msg = o2_flatten_message(msg))) return O2_FAIL;
+        return o2_send_osc((osc_entry_ptr) service, msg);
     } else {
         assert(FALSE);
     }
@@ -210,43 +1030,4 @@ int o2_send_bundle_from(struct remote_process *p, o2_service_ptr from, o2_bundle
     return ret;
 }
 
-// From http://tools.ietf.org/html/rfc1055
-#define SLIP_END        0300    /* indicates end of packet */
-#define SLIP_ESC        0333    /* indicates byte stuffing */
-#define SLIP_ESC_END    0334    /* ESC ESC_END means END data byte */
-#define SLIP_ESC_ESC    0335    /* ESC ESC_ESC means ESC data byte */
-
-static unsigned char *slip_encode(const unsigned char *data,
-                                  size_t *data_len)
-{
-    size_t i, j = 0, len=*data_len;
-    unsigned char *slipdata = O2_MALLOC(len*2);
-    for (i=0; i<len; i++) {
-        switch (data[i])
-        {
-            case SLIP_ESC:
-                slipdata[j++] = SLIP_ESC;
-                slipdata[j++] = SLIP_ESC_ESC;
-                break;
-            case SLIP_END:
-                slipdata[j++] = SLIP_ESC;
-                slipdata[j++] = SLIP_ESC_END;
-                break;
-            default:
-                slipdata[j++] = data[i];
-        }
-    }
-    slipdata[j++] = SLIP_END;
-    slipdata[j] = 0;
-    *data_len = j;
-    return slipdata;
-}
-
-
 #endif
-
-void send_osc(generic_entry_ptr service, o2_message_ptr msg)
-{
-    // TODO: finish
-    printf("ERROR! send_osc\n");
-}
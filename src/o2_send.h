@@ -51,8 +51,101 @@ int o2_add_data(char *ptr, const char *typestring, va_list ap);
 int check_buffer_size(int i);
 void find_empty_buffer();
 
-void send_osc(generic_entry_ptr service, o2_message_ptr msg);
-
 int send_by_tcp_to_process(process_info_ptr proc, o2_message_ptr msg);
 
+/**
+ *  Like o2_send_message(), but the service entry for the address of msg
+ *  has already been found with o2_find_service(). msg is sent as is,
+ *  so a received message can be passed on without copying.
+ */
+int o2_send_to_service(generic_entry_ptr service, o2_message_ptr msg,
+                       int tcp_flag);
+
+/// UDP messages to remote processes longer than this are sent in
+/// fragments (see o2_udp_mtu()); 0 for no fragmentation
+extern int o2_udp_mtu_bytes;
+
+/**
+ *  Send msg to proc by UDP, in fragments if it is longer than
+ *  o2_udp_mtu_bytes. msg is not freed. A message that refers to blobs
+ *  (see o2_add_blob_ref()) is sent in one packet.
+ *
+ *  @return O2_SUCCESS if succeed, O2_FAIL if not.
+ */
+int o2_send_udp(process_info_ptr proc, o2_message_ptr msg);
+
+/// bytes of message data taken by o2_wrap_header()
+#define O2_WRAP_HEADER_SIZE \
+    ((int) sizeof(double) + 4 + o2_strsize(o2_process.name) + 8)
+
+/**
+ *  Write the header of a fragment ('$'), a reliable UDP packet ('&')
+ *  or a stream chunk ('~') at the start of msg, which must have room
+ *  for O2_WRAP_HEADER_SIZE bytes of data: a timestamp of 0, marker
+ *  (padded), the name of this process (padded), and a and b (in
+ *  network order). msg->length is not changed.
+ *
+ *  @return the address after the header.
+ */
+char *o2_wrap_header(o2_message_ptr msg, char marker, int32_t a, int32_t b);
+
+/**
+ *  Add a fragment of a UDP message (a message addressed to "$").
+ *  frag is freed.
+ *
+ *  @return the whole message after its last fragment, otherwise NULL.
+ */
+o2_message_ptr o2_frag_receive(o2_message_ptr frag);
+
+/**
+ *  Drop the partly received messages from proc, which is being removed.
+ */
+void o2_frag_remove(process_info_ptr proc);
+
+/**
+ *  Free the buffers kept for fragmented messages, called by o2_finish().
+ */
+void o2_frag_finish();
+
+/// max latency of o2_coalesce_messages(), negative if not coalescing
+extern double o2_coalesce_latency;
+
+/**
+ *  Send the messages held by o2_coalesce_messages() that have waited
+ *  o2_coalesce_latency. Called at the end of o2_poll().
+ */
+void o2_coalesce_poll();
+
+/**
+ *  Free the messages held for proc, which is being removed.
+ */
+void o2_coalesce_remove(process_info_ptr proc);
+
+/// messages longer than this go in the bulk lane (see o2_bulk_lane());
+/// 0 for only messages marked O2_BULK, negative if there is no lane
+extern int o2_bulk_threshold;
+
+/**
+ *  Send the next chunks of bulk messages. Called at the end of o2_poll().
+ */
+void o2_bulk_poll();
+
+/**
+ *  Send all queued bulk messages now, unless a connection fails.
+ */
+void o2_bulk_drain();
+
+/**
+ *  Free the bulk messages to and from proc, which is being removed.
+ */
+void o2_bulk_remove(process_info_ptr proc);
+
+/**
+ *  Add a chunk of a bulk message from proc (a message addressed to "%").
+ *  chunk is freed.
+ *
+ *  @return the whole message after its last chunk, otherwise NULL.
+ */
+o2_message_ptr o2_bulk_receive(process_info_ptr proc, o2_message_ptr chunk);
+
 #endif /* o2_send_h */
@@ -0,0 +1,550 @@
+//  o2_shmem.c -- shared memory arguments
+//
+//  agent, 2026
+//
+/* Design notes:
+ *    Sending a 4MB video frame through a socket to a process on the
+ * same host copies it into the kernel and out again. o2_shmem_new()
+ * instead creates a POSIX shared memory segment named
+ * "/o2-<tcp port>-<id>", where the TCP port identifies the creating
+ * process (the owner) on the host. o2_add_shmem() adds an 'H'
+ * argument (an o2_shmem_arg) that names the segment by owner and id,
+ * with the offset and size of the data, and 8 bytes that the
+ * receiver fills in with the address of the data.
+ *
+ *    Uses of a segment are counted by the owner: 1 for the owner
+ * itself, until o2_shmem_release(), and 1 for each 'H' argument of
+ * each message that is sent to a local service or to a process on
+ * this host (o2_shmem_send_prepare()). A process is on this host if
+ * its name has the IP address of this process. Such messages are
+ * always sent by TCP, so that the receiver knows which process sent
+ * them. Messages to other processes, and to OSC servers, get blobs
+ * with copies of the data instead (o2_shmem_inline()), and so do
+ * messages added to bundles.
+ *
+ *    A receiver only trusts an 'H' argument that names a segment of
+ * the process that sent the message by TCP: deliver_or_schedule()
+ * calls o2_shmem_received(), which clears the owner of any other
+ * argument (and the data fields of all of them), so that such an
+ * argument is never mapped and no use is given up for it. Otherwise
+ * any process could map, or free, another process's segments.
+ *
+ *    When a message is delivered, dispatch_message() calls
+ * o2_shmem_attach(), which maps the data of each 'H' argument
+ * (read-only) with shm_open() and mmap() and sets the data field,
+ * and afterward o2_shmem_detach(), which unmaps it and sends the
+ * owner a !ip:port/sr message ("i" segment id) for each argument.
+ * The owner's /sr handler counts down the uses and frees the segment
+ * (munmap() and shm_unlink()) when there are none left. The owner
+ * delivers its own messages from its own mapping. A message that is
+ * dropped instead of delivered (malformed, timed before clock sync,
+ * or replaced by an O2_LATEST message) gives up its uses with
+ * o2_shmem_detach() too. A hub forwards a copy of the data
+ * (o2_shmem_forward()), since the next receiver only trusts segments
+ * of the process that sent it the message.
+ *
+ *    Segments are passed by name rather than as file descriptors
+ * (memfd_create() and SCM_RIGHTS) because these exist only on Linux,
+ * need a Unix domain socket beside the TCP connection, and the
+ * descriptor could arrive after the message. There is no shared
+ * memory on Windows: o2_shmem_new() returns NULL.
+ */
+
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+#include "o2_shmem.h"
+#include "o2_vector.h"
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+struct o2_shmem {
+    int id;             // identifies the segment to the owner
+    char *base;         // address of the segment
+    uint32_t size;      // size of the segment
+    int refs;           // uses of the segment (see o2_shmem_refs())
+};
+
+int o2_shmem_count = 0;
+
+// segments created by this process
+static dyn_array segments;
+static int next_segment_id = 0;
+
+// the TCP port of the process that sent the message being checked by
+// o2_shmem_received(), or 0
+static int received_from = 0;
+
+
+// Get the name of segment id of the process with TCP port owner.
+//
+static void segment_name(char *name, int owner, int id)
+{
+#ifndef WIN32
+    snprintf(name, 32, "/o2-%d-%d", owner, id);
+#else
+    _snprintf(name, 32, "/o2-%d-%d", owner, id);
+#endif
+}
+
+
+// Find a segment of this process by id.
+//
+static o2_shmem_ptr find_segment(int id)
+{
+    for (int i = 0; i < segments.length; i++) {
+        o2_shmem_ptr shm = *DA_GET(segments, o2_shmem_ptr, i);
+        if (shm->id == id) return shm;
+    }
+    return NULL;
+}
+
+
+static void free_segment(o2_shmem_ptr shm)
+{
+    for (int i = 0; i < segments.length; i++) {
+        if (*DA_GET(segments, o2_shmem_ptr, i) == shm) {
+            *DA_GET(segments, o2_shmem_ptr, i) =
+                    *DA_LAST(segments, o2_shmem_ptr);
+            segments.length--;
+            break;
+        }
+    }
+    o2_shmem_count = segments.length;
+#ifndef WIN32
+    char name[32];
+    segment_name(name, o2_local_tcp_port, shm->id);
+    munmap(shm->base, shm->size);
+    shm_unlink(name);
+#endif
+    O2_FREE(shm);
+}
+
+
+// Give up one use of shm, and free it if it is no longer used.
+//
+static void segment_unref(o2_shmem_ptr shm)
+{
+    if (--shm->refs <= 0) free_segment(shm);
+}
+
+
+o2_shmem_ptr o2_shmem_new(uint32_t size)
+{
+#ifdef WIN32
+    return NULL;
+#else
+    if (!o2_application_name || size == 0) return NULL;
+    char name[32];
+    int id = next_segment_id++;
+    segment_name(name, o2_local_tcp_port, id);
+    shm_unlink(name); // left by a crashed process that had our port
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return NULL;
+    void *base = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    o2_shmem_ptr shm = NULL;
+    if (base != MAP_FAILED) {
+        shm = (o2_shmem_ptr) O2_MALLOC(sizeof(struct o2_shmem));
+        if (!shm) munmap(base, size);
+    }
+    if (!shm) {
+        shm_unlink(name);
+        return NULL;
+    }
+    shm->id = id;
+    shm->base = (char *) base;
+    shm->size = size;
+    shm->refs = 1;
+    if (!segments.allocated) {
+        DA_INIT(segments, o2_shmem_ptr, 4);
+    }
+    DA_APPEND(segments, o2_shmem_ptr, shm);
+    o2_shmem_count = segments.length;
+    return shm;
+#endif
+}
+
+
+void *o2_shmem_data(o2_shmem_ptr shm)
+{
+    return shm->base;
+}
+
+
+int o2_shmem_refs(o2_shmem_ptr shm)
+{
+    return shm->refs;
+}
+
+
+void o2_shmem_release(o2_shmem_ptr shm)
+{
+    segment_unref(shm);
+}
+
+
+int o2_add_shmem(o2_shmem_ptr shm, uint32_t offset, uint32_t size)
+{
+    if (offset > shm->size || size > shm->size - offset) return O2_FAIL;
+    o2_shmem_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.owner = o2_local_tcp_port;
+    arg.segment = shm->id;
+    arg.offset = offset;
+    arg.size = size;
+    return add_argument(sizeof(arg), &arg, O2_SHMEM);
+}
+
+
+// Get the type string of the message at data, of length bytes (after
+//   the ','), or NULL if it has none.
+//
+static char *data_types(char *data, int length)
+{
+    char *end = data + length;
+    char *types = data + sizeof(double); // the address
+    if (types >= end) return NULL;
+    types += (strnlen(types, end - types) + 4) & ~3;
+    // the message may not be validated yet: the types must end in it
+    if (types >= end || *types != ',' || !memchr(types, 0, end - types)) {
+        return NULL;
+    }
+    return types + 1;
+}
+
+
+static char *message_types(o2_message_ptr msg)
+{
+    return data_types((char *) &msg->data, msg->length);
+}
+
+
+// Get the address after the argument of type t at arg, or NULL if
+//   it ends after end or the type is not known.
+//
+static char *skip_arg(char t, char *arg, char *end)
+{
+    switch (t) {
+      case O2_INT32: case O2_FLOAT: case O2_CHAR: case O2_MIDI:
+        arg += 4;
+        break;
+      case O2_INT64: case O2_TIME: case O2_DOUBLE:
+        arg += 8;
+        break;
+      case O2_STRING: case O2_SYMBOL:
+        if (arg >= end) return NULL;
+        arg += (strnlen(arg, end - arg) + 4) & ~3;
+        break;
+      case O2_BLOB: {
+        if (arg + 4 > end) return NULL;
+        int32_t size;
+        memcpy(&size, arg, 4);
+        if (size < 0) return NULL;
+        arg += 4 + ((size + 3) & ~3);
+        break;
+      }
+      case O2_SHMEM:
+        arg += sizeof(o2_shmem_arg);
+        break;
+      case O2_VECTOR: { // the caller skips the element type
+        if (arg + 8 > end) return NULL;
+        o2_vector_ptr v = (o2_vector_ptr) arg;
+        int size = o2_vector_elem_size((char) v->typ);
+        if (!size || v->len < 0 || v->len > (end - arg - 8) / size) {
+            return NULL;
+        }
+        arg += 8 + v->len * size;
+        break;
+      }
+      case O2_TRUE: case O2_FALSE: case O2_NIL: case O2_INFINITUM:
+        break;
+      default:
+        return NULL;
+    }
+    return arg > end ? NULL : arg;
+}
+
+
+// Call fn for each 'H' argument of the message at data, of length
+//   bytes.
+//
+static void for_each_shmem_in(char *data, int length,
+                              void (*fn)(o2_shmem_arg_ptr arg))
+{
+    char *types = data_types(data, length);
+    if (!types || !strchr(types, O2_SHMEM)) return;
+    char *end = data + length;
+    char *arg = (types - 1) + o2_strsize(types - 1);
+    for (char *t = types; *t && arg; t++) {
+        if (*t == O2_SHMEM && arg + sizeof(o2_shmem_arg) <= end) {
+            (*fn)((o2_shmem_arg_ptr) arg);
+        }
+        arg = skip_arg(*t, arg, end);
+        if (*t == O2_VECTOR && t[1]) t++;
+    }
+}
+
+
+static void for_each_shmem(o2_message_ptr msg,
+                           void (*fn)(o2_shmem_arg_ptr arg))
+{
+    for_each_shmem_in((char *) &msg->data, msg->length, fn);
+}
+
+
+static void count_use(o2_shmem_arg_ptr arg)
+{
+    if (arg->owner != o2_local_tcp_port) return; // not ours to count
+    o2_shmem_ptr shm = find_segment(arg->segment);
+    if (shm) shm->refs++;
+}
+
+
+// Test if proc is on this host, i.e. its name has our IP address.
+//
+static int same_host(process_info_ptr proc)
+{
+    int n = (int) strlen(o2_local_ip);
+    return strncmp(proc->name, o2_local_ip, n) == 0 && proc->name[n] == ':';
+}
+
+
+o2_message_ptr o2_shmem_send_prepare(o2_message_ptr msg,
+                                     generic_entry_ptr service,
+                                     int *tcp_flag)
+{
+    if (msg->data.address[0] == '#') return msg; // see o2_add_message()
+    char *types = message_types(msg);
+    if (!types || !strchr(types, O2_SHMEM)) return msg;
+    if (service->tag == PATTERN_NODE ||
+        (service->tag == O2_REMOTE_SERVICE &&
+         same_host(((remote_service_entry_ptr) service)->parent))) {
+        // the message is a use of each segment until it is delivered
+        if (msg->refs && !(msg = o2_flatten_message(msg))) return NULL;
+        for_each_shmem(msg, &count_use);
+        *tcp_flag = TRUE; // see o2_shmem_received()
+        return msg;
+    }
+    return o2_shmem_inline(msg);
+}
+
+
+// Get the data of the 'H' argument h: from our own segment, or where
+//   o2_shmem_attach() mapped it, or NULL if it is not here.
+//
+static char *shmem_arg_data(o2_shmem_arg_ptr h)
+{
+    if (h->owner == o2_local_tcp_port) {
+        o2_shmem_ptr shm = find_segment(h->segment);
+        return (shm && h->offset <= shm->size &&
+                h->size <= shm->size - h->offset) ?
+               shm->base + h->offset : NULL;
+    }
+    return (char *) h->data;
+}
+
+
+// Copy msg (which has 'H' arguments and no refs) with blobs in place
+//   of the 'H' arguments. msg is not freed.
+//
+static o2_message_ptr shmem_copy(o2_message_ptr msg)
+{
+    char *types = message_types(msg);
+    char *data = (char *) &msg->data;
+    char *end = data + msg->length;
+    char *args = (types - 1) + o2_strsize(types - 1);
+    // find the length with blobs in place of the 'H' arguments
+    int length = msg->length;
+    char *arg = args;
+    for (char *t = types; *t && arg; t++) {
+        if (*t == O2_SHMEM && arg + sizeof(o2_shmem_arg) <= end) {
+            o2_shmem_arg_ptr h = (o2_shmem_arg_ptr) arg;
+            int size = (shmem_arg_data(h) ? h->size : 0);
+            length += 4 + ((size + 3) & ~3) - (int) sizeof(o2_shmem_arg);
+        }
+        arg = skip_arg(*t, arg, end);
+        if (*t == O2_VECTOR && t[1]) t++;
+    }
+    o2_message_ptr copy = alloc_size_message(length);
+    if (!copy) return NULL;
+    // copy the timestamp, address and types, then each argument
+    char *to = (char *) &copy->data;
+    memcpy(to, data, args - data);
+    to += args - data;
+    arg = args;
+    for (char *t = types; *t && arg; t++) {
+        char *next = skip_arg(*t, arg, end);
+        if (*t == O2_SHMEM && next) {
+            o2_shmem_arg_ptr h = (o2_shmem_arg_ptr) arg;
+            char *from = shmem_arg_data(h);
+            uint32_t size = (from ? h->size : 0);
+            int realsize = (size + 3) & ~3;
+            memcpy(to, &size, 4);
+            if (realsize > 0) *((int32_t *) (to + realsize)) = 0;
+            if (from) memcpy(to + 4, from, size);
+            to += 4 + realsize;
+            ((char *) &copy->data)[t - data] = O2_BLOB;
+        } else if (next) {
+            memcpy(to, arg, next - arg);
+            to += next - arg;
+        }
+        if (*t == O2_VECTOR && t[1]) t++;
+        arg = next;
+    }
+    copy->length = (int) (to - (char *) &copy->data);
+    copy->flags = msg->flags;
+    return copy;
+}
+
+
+o2_message_ptr o2_shmem_inline(o2_message_ptr msg)
+{
+    char *types = message_types(msg);
+    if (!types || !strchr(types, O2_SHMEM)) return msg;
+    if (msg->refs && !(msg = o2_flatten_message(msg))) return NULL;
+    o2_message_ptr copy = shmem_copy(msg);
+    o2_free_message(msg);
+    return copy;
+}
+
+
+o2_message_ptr o2_shmem_forward(o2_message_ptr msg)
+{
+    if (!o2_shmem_attach(msg)) return msg;
+    o2_message_ptr copy = shmem_copy(msg);
+    o2_shmem_detach(msg);
+    o2_free_message(msg);
+    return copy;
+}
+
+
+static void clear_unless_sender(o2_shmem_arg_ptr arg)
+{
+    if (arg->owner != received_from) arg->owner = 0; // not trusted
+    arg->data = NULL;
+}
+
+
+void o2_shmem_received(o2_message_ptr msg, process_info_ptr sender)
+{
+    received_from = 0;
+    if (sender && sender->name && same_host(sender)) {
+        received_from = atoi(strchr(sender->name, ':') + 1);
+    }
+    for_each_shmem(msg, &clear_unless_sender);
+}
+
+
+#ifndef WIN32
+static void attach_one(o2_shmem_arg_ptr arg)
+{
+    arg->data = NULL;
+    if (arg->owner <= 0) return; // see o2_shmem_received()
+    if (arg->owner == o2_local_tcp_port) { // our own segment
+        o2_shmem_ptr shm = find_segment(arg->segment);
+        if (shm && arg->offset <= shm->size &&
+            arg->size <= shm->size - arg->offset) {
+            arg->data = shm->base + arg->offset;
+        }
+        return;
+    }
+    if (arg->size == 0) return;
+    char name[32];
+    segment_name(name, arg->owner, arg->segment);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && arg->offset <= st.st_size &&
+        arg->size <= st.st_size - arg->offset) {
+        // map the pages that hold the data
+        uint32_t skip = arg->offset % (uint32_t) sysconf(_SC_PAGESIZE);
+        void *map = mmap(NULL, arg->size + skip, PROT_READ, MAP_SHARED, fd,
+                         arg->offset - skip);
+        if (map != MAP_FAILED) arg->data = ((char *) map) + skip;
+    }
+    close(fd);
+}
+
+
+static void detach_one(o2_shmem_arg_ptr arg)
+{
+    if (arg->owner <= 0) return; // see o2_shmem_received()
+    if (arg->owner == o2_local_tcp_port) {
+        o2_shmem_ptr shm = find_segment(arg->segment);
+        if (shm) segment_unref(shm);
+        return;
+    }
+    if (arg->data) {
+        uint32_t skip = arg->offset % (uint32_t) sysconf(_SC_PAGESIZE);
+        munmap(((char *) arg->data) - skip, arg->size + skip);
+        arg->data = NULL;
+    }
+    // the owner is on this host, so it has our IP address
+    char address[48];
+    snprintf(address, 48, "!%s:%d/sr", o2_local_ip, arg->owner);
+    o2_send_cmd(address, 0.0, "i", arg->segment);
+}
+#endif
+
+
+int o2_shmem_attach(o2_message_ptr msg)
+{
+#ifndef WIN32
+    char *types = message_types(msg);
+    if (!types || !strchr(types, O2_SHMEM)) return FALSE;
+    for_each_shmem(msg, &attach_one);
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+
+void o2_shmem_detach(o2_message_ptr msg)
+{
+#ifndef WIN32
+    for_each_shmem(msg, &detach_one);
+#endif
+}
+
+
+void o2_shmem_detach_data(char *data, int length)
+{
+#ifndef WIN32
+    for_each_shmem_in(data, length, &detach_one);
+#endif
+}
+
+
+int o2_shmem_release_handler(o2_message_ptr msg, const char *types,
+                             o2_arg_ptr *argv, int argc, void *user_data)
+{
+    (void) argv; (void) argc; (void) user_data;
+    o2_arg_ptr id_arg;
+    o2_start_extract_types(msg, types);
+    if (!(id_arg = o2_get_next('i'))) return O2_FAIL;
+    o2_shmem_ptr shm = find_segment(id_arg->i32);
+    if (shm) segment_unref(shm);
+    return O2_SUCCESS;
+}
+
+
+void o2_shmem_finish()
+{
+    while (segments.length > 0) {
+        free_segment(*DA_LAST(segments, o2_shmem_ptr));
+    }
+    if (segments.allocated) DA_FINISH(segments);
+    memset(&segments, 0, sizeof(segments));
+}
@@ -0,0 +1,82 @@
+//  o2_shmem.h -- shared memory arguments
+//
+//  Messages to processes on the same host can pass data in shared
+//  memory segments ('H' arguments). See o2_shmem.c.
+
+#ifndef o2_shmem_h
+#define o2_shmem_h
+
+/// the number of shared memory segments created by this process
+extern int o2_shmem_count;
+
+/**
+ *  Get msg ready to be sent to service: count a use of each segment
+ *  in msg, or if service is not on this host, replace the 'H'
+ *  arguments by blobs with copies of the data. Called by
+ *  o2_send_to_service() when o2_shmem_count > 0. Sets *tcp_flag if
+ *  a message with segments goes to another process, since receivers
+ *  only trust segments of the process of a TCP connection.
+ *
+ *  @return the message (which may be a new one, in which case msg is
+ *          freed), or NULL if memory cannot be allocated.
+ */
+o2_message_ptr o2_shmem_send_prepare(o2_message_ptr msg,
+                                     generic_entry_ptr service,
+                                     int *tcp_flag);
+
+/**
+ *  Replace the 'H' arguments of msg by blobs with copies of the data.
+ *  msg is freed.
+ *
+ *  @return the new message, msg if it has no 'H' arguments, or NULL
+ *          if memory cannot be allocated.
+ */
+o2_message_ptr o2_shmem_inline(o2_message_ptr msg);
+
+/**
+ *  Copy msg, received by a hub, with blobs in place of its 'H'
+ *  arguments, and give up its uses of the segments. msg is freed.
+ *
+ *  @return the new message, msg if it has no 'H' arguments, or NULL
+ *          if memory cannot be allocated.
+ */
+o2_message_ptr o2_shmem_forward(o2_message_ptr msg);
+
+/**
+ *  Check the 'H' arguments of msg, which was just received from
+ *  sender by TCP, or by UDP if sender is NULL: only segments of a
+ *  sender on this host are kept. The others are never mapped, and no
+ *  use of them is given up.
+ */
+void o2_shmem_received(o2_message_ptr msg, process_info_ptr sender);
+
+/**
+ *  Map the shared memory of the 'H' arguments of msg before it is
+ *  delivered, and set their data fields.
+ *
+ *  @return TRUE if msg has 'H' arguments, which must be released by
+ *          o2_shmem_detach() after delivery.
+ */
+int o2_shmem_attach(o2_message_ptr msg);
+
+/**
+ *  Unmap the shared memory of the 'H' arguments of msg, and give up
+ *  the use of the segments counted when msg was sent. Also called for
+ *  a message that is dropped without being delivered.
+ */
+void o2_shmem_detach(o2_message_ptr msg);
+
+/**
+ *  Like o2_shmem_detach(), for the message at data, of length bytes,
+ *  in a bundle (see o2_bundle_replace()).
+ */
+void o2_shmem_detach_data(char *data, int length);
+
+/// /ip:port/sr handler: a message with a segment was delivered
+int o2_shmem_release_handler(o2_message_ptr msg, const char *types,
+                             o2_arg_ptr *argv, int argc, void *user_data);
+
+/// free all segments (called by o2_finish())
+void o2_shmem_finish();
+
+#endif /* o2_shmem_h */
@@ -13,6 +13,13 @@
 #include "o2_internal.h"
 #include "o2_sched.h"
 #include "o2_send.h"
+#include "o2_discovery.h"
+#include "o2_hub.h"
+#include "o2_rudp.h"
+#include "o2_stream.h"
+#include "o2_alias.h"
+#include "o2_compact.h"
+#include "o2_shmem.h"
 
 #ifdef WIN32
 #include <stdio.h> 
@@ -90,8 +97,129 @@ static int detect_windows_service_2003_or_later()
 #endif
 
 
-void deliver_or_schedule(o2_message_ptr msg)
+/* Byte order
+
+Arguments and timestamps are sent in the sender's byte order, while
+lengths and the headers of fragments, chunks and reliable packets are
+in network order. A message from a host with the other byte order is
+marked with O2_SWAP when it is received: by TCP, if the process of
+the connection has the other byte order; by UDP, if the source
+address is one of foreign_hosts, the hosts of such processes (which
+is only looked up if there are any). deliver_or_schedule() passes the
+mark on to the messages in coalesced frames and fragments (streams
+and reliable packets are unwrapped in place) and converts the message
+with o2_msg_swap_received() before it is forwarded, scheduled or
+delivered, so handlers always get host order. Between hosts with the
+same byte order, there is no conversion and no lookup.
+*/
+
+static dyn_array foreign_hosts; // IP addresses (network order)
+
+
+void o2_foreign_host(const char *name)
+{
+    char ip[24];
+    int n = (int) strcspn(name, ":");
+    if (n >= (int) sizeof(ip)) return;
+    memcpy(ip, name, n);
+    ip[n] = 0;
+    struct in_addr addr;
+    if (inet_pton(AF_INET, ip, &addr) != 1) return;
+    if (!foreign_hosts.allocated) {
+        DA_INIT(foreign_hosts, uint32_t, 2);
+    }
+    for (int i = 0; i < foreign_hosts.length; i++) {
+        if (*DA_GET(foreign_hosts, uint32_t, i) == addr.s_addr) return;
+    }
+    DA_APPEND(foreign_hosts, uint32_t, addr.s_addr);
+}
+
+
+void o2_foreign_hosts_finish()
+{
+    if (foreign_hosts.allocated) DA_FINISH(foreign_hosts);
+    memset(&foreign_hosts, 0, sizeof(foreign_hosts));
+}
+
+
+static int is_foreign_host(struct sockaddr_in *sa)
 {
+    for (int i = 0; i < foreign_hosts.length; i++) {
+        if (*DA_GET(foreign_hosts, uint32_t, i) == sa->sin_addr.s_addr) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+// the process of the TCP connection whose message is being delivered
+// by tcp_recv_handler(), or NULL
+static process_info_ptr tcp_sender = NULL;
+
+
+// Deliver or schedule msg as deliver_or_schedule() does. If handler is
+//   not NULL, it is the handler for the address of msg (see
+//   o2_alias_receive()), and is called without looking up the address
+//   if msg is delivered now.
+//
+static void deliver_to(o2_message_ptr msg, int tcp_flag,
+                       handler_entry_ptr handler)
+{
+    int swap = msg->flags & O2_SWAP;
+    if (msg->data.address[0] == '#' && msg->data.address[1] == 0) {
+        // messages coalesced by the sender (see o2_coalesce_messages()):
+        // each one is received as if it came alone
+        int pos = 0;
+        o2_message_ptr element;
+        while ((element = o2_bundle_next(msg, &pos))) {
+            // a sender never puts a frame in a frame, and each level
+            // would recurse here before validation: drop it
+            if (element->data.address[0] == '#' &&
+                element->data.address[1] == 0) {
+                o2_free_message(element);
+                continue;
+            }
+            element->flags |= swap;
+            deliver_or_schedule(element, tcp_flag);
+        }
+        o2_free_message(msg);
+        return;
+    }
+    if (msg->data.address[0] == '$') { // a fragment of a UDP message
+        msg = o2_frag_receive(msg);
+        if (msg) {
+            msg->flags |= swap;
+            deliver_or_schedule(msg, FALSE);
+        }
+        return;
+    }
+    if (msg->data.address[0] == '~') { // a chunk of an o2_stream
+        o2_stream_receive(msg);
+        return;
+    }
+    if (msg->data.address[0] == '&') { // a reliable UDP packet
+        o2_rudp_receive(msg);
+        return;
+    }
+    if (swap) { // from a host with the other byte order
+        msg->flags &= ~O2_SWAP;
+        if (o2_msg_swap_received(msg)) {
+            o2_free_message(msg); // malformed
+            return;
+        }
+    }
+    // shared memory can only be from the process that sent msg by TCP
+    // (see o2_shmem.c)
+    o2_shmem_received(msg, tcp_flag ? tcp_sender : NULL);
+    // nothing from the network reaches a handler (or is forwarded or
+    // scheduled) unless it is well formed
+    if (o2_msg_validate(msg)) {
+        O2_DB(printf("O2: dropped malformed message\n"));
+        o2_shmem_detach(msg); // give up its uses of shared memory
+        o2_free_message(msg);
+        return;
+    }
 #ifndef O2_NO_DEBUGGING
     if (o2_debug > 2 || // non-o2-system messages only if o2_debug <= 2
         (o2_debug > 1 && msg->data.address[1] != '_' &&
@@ -101,20 +229,33 @@ void deliver_or_schedule(o2_message_ptr msg)
             printf("\n");
     }
 #endif
+    // a hub passes messages for remote services on as received
+    if (o2_hub_flag && o2_hub_forward(msg, tcp_flag)) return;
     if (msg->data.timestamp > 0.0) {
-        if (o2_gtsched_started) {
-            if (msg->data.timestamp > o2_global_now) {
-                o2_schedule(&o2_gtsched, msg);
-            } else {
-                find_and_call_handlers(msg);
-            }
-        } // else drop the message, no timestamps allowed before clock sync
+        if (!o2_gtsched_started) {
+            // drop the message, no timestamps before clock sync
+            o2_shmem_detach(msg);
+            o2_free_message(msg);
+            return;
+        } else if (msg->data.timestamp > o2_global_now) {
+            o2_schedule(&o2_gtsched, msg);
+            return;
+        }
+    }
+    if (handler) {
+        o2_deliver_to_handler(handler, msg);
     } else {
         find_and_call_handlers(msg);
     }
 }
 
 
+void deliver_or_schedule(o2_message_ptr msg, int tcp_flag)
+{
+    deliver_to(msg, tcp_flag, NULL);
+}
+
+
 void add_new_socket(SOCKET sock, int tag, process_info_ptr process,
                     int (*handler)(SOCKET sock, struct fds_info *info))
 {
@@ -130,8 +271,15 @@ void add_new_socket(SOCKET sock, int tag, process_info_ptr process,
     info->length_got = 0;
     info->message = NULL;
     info->message_got = 0;
+    info->framing = 0;
+    info->blob_state = BLOB_NONE;
+    info->aliases = NULL;
+    info->types = NULL;
     pfd->fd = sock;
     pfd->events = POLLIN;
+    // o2_recv() may still be looking at revents from its last poll():
+    // clear whatever a removed socket left in this slot
+    pfd->revents = 0;
     // printf("%s: added new socket at %d", debug_prefix, o2_fds.length - 1);
     // if (process == &o2_process) printf(" for local process");
     // if (process) printf(" key %s",  process->name);
@@ -143,6 +291,9 @@ void add_new_socket(SOCKET sock, int tag, process_info_ptr process,
 //
 void o2_remove_socket(int i)
 {
+    fds_info_ptr removed = DA_GET(o2_fds_info, fds_info, i);
+    if (removed->aliases) o2_alias_free(removed->aliases);
+    if (removed->types) o2_compact_free(removed->types);
     if (o2_fds.length > i + 1) { // move last to i
         struct pollfd *fd = DA_LAST(o2_fds, struct pollfd);
         memcpy(DA_GET(o2_fds, struct pollfd, i), fd, sizeof(struct pollfd));
@@ -159,6 +310,53 @@ void o2_remove_socket(int i)
 }
 
 
+// close the TCP connection at index i, but keep the remote process
+//   and its services. Used with lazy connections: the process is
+//   reconnected when a message is sent to it again.
+//
+void o2_close_tcp_socket(int i)
+{
+    fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
+    process_info_ptr proc = info->u.process_info;
+    if (proc && proc->tcp_fd_index == i) {
+        proc->tcp_fd_index = -1;
+        // if both processes connected at the same time, there is
+        // another connection to proc that we can keep using
+        for (int j = 0; j < o2_fds_info.length; j++) {
+            fds_info_ptr other = DA_GET(o2_fds_info, fds_info, j);
+            if (j != i && other->tag == TCP_SOCKET &&
+                other->u.process_info == proc) {
+                proc->tcp_fd_index = j;
+                break;
+            }
+        }
+    }
+    O2_DB(printf("O2: closing connection to %s\n",
+                 proc ? proc->name : "unknown process"));
+    closesocket(DA_GET(o2_fds, struct pollfd, i)->fd);
+    if (info->message) o2_free_message(info->message);
+    o2_remove_socket(i);
+}
+
+
+// the TCP connection at index i was closed by the remote process
+//
+static void tcp_hangup(int i)
+{
+    fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
+    if (info->tag == OSC_TCP_SOCKET) { // an OSC client went away
+        closesocket(DA_GET(o2_fds, struct pollfd, i)->fd);
+        if (info->message) o2_free_message(info->message);
+        O2_FREE(info->u.osc_service_name);
+        o2_remove_socket(i);
+    } else if (info->u.process_info && !o2_lazy_flag) {
+        o2_remove_remote_process(info->u.process_info);
+    } else { // with lazy connections, the process may just be idle
+        o2_close_tcp_socket(i);
+    }
+}
+
+
 static struct sockaddr_in o2_serv_addr;
 
 int bind_recv_socket(SOCKET sock, int *port, int tcp_recv_flag)
@@ -186,8 +384,9 @@ int bind_recv_socket(SOCKET sock, int *port, int tcp_recv_flag)
 }
 
 
-void udp_recv_handler(SOCKET sock, struct fds_info *info)
+int udp_recv_handler(SOCKET sock, struct fds_info *info)
 {
+    (void) info; // one handler serves every UDP socket
     o2_message_ptr msg;
     int len;
 #ifndef WIN32
@@ -196,25 +395,29 @@ void udp_recv_handler(SOCKET sock, struct fds_info *info)
 	if (ioctlsocket(sock, FIONREAD, &len) == -1) {
 #endif
         perror("udp_recv_handler");
-        return;
-    }
-    if (len <= MESSAGE_SIZE_FROM_ALLOCATED(MESSAGE_DEFAULT_SIZE)) {
-        msg = alloc_message();
-    } else {
-        msg = (o2_message_ptr) o2_malloc(MESSAGE_SIZE_FROM_ALLOCATED(len));
+        return O2_FAIL;
     }
-    if (!msg) return;
+    msg = alloc_size_message(len); // uses a default message if len fits
+    if (!msg) return O2_FAIL;
     int n;
-    if ((n = recvfrom(sock, &(msg->data), len, 0, NULL, NULL)) <= 0) {
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    // the source address is only needed to find the byte order
+    if ((n = recvfrom(sock, &(msg->data), len, 0,
+                      foreign_hosts.length ? (struct sockaddr *) &from : NULL,
+                      foreign_hosts.length ? &from_len : NULL)) <= 0) {
         // I think udp errors should be ignored. UDP is not reliable
         // anyway. For now, though, let's at least print errors.
         perror("recvfrom in udp_recv_handler");
-        o2_free_message(info->message);
-        return;
+        o2_free_message(msg);
+        return O2_FAIL;
     }
     msg->length = n;
-    // endian corrections are done in handler
-    deliver_or_schedule(msg);
+    if (foreign_hosts.length && is_foreign_host(&from)) {
+        msg->flags |= O2_SWAP;
+    }
+    deliver_or_schedule(msg, FALSE);
+    return O2_SUCCESS;
 }
 
 
@@ -225,9 +428,209 @@ void tcp_message_cleanup(struct fds_info *info)
     info->message_got = 0;
     info->length = 0;
     info->length_got = 0;
+    info->blob_state = BLOB_NONE;
 }    
 
 
+/* Direct blob receive
+
+With o2_blob_buffer(), a long TCP message to a registered address
+is first read only up to BLOB_PREFIX bytes (state BLOB_START). If
+the prefix holds the address, types and the size of the first blob,
+the provider is asked for memory, and the rest of the message is
+read into three places (state BLOB_DIRECT): the blob data into the
+provider's memory, the blob padding into a scratch word, and the
+arguments after the blob into the message, which is allocated
+without room for the blob. The blob size in the message is set to
+0. Otherwise the message is read as usual (state BLOB_NONE).
+*/
+
+#define BLOB_PREFIX 512
+
+typedef struct blob_buffer {
+    char *path;
+    o2_blob_buffer_fn provider;
+    void *user_data;
+} blob_buffer, *blob_buffer_ptr;
+
+static dyn_array blob_buffers;
+
+
+int o2_blob_buffer(const char *path, o2_blob_buffer_fn provider,
+                   void *user_data)
+{
+    if (path[0] != '/' && path[0] != '!') return O2_FAIL;
+    if (!blob_buffers.allocated) {
+        DA_INIT(blob_buffers, blob_buffer, 4);
+    }
+    for (int i = 0; i < blob_buffers.length; i++) {
+        blob_buffer_ptr bb = DA_GET(blob_buffers, blob_buffer, i);
+        if (streql(bb->path + 1, path + 1)) {
+            if (provider) {
+                bb->provider = provider;
+                bb->user_data = user_data;
+            } else {
+                O2_FREE(bb->path);
+                *bb = *DA_LAST(blob_buffers, blob_buffer);
+                blob_buffers.length--;
+            }
+            return O2_SUCCESS;
+        }
+    }
+    if (!provider) return O2_SUCCESS;
+    blob_buffer bb;
+    bb.path = o2_heapify(path);
+    if (!bb.path) return O2_FAIL;
+    bb.provider = provider;
+    bb.user_data = user_data;
+    DA_APPEND(blob_buffers, blob_buffer, bb);
+    return O2_SUCCESS;
+}
+
+
+void o2_blob_buffers_finish()
+{
+    if (!blob_buffers.allocated) return;
+    for (int i = 0; i < blob_buffers.length; i++) {
+        O2_FREE(DA_GET(blob_buffers, blob_buffer, i)->path);
+    }
+    DA_FINISH(blob_buffers);
+    memset(&blob_buffers, 0, sizeof(blob_buffers));
+}
+
+
+// Find the first blob in the first got bytes of message data. Returns
+//   the offset of the blob data (after the size), or -1 if there is
+//   no blob, or it does not start within got bytes.
+//
+static int find_blob(char *data, int got, int *size)
+{
+    char *end = data + got;
+    char *address = data + sizeof(double);
+    if (!memchr(address, 0, end - address)) return -1;
+    char *types = address + o2_strsize(address);
+    if (types >= end || *types != ',' || !memchr(types, 0, end - types)) {
+        return -1;
+    }
+    char *arg = types + o2_strsize(types);
+    for (types++; *types; types++) {
+        switch (*types) {
+          case 'i': case 'f': case 'c': case 'm':
+            arg += 4;
+            break;
+          case 'h': case 't': case 'd':
+            arg += 8;
+            break;
+          case 's': case 'S':
+            if (arg >= end || !memchr(arg, 0, end - arg)) return -1;
+            arg += o2_strsize(arg);
+            break;
+          case 'T': case 'F': case 'N': case 'I':
+            break;
+          case 'b':
+            if (arg + 4 > end) return -1;
+            memcpy(size, arg, 4);
+            return (int) (arg + 4 - data);
+          default: // no blob, or a type that is not understood here
+            return -1;
+        }
+    }
+    return -1;
+}
+
+
+// Where to put the next bytes of the message from info's socket.
+//   Sets *max to the most bytes that may go there.
+//
+static char *blob_recv_dest(fds_info_ptr info, int *max)
+{
+    int pos = info->message_got;
+    char *data = (char *) &info->message->data;
+    if (info->blob_state != BLOB_DIRECT) {
+        *max = (info->blob_state == BLOB_START ? BLOB_PREFIX :
+                info->length) - pos;
+        return data + pos;
+    }
+    static char pad[4];
+    int blob_end = info->blob_at + info->blob_size;
+    int skip = (info->blob_size + 3) & ~3; // the blob with padding
+    if (pos < blob_end) {
+        *max = blob_end - pos;
+        return info->blob_dest + (pos - info->blob_at);
+    } else if (pos < info->blob_at + skip) {
+        *max = info->blob_at + skip - pos;
+        return pad;
+    }
+    *max = info->length - pos;
+    return data + pos - skip;
+}
+
+
+// Called when the prefix of a message has been read: ask for memory
+//   for the blob, and get ready to read the rest of the message.
+//
+static int blob_start(fds_info_ptr info)
+{
+    o2_message_ptr prefix = info->message;
+    char *data = (char *) &prefix->data;
+    char *dest = NULL;
+    int32_t size;
+    int at = find_blob(data, info->message_got, &size);
+    // the size is in the sender's byte order: O2_SWAP is only applied
+    // by deliver_to(), after the whole message is read
+    if (at >= 0 && info->u.process_info &&
+        info->u.process_info->little_endian != IS_LITTLE_ENDIAN) {
+        size = (int32_t) swap32((uint32_t) size);
+    }
+    // size comes from the peer: compare it before rounding it up,
+    // which could overflow
+    if (at >= 0 && size >= 0 && size <= (int) info->length - at &&
+        ((size + 3) & ~3) <= (int) info->length - at) {
+        const char *address = data + sizeof(double);
+        if (address[0] == '^') { // an alias (see o2_alias.c)
+            address = o2_alias_address(info, address);
+        }
+        for (int i = 0; address && i < blob_buffers.length; i++) {
+            blob_buffer_ptr bb = DA_GET(blob_buffers, blob_buffer, i);
+            if (streql(bb->path + 1, address + 1)) {
+                dest = (char *) (*bb->provider)(address, size, bb->user_data);
+                break;
+            }
+        }
+    }
+    int skip = dest ? (size + 3) & ~3 : 0;
+    info->message = alloc_size_message(info->length - skip);
+    if (!info->message) {
+        o2_free_message(prefix);
+        return O2_FAIL;
+    }
+    if (!dest) { // read the whole message as usual
+        memcpy(&info->message->data, data, info->message_got);
+        info->blob_state = BLOB_NONE;
+        o2_free_message(prefix);
+        return O2_SUCCESS;
+    }
+    memcpy(&info->message->data, data, at);
+    memset(((char *) &info->message->data) + at - 4, 0, 4); // empty blob
+    info->blob_state = BLOB_DIRECT;
+    info->blob_dest = dest;
+    info->blob_at = at;
+    info->blob_size = size;
+    // the prefix may hold some of the blob and what follows it
+    int got = info->message_got;
+    info->message_got = at;
+    while (info->message_got < got) {
+        int max;
+        char *to = blob_recv_dest(info, &max);
+        if (max > got - info->message_got) max = got - info->message_got;
+        memcpy(to, data + info->message_got, max);
+        info->message_got += max;
+    }
+    o2_free_message(prefix);
+    return O2_SUCCESS;
+}
+
+
 int read_whole_message(SOCKET sock, struct fds_info *info)
 {
     assert(info->length_got < 5);
@@ -237,7 +640,11 @@ int read_whole_message(SOCKET sock, struct fds_info *info)
     if (info->length_got < 4) {
         int n = recvfrom(sock, ((char *) &(info->length)) + info->length_got,
                          4 - info->length_got, 0, NULL, NULL);
-        if (n <= 0) { /* error: close the socket */
+        if (n == 0) { /* orderly shutdown by the remote process */
+            tcp_message_cleanup(info);
+            return O2_TCP_HUP;
+        }
+        if (n < 0) { /* error: close the socket */
             
             //BEGIN EDIT
             //Updated this to have split functionality on win32, because it wouldn't compile due to the use of win32 variables/functions
@@ -266,7 +673,7 @@ int read_whole_message(SOCKET sock, struct fds_info *info)
             }
 #endif
             //END EDIT
-            
+            return FALSE; // nothing to read yet
         }
 
         info->length_got += n;
@@ -276,29 +683,65 @@ int read_whole_message(SOCKET sock, struct fds_info *info)
         }
         // done receiving length bytes
         info->length = htonl(info->length);
-        info->message = alloc_size_message(info->length);
+        int compact = info->length & O2_COMPACT_LENGTH; // see o2_compact.c
+        info->length &= ~O2_COMPACT_LENGTH;
+        // no process sends more (see send_by_tcp_to_process()): a
+        // longer frame is not allocated, and the connection is dropped
+        if (info->length > O2_MAX_MSG_SIZE) {
+            O2_DB(printf("O2: dropped a TCP frame of %u bytes\n",
+                         info->length));
+            tcp_message_cleanup(info);
+            return O2_TCP_HUP;
+        }
+        if (blob_buffers.length > 0 && info->length > BLOB_PREFIX &&
+            !compact) {
+            // read the start first to see where its blob goes
+            info->message = alloc_size_message(BLOB_PREFIX);
+            info->blob_state = BLOB_START;
+        } else {
+            info->message = alloc_size_message(info->length);
+        }
+        if (!info->message) { // the rest of the frame cannot be read
+            tcp_message_cleanup(info);
+            return O2_TCP_HUP;
+        }
+        if (compact) info->message->flags |= O2_COMPACT;
         info->message_got = 0; // just to make sure
     }
 
     /* read the full message */
-    if (info->message_got < info->length) {
-        int n = recvfrom(sock,
-                         ((char *) &(info->message->data)) + info->message_got,
-                         info->length - info->message_got, 0, NULL, NULL);
-        if (n <= 0) {
+    if (info->message_got < (int) info->length) {
+        int max;
+        char *dest = blob_recv_dest(info, &max);
+        int n = recvfrom(sock, dest, max, 0, NULL, NULL);
+        if (n == 0) { /* orderly shutdown by the remote process */
+            o2_free_message(info->message);
+            tcp_message_cleanup(info);
+            return O2_TCP_HUP;
+        }
+        if (n < 0) {
 			if (errno != EAGAIN && errno != EINTR) {
                 perror("recvfrom in read_whole_message getting data");
                 o2_free_message(info->message);
                 tcp_message_cleanup(info);
                 return O2_FAIL;
             }
+            return FALSE; // nothing to read yet
         }
         info->message_got += n;
-        if (info->message_got < info->length) {
+        if (info->blob_state == BLOB_START &&
+            info->message_got == BLOB_PREFIX && blob_start(info)) {
+            tcp_message_cleanup(info);
+            return O2_FAIL;
+        }
+        if (info->message_got < (int) info->length) {
             return FALSE; 
         }
     }
     info->message->length = info->length;
+    if (info->blob_state == BLOB_DIRECT) { // the blob is not in message
+        info->message->length -= (info->blob_size + 3) & ~3;
+    }
     // printf("-    %s: received tcp msg %s\n", debug_prefix, info->message->data.address);
     return TRUE; // we have a full message now
 }
@@ -308,12 +751,33 @@ int tcp_recv_handler(SOCKET sock, struct fds_info *info)
 {
 	int n = read_whole_message(sock, info);
 	if (n <= 0) return n;
+    if (info->u.process_info) info->u.process_info->last_used = o2_local_now;
     
     /* got the message, deliver it */
-    // endian corrections are done in handler
-    deliver_or_schedule(info->message);
-    // info->message is now freed
+    // clean up first: handlers may add or remove sockets, which can
+    // move info in o2_fds_info
+    o2_message_ptr msg = info->message;
     tcp_message_cleanup(info);
+    int swap = info->u.process_info &&
+               info->u.process_info->little_endian != IS_LITTLE_ENDIAN;
+    if (msg->flags & O2_COMPACT) { // decoded in host order
+        if (!(msg = o2_compact_receive(info, msg))) return O2_SUCCESS;
+        swap = FALSE;
+    }
+    if (msg->data.address[0] == '%') { // a chunk of a bulk message
+        msg = o2_bulk_receive(info->u.process_info, msg);
+        if (!msg) return O2_SUCCESS; // more chunks to come
+    }
+    // restore aliased addresses (see o2_address_aliases())
+    handler_entry_ptr handler = NULL;
+    if ((info->aliases || msg->data.address[0] == '=') &&
+        !(msg = o2_alias_receive(info, msg, &handler))) {
+        return O2_SUCCESS;
+    }
+    if (swap) msg->flags |= O2_SWAP;
+    tcp_sender = info->u.process_info;
+    deliver_to(msg, TRUE, handler); // frees msg
+    tcp_sender = NULL;
 	return O2_SUCCESS;
 }
 
@@ -325,17 +789,18 @@ int tcp_recv_handler(SOCKET sock, struct fds_info *info)
 // We then create a process (if not discovered yet) and associate
 // this socket with the process
 //
-void tcp_initial_handler(SOCKET sock, struct fds_info *info)
+int tcp_initial_handler(SOCKET sock, struct fds_info *info)
 {
-    if (!read_whole_message(sock, info)) return;
+    int n = read_whole_message(sock, info);
+    if (n <= 0) return n;
 
     // message should be addressed to !*/in, where * is (hopefully) this
     // process, but we're not going to check that (could also be "!_o2/in")
     char *ptr = info->message->data.address;
-    if (*ptr != '!') return;
+    if (*ptr != '!') return O2_FAIL;
     ptr = strstr(ptr + 1, "/in");
-    if (!ptr) return;
-    if (ptr[3] != 0) return;
+    if (!ptr) return O2_FAIL;
+    if (ptr[3] != 0) return O2_FAIL;
     
     // types will be after "!IP:TCP_PORT/in<0>,"
     // this is tricky: ptr + 3 points to end-of-string after address; there
@@ -344,17 +809,18 @@ void tcp_initial_handler(SOCKET sock, struct fds_info *info)
     // next word, which is where types begin, then add 1 to skip the ',' that
     // begins the type string
     ptr = WORD_ALIGN_PTR(ptr + 7) + 1; // skip over the ','
-    o2_discovery_init_handler(info->message, ptr, NULL, 0, info);
+    // finish with info first: o2_discovery_init_handler() sends, and a
+    // failed send removes sockets, which can move info in o2_fds_info
+    o2_message_ptr msg = info->message;
     info->handler = &tcp_recv_handler;
-    info->u.process_info->tcp_fd_index =
-        info - (struct fds_info *) (o2_fds_info.array);
-    // printf("%s: tcp_initial_handler completed for %s\n", debug_prefix,
-    //       info->u.process_info->name);
+    tcp_message_cleanup(info);
+    // o2_discovery_init_handler links info to the process and sets
+    // the process's tcp_fd_index
+    o2_discovery_init_handler(msg, ptr, NULL, 0, info);
     // since we called o2_discovery_init_handler directly,
     //   we need to free the message
-    o2_free_message(info->message);
-    tcp_message_cleanup(info);
-    return;
+    o2_free_message(msg);
+    return O2_SUCCESS;
 }
 
 
@@ -362,8 +828,9 @@ void tcp_initial_handler(SOCKET sock, struct fds_info *info)
 // "readable" this handler is called to accept the connection
 // request.
 //
-void tcp_accept_handler(SOCKET sock, struct fds_info *info)
+int tcp_accept_handler(SOCKET sock, struct fds_info *info)
 {
+    (void) info;
     // note that this handler does not call read_whole_message()
     // printf("%s: accepting a tcp connection\n", debug_prefix);
     SOCKET connection = accept(sock, NULL, NULL);
@@ -373,6 +840,7 @@ void tcp_accept_handler(SOCKET sock, struct fds_info *info)
                (void *) &set, sizeof(int));
 #endif
     add_new_socket(connection, TCP_SOCKET, NULL, &tcp_initial_handler);
+    return O2_SUCCESS;
 }
 
 
@@ -397,6 +865,11 @@ int make_udp_recv_socket(int tag, int port)
     // UDP message receive port for this process. Remember it.
     if (!specified_port) {
         o2_process.udp_port = port;
+        // the fragments of a large message arrive in a burst (see
+        // o2_udp_mtu()), so ask for room to queue them (the system
+        // may give less)
+        int size = UDP_RECV_BUFFER_SIZE;
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *) &size, sizeof(size));
     }
     // printf("%s: make_udp_recv_socket: listening on port %d\n", debug_prefix, o2_process.udp_port);
     return O2_SUCCESS;
@@ -422,7 +895,7 @@ int init_sockets()
 #endif // WIN32
     
     DA_INIT(o2_fds_info, struct fds_info, 5);
-    memset(o2_fds_info.array, 5 * sizeof(fds_info), 0);
+    memset(o2_fds_info.array, 0, 5 * sizeof(fds_info));
     
     // Set a broadcast socket. If cannot set up,
     //   print the error and return O2_FAIL
@@ -467,7 +940,9 @@ int make_tcp_recv_socket(int tag, process_info_ptr process)
         if ((err = bind_recv_socket(sock, &port, TRUE))) return err;
         o2_local_tcp_port = port;
     
-        if ((err = listen(sock, 10))) return err;
+        // many processes may connect at once when they discover each
+        // other, so do not limit the backlog
+        if ((err = listen(sock, SOMAXCONN))) return err;
 
         struct ifaddrs *ifap, *ifa;
         struct sockaddr_in *sa;
@@ -536,8 +1011,9 @@ int o2_recv()
 		struct pollfd *d = DA_GET(o2_fds, struct pollfd, i);
 		if (FD_ISSET(d->fd, &o2_read_set)) {
 			fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
-			if (((*(info->handler))(d->fd, info)) == O2_TCP_HUP) {
-				o2_remove_remote_process(info->u.process_info);
+			if (((*(info->handler))(d->fd, info)) == O2_TCP_HUP &&
+                (info->tag == TCP_SOCKET || info->tag == OSC_TCP_SOCKET)) {
+				tcp_hangup(i);
 				i--; // we moved last into i, so look at i again
 			}
 		}
@@ -657,17 +1133,24 @@ int o2_recv()
     for (i = 0; i < o2_fds.length; i++) {
         struct pollfd *d = DA_GET(o2_fds, struct pollfd, i);
         // printf("%p:%x ", d, d->revents);
-        if (d->revents & POLLERR) {
+        int tag = DA_GET(o2_fds_info, fds_info, i)->tag;
+        if ((d->revents & POLLERR) &&
+            tag != TCP_SOCKET && tag != OSC_TCP_SOCKET) {
             printf("d->revents & POLLERR %d, d->revents & POLLHUP %d\n",
                    d->revents & POLLERR, d->revents & POLLHUP);
-        } else if (d->revents & POLLHUP) {
-            fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
-            o2_remove_remote_process(info->u.process_info);
+        } else if (d->revents & (POLLERR | POLLHUP)) {
+            // a TCP error (e.g. reset by peer) persists until the socket
+            // is closed, so treat it like a hang-up
+            tcp_hangup(i);
             i--; // we moved last into i, so look at i again
         } else if (d->revents) {
             fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
             assert(info->length_got < 5);
-            (*(info->handler))(d->fd, info);
+            if ((*(info->handler))(d->fd, info) == O2_TCP_HUP &&
+                (info->tag == TCP_SOCKET || info->tag == OSC_TCP_SOCKET)) {
+                tcp_hangup(i);
+                i--; // we moved last into i, so look at i again
+            }
         }
     }
   
@@ -57,8 +57,18 @@ typedef int SOCKET;     // In O2, we'll use SOCKET to denote the type of a socke
 #define OSC_SOCKET          2
 #define DISCOVER_SOCKET     3
 #define TCP_SERVER_SOCKET   4
+#define REGISTRY_SOCKET     5
+#define OSC_TCP_SERVER_SOCKET 6
+#define OSC_TCP_SOCKET      7
+
+// fds_info blob_state values (see o2_blob_buffer())
+#define BLOB_NONE   0 // read the message as usual
+#define BLOB_START  1 // read the start of the message
+#define BLOB_DIRECT 2 // read the blob into blob_dest
 
 struct process_info;
+struct alias_table;
+struct type_table;
 
 #ifdef WIN32
 typedef struct ifaddrs
@@ -83,16 +93,27 @@ typedef struct ifaddrs
 
 typedef struct fds_info {
     int tag;                    // UDP_SOCKET, TCP_SOCKET, OSC_SOCKET, DISCOVER_SOCKET,
-    // TCP_SERVER_SOCKET
+    // TCP_SERVER_SOCKET, REGISTRY_SOCKET, OSC_TCP_SERVER_SOCKET,
+    // OSC_TCP_SOCKET
     //int port;                   // Record the port number of the socket.
     uint32_t length;            // message length
     o2_message_ptr message;     // message data from TCP stream goes here
     int length_got;             // how many bytes of length have been read?
     int message_got;            // how many bytes of message have been read?
+    int framing;                // OSC_TCP_SOCKET: how packets are delimited
+    int blob_state;             // TCP_SOCKET: receiving a blob directly
+    char *blob_dest;            //   into blob_dest (see o2_blob_buffer())
+    int blob_at;                //   offset of the blob data in message
+    int blob_size;              //   size of the blob
+    struct alias_table *aliases; // TCP_SOCKET: address aliases of the
+                                //   connection (see o2_alias.c), or NULL
+    struct type_table *types;   // TCP_SOCKET: type strings numbered by
+                                //   compact messages (see o2_compact.c)
     int (*handler)(SOCKET sock, struct fds_info *info); // handler for socket
     union {
         struct process_info *process_info;  // if not OSC
-        char *osc_service_name;           // for incoming OSC port
+        char *osc_service_name; // "/service" for incoming OSC port
+                                // or connection
     } u;
 } fds_info, *fds_info_ptr;
 
@@ -121,8 +142,17 @@ void freeifaddrs(struct ifaddrs *ifp);
 
 int init_sockets();
 int make_udp_recv_socket(int tag, int port /* , int reuse_flag */);
+// bind sock to INADDR_ANY:*port; if *port is 0, set it to the port used
+int bind_recv_socket(SOCKET sock, int *port, int tcp_recv_flag);
 // TODO: does process_info_ptr work?
 int make_tcp_recv_socket(int tag, struct process_info *process);
+void add_new_socket(SOCKET sock, int tag, struct process_info *process,
+                    int (*handler)(SOCKET sock, struct fds_info *info));
+int udp_recv_handler(SOCKET sock, struct fds_info *info);
+
+// deliver a received message now or schedule it by its timestamp;
+//   tcp_flag tells how it arrived
+void deliver_or_schedule(o2_message_ptr msg, int tcp_flag);
 
 /**
  *  When we get the raw data from the socket, we call this function. This function
@@ -153,5 +183,16 @@ void o2_application_info();
 
 
 void o2_remove_socket(int i);
+void o2_close_tcp_socket(int i);
+
+/// free the addresses registered with o2_blob_buffer()
+void o2_blob_buffers_finish();
+
+/// record that the host of process name ("ip:port") has the other
+/// byte order, so UDP messages from it are converted
+void o2_foreign_host(const char *name);
+
+/// forget the hosts recorded by o2_foreign_host() (called by o2_finish())
+void o2_foreign_hosts_finish();
 
 #endif /* o2_socket_h */
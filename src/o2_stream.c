@@ -0,0 +1,236 @@
+//  o2_stream.c -- chunked streams with flow control
+//
+//  agent, 2026
+//
+/* Design notes:
+ *    Sending a large buffer as one blob means building the whole
+ * message in memory and then writing all of it to the TCP connection
+ * before anything else can go. A stream (o2_stream_open()) instead
+ * sends the data in chunks of at most STREAM_CHUNK bytes, each an
+ * ordinary message to the stream's path with types "ihb": the stream
+ * id, the offset of the chunk in the stream, and the data. The last
+ * message, sent by o2_stream_close(), has an empty blob. Since each
+ * chunk is a complete message, other messages interleave with them.
+ *
+ *    Flow control is by credit. A stream may have STREAM_WINDOW bytes
+ * of data sent but not yet delivered. Each chunk to a remote process
+ * travels inside a message addressed to "~" (padded), followed by the
+ * name of the sending process (padded), the stream id and the number
+ * of data bytes (int32s in network order), then the chunk message.
+ * The receiver, o2_stream_receive(), delivers the chunk and sends the
+ * bytes back to the sender as credit with a !ip:port/sc message
+ * ("ii" stream_id bytes). The receiver keeps no state. o2_stream_write()
+ * sends only as much as the credit allows and returns the number of
+ * bytes sent, so O2 never buffers stream data beyond one chunk, and a
+ * slow receiver slows the sender down rather than filling memory.
+ *
+ *    Chunks are sent with o2_send_to_service(), so they keep their
+ * order with other TCP messages to the same process, including with
+ * o2_coalesce_messages() and o2_bulk_lane(). Streams to local services
+ * are delivered directly and need no credit.
+ *
+ *    A stream remembers the process it sends chunks to. When that
+ * process is removed, o2_stream_remove() marks the stream failed: the
+ * credit of its chunks in flight will never come back, and another
+ * process offering the service would get the rest of a stream without
+ * its start. Writes then return O2_FAIL, and o2_stream_close() only
+ * frees the stream.
+ */
+
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+#include "o2_send.h"
+#include "o2_stream.h"
+
+#define STREAM_CHUNK 8192   // most data bytes in one chunk
+#define STREAM_WINDOW 65536 // most data bytes sent but not delivered
+
+struct o2_stream {
+    int id;             // identifies the stream to the sender
+    char *path;         // address of the chunk messages
+    int64_t offset;     // data bytes written so far
+    int credit;         // data bytes that may be sent now
+    process_info_ptr proc; // remote process of the chunks, or NULL
+    int failed;         // TRUE if proc was removed
+};
+
+// open streams
+static dyn_array streams;
+static int next_stream_id = 0;
+
+
+o2_stream_ptr o2_stream_open(const char *path)
+{
+    if (!o2_application_name || (path[0] != '/' && path[0] != '!')) {
+        return NULL;
+    }
+    o2_stream_ptr stream = (o2_stream_ptr) O2_MALLOC(sizeof(struct o2_stream));
+    if (!stream) return NULL;
+    stream->path = o2_heapify(path);
+    if (!stream->path) {
+        O2_FREE(stream);
+        return NULL;
+    }
+    stream->id = next_stream_id++;
+    stream->offset = 0;
+    stream->credit = STREAM_WINDOW;
+    stream->proc = NULL;
+    stream->failed = FALSE;
+    if (!streams.allocated) {
+        DA_INIT(streams, o2_stream_ptr, 4);
+    }
+    DA_APPEND(streams, o2_stream_ptr, stream);
+    return stream;
+}
+
+
+// Send a chunk of n bytes at data (n may be 0). Remote chunks are
+//   wrapped so that the receiver returns credit.
+//
+static int send_chunk(o2_stream_ptr stream, generic_entry_ptr service,
+                      const void *data, int n)
+{
+    if (o2_start_send() ||
+        o2_add_int32(stream->id) ||
+        o2_add_int64(stream->offset) ||
+        o2_add_blob_data(n, (void *) data)) {
+        return O2_FAIL;
+    }
+    o2_message_ptr msg = o2_finish_message(0.0, stream->path);
+    if (!msg) return O2_FAIL;
+    if (service->tag == PATTERN_NODE) { // local: no flow control
+        return o2_send_to_service(service, msg, TRUE);
+    }
+    stream->proc = ((remote_service_entry_ptr) service)->parent;
+    int header = O2_WRAP_HEADER_SIZE;
+    o2_message_ptr wrap = alloc_size_message(header + msg->length);
+    if (!wrap) {
+        o2_free_message(msg);
+        return O2_FAIL;
+    }
+    char *p = o2_wrap_header(wrap, '~', stream->id, n);
+    memcpy(p, &msg->data, msg->length);
+    wrap->length = header + msg->length;
+    o2_free_message(msg);
+    stream->credit -= n;
+    return o2_send_to_service(service, wrap, TRUE);
+}
+
+
+int o2_stream_write(o2_stream_ptr stream, const void *data, int len)
+{
+    generic_entry_ptr service = o2_find_service(stream->path + 1);
+    if (stream->failed || !service || service->tag == OSC_REMOTE_SERVICE) {
+        return O2_FAIL;
+    }
+    int local = (service->tag == PATTERN_NODE);
+    int sent = 0;
+    while (sent < len) {
+        int n = len - sent;
+        if (n > STREAM_CHUNK) n = STREAM_CHUNK;
+        if (!local && n > stream->credit) n = stream->credit;
+        if (n <= 0) break; // wait for credit
+        if (send_chunk(stream, service, ((const char *) data) + sent, n)) {
+            return sent > 0 ? sent : O2_FAIL;
+        }
+        stream->offset += n;
+        sent += n;
+    }
+    return sent;
+}
+
+
+int o2_stream_space(o2_stream_ptr stream)
+{
+    return stream->failed ? O2_FAIL : stream->credit;
+}
+
+
+int o2_stream_close(o2_stream_ptr stream)
+{
+    int err = O2_FAIL;
+    generic_entry_ptr service = o2_find_service(stream->path + 1);
+    if (!stream->failed && service && service->tag != OSC_REMOTE_SERVICE) {
+        err = send_chunk(stream, service, NULL, 0); // end of stream
+    }
+    for (int i = 0; i < streams.length; i++) {
+        if (*DA_GET(streams, o2_stream_ptr, i) == stream) {
+            *DA_GET(streams, o2_stream_ptr, i) =
+                    *DA_LAST(streams, o2_stream_ptr);
+            streams.length--;
+            break;
+        }
+    }
+    O2_FREE(stream->path);
+    O2_FREE(stream);
+    return err;
+}
+
+
+void o2_stream_receive(o2_message_ptr msg)
+{
+    char *p = msg->data.address;
+    int avail = msg->length - (int) sizeof(double);
+    // the name must end within the message
+    if (avail <= 4 || !memchr(p + 4, 0, avail - 4)) goto drop;
+    int name_len = o2_strsize(p + 4);
+    int header = 4 + name_len + 8;
+    int len = avail - header; // length of the chunk message
+    if (len < (int) sizeof(double) + 4) goto drop;
+    char address[40];
+    if (name_len > 32) goto drop;
+#ifndef WIN32
+    snprintf(address, 40, "!%s/sc", p + 4);
+#else
+    _snprintf(address, 40, "!%s/sc", p + 4);
+#endif
+    int32_t id, n;
+    memcpy(&id, p + 4 + name_len, 4);
+    memcpy(&n, p + 8 + name_len, 4);
+    // the chunk message replaces the header in place
+    memmove(&msg->data, p + header, len);
+    msg->length = len;
+    deliver_or_schedule(msg, TRUE);
+    // the chunk has been handled: let the sender send more
+    n = ntohl(n);
+    if (n > 0) o2_send_cmd(address, 0.0, "ii", ntohl(id), n);
+    return;
+  drop:
+    o2_free_message(msg);
+}
+
+
+void o2_stream_remove(process_info_ptr proc)
+{
+    for (int i = 0; i < streams.length; i++) {
+        o2_stream_ptr stream = *DA_GET(streams, o2_stream_ptr, i);
+        if (stream->proc == proc) {
+            stream->proc = NULL;
+            stream->failed = TRUE;
+        }
+    }
+}
+
+
+int o2_stream_credit_handler(o2_message_ptr msg, const char *types,
+                             o2_arg_ptr *argv, int argc, void *user_data)
+{
+    (void) argv; (void) argc; (void) user_data; // types are extracted
+    o2_arg_ptr id_arg, n_arg;
+    o2_start_extract_types(msg, types);
+    if (!(id_arg = o2_get_next('i')) || !(n_arg = o2_get_next('i'))) {
+        return O2_FAIL;
+    }
+    for (int i = 0; i < streams.length; i++) {
+        o2_stream_ptr stream = *DA_GET(streams, o2_stream_ptr, i);
+        if (stream->id == id_arg->i32) {
+            stream->credit += n_arg->i32;
+            break;
+        }
+    }
+    return O2_SUCCESS; // a closed stream needs no credit
+}
@@ -0,0 +1,24 @@
+//  o2_stream.h -- chunked streams with flow control
+//
+//  A stream sends data to a remote handler in bounded chunks, limited
+//  by credit from the receiver. See o2_stream.c.
+
+#ifndef o2_stream_h
+#define o2_stream_h
+
+/**
+ *  Deliver a stream chunk (a message addressed to "~") and return
+ *  credit for it to the sender. msg is delivered or freed.
+ */
+void o2_stream_receive(o2_message_ptr msg);
+
+/**
+ *  Fail the streams to proc, which is being removed.
+ */
+void o2_stream_remove(process_info_ptr proc);
+
+/// /ip:port/sc handler: credit for an open stream
+int o2_stream_credit_handler(o2_message_ptr msg, const char *types,
+                             o2_arg_ptr *argv, int argc, void *user_data);
+
+#endif /* o2_stream_h */
@@ -0,0 +1,162 @@
+//  o2_template.c -- message templates
+//
+//  agent, 2026
+//
+/* Design notes:
+ *    A sequencer or controller may send the same address and type
+ * string over and over with only the values changing. o2_send() builds
+ * each message from scratch: o2_build_message() copies the address,
+ * copies the type string and appends each argument, checking for room
+ * each time. o2_template_create() does that work once, like the cached
+ * o2_discovery_msg, keeping a message with the address, the type
+ * string and zeros for the arguments.
+ *
+ *    Only types with a fixed size can be in a template (no strings,
+ * blobs, vectors or shared memory), so every argument is at the same
+ * offset in every message. o2_template_send() takes a message from the
+ * free list (alloc_size_message()), copies the template into it, sets
+ * the timestamp, stores each argument at its offset and sends the
+ * message with o2_send_message(), which takes ownership of it as
+ * usual. Like o2_send(), the arguments are followed by O2_MARKER_A and
+ * O2_MARKER_B, which are checked unless USE_ANSI_C is defined.
+ */
+
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+
+typedef struct o2_template {
+    o2_message_ptr msg; // the address, types and zeros for arguments
+    const char *types;  // the type codes in msg, after the ','
+    int args;           // offset of the first argument from msg->data
+} o2_template;
+
+
+o2_template_ptr o2_template_create(const char *address, const char *types)
+{
+    if (address[0] != '/' && address[0] != '!') return NULL;
+    if (types[strspn(types, "ifhtdcmTFNI")]) {
+        fprintf(stderr, "o2 warning: types \"%s\" cannot be in a template\n",
+                types);
+        return NULL;
+    }
+    uint8_t midi[4] = {0, 0, 0, 0};
+    if (o2_start_send()) return NULL;
+    for (const char *t = types; *t; t++) {
+        switch (*t) {
+          case O2_INT32: o2_add_int32(0); break;
+          case O2_FLOAT: o2_add_float(0); break;
+          case O2_INT64: o2_add_int64(0); break;
+          case O2_TIME: o2_add_time(0); break;
+          case O2_DOUBLE: o2_add_double(0); break;
+          case O2_CHAR: o2_add_char(0); break;
+          case O2_MIDI: o2_add_midi(midi); break;
+          case O2_TRUE: o2_add_true(); break;
+          case O2_FALSE: o2_add_false(); break;
+          case O2_NIL: o2_add_nil(); break;
+          case O2_INFINITUM: o2_add_infinitum(); break;
+        }
+    }
+    o2_message_ptr built = o2_finish_message(0, (char *) address);
+    if (!built) return NULL;
+    o2_template_ptr tmpl = (o2_template_ptr) O2_MALLOC(sizeof(o2_template));
+    if (!tmpl) {
+        o2_free_message(built);
+        return NULL;
+    }
+    // the copy is only read by o2_template_send(), never appended
+    // to, so it is allocated for the bytes in use, not built->allocated
+    int size = MESSAGE_SIZE_FROM_ALLOCATED(built->length);
+    tmpl->msg = (o2_message_ptr) O2_MALLOC(size);
+    if (!tmpl->msg) {
+        O2_FREE(tmpl);
+        o2_free_message(built);
+        return NULL;
+    }
+    memcpy(tmpl->msg, built, size);
+    tmpl->msg->allocated = built->length;
+    o2_free_message(built);
+    char *data = (char *) &tmpl->msg->data;
+    const char *type_string = WORD_ALIGN_PTR(tmpl->msg->data.address +
+                                   strlen(tmpl->msg->data.address) + 4);
+    tmpl->types = type_string + 1; // skip the ','
+    tmpl->args = (int) (WORD_ALIGN_PTR(tmpl->types + strlen(tmpl->types) +
+                                       4) - data);
+    return tmpl;
+}
+
+
+void o2_template_free(o2_template_ptr tmpl)
+{
+    O2_FREE(tmpl->msg);
+    O2_FREE(tmpl);
+}
+
+
+// The macro form of o2_template_send. tcp_flag may include O2_LATEST,
+// O2_RELIABLE and O2_UNORDERED
+int o2_template_send_marker(o2_template_ptr tmpl, int tcp_flag,
+                            o2_time time, ...)
+{
+    int length = tmpl->msg->length;
+    o2_message_ptr msg = alloc_size_message(length);
+    if (!msg) return O2_FAIL;
+    memcpy(&msg->data, &tmpl->msg->data, length);
+    msg->length = length;
+    msg->data.timestamp = time;
+    char *slot = ((char *) &msg->data) + tmpl->args;
+    va_list ap;
+    va_start(ap, time);
+    for (const char *t = tmpl->types; *t; t++) {
+        switch (*t) {
+          case O2_INT32:
+            *((int32_t *) slot) = va_arg(ap, int32_t);
+            slot += 4;
+            break;
+          case O2_FLOAT:
+            *((float *) slot) = (float) va_arg(ap, double);
+            slot += 4;
+            break;
+          case O2_INT64:
+            *((int64_t *) slot) = va_arg(ap, int64_t);
+            slot += 8;
+            break;
+          case O2_TIME:
+          case O2_DOUBLE:
+            *((double *) slot) = va_arg(ap, double);
+            slot += 8;
+            break;
+          case O2_CHAR:
+            *slot = (char) va_arg(ap, int); // padding is already zero
+            slot += 4;
+            break;
+          case O2_MIDI:
+            memcpy(slot, va_arg(ap, uint8_t *), 4);
+            slot += 4;
+            break;
+          default: // T, F, N and I have no data
+            break;
+        }
+    }
+#ifndef USE_ANSI_C
+    void *a = va_arg(ap, void *);
+    void *b = va_arg(ap, void *);
+    if ((((unsigned long) a) & 0xFFFFFFFFUL) !=
+        (((unsigned long) O2_MARKER_A) & 0xFFFFFFFFUL) ||
+        (((unsigned long) b) & 0xFFFFFFFFUL) !=
+        (((unsigned long) O2_MARKER_B) & 0xFFFFFFFFUL)) {
+        fprintf(stderr, "o2 error: o2_template_send called with "
+                "mismatching template and data\n");
+        va_end(ap);
+        o2_free_message(msg);
+        return O2_FAIL;
+    }
+#endif
+    va_end(ap);
+    msg->flags = tcp_flag & (O2_LATEST | O2_RELIABLE | O2_UNORDERED);
+    tcp_flag &= ~msg->flags;
+    return o2_send_message(msg, tcp_flag);
+}
@@ -0,0 +1,347 @@
+//  o2_vector.c -- vector arguments
+//
+//  agent, 2026
+//
+/* Design notes:
+ *    A vector is one argument with two type codes: 'v' and the element
+ * type, one of 'i', 'h', 'f' or 'd'. The data is the number of
+ * elements (int32), the element type (int32, the same character as in
+ * the type string), and the elements. Since this is also the layout of
+ * an o2_vector, o2_get_next() returns a pointer into the message, as
+ * for blobs, and 512 floats are one argument rather than 512.
+ *
+ *    When a handler asks for another element type, o2_get_next_vector()
+ * converts the vector into memory allocated by o2_vector_coerce().
+ * These are kept in a list, which call_handler() takes after it builds
+ * argv and frees after the handler returns. Vectors converted by
+ * handlers that call o2_get_next_vector() themselves are freed by the
+ * next o2_start_extract().
+ *
+ *    Conversion and byte swapping of the elements are loops over whole
+ * vectors. With SSE2 (all x86-64 compilers), they do 4 elements per
+ * instruction with SSE intrinsics (SSSE3, if enabled, swaps bytes with
+ * one shuffle). Elsewhere, the plain loops are left for the compiler
+ * to vectorize. Elements in messages are only 4-byte aligned, so they
+ * are always loaded with unaligned loads or memcpy().
+ *
+ *    o2_find_zero(), which o2_msg_validate() uses to find the end of
+ * each string in a received message, tests 16 bytes per instruction
+ * the same way, and so does o2_find_either(), which finds the SLIP
+ * END and ESC bytes in OSC streams over TCP. Without SSE2,
+ * o2_find_either() tests 8 bytes at a time with word operations.
+ */
+
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_vector.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VECTOR_SSE2 1
+#include <emmintrin.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#endif
+
+// a vector converted by o2_vector_coerce()
+typedef struct coerced_vector {
+    struct coerced_vector *next;
+    o2_vector v; // followed by the rest of the elements
+} coerced_vector, *coerced_vector_ptr;
+
+static coerced_vector_ptr coerced_vectors = NULL;
+
+
+int o2_vector_elem_size(char element_type)
+{
+    switch (element_type) {
+      case O2_INT32: case O2_FLOAT:
+        return 4;
+      case O2_INT64: case O2_DOUBLE:
+        return 8;
+      default:
+        return 0;
+    }
+}
+
+
+// Reverse the bytes of each of n int32s at data.
+//
+void o2_swap32_array(char *data, int n)
+{
+    int i = 0;
+#ifdef VECTOR_SSE2
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((__m128i *) (data + 4 * i));
+#ifdef __SSSE3__
+        x = _mm_shuffle_epi8(x, _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+                                             4, 5, 6, 7, 0, 1, 2, 3));
+#else
+        // swap the 16-bit halves of each int32, then the bytes of each
+        x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1);
+        x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+#endif
+        _mm_storeu_si128((__m128i *) (data + 4 * i), x);
+    }
+#endif
+    for (; i < n; i++) {
+        uint32_t w;
+        memcpy(&w, data + 4 * i, 4);
+        w = swap32(w);
+        memcpy(data + 4 * i, &w, 4);
+    }
+}
+
+
+// Reverse the bytes of each of n int64s at data.
+//
+void o2_swap64_array(char *data, int n)
+{
+    int i = 0;
+#ifdef VECTOR_SSE2
+    for (; i + 2 <= n; i += 2) {
+        __m128i x = _mm_loadu_si128((__m128i *) (data + 8 * i));
+#ifdef __SSSE3__
+        x = _mm_shuffle_epi8(x, _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+                                             0, 1, 2, 3, 4, 5, 6, 7));
+#else
+        // swap the int32s of each int64, then swap each int32
+        x = _mm_shuffle_epi32(x, 0xB1);
+        x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1);
+        x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+#endif
+        _mm_storeu_si128((__m128i *) (data + 8 * i), x);
+    }
+#endif
+    for (; i < n; i++) {
+        uint64_t w;
+        memcpy(&w, data + 8 * i, 8);
+        w = swap64(w);
+        memcpy(data + 8 * i, &w, 8);
+    }
+}
+
+
+const char *o2_find_zero(const char *s, const char *end)
+{
+#ifdef VECTOR_SSE2
+    __m128i zero = _mm_setzero_si128();
+    for (; s + 16 <= end; s += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) s);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, zero));
+        if (mask) {
+#ifdef __GNUC__
+            return s + __builtin_ctz(mask);
+#else
+            break;
+#endif
+        }
+    }
+#endif
+    // the rest, or the 16 bytes with the zero
+    return (const char *) memchr(s, 0, end - s);
+}
+
+
+// true if any byte of the 64-bit word w is zero
+#define HAS_ZERO_BYTE(w) \
+    (((w) - 0x0101010101010101ULL) & ~(w) & 0x8080808080808080ULL)
+
+const char *o2_find_either(const char *s, const char *end, char a, char b)
+{
+#ifdef VECTOR_SSE2
+    __m128i va = _mm_set1_epi8(a);
+    __m128i vb = _mm_set1_epi8(b);
+    for (; s + 16 <= end; s += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) s);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, va),
+                                                  _mm_cmpeq_epi8(x, vb)));
+        if (mask) {
+#ifdef __GNUC__
+            return s + __builtin_ctz(mask);
+#else
+            break;
+#endif
+        }
+    }
+#else
+    uint64_t wa = 0x0101010101010101ULL * (unsigned char) a;
+    uint64_t wb = 0x0101010101010101ULL * (unsigned char) b;
+    for (; s + 8 <= end; s += 8) {
+        uint64_t w;
+        memcpy(&w, s, 8);
+        if (HAS_ZERO_BYTE(w ^ wa) | HAS_ZERO_BYTE(w ^ wb)) break;
+    }
+#endif
+    // the rest, or the bytes with a or b
+    while (s < end && *s != a && *s != b) s++;
+    return s;
+}
+
+
+// convert elements i to n - 1 from type FROM at src to type TO at dst
+#define CONVERT_LOOP(FROM, TO) \
+    for (; i < n; i++) { \
+        FROM x; \
+        memcpy(&x, src + i * sizeof(FROM), sizeof(FROM)); \
+        ((TO *) dst)[i] = (TO) x; \
+    }
+
+// Convert n elements of type from at src to type to at dst, which is
+//   aligned for the type. The types differ.
+//
+static void convert(char from, const char *src, char to, char *dst, int n)
+{
+    int i = 0;
+    switch ((from << 8) + to) {
+      case (O2_INT32 << 8) + O2_FLOAT:
+#ifdef VECTOR_SSE2
+        for (; i + 4 <= n; i += 4) {
+            __m128i x = _mm_loadu_si128((__m128i *) (src + 4 * i));
+            _mm_storeu_ps((float *) dst + i, _mm_cvtepi32_ps(x));
+        }
+#endif
+        CONVERT_LOOP(int32_t, float);
+        break;
+      case (O2_FLOAT << 8) + O2_INT32:
+#ifdef VECTOR_SSE2
+        for (; i + 4 <= n; i += 4) {
+            __m128 x = _mm_loadu_ps((float *) (src + 4 * i));
+            _mm_storeu_si128((__m128i *) (dst + 4 * i), _mm_cvttps_epi32(x));
+        }
+#endif
+        CONVERT_LOOP(float, int32_t);
+        break;
+      case (O2_INT32 << 8) + O2_DOUBLE:
+#ifdef VECTOR_SSE2
+        for (; i + 4 <= n; i += 4) {
+            __m128i x = _mm_loadu_si128((__m128i *) (src + 4 * i));
+            _mm_storeu_pd((double *) dst + i, _mm_cvtepi32_pd(x));
+            _mm_storeu_pd((double *) dst + i + 2,
+                          _mm_cvtepi32_pd(_mm_srli_si128(x, 8)));
+        }
+#endif
+        CONVERT_LOOP(int32_t, double);
+        break;
+      case (O2_DOUBLE << 8) + O2_INT32:
+#ifdef VECTOR_SSE2
+        for (; i + 4 <= n; i += 4) {
+            __m128i lo = _mm_cvttpd_epi32(_mm_loadu_pd((double *)
+                                                       (src + 8 * i)));
+            __m128i hi = _mm_cvttpd_epi32(_mm_loadu_pd((double *)
+                                                       (src + 8 * i + 16)));
+            _mm_storeu_si128((__m128i *) (dst + 4 * i),
+                             _mm_unpacklo_epi64(lo, hi));
+        }
+#endif
+        CONVERT_LOOP(double, int32_t);
+        break;
+      case (O2_FLOAT << 8) + O2_DOUBLE:
+#ifdef VECTOR_SSE2
+        for (; i + 4 <= n; i += 4) {
+            __m128 x = _mm_loadu_ps((float *) (src + 4 * i));
+            _mm_storeu_pd((double *) dst + i, _mm_cvtps_pd(x));
+            _mm_storeu_pd((double *) dst + i + 2,
+                          _mm_cvtps_pd(_mm_movehl_ps(x, x)));
+        }
+#endif
+        CONVERT_LOOP(float, double);
+        break;
+      case (O2_DOUBLE << 8) + O2_FLOAT:
+#ifdef VECTOR_SSE2
+        for (; i + 4 <= n; i += 4) {
+            __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd((double *) (src + 8 * i)));
+            __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd((double *)
+                                                  (src + 8 * i + 16)));
+            _mm_storeu_ps((float *) dst + i, _mm_movelh_ps(lo, hi));
+        }
+#endif
+        CONVERT_LOOP(double, float);
+        break;
+      // SSE2 has no int64 conversions
+      case (O2_INT32 << 8) + O2_INT64:
+        CONVERT_LOOP(int32_t, int64_t);
+        break;
+      case (O2_INT64 << 8) + O2_INT32:
+        CONVERT_LOOP(int64_t, int32_t);
+        break;
+      case (O2_INT64 << 8) + O2_FLOAT:
+        CONVERT_LOOP(int64_t, float);
+        break;
+      case (O2_FLOAT << 8) + O2_INT64:
+        CONVERT_LOOP(float, int64_t);
+        break;
+      case (O2_INT64 << 8) + O2_DOUBLE:
+        CONVERT_LOOP(int64_t, double);
+        break;
+      case (O2_DOUBLE << 8) + O2_INT64:
+        CONVERT_LOOP(double, int64_t);
+        break;
+    }
+}
+
+
+o2_arg_ptr o2_vector_coerce(o2_vector_ptr v, char element_type)
+{
+    int from_size = o2_vector_elem_size((char) v->typ);
+    int to_size = o2_vector_elem_size(element_type);
+    if (!from_size || !to_size) return NULL;
+    coerced_vector_ptr cv = (coerced_vector_ptr)
+            O2_MALLOC(sizeof(coerced_vector) + v->len * to_size);
+    if (!cv) return NULL;
+    cv->next = coerced_vectors;
+    coerced_vectors = cv;
+    cv->v.len = v->len;
+    cv->v.typ = element_type;
+    if (element_type == v->typ) {
+        memcpy(cv->v.vi, v->vi, v->len * to_size);
+    } else {
+        convert((char) v->typ, (const char *) v->vi, element_type,
+                (char *) cv->v.vi, v->len);
+    }
+    return (o2_arg_ptr) &cv->v;
+}
+
+
+void *o2_take_coerced_vectors()
+{
+    void *vectors = coerced_vectors;
+    coerced_vectors = NULL;
+    return vectors;
+}
+
+
+void o2_free_coerced_vectors(void *vectors)
+{
+    coerced_vector_ptr cv = (coerced_vector_ptr) vectors;
+    while (cv) {
+        coerced_vector_ptr next = cv->next;
+        O2_FREE(cv);
+        cv = next;
+    }
+}
+
+
+char *o2_vector_swap_endian(char *data, char *end, char element_type,
+                            int to_host)
+{
+    int size = o2_vector_elem_size(element_type);
+    if (!size || data + 8 > end) return NULL;
+    // the length tells where the next argument is, so read it while
+    // it is in host order
+    int32_t len;
+    if (to_host) o2_swap32_array(data, 2);
+    memcpy(&len, data, 4);
+    if (!to_host) o2_swap32_array(data, 2);
+    if (len < 0 || len > (end - data - 8) / size) return NULL;
+    if (size == 4) {
+        o2_swap32_array(data + 8, len);
+    } else {
+        o2_swap64_array(data + 8, len);
+    }
+    return data + 8 + len * size;
+}
@@ -0,0 +1,60 @@
+//  o2_vector.h -- vector arguments
+//
+//  Conversion and byte swapping of vector ('v') arguments, byte
+//  swapping of runs of numbers for o2_msg_swap_endian(), and the zero
+//  scan for o2_msg_validate(). See o2_vector.c.
+
+#ifndef o2_vector_h
+#define o2_vector_h
+
+/**
+ *  Get the size of an element of a vector of element_type.
+ *
+ *  @return 4 or 8, or 0 if element_type is not a vector element type.
+ */
+int o2_vector_elem_size(char element_type);
+
+/**
+ *  Convert vector v to element_type in newly allocated memory, which is
+ *  freed by the next o2_free_coerced_vectors().
+ *
+ *  @return the converted vector, or NULL if element_type is not valid
+ *          or memory cannot be allocated.
+ */
+o2_arg_ptr o2_vector_coerce(o2_vector_ptr v, char element_type);
+
+/**
+ *  Take the vectors converted since the last call, so that the caller
+ *  can free them with o2_free_coerced_vectors() when they are no
+ *  longer used. Used by call_handler().
+ */
+void *o2_take_coerced_vectors();
+
+/// free vectors taken by o2_take_coerced_vectors()
+void o2_free_coerced_vectors(void *vectors);
+
+/**
+ *  Convert the byte order of the vector at data, with elements of
+ *  element_type, in place. end is the end of the message.
+ *
+ *  @param to_host TRUE to convert from network to host order (see
+ *                 o2_msg_swap_endian()).
+ *
+ *  @return the address after the vector, or NULL if it is malformed.
+ */
+char *o2_vector_swap_endian(char *data, char *end, char element_type,
+                            int to_host);
+
+/// reverse the bytes of each of n int32s at data, which may be unaligned
+void o2_swap32_array(char *data, int n);
+
+/// reverse the bytes of each of n int64s at data, which may be unaligned
+void o2_swap64_array(char *data, int n);
+
+/// the first zero byte from s to end (not included), or NULL
+const char *o2_find_zero(const char *s, const char *end);
+
+/// the first byte equal to a or b from s to end (not included), or end
+const char *o2_find_either(const char *s, const char *end, char a, char b);
+
+#endif /* o2_vector_h */
@@ -0,0 +1,348 @@
+//  aliastest.c - test address aliases (o2_address_aliases())
+//
+//  A raw TCP socket of this program plays a remote O2 process: it
+//  connects to this process, sends the init and services messages
+//  that O2 processes send, and offers service "peer".
+//
+//  Receiving: the socket defines aliases with a "=" message and sends
+//  messages addressed by alias. Each must reach the handler of its
+//  address, with the address restored, including a handler added
+//  after the alias was first used, a handler that replaced the one
+//  the alias found before, and an address too long to restore in
+//  place. Messages with bad alias codes -- empty, not hex, not
+//  defined, without an end -- and definitions out of order must be
+//  dropped without harm, and so must unknown aliases in a frame of
+//  coalesced messages, while the other messages in the frame arrive.
+//
+//  Sending: after o2_address_aliases(), the first message to an
+//  address must be preceded by its definition, later ones must carry
+//  only the alias, and addresses past the limit, patterns, and
+//  addresses that are not longer than an alias go as they are.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("aliastest is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <sys/time.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+
+#define PEER_NAME "127.0.0.1:1"
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+void poll_for(double seconds)
+{
+    double start = o2_local_time();
+    while (o2_local_time() - start < seconds) {
+        o2_poll();
+        usleep(1000);
+    }
+}
+
+
+// values received by each handler, in order
+#define MAX_VALUES 16
+typedef struct values {
+    int n;
+    int v[MAX_VALUES];
+} values;
+
+values x_values, late_values, long_values, new_values;
+int bad_address = 0; // a handler saw an address other than its own
+
+int handler(const o2_message_ptr msg, const char *types,
+            o2_arg_ptr *argv, int argc, void *user_data)
+{
+    values *vals = (values *) user_data;
+    if (vals->n < MAX_VALUES) vals->v[vals->n++] = argv[0]->i32;
+    const char *path = (vals == &late_values ? "/loc/late" :
+                        vals == &long_values ? NULL : "/loc/x");
+    if (path && strcmp(msg->data.address, path) != 0) bad_address++;
+    return O2_SUCCESS;
+}
+
+
+int values_are(values *vals, int n, const int *v)
+{
+    return vals->n == n && memcmp(vals->v, v, n * sizeof(int)) == 0;
+}
+
+
+// building messages as a remote process sends them: the length, the
+//   timestamp, the address and the arguments
+char packet[2048];
+int length;
+int start; // where the message being built starts
+
+void add_bytes(const void *data, int n)
+{
+    memcpy(packet + length, data, n);
+    length += n;
+}
+
+void add_string(const char *s)
+{
+    int n = (int) strlen(s);
+    add_bytes(s, n);
+    memset(packet + length, 0, 4 - (n & 3));
+    length += 4 - (n & 3);
+}
+
+void add_int(int32_t i)
+{
+    add_bytes(&i, 4); // this process is little endian, like us
+}
+
+void start_message(const char *address)
+{
+    start = length;
+    int32_t len = 0;
+    add_bytes(&len, 4);
+    double timestamp = 0;
+    add_bytes(&timestamp, 8);
+    if (address) add_string(address);
+}
+
+void end_message()
+{
+    int32_t len = htonl(length - start - 4);
+    memcpy(packet + start, &len, 4);
+}
+
+// a message /x i (or with an alias for the address)
+void add_x(const char *address, int i)
+{
+    start_message(address);
+    add_string(",i");
+    add_int(i);
+    end_message();
+}
+
+
+int sock;
+
+void send_packet()
+{
+    check(send(sock, packet, length, 0) == length, "send");
+    length = 0;
+    poll_for(0.05);
+}
+
+
+// read the next message from this process into packet, setting length
+//   to its length, or to -1 if none arrives
+void receive()
+{
+    int32_t len;
+    length = -1;
+    if (recv(sock, &len, 4, MSG_WAITALL) != 4) return;
+    len = ntohl(len);
+    if (len < 0 || len > (int) sizeof(packet) ||
+        recv(sock, packet, len, MSG_WAITALL) != len) {
+        return;
+    }
+    length = len;
+}
+
+
+// receive messages from this process until one that is not to
+//   O2's own services, polling so that it sends
+void receive_user_message()
+{
+    do {
+        poll_for(0.02);
+        receive();
+    } while (length > 0 && (packet[8] == '!' || packet[9] == '_'));
+}
+
+
+void connect_peer()
+{
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(0x7F000001);
+    sa.sin_port = htons(o2_local_tcp_port);
+    check(connect(sock, (struct sockaddr *) &sa, sizeof(sa)) == 0,
+          "connect");
+    struct timeval tv = { 0, 200000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    // as o2_send_init() and o2_send_services() do
+    char address[64];
+    snprintf(address, sizeof(address), "!%s/in", o2_process.name);
+    start_message(address);
+    add_string(",ssiii");
+    add_string("l");
+    add_string("127.0.0.1");
+    add_int(1); // TCP port, which is not used
+    add_int(1); // UDP port
+    add_int(0); // no clock sync
+    end_message();
+    snprintf(address, sizeof(address), "!%s/sv", o2_process.name);
+    start_message(address);
+    add_string(",ss");
+    add_string(PEER_NAME);
+    add_string("peer");
+    end_message();
+    send_packet();
+    poll_for(0.1);
+    check(o2_status("peer") != O2_FAIL, "the peer is known");
+}
+
+
+void receive_tests()
+{
+    char long_address[300] = "/loc/";
+    memset(long_address + 5, 'y', 250);
+    long_address[255] = 0;
+    o2_add_service("loc");
+    o2_add_method("/loc/x", "i", &handler, &x_values, FALSE, TRUE);
+    o2_add_method(long_address, "i", &handler, &long_values, FALSE, TRUE);
+
+    start_message("=");
+    add_string("^0");
+    add_string("/loc/x");
+    add_string("^1");
+    add_string("/loc/late");
+    add_string("^2");
+    add_string(long_address);
+    end_message();
+    add_x("^0", 1);
+    add_x("^1", 2); // no handler yet
+    send_packet();
+    o2_add_method("/loc/late", "i", &handler, &late_values, FALSE, TRUE);
+    add_x("^1", 3);
+    add_x("^2", 4);
+    send_packet();
+    int x1[] = { 1 }, late1[] = { 3 }, long1[] = { 4 };
+    check(values_are(&x_values, 1, x1), "an alias reaches its handler");
+    check(values_are(&late_values, 1, late1),
+          "an alias reaches a handler added after it was used");
+    check(values_are(&long_values, 1, long1),
+          "a long address is restored");
+    check(bad_address == 0, "handlers get the restored address");
+
+    // bad codes
+    add_x("^", 5);
+    add_x("^x", 6);
+    add_x("^9", 7);
+    start_message(NULL);
+    add_bytes("^000", 4); // the message ends before the code does
+    end_message();
+    start_message("=");   // out of order, and not an alias
+    add_string("^5");
+    add_string("/loc/x");
+    end_message();
+    start_message("=");
+    add_string("5");
+    add_string("/loc/x");
+    end_message();
+    add_x("^5", 8);
+    send_packet();
+    check(values_are(&x_values, 1, x1), "bad alias codes are dropped");
+
+    // a frame of coalesced messages, with an unknown alias
+    start_message("#");
+    int frame = start;
+    add_x("^0", 9);
+    add_x("^9", 10);
+    add_x("/loc/x", 11);
+    start = frame;
+    end_message();
+    add_x("^0", 12);
+    send_packet();
+    int x4[] = { 1, 9, 11, 12 };
+    check(values_are(&x_values, 4, x4),
+          "a frame with an unknown alias, and a message after it");
+
+    // the handler that an alias found is replaced
+    o2_add_method("/loc/x", "i", &handler, &new_values, FALSE, TRUE);
+    add_x("^0", 13);
+    send_packet();
+    int new1[] = { 13 };
+    check(values_are(&x_values, 4, x4) && values_are(&new_values, 1, new1),
+          "an alias reaches the handler that replaced its handler");
+}
+
+
+// the address of the message in packet
+const char *address()
+{
+    return packet + 8;
+}
+
+
+void send_tests()
+{
+    o2_address_aliases(2);
+    o2_send_cmd("/peer/a/long/address", 0, "i", 1);
+    receive_user_message();
+    check(length > 0 && strcmp(address(), "=") == 0 &&
+          strcmp(packet + 12, "^0") == 0 &&
+          strcmp(packet + 16, "/peer/a/long/address") == 0,
+          "the first use of an address defines its alias");
+    receive_user_message();
+    check(length == 8 + 4 + 4 + 4 && strcmp(address(), "^0") == 0 &&
+          strcmp(packet + 12, ",i") == 0, "then the alias is used");
+    o2_send_cmd("/peer/a/long/address", 0, "i", 2);
+    receive_user_message();
+    check(length == 20 && strcmp(address(), "^0") == 0,
+          "later uses send only the alias");
+
+    o2_send_cmd("/peer/*", 0, "i", 3);
+    receive_user_message();
+    check(length > 0 && strcmp(address(), "/peer/*") == 0,
+          "patterns are not aliased");
+    o2_send_cmd("/peer/b", 0, "i", 4);
+    receive_user_message();
+    receive_user_message();
+    check(length == 20 && strcmp(address(), "^1") == 0,
+          "a second alias");
+    o2_send_cmd("/peer/c", 0, "i", 5);
+    receive_user_message();
+    check(length > 0 && strcmp(address(), "/peer/c") == 0,
+          "addresses past the limit are sent as they are");
+}
+
+
+int main(int argc, const char * argv[])
+{
+    o2_initialize("test");
+    connect_peer();
+    receive_tests();
+    send_tests();
+    close(sock);
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,212 @@
+//  blobbuftest.c - test o2_blob_buffer()
+//
+//  This program forks a receiver process offering service "rcv",
+//  which registers a provider for "/rcv/samples". The sender sends
+//  messages with an int32, a blob and a string by TCP. The provider
+//  gets the size of each blob and returns memory for it, and the
+//  handler must find an empty blob in the message, the other
+//  arguments intact, and the data in the provider's memory. When the
+//  provider returns NULL, the blob must arrive in the message as
+//  usual. The receiver's exit status is the result.
+//
+//  The sender also sends frames by hand to its own TCP port with
+//  blob sizes larger than the frame, up to 0x7FFFFFFF: the provider
+//  must not be asked for memory for them.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("blobbuftest needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+
+#define N_SENDS 5
+#define BUFFER_SIZE 100000
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+// the blob of send k has k * 10000 + 1000 bytes, with byte i equal to
+// i + k (mod 256). The last send is too big for the buffer.
+int blob_size(int k)
+{
+    return k == N_SENDS ? BUFFER_SIZE + 1 : k * 10000 + 1000;
+}
+
+
+int blob_ok(const char *data, int size, int k)
+{
+    for (int i = 0; i < size; i++) {
+        if ((unsigned char) data[i] != (unsigned char) (i + k)) return FALSE;
+    }
+    return TRUE;
+}
+
+
+// receiver state
+char buffer[BUFFER_SIZE];
+int provided = 0;  // the number of times the provider gave memory
+int received = 0;
+int errors = 0;
+
+void *provider(const char *path, uint32_t size, void *user_data)
+{
+    if (strcmp(path, "/rcv/samples") || user_data != buffer) errors++;
+    if (size > BUFFER_SIZE) return NULL;
+    if ((int) size != blob_size(received)) errors++;
+    provided++;
+    return buffer;
+}
+
+
+int handler(const o2_message_ptr msg, const char *types,
+            o2_arg_ptr *argv, int argc, void *user_data)
+{
+    int k = argv[0]->i32;
+    int ok = (k == received && strcmp(argv[2]->s, "after") == 0);
+    if (k < N_SENDS) { // the blob went to buffer
+        ok = ok && argv[1]->b.size == 0 && provided == k + 1 &&
+             blob_ok(buffer, blob_size(k), k);
+    } else { // too big: received as usual
+        ok = ok && (int) argv[1]->b.size == blob_size(k) &&
+             blob_ok(argv[1]->b.data, blob_size(k), k);
+    }
+    if (!ok) errors++;
+    received++;
+    return O2_SUCCESS;
+}
+
+
+void receiver()
+{
+    o2_initialize("blobbuftest");
+    o2_add_service("rcv");
+    o2_add_method("/rcv/samples", "ibs", &handler, NULL, FALSE, TRUE);
+    o2_blob_buffer("/rcv/samples", &provider, buffer);
+    double start = o2_local_time();
+    while (received <= N_SENDS && o2_local_time() - start < 10) {
+        o2_poll();
+        usleep(1000);
+    }
+    printf("receiver got %d/%d messages, %d blobs in the buffer, "
+           "%d errors\n", received, N_SENDS + 1, provided, errors);
+    exit(received == N_SENDS + 1 && provided == N_SENDS && errors == 0 ?
+         0 : 1);
+}
+
+
+int big_requests = 0; // sender: requests for more than a frame holds
+
+void *sender_provider(const char *path, uint32_t size, void *user_data)
+{
+    if (size > 1000) big_requests++;
+    return NULL;
+}
+
+
+// send a frame to "/snd/samples" with types ",b", the blob size
+// given, and 1000 bytes of data to this process's TCP port
+void bad_size_test(int32_t size)
+{
+    char frame[4 + 1024];
+    memset(frame, 0, sizeof(frame));
+    int32_t word = htonl(1024);
+    memcpy(frame, &word, 4);
+    strcpy(frame + 4 + 8, "/snd/samples"); // after the timestamp
+    strcpy(frame + 4 + 8 + 16, ",b");
+    memcpy(frame + 4 + 8 + 20, &size, 4); // in host order, as sent
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(0x7F000001);
+    sa.sin_port = htons(o2_local_tcp_port);
+    check(connect(sock, (struct sockaddr *) &sa, sizeof(sa)) == 0,
+          "connect");
+    check(write(sock, frame, sizeof(frame)) == sizeof(frame), "write");
+    double start = o2_local_time();
+    while (o2_local_time() - start < 0.1) {
+        o2_poll();
+        usleep(1000);
+    }
+    close(sock);
+}
+
+
+int main(int argc, const char * argv[])
+{
+    // fork before o2_initialize() so the receiver has its own sockets
+    pid_t pid = fork();
+    if (pid == 0) {
+        receiver();
+    } else if (pid < 0) {
+        perror("blobbuftest: fork");
+        return 1;
+    }
+    o2_initialize("blobbuftest");
+    o2_set_clock(NULL, NULL);
+
+    o2_blob_buffer("/snd/samples", &sender_provider, NULL);
+    bad_size_test(1001);
+    bad_size_test(0x7FFFFFFC);
+    bad_size_test(0x7FFFFFFF);
+    check(big_requests == 0, "no memory is asked for past the frame");
+
+    double start = o2_local_time();
+    while (o2_status("rcv") != O2_REMOTE && o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(o2_status("rcv") == O2_REMOTE, "rcv discovered");
+    for (int k = 0; k <= N_SENDS; k++) {
+        int size = blob_size(k);
+        char *data = (char *) malloc(size);
+        for (int i = 0; i < size; i++) data[i] = (char) (i + k);
+        o2_start_send();
+        o2_add_int32(k);
+        o2_add_blob_data(size, data);
+        o2_add_string("after");
+        o2_send_message(o2_finish_message(0, "/rcv/samples"), TRUE);
+        free(data);
+        o2_poll();
+    }
+
+    int status = 0;
+    start = o2_local_time();
+    while (waitpid(pid, &status, WNOHANG) == 0 &&
+           o2_local_time() - start < 12) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          "blobs arrive in the provider's memory");
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
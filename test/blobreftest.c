@@ -0,0 +1,313 @@
+//  blobreftest.c - test blobs sent from application memory
+//                  (o2_add_blob_ref())
+//
+//  Each test message has an index and two blobs added with
+//  o2_add_blob_ref(), with an int32 between them, so that the data
+//  before, between and after the blobs must all arrive in place. Blob
+//  sizes are 0, and sizes that need 0 to 3 bytes of padding, up to a
+//  blob too large for one TCP write.
+//
+//  Messages go to a local service, whose handler gets a copy, and to
+//  a receiver process that this program forks, by TCP (writev), by
+//  UDP (sendmsg, or in fragments when larger than the MTU) and by
+//  reliable UDP. The receiver checks each message and replies with
+//  its index and the result. Every blob must be released exactly
+//  once when its message is sent, including by a send that fails
+//  because there is no such service, and a message with more blobs
+//  than O2_MAX_BLOB_REFS must copy the rest and release them at once.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("blobreftest needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+#include "o2_send.h"
+
+#define N_SIZES 8
+#define MARKER 12345
+#define N_MANY (O2_MAX_BLOB_REFS + 2)
+
+// wait up to 5 seconds for cond
+#define POLL_UNTIL(cond) { \
+        double start_ = o2_local_time(); \
+        while (!(cond) && o2_local_time() - start_ < 5) { \
+            o2_poll(); \
+            usleep(1000); \
+        } \
+    }
+
+int sizes[N_SIZES] = { 0, 1, 2, 3, 4, 5, 1000, 200000 };
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+// blob bytes depend on the index of the message and the blob
+void fill(char *data, int size, int seed)
+{
+    for (int i = 0; i < size; i++) {
+        data[i] = (char) (i * 7 + seed);
+    }
+}
+
+
+int blob_ok(o2_blob_ptr blob, int size, int seed)
+{
+    if ((int) blob->size != size) return FALSE;
+    for (int i = 0; i < size; i++) {
+        if (blob->data[i] != (char) (i * 7 + seed)) return FALSE;
+    }
+    return TRUE;
+}
+
+
+// the second blob of message k is about half as large as the first
+int second_size(int k)
+{
+    return sizes[k] / 2 + k;
+}
+
+
+// check message k: its blobs, and the int32 between them
+int message_ok(o2_arg_ptr *argv)
+{
+    int k = argv[0]->i32;
+    return k >= 0 && k < N_SIZES && blob_ok(&argv[1]->b, sizes[k], k) &&
+           argv[2]->i32 == MARKER &&
+           blob_ok(&argv[3]->b, second_size(k), k + 50);
+}
+
+
+// in the receiver, reply with the index and the result; here, count
+//   messages that are intact in *user_data
+int b_handler(const o2_message_ptr msg, const char *types,
+              o2_arg_ptr *argv, int argc, void *user_data)
+{
+    int ok = message_ok(argv);
+    if (user_data) {
+        if (ok) (*(int *) user_data)++;
+    } else {
+        o2_send_cmd("/snd/got", 0, "ii", argv[0]->i32, ok);
+    }
+    return O2_SUCCESS;
+}
+
+
+int quit_handler(const o2_message_ptr msg, const char *types,
+                 o2_arg_ptr *argv, int argc, void *user_data)
+{
+    exit(0);
+}
+
+
+void receiver()
+{
+    o2_initialize("blobreftest");
+    o2_add_service("rcv");
+    o2_add_method("/rcv/b", "ibib", &b_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/quit", "i", &quit_handler, NULL, FALSE, TRUE);
+    double start = o2_local_time();
+    while (o2_local_time() - start < 30) {
+        o2_poll();
+        usleep(1000);
+    }
+    exit(1);
+}
+
+
+// buffers of the blobs, and how many times each was released
+char *buffers[N_SIZES][2];
+int releases[N_SIZES];
+
+void release(void *data, void *user_data)
+{
+    int k = (int) (size_t) user_data;
+    if (data == buffers[k][0] || data == buffers[k][1]) releases[k]++;
+}
+
+
+// start message k, with its blobs in buffers
+void build(int k)
+{
+    o2_start_send();
+    o2_add_int32(k);
+    o2_add_blob_ref(sizes[k], buffers[k][0], &release, (void *) (size_t) k);
+    o2_add_int32(MARKER);
+    o2_add_blob_ref(second_size(k), buffers[k][1], &release,
+                    (void *) (size_t) k);
+}
+
+
+// send every message to address, with flags; returns how many had
+//   both blobs released when the send returned
+int send_all(char *address, int tcp_flag, int flags)
+{
+    int released = 0;
+    for (int k = 0; k < N_SIZES; k++) {
+        releases[k] = 0;
+        build(k);
+        o2_message_ptr msg = o2_finish_message(0, address);
+        msg->flags |= flags;
+        o2_send_message(msg, tcp_flag);
+        if (releases[k] == 2) released++;
+    }
+    return released;
+}
+
+
+int got_count = 0; // replies with an index that was not seen
+int got_ok = 0;    // replies for messages that were intact
+int seen;          // bit k is set when a reply for message k arrives
+
+int got_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    int k = argv[0]->i32;
+    if (!(seen & (1 << k))) {
+        seen |= 1 << k;
+        got_count++;
+        if (argv[1]->i32) got_ok++;
+    }
+    return O2_SUCCESS;
+}
+
+
+// send every message to the receiver and wait for the replies
+void remote_test(int tcp_flag, int flags, const char *what)
+{
+    char msg[80];
+    got_count = got_ok = seen = 0;
+    int released = send_all("/rcv/b", tcp_flag, flags);
+    snprintf(msg, sizeof(msg), "%s: blobs released when sent", what);
+    check(released == N_SIZES, msg);
+    POLL_UNTIL(got_count == N_SIZES);
+    snprintf(msg, sizeof(msg), "%s: every message arrives intact", what);
+    check(got_count == N_SIZES && got_ok == N_SIZES, msg);
+}
+
+
+int many_count = 0;
+int many_releases = 0;
+
+void many_release(void *data, void *user_data)
+{
+    many_releases++;
+}
+
+// the blobs of the message with too many references
+int many_handler(const o2_message_ptr msg, const char *types,
+                 o2_arg_ptr *argv, int argc, void *user_data)
+{
+    int ok = (argc == N_MANY);
+    for (int i = 0; ok && i < N_MANY; i++) {
+        ok = blob_ok(&argv[i]->b, i * 97, i);
+    }
+    if (ok) many_count++;
+    return O2_SUCCESS;
+}
+
+
+void local_tests()
+{
+    int local_ok = 0;
+    o2_add_service("loc");
+    o2_add_method("/loc/b", "ibib", &b_handler, &local_ok, FALSE, TRUE);
+    check(send_all("/loc/b", FALSE, 0) == N_SIZES,
+          "local: blobs released when sent");
+    check(local_ok == N_SIZES, "local: every message arrives intact");
+
+    // the send fails, but the blobs are still released
+    releases[2] = 0;
+    build(2);
+    check(o2_finish_send(0, "/none/b") == O2_FAIL && releases[2] == 2,
+          "blobs of a message to no service are released");
+
+    // blobs past O2_MAX_BLOB_REFS are copied and released at once
+    char many[N_MANY][1000];
+    o2_add_service("many");
+    // N_MANY blobs
+    o2_add_method("/many/b", "bbbbbbbbbb", &many_handler, NULL, FALSE, TRUE);
+    o2_start_send();
+    for (int i = 0; i < N_MANY; i++) {
+        fill(many[i], i * 97, i);
+        o2_add_blob_ref(i * 97, many[i], &many_release, NULL);
+    }
+    check(many_releases == N_MANY - O2_MAX_BLOB_REFS,
+          "blobs past the limit are released when added");
+    o2_finish_send(0, "/many/b");
+    check(many_count == 1 && many_releases == N_MANY,
+          "a message with more blobs than the limit");
+}
+
+
+int main(int argc, const char * argv[])
+{
+    // fork before o2_initialize() so the receiver has its own sockets
+    pid_t pid = fork();
+    if (pid == 0) {
+        receiver();
+    } else if (pid < 0) {
+        perror("blobreftest: fork");
+        return 1;
+    }
+    o2_initialize("blobreftest");
+    o2_add_service("snd");
+    o2_add_method("/snd/got", "ii", &got_handler, NULL, FALSE, TRUE);
+
+    for (int k = 0; k < N_SIZES; k++) {
+        for (int j = 0; j < 2; j++) {
+            int size = (j == 0 ? sizes[k] : second_size(k));
+            buffers[k][j] = (char *) malloc(size + 1);
+            fill(buffers[k][j], size, j == 0 ? k : k + 50);
+        }
+    }
+    local_tests();
+
+    POLL_UNTIL(o2_status("rcv") != O2_FAIL);
+    check(o2_status("rcv") != O2_FAIL, "the receiver is found");
+    remote_test(TRUE, 0, "TCP");
+    remote_test(FALSE, 0, "UDP");
+    remote_test(FALSE, O2_RELIABLE, "reliable UDP");
+
+    o2_send_cmd("/rcv/quit", 0, "i", 0);
+    int status = 0;
+    double start = o2_local_time();
+    while (waitpid(pid, &status, WNOHANG) == 0 &&
+           o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "the receiver exits");
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
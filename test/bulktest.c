@@ -0,0 +1,267 @@
+//  bulktest.c - test the bulk lane (o2_bulk_lane())
+//
+//  This program forks a receiver process offering service "rcv". The
+//  sender turns on the bulk lane and sends a large blob by TCP, then
+//  small messages. The small messages must reach the receiver before
+//  the last chunk of the blob, and the blob must arrive intact. With
+//  a threshold of 0, only a message marked O2_BULK goes in the lane.
+//  The receiver's exit status is the result.
+//
+//  Chunks are also given to o2_bulk_receive() directly: chunks with a
+//  total over O2_MAX_MSG_SIZE, a bad offset, or no first chunk must
+//  not make a message, and a bulk message over O2_MAX_MSG_SIZE must
+//  not be sent.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("bulktest needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+#include "o2_send.h"
+
+#define N_SMALL 10
+#define BIG_SIZE 200000
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+// receiver state
+int small_count = 0;
+int small_before_big = -1; // small_count when the blob arrived
+int marked_count = 0;
+int plain_before_marked = -1; // plain_count when the marked one arrived
+int plain_count = 0;
+int errors = 0;
+
+int small_handler(const o2_message_ptr msg, const char *types,
+                  o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (argv[0]->i32 != small_count) errors++;
+    small_count++;
+    return O2_SUCCESS;
+}
+
+
+int big_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    o2_blob_ptr blob = &argv[0]->b;
+    if (blob->size != BIG_SIZE) {
+        errors++;
+    } else {
+        for (int i = 0; i < BIG_SIZE; i++) {
+            if (((unsigned char *) blob->data)[i] != (unsigned char) i) {
+                errors++;
+                break;
+            }
+        }
+    }
+    small_before_big = small_count;
+    return O2_SUCCESS;
+}
+
+
+int marked_handler(const o2_message_ptr msg, const char *types,
+                   o2_arg_ptr *argv, int argc, void *user_data)
+{
+    plain_before_marked = plain_count;
+    marked_count++;
+    return O2_SUCCESS;
+}
+
+
+int plain_handler(const o2_message_ptr msg, const char *types,
+                  o2_arg_ptr *argv, int argc, void *user_data)
+{
+    plain_count++;
+    return O2_SUCCESS;
+}
+
+
+void receiver()
+{
+    o2_initialize("bulktest");
+    o2_add_service("rcv");
+    o2_add_method("/rcv/small", "i", &small_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/big", "b", &big_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/marked", "i", &marked_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/plain", "i", &plain_handler, NULL, FALSE, TRUE);
+    double start = o2_local_time();
+    while ((small_before_big < 0 || marked_count == 0 || plain_count == 0) &&
+           o2_local_time() - start < 10) {
+        o2_poll();
+        usleep(1000);
+    }
+    printf("receiver got %d small messages before the blob, the marked "
+           "message after %d plain, %d errors\n", small_before_big,
+           plain_before_marked, errors);
+    exit(small_before_big == N_SMALL && plain_before_marked == 1 &&
+         marked_count == 1 && errors == 0 ? 0 : 1);
+}
+
+
+// a chunk of a bulk message as send_bulk_chunk() makes it: total and
+// offset, then n bytes
+o2_message_ptr chunk(int32_t total, int32_t offset, int n)
+{
+    o2_message_ptr msg = alloc_size_message(sizeof(double) + 12 + n);
+    char *data = msg->data.address;
+    msg->data.timestamp = 0;
+    memcpy(data, "%\0\0\0", 4);
+    int32_t word = htonl(total);
+    memcpy(data + 4, &word, 4);
+    word = htonl(offset);
+    memcpy(data + 8, &word, 4);
+    memset(data + 12, 0, n);
+    msg->length = sizeof(double) + 12 + n;
+    return msg;
+}
+
+
+void receive_tests()
+{
+    process_info proc;
+    memset(&proc, 0, sizeof(proc));
+    o2_message_ptr msg;
+    // a message of 32 bytes in two chunks
+    check(o2_bulk_receive(&proc, chunk(32, 0, 16)) == NULL,
+          "the first chunk does not make a message");
+    msg = o2_bulk_receive(&proc, chunk(32, 16, 16));
+    check(msg && msg->length == 32, "the last chunk makes a message");
+    if (msg) o2_free_message(msg);
+    // no first chunk
+    check(o2_bulk_receive(&proc, chunk(32, 16, 16)) == NULL,
+          "a chunk without the first chunk is dropped");
+    // too large to allocate
+    check(o2_bulk_receive(&proc, chunk(O2_MAX_MSG_SIZE + 1, 0, 16)) == NULL &&
+          proc.bulk_in == NULL, "a total over O2_MAX_MSG_SIZE is dropped");
+    check(o2_bulk_receive(&proc, chunk(0x7FFFFFFF, 0, 16)) == NULL &&
+          proc.bulk_in == NULL, "a total of 2GB is dropped");
+    // offsets that do not fit
+    check(o2_bulk_receive(&proc, chunk(32, 0, 16)) == NULL,
+          "the first chunk");
+    check(o2_bulk_receive(&proc, chunk(32, 24, 16)) == NULL,
+          "a chunk past the end is dropped");
+    check(o2_bulk_receive(&proc, chunk(32, -16, 16)) == NULL,
+          "a negative offset is dropped");
+    check(o2_bulk_receive(&proc, chunk(32, 8, 16)) == NULL,
+          "a chunk at the wrong offset is dropped");
+    // a chunk without a whole header
+    msg = chunk(32, 0, 0);
+    msg->length -= 4;
+    check(o2_bulk_receive(&proc, msg) == NULL, "a short chunk is dropped");
+    if (proc.bulk_in) o2_free_message(proc.bulk_in);
+}
+
+
+void poll_for(double seconds)
+{
+    double start = o2_local_time();
+    while (o2_local_time() - start < seconds) {
+        o2_poll();
+        usleep(1000);
+    }
+}
+
+
+int main(int argc, const char * argv[])
+{
+    // fork before o2_initialize() so the receiver has its own sockets
+    pid_t pid = fork();
+    if (pid == 0) {
+        receiver();
+    } else if (pid < 0) {
+        perror("bulktest: fork");
+        return 1;
+    }
+    o2_initialize("bulktest");
+    o2_set_clock(NULL, NULL);
+    receive_tests();
+
+    double start = o2_local_time();
+    while (o2_status("rcv") != O2_REMOTE && o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(o2_status("rcv") == O2_REMOTE, "rcv discovered");
+
+    // the blob goes in the lane, the small messages pass it
+    o2_bulk_lane(1000, 8192);
+    o2_blob_ptr blob = o2_blob_new(BIG_SIZE);
+    blob->size = BIG_SIZE;
+    for (int i = 0; i < BIG_SIZE; i++) {
+        ((unsigned char *) blob->data)[i] = (unsigned char) i;
+    }
+    o2_start_send();
+    o2_add_blob(blob);
+    check(o2_send_message(o2_finish_message(0, "/rcv/big"), TRUE) ==
+          O2_SUCCESS, "send the blob");
+    O2_FREE(blob);
+    for (int i = 0; i < N_SMALL; i++) {
+        o2_send_cmd("/rcv/small", 0, "i", i);
+    }
+    poll_for(0.2);
+
+    // with threshold 0, only marked messages go in the lane
+    o2_bulk_lane(0, 8192);
+    o2_start_send();
+    o2_add_int32(1);
+    o2_message_ptr msg = o2_finish_message(0, "/rcv/marked");
+    msg->flags |= O2_BULK;
+    o2_send_message(msg, TRUE);
+    o2_send_cmd("/rcv/plain", 0, "i", 1);
+
+    // too large for any TCP frame
+    char *data = (char *) calloc(O2_MAX_MSG_SIZE, 1);
+    o2_start_send();
+    o2_add_blob_data(O2_MAX_MSG_SIZE, data);
+    free(data);
+    msg = o2_finish_message(0, "/rcv/big");
+    msg->flags |= O2_BULK;
+    check(o2_send_message(msg, TRUE) == O2_FAIL,
+          "a bulk message over O2_MAX_MSG_SIZE is not sent");
+
+    int status = 0;
+    start = o2_local_time();
+    while (waitpid(pid, &status, WNOHANG) == 0 &&
+           o2_local_time() - start < 12) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          "small messages pass bulk messages, which arrive intact");
+    o2_bulk_lane(-1, 0);
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
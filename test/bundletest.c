@@ -0,0 +1,215 @@
+//  bundletest.c - test O2 bundles
+//
+//  Local part: an untimed bundle is delivered in order as soon as it
+//  is finished, a timed bundle (with a nested bundle) is held until
+//  its time and then delivered in order, and o2_add_message() rejects
+//  a message to another service.
+//
+//  Remote part: this program forks a receiver process offering
+//  service "rcv". The sender sends one bundle by TCP and one by UDP,
+//  and the receiver checks that the elements of each arrive in order,
+//  one bundle after the other. The receiver's exit status is the
+//  result.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("bundletest needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#define N_ELEMENTS 10
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+int seq[100];
+o2_time when[100];
+int received = 0;
+
+int element_handler(const o2_message_ptr msg, const char *types,
+                    o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (received < 100) {
+        seq[received] = argv[0]->i32;
+        when[received] = msg->data.timestamp;
+    }
+    received++;
+    return O2_SUCCESS;
+}
+
+
+void poll_for(double seconds)
+{
+    double start = o2_local_time();
+    while (o2_local_time() - start < seconds) {
+        o2_poll();
+        usleep(1000);
+    }
+}
+
+
+void local_tests()
+{
+    o2_add_service("one");
+    o2_add_service("two");
+    o2_add_method("/one/a", "i", &element_handler, NULL, FALSE, TRUE);
+    o2_add_method("/one/b", "i", &element_handler, NULL, FALSE, TRUE);
+
+    // untimed: all elements are delivered by o2_finish_bundle()
+    check(o2_start_bundle() == O2_SUCCESS, "o2_start_bundle");
+    for (int i = 0; i < N_ELEMENTS; i++) {
+        o2_start_send();
+        o2_add_int32(i);
+        // element timestamps are ignored: the bundle's time is used
+        o2_message_ptr msg = o2_finish_message(123.0,
+                                               (i & 1) ? "/one/b" : "/one/a");
+        check(o2_add_message(msg) == O2_SUCCESS, "o2_add_message");
+    }
+    o2_start_send();
+    o2_add_int32(99);
+    check(o2_add_message(o2_finish_message(0, "/two/a")) == O2_FAIL,
+          "o2_add_message to another service fails");
+    check(o2_finish_bundle(0) == O2_SUCCESS, "o2_finish_bundle");
+    check(received == N_ELEMENTS, "untimed bundle delivered");
+    for (int i = 0; i < received && i < N_ELEMENTS; i++) {
+        check(seq[i] == i && when[i] == 0, "untimed bundle order");
+    }
+
+    // timed, with a nested bundle: held until its time, then in order
+    received = 0;
+    o2_start_bundle();
+    for (int i = 0; i < 3; i++) {
+        o2_start_send();
+        o2_add_int32(i);
+        o2_add_message(o2_finish_message(0, "/one/a"));
+    }
+    o2_message_ptr inner = o2_finish_bundle_message(0);
+    check(inner != NULL, "o2_finish_bundle_message");
+    o2_start_bundle();
+    o2_add_message(inner);
+    o2_start_send();
+    o2_add_int32(3);
+    o2_add_message(o2_finish_message(0, "/one/b"));
+    o2_time t = o2_get_time() + 0.1;
+    check(o2_finish_bundle(t) == O2_SUCCESS, "timed o2_finish_bundle");
+    check(received == 0, "timed bundle is held");
+    double start = o2_local_time();
+    while (received == 0 && o2_local_time() - start < 1) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(received == 4, "timed bundle delivered");
+    for (int i = 0; i < received && i < 4; i++) {
+        check(seq[i] == i && when[i] == t, "timed bundle order and time");
+    }
+    check(o2_finish_bundle(0) == O2_FAIL, "o2_finish_bundle without start");
+}
+
+
+// the receiver gets bundle 1 by TCP, then bundle 2 by UDP; each
+// element's value is bundle * 100 + index
+void receiver()
+{
+    o2_initialize("bundletest");
+    o2_add_service("rcv");
+    o2_add_method("/rcv/x", "i", &element_handler, NULL, FALSE, TRUE);
+    double start = o2_local_time();
+    while (received < 2 * N_ELEMENTS && o2_local_time() - start < 10) {
+        o2_poll();
+        usleep(1000);
+    }
+    int ok = (received == 2 * N_ELEMENTS);
+    for (int i = 0; ok && i < received; i++) {
+        int expect = (i / N_ELEMENTS + 1) * 100 + i % N_ELEMENTS;
+        ok = (seq[i] == expect);
+    }
+    printf("receiver got %d of %d elements%s\n", received,
+           2 * N_ELEMENTS, ok ? "" : ", NOT IN ORDER");
+    exit(ok ? 0 : 1);
+}
+
+
+void send_bundle(int bundle, int tcp_flag)
+{
+    o2_start_bundle();
+    for (int i = 0; i < N_ELEMENTS; i++) {
+        o2_start_send();
+        o2_add_int32(bundle * 100 + i);
+        o2_add_message(o2_finish_message(0, "/rcv/x"));
+    }
+    o2_message_ptr msg = o2_finish_bundle_message(0);
+    check(msg != NULL, "o2_finish_bundle_message to rcv");
+    if (msg) {
+        check(o2_send_message(msg, tcp_flag) == O2_SUCCESS,
+              "send bundle to rcv");
+    }
+}
+
+
+void remote_tests(pid_t pid)
+{
+    double start = o2_local_time();
+    while (o2_status("rcv") != O2_REMOTE && o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(o2_status("rcv") == O2_REMOTE, "rcv discovered");
+    send_bundle(1, TRUE);
+    poll_for(0.1); // let the TCP bundle arrive before the UDP one
+    send_bundle(2, FALSE);
+    int status = 0;
+    start = o2_local_time();
+    while (waitpid(pid, &status, WNOHANG) == 0 &&
+           o2_local_time() - start < 12) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          "receiver got both bundles in order");
+}
+
+
+int main(int argc, const char * argv[])
+{
+    // fork before o2_initialize() so the receiver has its own sockets
+    pid_t pid = fork();
+    if (pid == 0) {
+        receiver();
+    } else if (pid < 0) {
+        perror("bundletest: fork");
+        return 1;
+    }
+    o2_initialize("bundletest");
+    o2_set_clock(NULL, NULL);
+    local_tests();
+    received = 0;
+    remote_tests(pid);
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,288 @@
+//  coalescetest.c - test o2_coalesce_messages()
+//
+//  This program forks a receiver process offering service "rcv". The
+//  sender turns on coalescing and sends bursts of messages by UDP and
+//  by TCP, some of them timed, so that they travel in coalesced ("#")
+//  frames. Each message carries its index and its timestamp. The
+//  receiver checks that every message arrives once, in order, with its
+//  own timestamp, and that timed messages are not delivered early.
+//  A message larger than a frame is sent between the bursts to check
+//  that it is sent on its own. The receiver's exit status is the
+//  result.
+//
+//  The sender also sends frames built by hand to its own UDP port: a
+//  message in a frame must be delivered, but a frame in a frame, which
+//  no sender makes, must be dropped.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("coalescetest needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+
+#define N_UDP 200
+#define N_TCP 2000
+#define N_TIMED 10
+#define BIG_SIZE 20000
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+// receiver state
+int udp_count = 0;
+int tcp_count = 0;
+int timed_count = 0;
+int big_count = 0;
+int errors = 0;
+
+// argv[0] is the index, argv[1] the timestamp the message was sent with
+int udp_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (argv[0]->i32 != udp_count || msg->data.timestamp != argv[1]->d) {
+        errors++;
+    }
+    udp_count++;
+    return O2_SUCCESS;
+}
+
+
+int tcp_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (argv[0]->i32 != tcp_count || msg->data.timestamp != argv[1]->d) {
+        errors++;
+    }
+    tcp_count++;
+    return O2_SUCCESS;
+}
+
+
+int timed_handler(const o2_message_ptr msg, const char *types,
+                  o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (argv[0]->i32 != timed_count || msg->data.timestamp != argv[1]->d ||
+        o2_get_time() < msg->data.timestamp - 0.01) {
+        errors++;
+    }
+    timed_count++;
+    return O2_SUCCESS;
+}
+
+
+int big_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    o2_blob_ptr blob = &argv[0]->b;
+    if (blob->size != BIG_SIZE) {
+        errors++;
+    } else {
+        for (int i = 0; i < BIG_SIZE; i++) {
+            if (((unsigned char *) blob->data)[i] != (unsigned char) i) {
+                errors++;
+                break;
+            }
+        }
+    }
+    big_count++;
+    return O2_SUCCESS;
+}
+
+
+int all_received()
+{
+    return udp_count >= N_UDP && tcp_count >= N_TCP &&
+           timed_count >= N_TIMED && big_count >= 1;
+}
+
+
+void receiver()
+{
+    o2_initialize("coalescetest");
+    o2_add_service("rcv");
+    o2_add_method("/rcv/u", "id", &udp_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/t", "id", &tcp_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/timed", "id", &timed_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/big", "b", &big_handler, NULL, FALSE, TRUE);
+    // timed messages need clock sync: tell the sender when it is done
+    double start = o2_local_time();
+    while (o2_status("snd") != O2_REMOTE && o2_local_time() - start < 10) {
+        o2_poll();
+        usleep(1000);
+    }
+    o2_send_cmd("/snd/ready", 0, "i", 1);
+    start = o2_local_time();
+    while (!all_received() && o2_local_time() - start < 10) {
+        o2_poll();
+        usleep(1000);
+    }
+    printf("receiver got udp %d/%d tcp %d/%d timed %d/%d big %d/1, "
+           "%d errors\n", udp_count, N_UDP, tcp_count, N_TCP,
+           timed_count, N_TIMED, big_count, errors);
+    exit(udp_count == N_UDP && tcp_count == N_TCP &&
+         timed_count == N_TIMED && big_count == 1 && errors == 0 ? 0 : 1);
+}
+
+
+int ready = 0;
+
+int ready_handler(const o2_message_ptr msg, const char *types,
+                  o2_arg_ptr *argv, int argc, void *user_data)
+{
+    ready = 1;
+    return O2_SUCCESS;
+}
+
+
+int framed_count = 0;
+
+int framed_handler(const o2_message_ptr msg, const char *types,
+                   o2_arg_ptr *argv, int argc, void *user_data)
+{
+    framed_count++;
+    return O2_SUCCESS;
+}
+
+
+// write a frame holding the len bytes at element to out
+int frame(char *out, const char *element, int len)
+{
+    int32_t word = htonl(len);
+    memset(out, 0, 12); // timestamp and "#" padded
+    out[8] = '#';
+    memcpy(out + 12, &word, 4);
+    memcpy(out + 16, element, len);
+    return 16 + len;
+}
+
+
+void poll_for(double seconds)
+{
+    double start = o2_local_time();
+    while (o2_local_time() - start < seconds) {
+        o2_poll();
+        usleep(1000);
+    }
+}
+
+
+int main(int argc, const char * argv[])
+{
+    // fork before o2_initialize() so the receiver has its own sockets
+    pid_t pid = fork();
+    if (pid == 0) {
+        receiver();
+    } else if (pid < 0) {
+        perror("coalescetest: fork");
+        return 1;
+    }
+    o2_initialize("coalescetest");
+    o2_add_service("snd");
+    o2_add_method("/snd/ready", "i", &ready_handler, NULL, FALSE, TRUE);
+    o2_set_clock(NULL, NULL);
+    double start = o2_local_time();
+    while (!ready && o2_local_time() - start < 10) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(ready, "receiver is ready");
+
+    // frames sent by hand to our own UDP port
+    o2_add_method("/snd/framed", "i", &framed_handler, NULL, FALSE, TRUE);
+    o2_start_send();
+    o2_add_int32(1);
+    o2_message_ptr msg = o2_finish_message(0, "/snd/framed");
+    char once[100], twice[100];
+    int once_len = frame(once, (char *) &msg->data, msg->length);
+    int twice_len = frame(twice, once, once_len);
+    o2_free_message(msg);
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(0x7F000001);
+    sa.sin_port = htons(o2_process.udp_port);
+    sendto(sock, twice, twice_len, 0, (struct sockaddr *) &sa, sizeof(sa));
+    sendto(sock, once, once_len, 0, (struct sockaddr *) &sa, sizeof(sa));
+    close(sock);
+    start = o2_local_time();
+    while (framed_count == 0 && o2_local_time() - start < 1) {
+        o2_poll();
+        usleep(1000);
+    }
+    poll_for(0.05);
+    check(framed_count == 1, "a frame in a frame is dropped");
+
+    check(o2_coalesce_messages(0.01) == O2_SUCCESS, "o2_coalesce_messages");
+    // UDP: in bursts of 50 so the receiver's socket buffer keeps up
+    for (int i = 0; i < N_UDP; i++) {
+        o2_send("/rcv/u", 0, "id", i, 0.0);
+        if (i % 50 == 49) poll_for(0.005);
+    }
+    // TCP, with the timed messages in between
+    o2_time when = o2_get_time() + 0.2;
+    int timed = 0;
+    for (int i = 0; i < N_TCP; i++) {
+        o2_send_cmd("/rcv/t", 0, "id", i, 0.0);
+        if (i % (N_TCP / N_TIMED) == 0) {
+            o2_time t = when + timed * 0.01;
+            o2_send_cmd("/rcv/timed", t, "id", timed, t);
+            timed++;
+        }
+    }
+    // too big for a frame: sent by itself after the held messages
+    o2_blob_ptr blob = o2_blob_new(BIG_SIZE);
+    blob->size = BIG_SIZE;
+    for (int i = 0; i < BIG_SIZE; i++) {
+        ((unsigned char *) blob->data)[i] = (unsigned char) i;
+    }
+    o2_start_send();
+    o2_add_blob(blob);
+    o2_send_message(o2_finish_message(0, "/rcv/big"), TRUE);
+    O2_FREE(blob);
+    check(o2_flush() == O2_SUCCESS, "o2_flush");
+
+    int status = 0;
+    start = o2_local_time();
+    while (waitpid(pid, &status, WNOHANG) == 0 &&
+           o2_local_time() - start < 15) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          "receiver got all messages in order with their timestamps");
+    o2_coalesce_messages(-1);
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,324 @@
+//  compacttest.c - test the compact encoding (see o2_compact.c)
+//
+//  Messages are encoded with o2_compact_send() and decoded with
+//  o2_compact_receive() in this process. Both use the type string
+//  tables of one o2_fds_info entry, which stands for a connection to
+//  this process: what the encoder numbers, the decoder numbers too.
+//  Every decoded message must be byte for byte the message that was
+//  encoded. The test covers every type the encoding handles, varints
+//  at their size boundaries and the extremes of zigzag, timestamps,
+//  type strings sent by number after their first use and after the
+//  table is full, and messages that must be sent as they are.
+//
+//  Then hand-made and truncated compact messages are given to
+//  o2_compact_receive(), which must reject each malformed one. Last,
+//  a compact frame that cannot be allocated is sent to this process's
+//  TCP port: the connection must be closed.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+#include "o2_compact.h"
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+fds_info_ptr loopback;    // the connection the messages go over
+process_info loopback_proc;
+
+int32_t ints[] = {0, -1, 1, 63, -64, 64, -65, 8191, 8192, -8193,
+                  0x7FFFFFFF, (int32_t) 0x80000000};
+int64_t longs[] = {0, -1, 0x7FFFFFFFFFFFFFFFLL,
+                   (int64_t) 0x8000000000000000ULL, 1LL << 35, -(1LL << 35)};
+float floats[] = {0.5f, -1e30f, 3.0f};
+double doubles[] = {1e-300, -2.5};
+
+// a message with every type the compact encoding handles; k varies
+// the values and the string length
+o2_message_ptr build_all(int k, o2_time time)
+{
+    uint8_t midi[4] = {0x90, 60, (uint8_t) k, 0};
+    char string[100];
+    memset(string, 'a' + k % 26, sizeof(string));
+    string[k % 100] = 0;
+    o2_start_send();
+    o2_add_int32(ints[k % 12]);
+    o2_add_int64(longs[k % 6]);
+    o2_add_float(k * 0.5f);
+    o2_add_double(-k * 0.25);
+    o2_add_time(k + 0.125);
+    o2_add_string(string);
+    o2_add_symbol("sym");
+    o2_add_char('A' + k % 26);
+    o2_add_midi(midi);
+    o2_add_true();
+    o2_add_false();
+    o2_add_nil();
+    o2_add_infinitum();
+    o2_add_vector(O2_INT32, 12, ints);
+    o2_add_vector(O2_INT64, 6, longs);
+    o2_add_vector(O2_FLOAT, 3, floats);
+    o2_add_vector(O2_DOUBLE, 2, doubles);
+    o2_add_vector(O2_INT32, 0, ints);
+    return o2_finish_message(time, "/test/all");
+}
+
+
+// a message whose type string of 9 'i' and 'f' spells code in binary
+o2_message_ptr build_code(int code)
+{
+    o2_start_send();
+    for (int i = 0; i < 9; i++) {
+        if ((code >> (8 - i)) & 1) {
+            o2_add_float((float) code);
+        } else {
+            o2_add_int32(code);
+        }
+    }
+    return o2_finish_message(0, "/test/code");
+}
+
+
+// Encode msg and decode it again. expect is a copy of msg, which is
+// freed. Returns the compact length, or -1 if it was not encoded.
+int round_trip(o2_message_ptr msg, o2_message_ptr expect, const char *what)
+{
+    int length = -1;
+    o2_message_ptr cmsg = o2_compact_send(&loopback_proc, msg);
+    check((cmsg->flags & O2_COMPACT) && cmsg->length < expect->length,
+          what);
+    if (cmsg->flags & O2_COMPACT) {
+        length = cmsg->length;
+        o2_message_ptr decoded = o2_compact_receive(loopback, cmsg);
+        check(decoded && !(decoded->flags & O2_COMPACT) &&
+              decoded->length == expect->length &&
+              memcmp(&decoded->data, &expect->data, expect->length) == 0,
+              what);
+        if (decoded) o2_free_message(decoded);
+    } else {
+        o2_free_message(cmsg);
+    }
+    o2_free_message(expect);
+    return length;
+}
+
+
+// a compact message with the given bytes
+o2_message_ptr compact_message(const char *bytes, int length)
+{
+    o2_message_ptr msg = alloc_size_message(length);
+    memcpy(&msg->data, bytes, length);
+    msg->length = length;
+    msg->flags = O2_COMPACT;
+    return msg;
+}
+
+
+// decode bytes on a new connection; TRUE if the message is accepted
+int accepted(const char *bytes, int length)
+{
+    fds_info info;
+    memset(&info, 0, sizeof(info));
+    info.u.process_info = &o2_process;
+    o2_message_ptr decoded =
+            o2_compact_receive(&info, compact_message(bytes, length));
+    if (decoded) o2_free_message(decoded);
+    if (info.types) o2_compact_free(info.types);
+    return decoded != NULL;
+}
+
+
+void malformed_tests(const char *good, int good_length)
+{
+    check(accepted(good, good_length), "a valid message is accepted");
+    for (int cut = 0; cut < good_length; cut++) {
+        check(!accepted(good, cut), "a truncated message is rejected");
+    }
+    char bytes[64];
+    memcpy(bytes, good, good_length);
+    bytes[good_length] = 0;
+    check(!accepted(bytes, good_length + 1),
+          "a message with extra bytes is rejected");
+
+    // flags 0, address "/t/x", then the cases below
+    const char head[] = {0, 4, '/', 't', '/', 'x'};
+    // type string number 0 before any was sent
+    memcpy(bytes, head, 6);
+    bytes[6] = 1;
+    check(!accepted(bytes, 7), "an unknown type string is rejected");
+    // a vector whose element type is not the one in the type string
+    memcpy(bytes + 6, "\x06" "vif" "\x01" "f", 6);
+    memcpy(bytes + 12, "\0\0\0\0", 4);
+    check(!accepted(bytes, 16), "a vector element type mismatch is "
+          "rejected");
+    // a vector with no element type in the type string
+    memcpy(bytes + 6, "\x02" "v" "\x00" "i", 4);
+    check(!accepted(bytes, 10), "a vector without an element type is "
+          "rejected");
+    // a string longer than the message
+    memcpy(bytes + 6, "\x02" "s" "\x10" "abc", 6);
+    check(!accepted(bytes, 12), "a string past the end is rejected");
+    // an int32 varint that does not end
+    memcpy(bytes + 6, "\x02" "i" "\xff\xff\xff", 5);
+    check(!accepted(bytes, 11), "an unterminated varint is rejected");
+    // an empty address
+    memcpy(bytes, "\0\0\x02" "i" "\x02", 5);
+    check(!accepted(bytes, 5), "an empty address is rejected");
+    // a type that is never encoded (a blob)
+    memcpy(bytes, head, 6);
+    memcpy(bytes + 6, "\x02" "b" "\x00", 3);
+    check(!accepted(bytes, 9), "a blob is rejected");
+    // a timestamp flag with no timestamp
+    memcpy(bytes, "\x01" "\0\0\0", 4);
+    check(!accepted(bytes, 4), "a short timestamp is rejected");
+}
+
+
+#ifndef WIN32
+// an allocator that fails for anything as large as the frame below
+void *small_malloc(size_t size)
+{
+    return size < 50000 ? malloc(size) : NULL;
+}
+
+
+// the number of open TCP connections
+int tcp_connections()
+{
+    int count = 0;
+    for (int i = 0; i < o2_fds_info.length; i++) {
+        if (DA_GET(o2_fds_info, fds_info, i)->tag == TCP_SOCKET) count++;
+    }
+    return count;
+}
+
+
+// send the length of a compact frame to this process's TCP port when
+// the frame cannot be allocated: the connection must be closed
+void unallocated_test()
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(0x7F000001);
+    sa.sin_port = htons(o2_local_tcp_port);
+    int before = tcp_connections();
+    check(connect(sock, (struct sockaddr *) &sa, sizeof(sa)) == 0,
+          "connect");
+    for (int i = 0; i < 100 && tcp_connections() == before; i++) {
+        o2_poll(); // accept the connection
+        usleep(1000);
+    }
+    uint32_t len = htonl(O2_COMPACT_LENGTH | 60000);
+    check(send(sock, &len, 4, 0) == 4, "send");
+    o2_memory(&small_malloc, &free);
+    for (int i = 0; i < 100 && tcp_connections() > before; i++) {
+        o2_poll();
+        usleep(1000);
+    }
+    o2_memory(&malloc, &free);
+    check(tcp_connections() == before,
+          "a frame that cannot be allocated closes the connection");
+    close(sock);
+}
+#endif
+
+
+int main(int argc, const char * argv[])
+{
+    o2_initialize("test");
+    for (int i = 0; i < o2_fds_info.length; i++) {
+        fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
+        if (info->tag == TCP_SERVER_SOCKET) {
+            loopback = info;
+            loopback_proc.tcp_fd_index = i;
+        }
+    }
+    check(loopback != NULL, "found the TCP server socket");
+    if (!loopback) return 1;
+
+    // every type, with and without timestamps; after the first
+    // message its type string goes by number
+    int first = round_trip(build_all(0, 0), build_all(0, 0),
+                           "round trip of every type");
+    int second = round_trip(build_all(0, 0), build_all(0, 0),
+                            "round trip with a numbered type string");
+    check(second > 0 && second < first - 10,
+          "a numbered type string is shorter");
+    for (int k = 1; k < 100; k++) {
+        round_trip(build_all(k, k * 1.5), build_all(k, k * 1.5),
+                   "round trip of values and timestamps");
+    }
+
+    // more type strings than are numbered: the ones after the limit
+    // are always sent in full
+    int full_length[300];
+    int in_full = 0, by_number = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int code = 0; code < 300; code++) {
+            int n = round_trip(build_code(code), build_code(code),
+                               "round trip of many type strings");
+            if (pass == 0) {
+                full_length[code] = n;
+            } else if (n >= 0 && n < full_length[code]) {
+                by_number++;
+            } else if (n >= 0) {
+                in_full++;
+            }
+        }
+    }
+    check(by_number > 0 && in_full > 0,
+          "type strings are numbered up to the limit");
+
+    // messages that are sent as they are
+    o2_start_send();
+    o2_add_blob_data(4, "abcd");
+    o2_message_ptr msg = o2_finish_message(0, "/test/blob");
+    check(o2_compact_send(&loopback_proc, msg) == msg &&
+          !(msg->flags & O2_COMPACT), "a blob is not encoded");
+    o2_free_message(msg);
+    o2_start_send();
+    o2_add_int32(1);
+    msg = o2_finish_message(0, "/_o2/x");
+    check(o2_compact_send(&loopback_proc, msg) == msg,
+          "an O2 message is not encoded");
+    o2_free_message(msg);
+
+    // a valid compact message: flags, address "/t/x", types "if"
+    // inline, zigzag -2, a float
+    float f = 2.5f;
+    char good[16] = {0, 4, '/', 't', '/', 'x', 4, 'i', 'f', 3};
+    memcpy(good + 10, &f, 4);
+    malformed_tests(good, 14);
+
+    o2_compact_free(loopback->types);
+    loopback->types = NULL;
+#ifndef WIN32
+    unallocated_test();
+#endif
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,260 @@
+//  discoverybench.c - discovery and connection-setup benchmark
+//
+//  This program forks N O2 processes on this host, all in the same
+//  application. Process k offers service "pk", and process 0 provides
+//  the master clock. Each process measures:
+//      mesh_time - seconds until it sees the services of all others
+//      sync_time - seconds until all those services report O2_REMOTE,
+//                  i.e. both ends have clock sync
+//      discovery_sent - discovery messages it sent up to sync_time
+//      cpu_time - CPU seconds (user + system) it used up to sync_time
+//      peak_cpu - highest CPU load (CPU seconds per second) over any
+//                 0.1s interval up to sync_time
+//  Times are from the moment the processes were started. A process
+//  that does not finish within the timeout reports -1 for the times.
+//
+//  Results go to a CSV file with one line per process, and a summary
+//  is printed. Usage:
+//      discoverybench [-n processes] [-t timeout] [-o file] [-l]
+//  -n defaults to 10, -t to 60 seconds, -o to discoverybench.csv.
+//  -l uses o2_lazy_connections(0), so processes only exchange
+//  announcements and never connect here.
+//
+//  Raise the open file limit (ulimit -n) for large N: each process
+//  has a socket for every other process.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("discoverybench needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_discovery.h"
+#include "o2_clock.h"
+
+#define MAX_PROCESSES 1000
+
+double start_time; // when the processes were started (wall time)
+
+
+double wall_time()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+
+double cpu_time()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+
+// the lowest status of the services of all other processes, or -1 if
+// some service is not known yet
+//
+int mesh_status(int me, int n)
+{
+    int lowest = O2_REMOTE;
+    for (int i = 0; i < n; i++) {
+        if (i == me) continue;
+        char service[16];
+        sprintf(service, "p%d", i);
+        int status = o2_status(service);
+        if (status < 0) return -1;
+        if (status < lowest) lowest = status;
+    }
+    return lowest;
+}
+
+
+// run one O2 process; reports one line of results on fd, then keeps
+// polling so that the others can finish, until it is killed
+//
+void bench_process(int me, int n, double timeout, int lazy, int fd)
+{
+    char service[16];
+    sprintf(service, "p%d", me);
+    // where SO_NOSIGPIPE is not available, a peer that closes a socket
+    // would otherwise kill this process
+    signal(SIGPIPE, SIG_IGN);
+    if (lazy) o2_lazy_connections(0);
+    if (o2_initialize("discoverybench")) {
+        exit(1);
+    }
+    o2_add_service(service);
+    if (me == 0) {
+        o2_set_clock(NULL, NULL);
+    }
+    double mesh_time = -1;
+    double sync_time = -1;
+    double last_check = 0;
+    double last_sample = wall_time();
+    double last_cpu = cpu_time();
+    double peak_cpu = 0;
+    int reported = FALSE;
+    while (TRUE) {
+        o2_poll();
+        usleep(1000);
+        double now = wall_time();
+        if (reported || now - last_check < 0.01) continue;
+        last_check = now;
+        if (now - last_sample >= 0.1) {
+            double cpu = cpu_time();
+            double load = (cpu - last_cpu) / (now - last_sample);
+            if (load > peak_cpu) peak_cpu = load;
+            last_cpu = cpu;
+            last_sample = now;
+        }
+        int status = mesh_status(me, n);
+        if (status >= 0 && mesh_time < 0) {
+            mesh_time = now - start_time;
+        }
+        if (status == O2_REMOTE && o2_clock_is_synchronized) {
+            sync_time = now - start_time;
+        }
+        if (sync_time >= 0 || now - start_time > timeout) {
+            char line[128];
+            int len = sprintf(line, "%d,%d,%g,%g,%ld,%g,%g\n", n, me,
+                              mesh_time, sync_time, o2_discovery_sent,
+                              cpu_time(), peak_cpu);
+            write(fd, line, len); // short lines are written atomically
+            reported = TRUE;
+        }
+    }
+}
+
+
+int main(int argc, const char * argv[])
+{
+    int n = 10;
+    double timeout = 60;
+    const char *filename = "discoverybench.csv";
+    int lazy = FALSE;
+    for (int i = 1; i < argc; i++) {
+        if (streql(argv[i], "-n") && i + 1 < argc) {
+            n = atoi(argv[++i]);
+        } else if (streql(argv[i], "-t") && i + 1 < argc) {
+            timeout = atof(argv[++i]);
+        } else if (streql(argv[i], "-o") && i + 1 < argc) {
+            filename = argv[++i];
+        } else if (streql(argv[i], "-l")) {
+            lazy = TRUE;
+        } else {
+            printf("usage: discoverybench [-n processes] [-t timeout] "
+                   "[-o file] [-l]\n");
+            return 1;
+        }
+    }
+    if (n < 2 || n > MAX_PROCESSES) {
+        printf("number of processes must be from 2 to %d\n", MAX_PROCESSES);
+        return 1;
+    }
+    FILE *out = fopen(filename, "w");
+    if (!out) {
+        perror("discoverybench: cannot open results file");
+        return 1;
+    }
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("discoverybench: pipe");
+        return 1;
+    }
+    static pid_t pids[MAX_PROCESSES];
+    start_time = wall_time();
+    for (int i = 0; i < n; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            close(fds[0]);
+            bench_process(i, n, timeout, lazy, fds[1]);
+        } else if (pids[i] < 0) {
+            perror("discoverybench: fork");
+            n = i; // measure the processes we have
+            break;
+        }
+    }
+    close(fds[1]);
+
+    // collect one line per process; lines may arrive split across reads
+    fprintf(out, "processes,process,mesh_time,sync_time,discovery_sent,"
+                 "cpu_time,peak_cpu\n");
+    char buffer[256];
+    int used = 0;
+    int results = 0;
+    int meshed = 0;
+    int synced = 0;
+    double max_mesh = 0, max_sync = 0, max_peak = 0, total_cpu = 0;
+    long total_sent = 0;
+    struct pollfd pfd = { fds[0], POLLIN, 0 };
+    while (results < n) {
+        // leave the processes a little longer than their own timeout
+        int wait_ms = (int) ((start_time + timeout + 5 - wall_time()) * 1000);
+        if (wait_ms <= 0 || poll(&pfd, 1, wait_ms) <= 0) break;
+        int len = (int) read(fds[0], buffer + used, sizeof(buffer) - 1 - used);
+        if (len <= 0) break;
+        used += len;
+        buffer[used] = 0;
+        char *eol;
+        while ((eol = strchr(buffer, '\n'))) {
+            *eol = 0;
+            int processes, process;
+            double mesh, sync, cpu, peak;
+            long sent;
+            if (sscanf(buffer, "%d,%d,%lf,%lf,%ld,%lf,%lf", &processes,
+                       &process, &mesh, &sync, &sent, &cpu, &peak) == 7) {
+                fprintf(out, "%s\n", buffer);
+                results++;
+                if (mesh >= 0) meshed++;
+                if (sync >= 0) synced++;
+                if (mesh > max_mesh) max_mesh = mesh;
+                if (sync > max_sync) max_sync = sync;
+                if (peak > max_peak) max_peak = peak;
+                total_sent += sent;
+                total_cpu += cpu;
+            }
+            used -= (int) (eol + 1 - buffer);
+            memmove(buffer, eol + 1, used + 1);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        kill(pids[i], SIGTERM);
+    }
+    for (int i = 0; i < n; i++) {
+        waitpid(pids[i], NULL, 0);
+    }
+    fclose(out);
+
+    printf("%d processes, %d reported within %gs\n", n, results, timeout);
+    printf("%d reached full mesh, slowest after %gs\n", meshed, max_mesh);
+    printf("%d reached clock sync, slowest after %gs\n", synced, max_sync);
+    printf("discovery messages %ld (%g per process)\n", total_sent,
+           results ? (double) total_sent / results : 0.0);
+    printf("cpu time %gs per process, peak load %g\n",
+           results ? total_cpu / results : 0.0, max_peak);
+    printf("results written to %s\n", filename);
+    return (synced == n) ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,276 @@
+//  fragtest.c - test fragmentation of large UDP messages
+//
+//  This program forks a receiver process offering service "rcv". The
+//  sender sends blobs by UDP that are larger than o2_udp_mtu(): one
+//  with the default MTU, one larger than 64KB, and one with the
+//  smallest MTU, and the receiver checks that each is put back
+//  together intact.
+//
+//  Then the sender builds fragments itself and sends them straight to
+//  the receiver's UDP port: the first fragment of a message, then,
+//  after more than the 1 second timeout, its last fragment. The
+//  receiver must drop the partial message rather than complete it
+//  with the late fragment. A message sent the same way with all of
+//  its fragments must still be delivered. A sender has at most 4
+//  messages in progress, so after the first fragments of 5 messages,
+//  the first message must not complete, and a message after them
+//  must still be delivered. The receiver's exit status is the result.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("fragtest needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_send.h"
+
+#define N_BIG 3
+#define FRAG_WAIT 1.5 // longer than the receiver's timeout (1 second)
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+void poll_for(double seconds)
+{
+    double start = o2_local_time();
+    while (o2_local_time() - start < seconds) {
+        o2_poll();
+        usleep(1000);
+    }
+}
+
+
+// receiver state
+int big_count = 0;
+int big_ok = 0;
+int partial_count = 0;
+int whole_count = 0;
+int done = 0;
+
+// argv[0] is the blob, argv[1] its index; byte i of blob k is i * 3 + k
+int big_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    o2_blob_ptr blob = &argv[0]->b;
+    int k = argv[1]->i32;
+    int ok = ((int) blob->size == argv[2]->i32);
+    for (int i = 0; ok && i < (int) blob->size; i++) {
+        ok = (((unsigned char *) blob->data)[i] == (unsigned char) (i * 3 + k));
+    }
+    if (!ok) printf("blob %d is wrong\n", k);
+    big_count++;
+    big_ok += ok;
+    return O2_SUCCESS;
+}
+
+
+int partial_handler(const o2_message_ptr msg, const char *types,
+                    o2_arg_ptr *argv, int argc, void *user_data)
+{
+    partial_count++;
+    return O2_SUCCESS;
+}
+
+
+int whole_handler(const o2_message_ptr msg, const char *types,
+                  o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (argv[0]->i32 == 8 || argv[0]->i32 == 9) whole_count++;
+    return O2_SUCCESS;
+}
+
+
+int done_handler(const o2_message_ptr msg, const char *types,
+                 o2_arg_ptr *argv, int argc, void *user_data)
+{
+    done = 1;
+    return O2_SUCCESS;
+}
+
+
+void receiver()
+{
+    o2_initialize("fragtest");
+    o2_add_service("rcv");
+    o2_add_method("/rcv/big", "bii", &big_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/partial", "i", &partial_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/whole", "i", &whole_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/done", "i", &done_handler, NULL, FALSE, TRUE);
+    double start = o2_local_time();
+    while (!done && o2_local_time() - start < 20) {
+        o2_poll();
+        usleep(100);
+    }
+    printf("receiver got %d/%d big messages (%d intact), "
+           "%d partial (should be 0), %d/2 whole\n",
+           big_count, N_BIG, big_ok, partial_count, whole_count);
+    exit(big_count == N_BIG && big_ok == N_BIG && partial_count == 0 &&
+         whole_count == 2 ? 0 : 1);
+}
+
+
+void send_big(int k, int size)
+{
+    o2_blob_ptr blob = o2_blob_new(size);
+    blob->size = size;
+    for (int i = 0; i < size; i++) {
+        ((unsigned char *) blob->data)[i] = (unsigned char) (i * 3 + k);
+    }
+    o2_start_send();
+    o2_add_blob(blob);
+    o2_add_int32(k);
+    o2_add_int32(size);
+    check(o2_send_message(o2_finish_message(0, "/rcv/big"), FALSE) ==
+          O2_SUCCESS, "send a big message");
+    O2_FREE(blob);
+    poll_for(0.1);
+}
+
+
+// Send fragment index of count of msg, with the given message id,
+// to proc in the format of o2_send_udp(). The fragments are split
+// evenly like o2_send_udp() does.
+void send_fragment(int sock, process_info_ptr proc, o2_message_ptr msg,
+                   uint32_t id, int index, int count)
+{
+    char packet[512];
+    int name_len = o2_strsize(o2_process.name);
+    int header = sizeof(double) + 4 + name_len + 16;
+    int chunk = (msg->length + count - 1) / count;
+    int n = (index < count - 1 ? chunk : msg->length - index * chunk);
+    memset(packet, 0, header);
+    memcpy(packet + sizeof(double), "$", 1);
+    memcpy(packet + sizeof(double) + 4, o2_process.name, name_len);
+    int32_t words[4];
+    words[0] = htonl(id);
+    words[1] = htonl(msg->length);
+    words[2] = htonl(index);
+    words[3] = htonl(count);
+    memcpy(packet + header - 16, words, 16);
+    memcpy(packet + header, ((char *) &msg->data) + index * chunk, n);
+    check(sendto(sock, packet, header + n, 0,
+                 (struct sockaddr *) &proc->udp_sa,
+                 sizeof(proc->udp_sa)) == header + n, "send a fragment");
+}
+
+
+void partial_tests()
+{
+    generic_entry_ptr entry = o2_find_service("rcv");
+    check(entry && entry->tag == O2_REMOTE_SERVICE, "rcv is remote");
+    if (!entry || entry->tag != O2_REMOTE_SERVICE) return;
+    process_info_ptr proc = ((remote_service_entry_ptr) entry)->parent;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    check(sock >= 0, "socket");
+    if (sock < 0) return;
+
+    // ids well away from the ones o2_send_udp() uses
+    uint32_t id = 0x7FFF0000;
+    o2_start_send();
+    o2_add_int32(7);
+    o2_message_ptr partial = o2_finish_message(0, "/rcv/partial");
+    send_fragment(sock, proc, partial, id, 0, 2);
+    poll_for(FRAG_WAIT);
+    send_fragment(sock, proc, partial, id, 1, 2); // too late
+    o2_free_message(partial);
+
+    o2_start_send();
+    o2_add_int32(8);
+    o2_message_ptr whole = o2_finish_message(0, "/rcv/whole");
+    for (int i = 0; i < 3; i++) {
+        send_fragment(sock, proc, whole, id + 1, i, 3);
+    }
+    o2_free_message(whole);
+
+    // too many messages from one sender: the oldest is dropped
+    o2_start_send();
+    o2_add_int32(10);
+    partial = o2_finish_message(0, "/rcv/partial");
+    for (int i = 0; i < 5; i++) {
+        send_fragment(sock, proc, partial, id + 2 + i, 0, 2);
+    }
+    poll_for(0.1);
+    send_fragment(sock, proc, partial, id + 2, 1, 2);
+    o2_free_message(partial);
+    o2_start_send();
+    o2_add_int32(9);
+    whole = o2_finish_message(0, "/rcv/whole");
+    for (int i = 0; i < 2; i++) {
+        send_fragment(sock, proc, whole, id + 7, i, 2);
+    }
+    o2_free_message(whole);
+    close(sock);
+}
+
+
+int main(int argc, const char * argv[])
+{
+    // fork before o2_initialize() so the receiver has its own sockets
+    pid_t pid = fork();
+    if (pid == 0) {
+        receiver();
+    } else if (pid < 0) {
+        perror("fragtest: fork");
+        return 1;
+    }
+    o2_initialize("fragtest");
+    o2_set_clock(NULL, NULL);
+    double start = o2_local_time();
+    while (o2_status("rcv") != O2_REMOTE && o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(o2_status("rcv") == O2_REMOTE, "rcv discovered");
+
+    check(o2_udp_mtu(100) == O2_FAIL, "o2_udp_mtu rejects a tiny MTU");
+    send_big(0, 5000);
+    send_big(1, 100000); // more than a UDP datagram can hold
+    check(o2_udp_mtu(256) == O2_SUCCESS, "o2_udp_mtu(256)");
+    send_big(2, 5000);
+    o2_udp_mtu(1500 - 20 - 8);
+
+    partial_tests();
+    poll_for(0.1);
+    o2_send_cmd("/rcv/done", 0, "i", 1);
+
+    int status = 0;
+    start = o2_local_time();
+    while (waitpid(pid, &status, WNOHANG) == 0 &&
+           o2_local_time() - start < 20) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          "receiver reassembled the big messages and dropped the partial");
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,200 @@
+//  getargtest.c - test o2_get_arg() and o2_start_extract_types()
+//
+//  Like dispatchtest, this uses local services only. Handlers fetch
+//  the arguments of a message with o2_get_arg() in reverse and in
+//  scattered order, and again once the offsets are kept in the
+//  message (O2_ARG_INDEX). When call_handler() puts argv in the
+//  unused space at the end of the message (O2_ARGV_SLACK), o2_get_arg()
+//  must not overwrite it, and an index built before dispatch must not
+//  be used once argv has replaced it. Coerced argv values do not
+//  change what o2_get_arg() returns, and o2_start_extract_types() with
+//  the handler's types gives the same arguments as o2_start_extract().
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+
+#define N_ARGS 7
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+int32_t vector[3] = {1, 2, 3};
+
+// the arguments of build(): 7, 1 << 40, "hello", blob "abc", 2.5,
+// vector [1, 2, 3], 9.5
+int arg_ok(o2_arg_ptr arg, int i)
+{
+    if (!arg) return FALSE;
+    switch (i) {
+      case 0: return arg->i32 == 7;
+      case 1: return arg->i64 == (1LL << 40);
+      case 2: return strcmp(arg->s, "hello") == 0;
+      case 3: return arg->b.size == 3 && memcmp(arg->b.data, "abc", 3) == 0;
+      case 4: return arg->f == 2.5f;
+      case 5: return arg->v.len == 3 && arg->v.typ == O2_INT32 &&
+                     memcmp(arg->v.vi, vector, sizeof(vector)) == 0;
+      case 6: return arg->d == 9.5;
+    }
+    return FALSE;
+}
+
+
+o2_message_ptr build(char *path)
+{
+    o2_start_send();
+    o2_add_int32(7);
+    o2_add_int64(1LL << 40);
+    o2_add_string("hello");
+    o2_add_blob_data(3, "abc");
+    o2_add_float(2.5f);
+    o2_add_vector(O2_INT32, 3, vector);
+    o2_add_double(9.5);
+    return o2_finish_message(0, path);
+}
+
+
+// get every argument of msg in reverse order, then in a scattered
+// order, and check the ones that do not exist
+void check_args(o2_message_ptr msg)
+{
+    for (int i = N_ARGS - 1; i >= 0; i--) {
+        check(arg_ok(o2_get_arg(msg, i), i), "o2_get_arg in reverse");
+    }
+    int scattered[N_ARGS] = {3, 6, 0, 5, 1, 4, 2};
+    for (int i = 0; i < N_ARGS; i++) {
+        check(arg_ok(o2_get_arg(msg, scattered[i]), scattered[i]),
+              "o2_get_arg in scattered order");
+    }
+    check(o2_get_arg(msg, N_ARGS) == NULL, "o2_get_arg past the end");
+    check(o2_get_arg(msg, -1) == NULL, "o2_get_arg of -1");
+}
+
+
+int handled = 0;
+
+// not parsed: argv is NULL, so the offsets can be kept in the message
+int raw_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    check(argv == NULL, "no argv without parsing");
+    check_args(msg);
+    check(msg->flags & O2_ARG_INDEX, "the offsets are kept");
+    check_args(msg); // again, from the kept offsets
+    handled++;
+    return O2_SUCCESS;
+}
+
+
+// parsed: argv is in the slack, where o2_get_arg() must not write
+int parsed_handler(const o2_message_ptr msg, const char *types,
+                   o2_arg_ptr *argv, int argc, void *user_data)
+{
+    check(argc == N_ARGS, "argc");
+    check(msg->flags & O2_ARGV_SLACK, "argv is at the end of the message");
+    check(!(msg->flags & O2_ARG_INDEX), "argv replaced the offsets");
+    o2_arg_ptr saved[N_ARGS];
+    memcpy(saved, argv, sizeof(saved));
+    check_args(msg);
+    check(!(msg->flags & O2_ARG_INDEX), "no offsets are kept over argv");
+    check(memcmp(saved, argv, sizeof(saved)) == 0, "argv is unchanged");
+    for (int i = 0; i < N_ARGS; i++) {
+        check(arg_ok(argv[i], i), "argv values are unchanged");
+    }
+    handled++;
+    return O2_SUCCESS;
+}
+
+
+// coerced: argv has the handler's types, o2_get_arg() the message's
+int coerced_handler(const o2_message_ptr msg, const char *types,
+                    o2_arg_ptr *argv, int argc, void *user_data)
+{
+    check(argv[0]->d == 7.0 && argv[1]->f == (float) (1LL << 40) &&
+          argv[6]->i32 == 9, "coerced argv");
+    check_args(msg);
+    handled++;
+    return O2_SUCCESS;
+}
+
+
+// o2_start_extract_types() with the handler's types
+int extract_handler(const o2_message_ptr msg, const char *types,
+                    o2_arg_ptr *argv, int argc, void *user_data)
+{
+    check(o2_start_extract_types(msg, types) == N_ARGS,
+          "o2_start_extract_types gives the number of arguments");
+    for (int i = 0; i < N_ARGS; i++) {
+        char type = types[i <= 5 ? i : i + 1]; // skip the vector's 'i'
+        check(arg_ok(o2_get_next(type), i), "o2_get_next after "
+              "o2_start_extract_types");
+    }
+    check(o2_get_next(O2_INT32) == NULL, "o2_get_next past the end");
+    // o2_get_arg() does not disturb extraction
+    check(o2_start_extract(msg) == N_ARGS, "o2_start_extract");
+    check(arg_ok(o2_get_next(O2_INT32), 0), "first o2_get_next");
+    check_args(msg);
+    check(arg_ok(o2_get_next(O2_INT64), 1), "o2_get_next after o2_get_arg");
+    handled++;
+    return O2_SUCCESS;
+}
+
+
+int main(int argc, const char * argv[])
+{
+    o2_initialize("test");
+    o2_add_service("one");
+    o2_add_method("/one/raw", "ihsbfvid", &raw_handler, NULL, FALSE, FALSE);
+    o2_add_method("/one/any", NULL, &raw_handler, NULL, FALSE, FALSE);
+    o2_add_method("/one/parsed", "ihsbfvid", &parsed_handler, NULL,
+                  FALSE, TRUE);
+    o2_add_method("/one/coerced", "dfsbfvii", &coerced_handler, NULL,
+                  TRUE, TRUE);
+    o2_add_method("/one/extract", "ihsbfvid", &extract_handler, NULL,
+                  FALSE, FALSE);
+
+    o2_send_message(build("/one/raw"), FALSE);
+    o2_send_message(build("/one/any"), FALSE);
+    o2_send_message(build("/one/parsed"), FALSE);
+    // offsets kept before dispatch must give way to argv
+    o2_message_ptr msg = build("/one/parsed");
+    check_args(msg);
+    check(msg->flags & O2_ARG_INDEX, "offsets kept before dispatch");
+    o2_send_message(msg, FALSE);
+    o2_send_message(build("/one/coerced"), FALSE);
+    o2_send_message(build("/one/extract"), FALSE);
+    o2_poll();
+    check(handled == 6, "every handler was called");
+
+    // a message with no room after it finds each argument every time
+    msg = build("/one/x");
+    int size = (int) ((char *) &msg->data - (char *) msg) + msg->length;
+    o2_message_ptr tight = (o2_message_ptr) O2_MALLOC(size);
+    memcpy(tight, msg, size);
+    tight->allocated = tight->length;
+    check_args(tight);
+    check(!(tight->flags & O2_ARG_INDEX), "no room for offsets");
+    O2_FREE(tight);
+    o2_free_message(msg);
+
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
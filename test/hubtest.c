@@ -0,0 +1,267 @@
+//  hubtest.c - test hubs (o2_become_hub() and o2_hub())
+//
+//  This program forks a hub and a process "c" offering service "c".
+//  The hub sends its address through a pipe, and this process and c
+//  attach to it with o2_hub(), so they reach each other only through
+//  the hub:
+//
+//  - o2_hub() to a port where nothing listens fails and leaves no
+//    trace: no process entry, and discovery is not stopped.
+//  - "c" is known as a bridged service, and messages to it by TCP and
+//    UDP are forwarded by the hub; so are c's replies.
+//  - A service that c adds later is bridged as well.
+//  - Connecting to c directly (c's address comes in its replies)
+//    replaces the bridged routes to its services with direct ones.
+//  - When c exits, its services disappear.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("hubtest needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_send.h"
+#include "o2_hub.h"
+
+// wait up to 5 seconds for cond
+#define POLL_UNTIL(cond) { \
+        double start_ = o2_local_time(); \
+        while (!(cond) && o2_local_time() - start_ < 5) { \
+            o2_poll(); \
+            usleep(1000); \
+        } \
+    }
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+typedef struct hub_address {
+    char ip[24];
+    int port;
+} hub_address;
+
+int hub_pipe[2];
+
+
+void hub()
+{
+    o2_become_hub();
+    o2_initialize("hubtest");
+    hub_address address;
+    memset(&address, 0, sizeof(address));
+    strcpy(address.ip, o2_local_ip);
+    address.port = o2_local_tcp_port;
+    // one for each process that attaches
+    write(hub_pipe[1], &address, sizeof(address));
+    write(hub_pipe[1], &address, sizeof(address));
+    double start = o2_local_time();
+    while (o2_local_time() - start < 30) {
+        o2_poll();
+        usleep(1000);
+    }
+    exit(0);
+}
+
+
+int c_handler(const o2_message_ptr msg, const char *types,
+              o2_arg_ptr *argv, int argc, void *user_data)
+{
+    o2_send_cmd("/b/reply", 0, "is", argv[0]->i32 + 1, o2_process.name);
+    return O2_SUCCESS;
+}
+
+
+int add_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    o2_add_service("c2");
+    return O2_SUCCESS;
+}
+
+
+int quit_handler(const o2_message_ptr msg, const char *types,
+                 o2_arg_ptr *argv, int argc, void *user_data)
+{
+    exit(0);
+}
+
+
+void c_process()
+{
+    hub_address address;
+    if (read(hub_pipe[0], &address, sizeof(address)) != sizeof(address)) {
+        exit(1);
+    }
+    o2_initialize("hubtest");
+    o2_add_service("c");
+    o2_add_method("/c/x", "i", &c_handler, NULL, FALSE, TRUE);
+    o2_add_method("/c/add", "i", &add_handler, NULL, FALSE, TRUE);
+    o2_add_method("/c/quit", "i", &quit_handler, NULL, FALSE, TRUE);
+    // attach before o2_poll() so that discovery never runs
+    if (o2_hub(address.ip, address.port)) exit(1);
+    double start = o2_local_time();
+    while (o2_local_time() - start < 30) {
+        o2_poll();
+        usleep(1000);
+    }
+    exit(1);
+}
+
+
+int reply_count = 0;
+int reply_sum = 0;
+char c_name[32]; // c's process name, from its replies
+
+int reply_handler(const o2_message_ptr msg, const char *types,
+                  o2_arg_ptr *argv, int argc, void *user_data)
+{
+    reply_count++;
+    reply_sum += argv[0]->i32;
+    strncpy(c_name, argv[1]->s, sizeof(c_name) - 1);
+    return O2_SUCCESS;
+}
+
+
+// the tag of the route to service, or -1 if there is none
+int route(const char *service)
+{
+    generic_entry_ptr entry = o2_find_service(service);
+    return entry ? entry->tag : -1;
+}
+
+
+process_info_ptr route_process(const char *service)
+{
+    generic_entry_ptr entry = o2_find_service(service);
+    return entry ? ((remote_service_entry_ptr) entry)->parent : NULL;
+}
+
+
+// a TCP port where nothing listens
+int closed_port()
+{
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(0x7F000001);
+    socklen_t len = sizeof(sa);
+    bind(sock, (struct sockaddr *) &sa, len);
+    getsockname(sock, (struct sockaddr *) &sa, &len);
+    close(sock);
+    return ntohs(sa.sin_port);
+}
+
+
+int main(int argc, const char * argv[])
+{
+    // fork before o2_initialize() so each process has its own sockets
+    if (pipe(hub_pipe)) {
+        perror("hubtest: pipe");
+        return 1;
+    }
+    pid_t hub_pid = fork();
+    if (hub_pid == 0) hub();
+    pid_t c_pid = fork();
+    if (c_pid == 0) c_process();
+    if (hub_pid < 0 || c_pid < 0) {
+        perror("hubtest: fork");
+        return 1;
+    }
+    hub_address address;
+    if (read(hub_pipe[0], &address, sizeof(address)) != sizeof(address)) {
+        return 1;
+    }
+    int port = closed_port();
+    o2_initialize("hubtest");
+    o2_add_service("b");
+    o2_add_method("/b/reply", "is", &reply_handler, NULL, FALSE, TRUE);
+
+    check(o2_hub("127.0.0.1", port) != O2_SUCCESS, "o2_hub with no hub fails");
+    char name[32];
+    snprintf(name, sizeof(name), "127.0.0.1:%d", port);
+    check(route(name) == -1 && !o2_using_hub, "a failed o2_hub is undone");
+    check(o2_hub(address.ip, address.port) == O2_SUCCESS, "o2_hub");
+
+    POLL_UNTIL(route("c") == O2_BRIDGE_SERVICE);
+    check(route("c") == O2_BRIDGE_SERVICE, "c is reached through the hub");
+    // c may learn of b after b learns of c: once c's reply to TCP
+    //   arrives, c can reply to UDP too
+    o2_send_cmd("/c/x", 0, "i", 5);
+    POLL_UNTIL(reply_count == 1);
+    o2_send("/c/x", 0, "i", 7);
+    POLL_UNTIL(reply_count == 2);
+    check(reply_count == 2 && reply_sum == 6 + 8,
+          "messages by TCP and UDP are forwarded both ways");
+
+    o2_send_cmd("/c/add", 0, "i", 0);
+    POLL_UNTIL(route("c2") == O2_BRIDGE_SERVICE);
+    check(route("c2") == O2_BRIDGE_SERVICE, "a new service is bridged");
+
+    // connect to c directly, as if it were a hub
+    char *colon = strchr(c_name, ':');
+    check(colon != NULL, "c's name");
+    if (colon) {
+        *colon = 0;
+        int c_port = atoi(colon + 1);
+        check(o2_hub(c_name, c_port) == O2_SUCCESS, "connect to c");
+        *colon = ':';
+    }
+    POLL_UNTIL(route("c") == O2_REMOTE_SERVICE &&
+               route("c2") == O2_REMOTE_SERVICE);
+    check(route("c") == O2_REMOTE_SERVICE &&
+          route("c2") == O2_REMOTE_SERVICE &&
+          route_process("c") == route_process(c_name) &&
+          route_process("c2") == route_process(c_name),
+          "a direct connection replaces the bridged routes");
+    o2_send_cmd("/c/x", 0, "i", 9);
+    POLL_UNTIL(reply_count == 3);
+    check(reply_count == 3 && reply_sum == 6 + 8 + 10, "c is reached directly");
+
+    o2_send_cmd("/c/quit", 0, "i", 0);
+    int status = 0;
+    double start = o2_local_time();
+    while (waitpid(c_pid, &status, WNOHANG) == 0 &&
+           o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "c exits");
+    POLL_UNTIL(route("c") == -1 && route("c2") == -1);
+    check(route("c") == -1 && route("c2") == -1, "c's services are removed");
+
+    kill(hub_pid, SIGTERM);
+    waitpid(hub_pid, &status, 0);
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,169 @@
+//  latesttest.c - test o2_send_latest() and o2_method_latest()
+//
+//  Messages sent to this process from a handler wait in O2's queue
+//  until o2_poll() delivers them. The handler for "/svc/go" sends a
+//  burst of messages to "/svc/latest" with o2_send_latest(), which
+//  must leave only the last one queued, in the place of the first, and
+//  a burst of plain messages to "/svc/all", which must all be
+//  delivered. After o2_method_latest("/svc/all", TRUE), plain messages
+//  to "/svc/all" are replaced too.
+//
+//  Then messages are added to a coalesced ("#") frame with
+//  o2_bundle_replace() directly: a message with the address and
+//  timestamp of a held message replaces it, while a message for
+//  another time or another address is appended.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+
+#define N_BURST 10
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+// the order of delivery: 'l' for "/svc/latest", 'a' for "/svc/all"
+char order[100];
+int delivered = 0;
+int latest_value = -1;
+int all_count = 0;
+
+int latest_handler(const o2_message_ptr msg, const char *types,
+                   o2_arg_ptr *argv, int argc, void *user_data)
+{
+    latest_value = argv[0]->i32;
+    order[delivered++] = 'l';
+    return O2_SUCCESS;
+}
+
+
+int all_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (argv[0]->i32 == all_count) all_count++;
+    order[delivered++] = 'a';
+    return O2_SUCCESS;
+}
+
+
+int go_handler(const o2_message_ptr msg, const char *types,
+               o2_arg_ptr *argv, int argc, void *user_data)
+{
+    for (int i = 0; i < N_BURST; i++) {
+        o2_send_latest("/svc/latest", 0, "i", i);
+        o2_send("/svc/all", 0, "i", i);
+    }
+    return O2_SUCCESS;
+}
+
+
+void queue_tests()
+{
+    o2_send("/svc/go", 0, "i", 0);
+    o2_poll(); // deliver the queued messages
+    check(latest_value == N_BURST - 1, "the latest value is delivered");
+    check(all_count == N_BURST, "plain messages are all delivered");
+    check(delivered == N_BURST + 1 && order[0] == 'l',
+          "the latest value takes the place of the first");
+
+    o2_method_latest("/svc/all", TRUE);
+    delivered = 0;
+    all_count = 0;
+    o2_send("/svc/go", 0, "i", 0);
+    o2_poll();
+    check(delivered == 2 && all_count == 0,
+          "o2_method_latest() replaces plain messages");
+    o2_method_latest("/svc/all", FALSE);
+}
+
+
+o2_message_ptr make_message(double time, const char *address, int i)
+{
+    o2_start_send();
+    o2_add_int32(i);
+    return o2_finish_message(time, (char *) address);
+}
+
+
+// the values of the messages in frame, with their timestamps
+int frame_values(o2_message_ptr frame, int *values, double *times)
+{
+    int pos = 0;
+    int n = 0;
+    o2_message_ptr msg;
+    while ((msg = o2_bundle_next(frame, &pos))) {
+        memcpy(&values[n], (char *) &msg->data + msg->length - 4, 4);
+        times[n++] = msg->data.timestamp;
+        o2_free_message(msg);
+    }
+    return n;
+}
+
+
+void frame_tests()
+{
+    o2_message_ptr frame = alloc_message();
+    frame->data.timestamp = 0.0;
+    memcpy(frame->data.address, "#\0\0\0", 4);
+    frame->length = sizeof(double) + 4;
+
+    frame = o2_bundle_replace(frame, make_message(1.0, "/svc/x", 1));
+    frame = o2_bundle_replace(frame, make_message(0.0, "/svc/y", 2));
+    int values[10];
+    double times[10];
+    // the same address and timestamp
+    frame = o2_bundle_replace(frame, make_message(1.0, "/svc/x", 3));
+    int n = frame_values(frame, values, times);
+    check(n == 2 && values[0] == 3 && times[0] == 1.0 && values[1] == 2,
+          "a message with the same timestamp is replaced in place");
+    // another time
+    frame = o2_bundle_replace(frame, make_message(2.0, "/svc/x", 4));
+    n = frame_values(frame, values, times);
+    check(n == 3 && values[0] == 3 && times[0] == 1.0 &&
+          values[2] == 4 && times[2] == 2.0,
+          "a message for another time is appended");
+    // the second of two messages to "/svc/x" is replaced
+    frame = o2_bundle_replace(frame, make_message(2.0, "/svc/x", 5));
+    n = frame_values(frame, values, times);
+    check(n == 3 && values[0] == 3 && values[2] == 5,
+          "the message with the same timestamp is the one replaced");
+    // another address
+    frame = o2_bundle_replace(frame, make_message(0.0, "/svc/z", 6));
+    n = frame_values(frame, values, times);
+    check(n == 4 && values[1] == 2 && values[3] == 6,
+          "a message to another address is appended");
+    o2_free_message(frame);
+}
+
+
+int main(int argc, const char * argv[])
+{
+    o2_initialize("test");
+    o2_add_service("svc");
+    o2_add_method("/svc/go", "i", &go_handler, NULL, FALSE, TRUE);
+    o2_add_method("/svc/latest", "i", &latest_handler, NULL, FALSE, TRUE);
+    o2_add_method("/svc/all", "i", &all_handler, NULL, FALSE, TRUE);
+
+    queue_tests();
+    frame_tests();
+
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
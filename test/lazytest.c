@@ -0,0 +1,174 @@
+//  lazytest.c - test lazy connections (o2_lazy_connections())
+//
+//  This program forks a receiver process offering service "rcv". Both
+//  processes use lazy connections with a short idle timeout. The
+//  receiver is found by announcements, without a TCP connection.
+//  o2_send() goes by UDP and does not connect; o2_send_cmd() opens a
+//  connection, which is closed when it is idle but keeps the receiver
+//  and its service, and is opened again by the next o2_send_cmd().
+//  The receiver's exit status tells if it got every message.
+//
+//  After the receiver exits, a connection to it cannot be made, so
+//  the next o2_send_cmd() must fail and remove it and its service.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("lazytest needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_send.h"
+
+#define IDLE_TIMEOUT 0.5
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+void poll_for(double seconds)
+{
+    double start = o2_local_time();
+    while (o2_local_time() - start < seconds) {
+        o2_poll();
+        usleep(1000);
+    }
+}
+
+
+// receiver state
+int received = 0; // bit i is set when value i arrives
+
+int rcv_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    received |= 1 << argv[0]->i32;
+    return O2_SUCCESS;
+}
+
+
+int quit_handler(const o2_message_ptr msg, const char *types,
+                 o2_arg_ptr *argv, int argc, void *user_data)
+{
+    printf("receiver got values 0x%x\n", received);
+    exit(received == 0xF ? 0 : 1);
+}
+
+
+void receiver()
+{
+    o2_lazy_connections(IDLE_TIMEOUT);
+    o2_initialize("lazytest");
+    o2_add_service("rcv");
+    o2_add_method("/rcv/x", "i", &rcv_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/quit", "i", &quit_handler, NULL, FALSE, TRUE);
+    poll_for(20);
+    exit(1);
+}
+
+
+// the number of TCP connections to the process offering service
+int connections(const char *service)
+{
+    generic_entry_ptr entry = o2_find_service(service);
+    if (!entry || entry->tag != O2_REMOTE_SERVICE) return -1;
+    process_info_ptr proc = ((remote_service_entry_ptr) entry)->parent;
+    int n = 0;
+    for (int i = 0; i < o2_fds_info.length; i++) {
+        fds_info_ptr info = DA_GET(o2_fds_info, fds_info, i);
+        if (info->tag == TCP_SOCKET && info->u.process_info == proc) n++;
+    }
+    return n;
+}
+
+
+int main(int argc, const char * argv[])
+{
+    // fork before o2_initialize() so the receiver has its own sockets
+    pid_t pid = fork();
+    if (pid == 0) {
+        receiver();
+    } else if (pid < 0) {
+        perror("lazytest: fork");
+        return 1;
+    }
+    check(o2_lazy_connections(IDLE_TIMEOUT) == O2_SUCCESS,
+          "o2_lazy_connections");
+    o2_initialize("lazytest");
+    check(o2_lazy_connections(IDLE_TIMEOUT) == O2_RUNNING,
+          "o2_lazy_connections after o2_initialize");
+
+    double start = o2_local_time();
+    while (o2_status("rcv") == O2_FAIL && o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(o2_status("rcv") != O2_FAIL, "rcv is announced");
+    check(connections("rcv") == 0, "no connection before it is needed");
+
+    o2_send("/rcv/x", 0, "i", 0);
+    poll_for(0.1);
+    check(connections("rcv") == 0, "o2_send() does not connect");
+
+    check(o2_send_cmd("/rcv/x", 0, "i", 1) == O2_SUCCESS, "o2_send_cmd");
+    check(connections("rcv") == 1, "o2_send_cmd() connects");
+    poll_for(0.1);
+    check(o2_send_cmd("/rcv/x", 0, "i", 2) == O2_SUCCESS &&
+          connections("rcv") == 1, "the connection is used again");
+
+    poll_for(IDLE_TIMEOUT * 3);
+    check(connections("rcv") == 0, "an idle connection is closed");
+    check(o2_status("rcv") != O2_FAIL, "rcv is kept without a connection");
+
+    check(o2_send_cmd("/rcv/x", 0, "i", 3) == O2_SUCCESS &&
+          connections("rcv") == 1, "o2_send_cmd() connects again");
+    poll_for(0.1);
+    o2_send_cmd("/rcv/quit", 0, "i", 0);
+
+    int status = 0;
+    start = o2_local_time();
+    while (waitpid(pid, &status, WNOHANG) == 0 &&
+           o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          "the receiver got every message");
+
+    // the hang-up only closes the connection
+    poll_for(0.1);
+    check(connections("rcv") == 0 && o2_status("rcv") != O2_FAIL,
+          "a hang-up keeps rcv");
+    check(o2_send_cmd("/rcv/x", 0, "i", 4) != O2_SUCCESS,
+          "o2_send_cmd() to a process that is gone fails");
+    check(o2_status("rcv") == O2_FAIL, "a process that is gone is removed");
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,353 @@
+//  oscbundletest.c - test OSC bundles and timetags
+//
+//  Incoming: a raw UDP socket sends OSC bundles to an OSC UDP port of
+//  this process for service "ob". Before clock sync, elements are
+//  delivered at once whatever their timetag. After clock sync (this
+//  process is the master), timetag 1 means "immediately", and other
+//  timetags become timestamps: elements of a bundle for 0.3s from now,
+//  and of a bundle nested in it, must not arrive early, and must carry
+//  the timestamp that corresponds to the timetag. A bundle with an
+//  element that runs past its end is dropped as a whole.
+//
+//  Outgoing: service "out" is delegated to another raw socket. Timed
+//  messages with the same timestamp must arrive in one bundle whose
+//  timetag is the wall clock time they are due, those with another
+//  timestamp in another bundle, and more than a bundle holds in two.
+//  Untimed messages, and timed messages already due, are sent as plain
+//  OSC messages.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("oscbundletest is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <sys/time.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+
+// seconds from 1900 (NTP time 0) to 1970 (Unix time 0)
+#define NTP_UNIX_OFFSET 2208988800.0
+#define DELAY 0.3
+#define N_MANY 70 // more than an outgoing bundle holds
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+double ntp_now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + NTP_UNIX_OFFSET + tv.tv_usec * 1e-6;
+}
+
+
+// what /ob/x received: values, their timestamps, and when they arrived
+#define MAX_RECEIVED 16
+int received[MAX_RECEIVED];
+o2_time stamps[MAX_RECEIVED];
+o2_time arrivals[MAX_RECEIVED];
+int received_count = 0;
+
+int x_handler(const o2_message_ptr msg, const char *types,
+              o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (received_count < MAX_RECEIVED) {
+        received[received_count] = argv[0]->i32;
+        stamps[received_count] = msg->data.timestamp;
+        arrivals[received_count] = o2_get_time();
+        received_count++;
+    }
+    return O2_SUCCESS;
+}
+
+
+void poll_for(double seconds)
+{
+    double start = o2_local_time();
+    while (o2_local_time() - start < seconds) {
+        o2_poll();
+        usleep(1000);
+    }
+}
+
+
+// building OSC packets
+char packet[4096];
+int length;
+
+void add_bytes(const void *data, int n)
+{
+    memcpy(packet + length, data, n);
+    length += n;
+}
+
+void add_string(const char *s)
+{
+    int n = (int) strlen(s);
+    add_bytes(s, n);
+    memset(packet + length, 0, 4 - (n & 3));
+    length += 4 - (n & 3);
+}
+
+void add_word(int32_t w)
+{
+    w = htonl(w);
+    add_bytes(&w, 4);
+}
+
+// "#bundle" and the timetag for NTP time ntp (0 for "immediately")
+void add_bundle_header(double ntp)
+{
+    add_string("#bundle");
+    uint32_t secs = (uint32_t) ntp;
+    add_word(secs);
+    add_word(ntp ? (uint32_t) ((ntp - secs) * 4294967296.0) : 1);
+}
+
+// an element of a bundle: the size, then the OSC message /x i
+void add_x(int i)
+{
+    add_word(12);
+    add_string("/x");
+    add_string(",i");
+    add_word(i);
+}
+
+// the size of the element that starts at offset start, once complete
+void set_size(int start)
+{
+    int32_t size = htonl(length - start - 4);
+    memcpy(packet + start, &size, 4);
+}
+
+
+int sock;
+struct sockaddr_in osc_sa;
+
+void send_packet()
+{
+    check(sendto(sock, packet, length, 0, (struct sockaddr *) &osc_sa,
+                 sizeof(osc_sa)) == length, "sendto");
+    length = 0;
+}
+
+
+// find the address of the OSC UDP socket
+int find_port()
+{
+    for (int i = 0; i < o2_fds_info.length; i++) {
+        if (DA_GET(o2_fds_info, fds_info, i)->tag == OSC_SOCKET) {
+            struct sockaddr_in sa;
+            socklen_t len = sizeof(sa);
+            if (getsockname(DA_GET(o2_fds, struct pollfd, i)->fd,
+                            (struct sockaddr *) &sa, &len) == 0) {
+                return ntohs(sa.sin_port);
+            }
+        }
+    }
+    return 0;
+}
+
+
+void incoming_tests()
+{
+    o2_add_service("ob");
+    o2_add_method("/ob/x", "i", &x_handler, NULL, FALSE, TRUE);
+    check(o2_create_osc_port("ob", 0, TRUE) == O2_SUCCESS,
+          "o2_create_osc_port");
+    int port = find_port();
+    check(port != 0, "found the OSC UDP port");
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&osc_sa, 0, sizeof(osc_sa));
+    osc_sa.sin_family = AF_INET;
+    osc_sa.sin_addr.s_addr = htonl(0x7F000001);
+    osc_sa.sin_port = htons(port);
+
+    // before clock sync, timetags cannot be converted
+    add_bundle_header(ntp_now() + 10);
+    add_x(1);
+    send_packet();
+    poll_for(0.1);
+    check(received_count == 1 && received[0] == 1 && stamps[0] == 0,
+          "a bundle before clock sync is delivered at once");
+
+    o2_set_clock(NULL, NULL);
+    add_bundle_header(0);
+    add_x(2);
+    add_x(3);
+    send_packet();
+    poll_for(0.1);
+    check(received_count == 3 && received[1] == 2 && received[2] == 3 &&
+          stamps[1] == 0 && stamps[2] == 0,
+          "timetag 1 is delivered at once");
+
+    // a timed bundle with a nested one
+    o2_time due = o2_get_time() + DELAY;
+    add_bundle_header(ntp_now() + DELAY);
+    add_x(4);
+    int nested = length;
+    add_word(0);
+    add_bundle_header(ntp_now() + DELAY);
+    add_x(5);
+    set_size(nested);
+    send_packet();
+    poll_for(DELAY / 3);
+    check(received_count == 3, "a timed bundle is not delivered early");
+    poll_for(DELAY * 2);
+    check(received_count == 5 && received[3] == 4 && received[4] == 5,
+          "a timed bundle and a nested one are delivered");
+    for (int i = 3; i < 5 && i < received_count; i++) {
+        check(stamps[i] > due - 0.05 && stamps[i] < due + 0.05,
+              "the timestamp is the timetag");
+        check(arrivals[i] >= stamps[i], "delivered when due");
+    }
+
+    // the second element runs past the end of the bundle
+    add_bundle_header(0);
+    add_x(6);
+    add_word(100);
+    add_string("/x");
+    send_packet();
+    add_string("/x");
+    add_string(",i");
+    add_word(7);
+    send_packet();
+    poll_for(0.1);
+    check(received_count == 6 && received[5] == 7,
+          "a malformed bundle is dropped");
+    close(sock);
+}
+
+
+// read the next datagram on s into packet, setting length
+void receive(int s)
+{
+    length = (int) recv(s, packet, sizeof(packet), MSG_DONTWAIT);
+}
+
+
+// the number of elements /out/x with values first, first + 1, ... in
+//   the bundle in packet, or -1 if it is not such a bundle
+int bundle_elements(int first)
+{
+    if (length < 16 || strcmp(packet, "#bundle") != 0) return -1;
+    int count = 0;
+    int pos = 16;
+    while (pos + 16 <= length) {
+        int32_t size, value;
+        memcpy(&size, packet + pos, 4);
+        memcpy(&value, packet + pos + 12, 4);
+        if (ntohl(size) != 12 || strcmp(packet + pos + 4, "/x") != 0 ||
+            (int) ntohl(value) != first + count) {
+            return -1;
+        }
+        pos += 16;
+        count++;
+    }
+    return pos == length ? count : -1;
+}
+
+
+// the NTP time of the timetag of the bundle in packet
+double timetag()
+{
+    uint32_t secs, frac;
+    memcpy(&secs, packet + 8, 4);
+    memcpy(&frac, packet + 12, 4);
+    return ntohl(secs) + ntohl(frac) / 4294967296.0;
+}
+
+
+void outgoing_tests()
+{
+    int out = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(0x7F000001);
+    socklen_t len = sizeof(sa);
+    bind(out, (struct sockaddr *) &sa, len);
+    getsockname(out, (struct sockaddr *) &sa, &len);
+    check(o2_delegate_to_osc("out", "127.0.0.1", ntohs(sa.sin_port),
+                             FALSE) == O2_SUCCESS, "o2_delegate_to_osc");
+
+    // two timestamps: two bundles, sent by o2_poll()
+    o2_time now = o2_get_time();
+    double ntp = ntp_now();
+    o2_send("/out/x", now + 1, "i", 0);
+    o2_send("/out/x", now + 1, "i", 1);
+    o2_send("/out/x", now + 2, "i", 2);
+    o2_poll();
+    usleep(10000);
+    receive(out);
+    check(bundle_elements(0) == 2,
+          "messages with one timestamp share a bundle");
+    check(length > 0 && timetag() > ntp + 0.95 && timetag() < ntp + 1.05,
+          "the timetag is when the messages are due");
+    receive(out);
+    check(bundle_elements(2) == 1 && timetag() > ntp + 1.95 &&
+          timetag() < ntp + 2.05, "another timestamp is another bundle");
+
+    // more messages than a bundle holds
+    for (int i = 0; i < N_MANY; i++) {
+        o2_send("/out/x", now + 1, "i", i);
+    }
+    o2_poll();
+    usleep(10000);
+    receive(out);
+    int first = bundle_elements(0);
+    receive(out);
+    check(first > 0 && bundle_elements(first) == N_MANY - first,
+          "a full bundle is sent and another started");
+
+    // plain messages
+    o2_send("/out/x", 0, "i", 8);
+    o2_send("/out/x", now - 1, "i", 9);
+    o2_poll();
+    usleep(10000);
+    for (int i = 8; i <= 9; i++) {
+        receive(out);
+        int32_t value;
+        memcpy(&value, packet + 8, 4);
+        check(length == 12 && strcmp(packet, "/x") == 0 &&
+              (int) ntohl(value) == i,
+              "untimed and due messages are not bundled");
+    }
+    receive(out);
+    check(length < 0, "nothing else is sent");
+    close(out);
+}
+
+
+int main(int argc, const char * argv[])
+{
+    o2_initialize("test");
+    incoming_tests();
+    outgoing_tests();
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,282 @@
+//  oscouttest.c - test sending to OSC servers (o2_delegate_to_osc())
+//
+//  Sockets of this program act as OSC servers: one UDP socket and one
+//  TCP server socket. O2 messages sent to services delegated to them
+//  must arrive as the OSC messages they translate to, byte for byte:
+//  the service name is dropped, the address is padded again, and the
+//  arguments are in network order. Over TCP, each message is preceded
+//  by its length, or with O2_OSC_SLIP, SLIP encoded with escapes.
+//
+//  Some sends must fail or send nothing: to a service that is only a
+//  service name, with a timestamp before clock sync, and delegating to
+//  a bad address, to an existing service or to a TCP server that is
+//  not there. When the server closes a TCP connection, a later send
+//  must connect again.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("oscouttest is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+// building the expected OSC packets
+char expect[256];
+int expect_len;
+
+void add_bytes(const void *data, int n)
+{
+    memcpy(expect + expect_len, data, n);
+    expect_len += n;
+}
+
+void add_string(const char *s)
+{
+    int n = (int) strlen(s);
+    add_bytes(s, n);
+    memset(expect + expect_len, 0, 4 - (n & 3));
+    expect_len += 4 - (n & 3);
+}
+
+void add_word(int32_t w)
+{
+    w = htonl(w);
+    add_bytes(&w, 4);
+}
+
+void add_float(float f)
+{
+    int32_t w;
+    memcpy(&w, &f, 4);
+    add_word(w);
+}
+
+void add_int64(int64_t h)
+{
+    add_word((int32_t) (h >> 32));
+    add_word((int32_t) h);
+}
+
+void add_double(double d)
+{
+    int64_t h;
+    memcpy(&h, &d, 8);
+    add_int64(h);
+}
+
+
+// a socket bound to a free port on localhost; sets *port
+int server_socket(int type, int *port)
+{
+    int sock = socket(AF_INET, type, 0);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(0x7F000001);
+    socklen_t len = sizeof(sa);
+    bind(sock, (struct sockaddr *) &sa, len);
+    getsockname(sock, (struct sockaddr *) &sa, &len);
+    *port = ntohs(sa.sin_port);
+    // reads give up after 0.5s
+    struct timeval tv = { 0, 500000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return sock;
+}
+
+
+// read n bytes from a TCP connection, or fewer if it times out
+int read_all(int sock, char *buf, int n)
+{
+    int got = 0;
+    while (got < n) {
+        int r = (int) recv(sock, buf + got, n - got, 0);
+        if (r <= 0) break;
+        got += r;
+    }
+    return got;
+}
+
+
+// check that the next datagram on sock is the expected packet
+void check_datagram(int sock, const char *what)
+{
+    char buf[256];
+    int n = (int) recv(sock, buf, sizeof(buf), 0);
+    check(n == expect_len && memcmp(buf, expect, n) == 0, what);
+    expect_len = 0;
+}
+
+
+// check that nothing arrives on the UDP socket
+void check_nothing(int sock, const char *what)
+{
+    char buf[256];
+    check(recv(sock, buf, sizeof(buf), MSG_DONTWAIT) < 0, what);
+}
+
+
+void udp_tests()
+{
+    int port;
+    int sock = server_socket(SOCK_DGRAM, &port);
+    check(o2_delegate_to_osc("out", "127.0.0.1", port, FALSE) == O2_SUCCESS,
+          "o2_delegate_to_osc by UDP");
+    check(o2_status("out") == O2_TO_OSC_NOTIME, "o2_status of an OSC service");
+    check(o2_delegate_to_osc("out", "127.0.0.1", port, FALSE) == O2_FAIL,
+          "o2_delegate_to_osc to an existing service fails");
+    check(o2_delegate_to_osc("bad", "not.an.ip", port, FALSE) == O2_FAIL &&
+          o2_status("bad") == O2_FAIL, "o2_delegate_to_osc to a bad address");
+
+    o2_blob_ptr blob = o2_blob_new(5);
+    blob->size = 5;
+    memcpy(blob->data, "abcde", 5);
+    o2_start_send();
+    o2_add_int32(1);
+    o2_add_float(2.5f);
+    o2_add_string("three");
+    o2_add_blob(blob);
+    o2_add_int64(4000000000LL);
+    o2_add_double(5.25);
+    o2_finish_send(0, "/out/x");
+    O2_FREE(blob);
+    add_string("/x");
+    add_string(",ifsbhd");
+    add_word(1);
+    add_float(2.5f);
+    add_string("three");
+    add_word(5);
+    add_bytes("abcde\0\0\0", 8);
+    add_int64(4000000000LL);
+    add_double(5.25);
+    check_datagram(sock, "every type of argument is translated");
+
+    // the O2 address and the OSC address pad differently
+    o2_send("/out/abcd", 0, "i", 6);
+    add_string("/abcd");
+    add_string(",i");
+    add_word(6);
+    check_datagram(sock, "an address that pads differently");
+
+    o2_send_osc_message("out", "/y", "i", 7);
+    add_string("/y");
+    add_string(",i");
+    add_word(7);
+    check_datagram(sock, "o2_send_osc_message");
+
+    o2_send("/out", 0, "i", 8);
+    check_nothing(sock, "a message with no OSC address is dropped");
+    o2_send("/out/x", 10.0, "i", 9);
+    o2_poll();
+    check_nothing(sock, "a timed message before clock sync is dropped");
+    close(sock);
+}
+
+
+void tcp_tests()
+{
+    int port;
+    int listener = server_socket(SOCK_STREAM, &port);
+    check(o2_delegate_to_osc("none", "127.0.0.1", port, TRUE) == O2_FAIL &&
+          o2_status("none") == O2_FAIL,
+          "o2_delegate_to_osc to no TCP server fails");
+    listen(listener, 4);
+
+    // OSC 1.0: the length, then the message
+    check(o2_delegate_to_osc("tcp", "127.0.0.1", port, TRUE) == O2_SUCCESS,
+          "o2_delegate_to_osc by TCP");
+    int conn = accept(listener, NULL, NULL);
+    struct timeval tv = { 0, 500000 };
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    o2_send_cmd("/tcp/x", 0, "i", 10);
+    char buf[256];
+    add_word(12);
+    add_string("/x");
+    add_string(",i");
+    add_word(10);
+    check(read_all(conn, buf, expect_len) == expect_len &&
+          memcmp(buf, expect, expect_len) == 0, "a length-prefixed message");
+    expect_len = 0;
+
+    // the server closes the connection: a later send connects again
+    close(conn);
+    conn = -1;
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+    int k;
+    for (k = 0; k < 10 && conn < 0; k++) {
+        o2_send_cmd("/tcp/x", 0, "i", 11 + k);
+        usleep(10000);
+        conn = accept(listener, NULL, NULL);
+    }
+    check(conn >= 0, "a send after the connection closed connects again");
+    if (conn >= 0) {
+        fcntl(conn, F_SETFL, 0);
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        add_word(12);
+        add_string("/x");
+        add_string(",i");
+        add_word(11 + k - 1);
+        check(read_all(conn, buf, expect_len) == expect_len &&
+              memcmp(buf, expect, expect_len) == 0,
+              "the message that connected again arrives");
+        expect_len = 0;
+        close(conn);
+    }
+    fcntl(listener, F_SETFL, 0);
+
+    // OSC 1.1: SLIP with END and ESC bytes in the int32
+    check(o2_delegate_to_osc("slip", "127.0.0.1", port, O2_OSC_SLIP) ==
+          O2_SUCCESS, "o2_delegate_to_osc with SLIP");
+    conn = accept(listener, NULL, NULL);
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    o2_send_cmd("/slip/x", 0, "i", 0x01C0DB02);
+    const char slip[] = "\xC0/x\0\0,i\0\0\x01\xDB\xDC\xDB\xDD\x02\xC0";
+    int slip_len = (int) sizeof(slip) - 1;
+    check(read_all(conn, buf, slip_len) == slip_len &&
+          memcmp(buf, slip, slip_len) == 0, "a SLIP encoded message");
+    close(conn);
+    close(listener);
+}
+
+
+int main(int argc, const char * argv[])
+{
+    signal(SIGPIPE, SIG_IGN); // sends to a closed connection fail
+    check(o2_delegate_to_osc("out", "127.0.0.1", 1, FALSE) == O2_FAIL,
+          "o2_delegate_to_osc before o2_initialize fails");
+    o2_initialize("test");
+    udp_tests();
+    tcp_tests();
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,300 @@
+//  osctcptest.c - test OSC over TCP (o2_create_osc_port() with TCP)
+//
+//  A raw TCP client connects to an OSC TCP port of this process and
+//  sends OSC messages to service "osc", first preceded by their
+//  lengths (OSC 1.0), then SLIP encoded (OSC 1.1), whole, many per
+//  write, and split one byte per write. SLIP packets include bytes
+//  that must be escaped. The handler checks every value.
+//
+//  Then the client sends data that must not be accepted: a length of
+//  0x80000000, a length just over the limit, and a SLIP packet that
+//  never ends. Each time, the messages before the bad data must be
+//  delivered and the connection must be closed. A connection closed
+//  in the middle of a packet must not deliver it.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("osctcptest is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+
+#define N_MANY 250
+#define MAX_BYTES 0x100000 // OSC_TCP_MAX_BYTES in o2_interoperation.c
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+int received = 0;
+int errors = 0;
+
+// the messages are "/x" with an int32 that counts them and a float
+// that is twice the count
+int handler(const o2_message_ptr msg, const char *types,
+            o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (argc != 2 || argv[0]->i32 != received ||
+        argv[1]->f != received * 2.0f) {
+        errors++;
+    }
+    received++;
+    return O2_SUCCESS;
+}
+
+
+// the OSC message number k, 16 bytes. When k is 0xC0 or 0xDB, the
+// int32 has a byte that SLIP must escape.
+int osc_message(char *bytes, int k)
+{
+    float f = k * 2.0f;
+    int32_t i = htonl(k);
+    int32_t fi;
+    memcpy(&fi, &f, 4);
+    fi = htonl(fi);
+    memcpy(bytes, "/x\0\0,if\0", 8);
+    memcpy(bytes + 8, &i, 4);
+    memcpy(bytes + 12, &fi, 4);
+    return 16;
+}
+
+
+// the OSC 1.0 packet for message k
+int length_packet(char *bytes, int k)
+{
+    int32_t len = htonl(16);
+    memcpy(bytes, &len, 4);
+    return 4 + osc_message(bytes + 4, k);
+}
+
+
+// the OSC 1.1 packet for message k
+int slip_packet(char *bytes, int k)
+{
+    char msg[16];
+    osc_message(msg, k);
+    int n = 0;
+    bytes[n++] = (char) SLIP_END;
+    for (int i = 0; i < 16; i++) {
+        unsigned char c = (unsigned char) msg[i];
+        if (c == SLIP_END || c == SLIP_ESC) {
+            bytes[n++] = (char) SLIP_ESC;
+            bytes[n++] = (char) (c == SLIP_END ? 0xDC : 0xDD);
+        } else {
+            bytes[n++] = (char) c;
+        }
+    }
+    bytes[n++] = (char) SLIP_END;
+    return n;
+}
+
+
+int port = 0; // the OSC TCP port, chosen by the system
+
+// find the port of the OSC TCP server socket
+int find_port()
+{
+    for (int i = 0; i < o2_fds_info.length; i++) {
+        if (DA_GET(o2_fds_info, fds_info, i)->tag == OSC_TCP_SERVER_SOCKET) {
+            struct sockaddr_in sa;
+            socklen_t len = sizeof(sa);
+            if (getsockname(DA_GET(o2_fds, struct pollfd, i)->fd,
+                            (struct sockaddr *) &sa, &len) == 0) {
+                return ntohs(sa.sin_port);
+            }
+        }
+    }
+    return 0;
+}
+
+
+int connect_client()
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(0x7F000001);
+    sa.sin_port = htons(port);
+    if (connect(sock, (struct sockaddr *) &sa, sizeof(sa))) {
+        perror("osctcptest: connect");
+        return -1;
+    }
+    return sock;
+}
+
+
+// the number of open OSC TCP connections
+int connections()
+{
+    int count = 0;
+    for (int i = 0; i < o2_fds_info.length; i++) {
+        if (DA_GET(o2_fds_info, fds_info, i)->tag == OSC_TCP_SOCKET) {
+            count++;
+        }
+    }
+    return count;
+}
+
+
+// poll until received reaches count (or for 0.1s if it is already
+// there), or 2 seconds pass
+void poll_until(int count)
+{
+    double start = o2_local_time();
+    double stop = start + 2;
+    while (o2_local_time() < stop) {
+        o2_poll();
+        usleep(1000);
+        if (received >= count && o2_local_time() > start + 0.1) break;
+    }
+}
+
+
+void good_tests(int slip)
+{
+    const char *what = slip ? "SLIP packets" : "length-prefixed packets";
+    int (*packet)(char *, int) = slip ? &slip_packet : &length_packet;
+    int sock = connect_client();
+    char bytes[N_MANY * 40];
+    int n = 0;
+    // many packets per write, including messages 0xC0 and 0xDB
+    int count = received;
+    for (int k = 0; k < N_MANY; k++) {
+        n += (*packet)(bytes + n, count + k);
+    }
+    check(write(sock, bytes, n) == n, "write");
+    poll_until(count + N_MANY);
+    check(received == count + N_MANY, what);
+    // one byte per write
+    count = received;
+    n = (*packet)(bytes, count);
+    n += (*packet)(bytes + n, count + 1);
+    for (int i = 0; i < n; i++) {
+        check(write(sock, bytes + i, 1) == 1, "write");
+        o2_poll();
+    }
+    poll_until(count + 2);
+    check(received == count + 2, what);
+    check(errors == 0, "every value arrived intact");
+    check(connections() == 1, "the connection is open");
+    close(sock);
+    poll_until(received);
+    check(connections() == 0, "the connection was closed by the client");
+}
+
+
+// send one good packet and then bytes, which must close the connection
+void bad_test(const char *bytes, int n, const char *what)
+{
+    int sock = connect_client();
+    char good[40];
+    int count = received;
+    int g = length_packet(good, count);
+    check(write(sock, good, g) == g, "write");
+    check(write(sock, bytes, n) == n, "write");
+    poll_until(count + 1);
+    check(received == count + 1, "the packet before bad data arrived");
+    check(connections() == 0, what);
+    close(sock);
+}
+
+
+// a SLIP packet over the limit: the connection must be closed before
+// the client can send all of it
+void endless_slip_test()
+{
+    int sock = connect_client();
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    char bytes[4096];
+    memset(bytes, 'a', sizeof(bytes));
+    bytes[0] = (char) SLIP_END;
+    int sent = 0;
+    double stop = o2_local_time() + 5;
+    while (sent < 4 * MAX_BYTES && o2_local_time() < stop) {
+        int n = (int) send(sock, bytes, sizeof(bytes), 0);
+        if (n > 0) {
+            sent += n;
+            bytes[0] = 'a';
+        } else if (errno != EAGAIN) {
+            break; // the connection was closed
+        }
+        o2_poll();
+    }
+    poll_until(received);
+    check(sent < 4 * MAX_BYTES && connections() == 0,
+          "a SLIP packet over the limit closes the connection");
+    close(sock);
+}
+
+
+int main(int argc, const char * argv[])
+{
+    signal(SIGPIPE, SIG_IGN); // writes to a closed connection fail
+    o2_initialize("test");
+    o2_add_service("osc");
+    o2_add_method("/osc/x", "if", &handler, NULL, FALSE, TRUE);
+    // port 0: the system picks a free port
+    check(o2_create_osc_port("osc", 0, FALSE) == O2_SUCCESS,
+          "o2_create_osc_port");
+    port = find_port();
+    check(port != 0, "found the OSC TCP port");
+    if (!port) return 1;
+
+    good_tests(FALSE);
+    good_tests(TRUE);
+
+    // a length that is negative as an int, followed by some data
+    bad_test("\x80\0\0\0" "abcdefgh", 12,
+             "a length of 0x80000000 closes the connection");
+    char bytes[40];
+    int32_t len = htonl(MAX_BYTES + 1);
+    memcpy(bytes, &len, 4);
+    bad_test(bytes, 4, "a length over the limit closes the connection");
+    endless_slip_test();
+
+    // a connection closed in the middle of a packet
+    int sock = connect_client();
+    int count = received;
+    int n = length_packet(bytes, count);
+    check(write(sock, bytes, n - 4) == n - 4, "write");
+    poll_until(count);
+    close(sock);
+    poll_until(count);
+    check(received == count && connections() == 0,
+          "a packet cut short is not delivered");
+    check(errors == 0, "every value arrived intact");
+
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
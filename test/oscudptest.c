@@ -0,0 +1,303 @@
+//  oscudptest.c - test OSC over UDP (o2_create_osc_port() with UDP)
+//
+//  A raw UDP socket sends OSC messages to an OSC UDP port of this
+//  process for service "os". The prefix "/os" pads differently from
+//  some OSC addresses ("/abc"), so their types and arguments must
+//  move, and not others ("/x"). Arguments of every size are checked
+//  after conversion from network order.
+//
+//  Many small datagrams are sent at once so that they are received
+//  in batches. Datagrams larger than a batch buffer must arrive
+//  intact whether they are first in the socket's queue or behind
+//  small ones.
+//
+//  Malformed datagrams -- an address or string that does not end, a
+//  missing type string, arguments cut short, a blob size past the end
+//  -- must be dropped, and good datagrams after them delivered.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("oscudptest is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+
+#define N_MANY 40
+#define BIG_SIZE 8000 // larger than a batch buffer (1472 bytes)
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+int x_count = 0;   // messages to /os/x
+int abc_count = 0; // messages to /os/abc
+int bad_count = 0; // messages to /os/bad, which are all malformed
+int errors = 0;
+
+// argument k of /x is the count, and the others are computed from it
+int x_handler(const o2_message_ptr msg, const char *types,
+              o2_arg_ptr *argv, int argc, void *user_data)
+{
+    int k = x_count++;
+    char s[16];
+    snprintf(s, sizeof(s), "s%d", k);
+    if (argv[0]->i32 != k || argv[1]->f != k * 0.5f ||
+        strcmp(argv[2]->s, s) != 0 || argv[3]->h != k * 10000000000LL ||
+        argv[4]->d != k * 0.25) {
+        errors++;
+    }
+    return O2_SUCCESS;
+}
+
+
+// the blob holds bytes i + size, then an int32 equal to the size
+int abc_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    o2_blob_ptr blob = &argv[0]->b;
+    int ok = (argv[1]->i32 == (int) blob->size);
+    for (int i = 0; ok && i < (int) blob->size; i++) {
+        ok = ((unsigned char) blob->data[i] == (unsigned char) (i + blob->size));
+    }
+    if (!ok) errors++;
+    abc_count++;
+    return O2_SUCCESS;
+}
+
+
+int bad_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    bad_count++;
+    return O2_SUCCESS;
+}
+
+
+// building OSC packets
+char packet[BIG_SIZE + 100];
+int length;
+
+void add_bytes(const void *data, int n)
+{
+    memcpy(packet + length, data, n);
+    length += n;
+}
+
+void add_string(const char *s)
+{
+    int n = (int) strlen(s);
+    add_bytes(s, n);
+    memset(packet + length, 0, 4 - (n & 3));
+    length += 4 - (n & 3);
+}
+
+void add_word(int32_t w)
+{
+    w = htonl(w);
+    add_bytes(&w, 4);
+}
+
+void add_float(float f)
+{
+    int32_t w;
+    memcpy(&w, &f, 4);
+    add_word(w);
+}
+
+void add_int64(int64_t h)
+{
+    add_word((int32_t) (h >> 32));
+    add_word((int32_t) h);
+}
+
+void add_double(double d)
+{
+    int64_t h;
+    memcpy(&h, &d, 8);
+    add_int64(h);
+}
+
+
+int sock;
+struct sockaddr_in osc_sa;
+
+void send_packet()
+{
+    check(sendto(sock, packet, length, 0, (struct sockaddr *) &osc_sa,
+                 sizeof(osc_sa)) == length, "sendto");
+    length = 0;
+}
+
+
+void send_x(int k)
+{
+    char s[16];
+    snprintf(s, sizeof(s), "s%d", k);
+    add_string("/x");
+    add_string(",ifshd");
+    add_word(k);
+    add_float(k * 0.5f);
+    add_string(s);
+    add_int64(k * 10000000000LL);
+    add_double(k * 0.25);
+    send_packet();
+}
+
+
+void send_abc(int size)
+{
+    add_string("/abc");
+    add_string(",bi");
+    add_word(size);
+    for (int i = 0; i < size; i++) {
+        packet[length++] = (char) (i + size);
+    }
+    while (length & 3) packet[length++] = 0;
+    add_word(size);
+    send_packet();
+}
+
+
+// poll until x_count and abc_count reach x and abc, or 2 seconds pass
+void poll_until(int x, int abc)
+{
+    double stop = o2_local_time() + 2;
+    while ((x_count < x || abc_count < abc) && o2_local_time() < stop) {
+        o2_poll();
+        usleep(1000);
+    }
+    // anything more that would arrive
+    for (int i = 0; i < 20; i++) {
+        o2_poll();
+        usleep(1000);
+    }
+}
+
+
+// find the address of the OSC UDP socket
+int find_port()
+{
+    for (int i = 0; i < o2_fds_info.length; i++) {
+        if (DA_GET(o2_fds_info, fds_info, i)->tag == OSC_SOCKET) {
+            struct sockaddr_in sa;
+            socklen_t len = sizeof(sa);
+            if (getsockname(DA_GET(o2_fds, struct pollfd, i)->fd,
+                            (struct sockaddr *) &sa, &len) == 0) {
+                return ntohs(sa.sin_port);
+            }
+        }
+    }
+    return 0;
+}
+
+
+void bad_tests()
+{
+    // the address does not end
+    add_bytes("/bad", 4);
+    send_packet();
+    // no type string
+    add_string("/bad");
+    add_word(1);
+    send_packet();
+    // an int32 and a double cut short
+    add_string("/bad");
+    add_string(",id");
+    add_word(1);
+    add_word(2);
+    send_packet();
+    // a string that does not end
+    add_string("/bad");
+    add_string(",s");
+    add_bytes("abcd", 4);
+    send_packet();
+    // a blob size past the end
+    add_string("/bad");
+    add_string(",b");
+    add_word(100);
+    add_word(0);
+    send_packet();
+    int x = x_count;
+    send_x(x);
+    poll_until(x + 1, 0);
+    check(bad_count == 0, "malformed datagrams are dropped");
+    check(x_count == x + 1, "a datagram after malformed ones arrives");
+}
+
+
+int main(int argc, const char * argv[])
+{
+    o2_initialize("test");
+    o2_add_service("os");
+    o2_add_method("/os/x", "ifshd", &x_handler, NULL, FALSE, TRUE);
+    o2_add_method("/os/abc", "bi", &abc_handler, NULL, FALSE, TRUE);
+    o2_add_method("/os/bad", NULL, &bad_handler, NULL, FALSE, FALSE);
+    // port 0: the system picks a free port
+    check(o2_create_osc_port("os", 0, TRUE) == O2_SUCCESS,
+          "o2_create_osc_port");
+    int port = find_port();
+    check(port != 0, "found the OSC UDP port");
+    if (!port) return 1;
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&osc_sa, 0, sizeof(osc_sa));
+    osc_sa.sin_family = AF_INET;
+    osc_sa.sin_addr.s_addr = htonl(0x7F000001);
+    osc_sa.sin_port = htons(port);
+
+    // one at a time, with and without moving the arguments
+    send_x(0);
+    send_abc(5);
+    poll_until(1, 1);
+    check(x_count == 1 && abc_count == 1, "one datagram at a time");
+
+    // many, received in batches
+    for (int k = 1; k <= N_MANY; k++) {
+        send_x(k);
+        send_abc(k);
+    }
+    poll_until(N_MANY + 1, N_MANY + 1);
+    check(x_count == N_MANY + 1 && abc_count == N_MANY + 1,
+          "many datagrams at once");
+
+    // large datagrams: first in the queue, then behind small ones
+    send_abc(BIG_SIZE);
+    poll_until(0, N_MANY + 2);
+    check(abc_count == N_MANY + 2, "a large datagram alone");
+    send_x(N_MANY + 1);
+    send_abc(BIG_SIZE - 1);
+    send_x(N_MANY + 2);
+    poll_until(N_MANY + 3, N_MANY + 3);
+    check(x_count == N_MANY + 3 && abc_count == N_MANY + 3,
+          "a large datagram behind a small one");
+    check(errors == 0, "every value arrived intact");
+
+    bad_tests();
+    check(errors == 0, "every value arrived intact");
+    close(sock);
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
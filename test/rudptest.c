@@ -0,0 +1,281 @@
+//  rudptest.c - test reliable UDP (o2_send_reliable())
+//
+//  This program forks a receiver process offering service "rcv".
+//
+//  Receiving: packets of a reliable UDP channel are given to
+//  o2_rudp_receive() as if "rcv" had sent them, while packets to
+//  "rcv" go to a socket of the test instead. A packet after a gap is
+//  held and the gap is NACKed; the missing packet releases both in
+//  order; duplicates and packets given up on are dropped; an
+//  unordered packet is delivered at once; a SKIP gives up on a gap.
+//
+//  Sending: messages are sent to "rcv" with o2_send_reliable(), and
+//  some of them, including the last, are lost on the way (sent to the
+//  socket of the test). The receiver must get every message once, in
+//  order, through NACKs and retransmission. The receiver's exit status
+//  is the result.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("rudptest needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+#include "o2_send.h"
+#include "o2_rudp.h"
+
+#define N_SENDS 50
+
+// packet kinds (see o2_rudp.c)
+#define RUDP_DATA 0
+#define RUDP_UNORDERED 1
+#define RUDP_SKIP 3
+#define RUDP_NACK 4
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+// receiver state
+int received = 0;
+int errors = 0;
+
+int rcv_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (argv[0]->i32 != received) errors++;
+    received++;
+    return O2_SUCCESS;
+}
+
+
+void receiver()
+{
+    o2_initialize("rudptest");
+    o2_add_service("rcv");
+    o2_add_method("/rcv/x", "i", &rcv_handler, NULL, FALSE, TRUE);
+    double start = o2_local_time();
+    while (received < N_SENDS && o2_local_time() - start < 10) {
+        o2_poll();
+        usleep(1000);
+    }
+    // duplicates would arrive soon after
+    double stop = o2_local_time() + 0.3;
+    while (o2_local_time() < stop) {
+        o2_poll();
+        usleep(1000);
+    }
+    printf("receiver got %d/%d messages, %d errors\n", received, N_SENDS,
+           errors);
+    exit(received == N_SENDS && errors == 0 ? 0 : 1);
+}
+
+
+// values delivered to /test/x, in order of delivery
+int values[20];
+int n_values = 0;
+
+int test_handler(const o2_message_ptr msg, const char *types,
+                 o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (n_values < 20) values[n_values++] = argv[0]->i32;
+    return O2_SUCCESS;
+}
+
+
+process_info_ptr rcv; // the receiver process
+int sink;             // a UDP socket that packets can be sent to instead
+struct sockaddr_in sink_sa;
+
+
+// deliver a packet from rcv with the given kind and seq, holding a
+//   message to /test/x with value (if value >= 0)
+void inject(int kind, uint32_t seq, int value)
+{
+    o2_message_ptr msg = NULL;
+    if (value >= 0) {
+        o2_start_send();
+        o2_add_int32(value);
+        msg = o2_finish_message(0, "/test/x");
+    }
+    int name_len = o2_strsize(rcv->name);
+    int header = 4 + name_len + 8;
+    int len = msg ? msg->length : 0;
+    o2_message_ptr packet = alloc_size_message(sizeof(double) + header + len);
+    char *p = ((char *) &packet->data) + sizeof(double);
+    packet->data.timestamp = 0;
+    memset(p, 0, header);
+    p[0] = '&';
+    strcpy(p + 4, rcv->name);
+    int32_t word = htonl(seq);
+    memcpy(p + 4 + name_len, &word, 4);
+    word = htonl(kind);
+    memcpy(p + 8 + name_len, &word, 4);
+    if (msg) {
+        memcpy(p + header, &msg->data, len);
+        o2_free_message(msg);
+    }
+    packet->length = sizeof(double) + header + len;
+    o2_rudp_receive(packet);
+}
+
+
+// read a NACK from sink: return its count and set *seq, or return 0
+int read_nack(uint32_t *seq)
+{
+    char buf[512];
+    double stop = o2_local_time() + 0.2;
+    while (o2_local_time() < stop) {
+        int n = (int) recvfrom(sink, buf, sizeof(buf), 0, NULL, NULL);
+        if (n < (int) sizeof(double) + 8 || buf[sizeof(double)] != '&') {
+            usleep(1000);
+            continue;
+        }
+        char *p = buf + sizeof(double);
+        int header = 4 + o2_strsize(p + 4) + 8;
+        int32_t word;
+        memcpy(&word, p + header - 4, 4);
+        if (ntohl(word) != RUDP_NACK || n < (int) sizeof(double) + header + 4) {
+            continue;
+        }
+        memcpy(&word, p + header - 8, 4);
+        *seq = ntohl(word);
+        memcpy(&word, p + header, 4);
+        return ntohl(word);
+    }
+    return 0;
+}
+
+
+int values_are(const int *expected, int n)
+{
+    return n_values == n && memcmp(values, expected, n * sizeof(int)) == 0;
+}
+
+
+void receive_tests()
+{
+    struct sockaddr_in saved = rcv->udp_sa;
+    rcv->udp_sa = sink_sa; // NACKs go to sink
+    inject(RUDP_DATA, 0, 0);
+    int v1[] = {0};
+    check(values_are(v1, 1), "the first packet is delivered");
+    inject(RUDP_DATA, 2, 2);
+    check(values_are(v1, 1), "a packet after a gap is held");
+    o2_poll();
+    uint32_t seq = 0;
+    int count = read_nack(&seq);
+    check(count == 1 && seq == 1, "the gap is NACKed");
+    inject(RUDP_DATA, 1, 1);
+    int v3[] = {0, 1, 2};
+    check(values_are(v3, 3), "the missing packet releases the held one");
+    inject(RUDP_DATA, 1, 1);
+    inject(RUDP_DATA, 2, 2);
+    check(values_are(v3, 3), "duplicates are dropped");
+    inject(RUDP_UNORDERED, 4, 4);
+    int v4[] = {0, 1, 2, 4};
+    check(values_are(v4, 4), "an unordered packet is delivered at once");
+    inject(RUDP_DATA, 4, 4);
+    check(values_are(v4, 4), "an unordered duplicate is dropped");
+    inject(RUDP_SKIP, 5, -1);
+    inject(RUDP_DATA, 3, 3);
+    check(values_are(v4, 4), "a packet given up on is dropped");
+    inject(RUDP_DATA, 5, 5);
+    int v5[] = {0, 1, 2, 4, 5};
+    check(values_are(v5, 5), "packets after a SKIP are delivered");
+    rcv->udp_sa = saved;
+}
+
+
+// send message i to rcv; if lost, it goes to sink
+void send_one(int i, int lost)
+{
+    struct sockaddr_in saved = rcv->udp_sa;
+    if (lost) rcv->udp_sa = sink_sa;
+    o2_send_reliable("/rcv/x", 0, "i", i);
+    rcv->udp_sa = saved;
+    o2_poll();
+}
+
+
+int main(int argc, const char * argv[])
+{
+    // fork before o2_initialize() so the receiver has its own sockets
+    pid_t pid = fork();
+    if (pid == 0) {
+        receiver();
+    } else if (pid < 0) {
+        perror("rudptest: fork");
+        return 1;
+    }
+    o2_initialize("rudptest");
+    o2_set_clock(NULL, NULL);
+    o2_add_service("test");
+    o2_add_method("/test/x", "i", &test_handler, NULL, FALSE, TRUE);
+
+    sink = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&sink_sa, 0, sizeof(sink_sa));
+    sink_sa.sin_family = AF_INET;
+    sink_sa.sin_addr.s_addr = htonl(0x7F000001);
+    socklen_t sa_len = sizeof(sink_sa);
+    bind(sink, (struct sockaddr *) &sink_sa, sa_len);
+    getsockname(sink, (struct sockaddr *) &sink_sa, &sa_len);
+    fcntl(sink, F_SETFL, O_NONBLOCK);
+
+    double start = o2_local_time();
+    while (o2_status("rcv") != O2_REMOTE && o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(o2_status("rcv") == O2_REMOTE, "rcv discovered");
+    rcv = ((remote_service_entry_ptr) o2_find_service("rcv"))->parent;
+
+    receive_tests();
+
+    for (int i = 0; i < N_SENDS; i++) {
+        send_one(i, (i >= 10 && i < 13) || i == 30 || i == N_SENDS - 1);
+    }
+
+    int status = 0;
+    start = o2_local_time();
+    while (waitpid(pid, &status, WNOHANG) == 0 &&
+           o2_local_time() - start < 12) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          "lost messages are resent, in order and once");
+    close(sink);
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
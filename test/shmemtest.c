@@ -0,0 +1,201 @@
+//  shmemtest.c - test shared memory arguments (o2_shmem_new())
+//
+//  This program forks a receiver process offering service "rcv" on
+//  the same host. Neither process has a clock. The sender puts data
+//  in a segment and sends the receiver 'H' arguments in messages
+//  that must be dropped: one with a timestamp (there is no clock
+//  sync) and one that is malformed after the argument. Then it sends
+//  an argument naming a segment of the receiver, which must not be
+//  mapped or lose a use, and finally a good message by o2_send(),
+//  which must go by TCP and be mapped. The receiver's exit status
+//  tells if the handlers got what they should.
+//
+//  The sender checks that each message counted a use of the segment
+//  and that every use, including those of dropped messages, is given
+//  back, so the segment is freed when the sender releases it.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("shmemtest needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+#include "o2_send.h"
+#include "o2_shmem.h"
+
+#define DATA_SIZE 10000
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+// receiver state
+int good_count = 0;
+int other_count = 0;
+int dropped_count = 0; // messages that should have been dropped
+int errors = 0;
+o2_shmem_ptr own; // the receiver's segment
+
+int good_handler(const o2_message_ptr msg, const char *types,
+                 o2_arg_ptr *argv, int argc, void *user_data)
+{
+    o2_shmem_arg_ptr h = &argv[0]->H;
+    if (h->size != DATA_SIZE || !h->data) {
+        errors++;
+    } else {
+        for (int i = 0; i < DATA_SIZE; i++) {
+            if (((unsigned char *) h->data)[i] != (unsigned char) i) {
+                errors++;
+                break;
+            }
+        }
+    }
+    good_count++;
+    return O2_SUCCESS;
+}
+
+
+int other_handler(const o2_message_ptr msg, const char *types,
+                  o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (argv[0]->H.data) errors++; // not the sender's segment
+    if (o2_shmem_refs(own) != 1) errors++;
+    other_count++;
+    return O2_SUCCESS;
+}
+
+
+int dropped_handler(const o2_message_ptr msg, const char *types,
+                    o2_arg_ptr *argv, int argc, void *user_data)
+{
+    dropped_count++;
+    return O2_SUCCESS;
+}
+
+
+void receiver()
+{
+    o2_initialize("shmemtest");
+    o2_add_service("rcv");
+    own = o2_shmem_new(DATA_SIZE); // its id is 0
+    o2_add_method("/rcv/good", "H", &good_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/other", "H", &other_handler, NULL, FALSE, TRUE);
+    o2_add_method("/rcv/timed", "H", &dropped_handler, NULL, FALSE, FALSE);
+    o2_add_method("/rcv/bad", NULL, &dropped_handler, NULL, FALSE, FALSE);
+    double start = o2_local_time();
+    while (good_count == 0 && o2_local_time() - start < 10) {
+        o2_poll();
+        usleep(1000);
+    }
+    // give the sender time to get the last /sr message
+    double stop = o2_local_time() + 0.5;
+    while (o2_local_time() < stop) {
+        o2_poll();
+        usleep(1000);
+    }
+    printf("receiver got %d good, %d other and %d dropped messages, "
+           "%d errors\n", good_count, other_count, dropped_count, errors);
+    exit(good_count == 1 && other_count == 1 && dropped_count == 0 &&
+         errors == 0 && o2_shmem_refs(own) == 1 ? 0 : 1);
+}
+
+
+int main(int argc, const char * argv[])
+{
+    // fork before o2_initialize() so the receiver has its own sockets
+    pid_t pid = fork();
+    if (pid == 0) {
+        receiver();
+    } else if (pid < 0) {
+        perror("shmemtest: fork");
+        return 1;
+    }
+    o2_initialize("shmemtest");
+    // no o2_set_clock(): the receiver never has clock sync
+
+    double start = o2_local_time();
+    while (o2_status("rcv") != O2_REMOTE_NOTIME &&
+           o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(o2_status("rcv") == O2_REMOTE_NOTIME, "rcv discovered");
+
+    o2_shmem_ptr shm = o2_shmem_new(DATA_SIZE);
+    check(shm != NULL, "o2_shmem_new");
+    if (!shm) return 1;
+    for (int i = 0; i < DATA_SIZE; i++) {
+        ((unsigned char *) o2_shmem_data(shm))[i] = (unsigned char) i;
+    }
+
+    // dropped before clock sync
+    o2_start_send();
+    o2_add_shmem(shm, 0, DATA_SIZE);
+    o2_finish_send_cmd(1.0, "/rcv/timed");
+    // malformed: the string after the argument does not end
+    o2_start_send();
+    o2_add_shmem(shm, 0, DATA_SIZE);
+    o2_add_string("abc");
+    o2_message_ptr msg = o2_finish_message(0, "/rcv/bad");
+    ((char *) &msg->data)[msg->length - 1] = 'd';
+    o2_send_message(msg, TRUE);
+    // the receiver's segment, which the sender does not own
+    remote_service_entry_ptr rcv =
+            (remote_service_entry_ptr) o2_find_service("rcv");
+    o2_start_send();
+    o2_add_shmem(shm, 0, DATA_SIZE);
+    msg = o2_finish_message(0, "/rcv/other");
+    o2_shmem_arg_ptr h = (o2_shmem_arg_ptr) ((char *) &msg->data +
+                                             msg->length - sizeof(*h));
+    h->owner = atoi(strchr(rcv->parent->name, ':') + 1);
+    o2_send_message(msg, TRUE);
+    check(o2_shmem_refs(shm) == 3, "each message counts a use");
+    // good, and sent by TCP although o2_send() asks for UDP
+    o2_start_send();
+    o2_add_shmem(shm, 0, DATA_SIZE);
+    o2_finish_send(0, "/rcv/good");
+
+    int status = 0;
+    start = o2_local_time();
+    while (waitpid(pid, &status, WNOHANG) == 0 &&
+           o2_local_time() - start < 12) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          "the receiver maps only good segments");
+    check(o2_shmem_refs(shm) == 1, "every use is given back");
+    o2_shmem_release(shm);
+    check(o2_shmem_count == 0, "the segment is freed");
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
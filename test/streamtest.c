@@ -0,0 +1,179 @@
+//  streamtest.c - test o2_stream_open() and friends
+//
+//  This program forks a receiver process offering service "rcv".
+//  The sender writes a large buffer to a stream to "/rcv/data". A
+//  write sends no more than the credit allows, so the sender polls
+//  and writes the rest until all of it is sent, then closes the
+//  stream. The receiver checks that chunks arrive in order, at the
+//  right offsets, with the right bytes, and end with an empty chunk.
+//
+//  A second stream is opened, and the receiver exits as soon as its
+//  first chunk arrives, without returning credit. When the receiver
+//  process is removed, the stream must fail instead of waiting for
+//  credit forever. A stream to a local service is not limited.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("streamtest needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#define TOTAL 300000 // more than the window of 64KB
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+// receiver state, also used by the sender for its local stream
+int64_t got = 0;    // bytes received on the first stream
+int first_id = -1;  // id of the first stream
+int closed = FALSE; // the first stream ended
+int errors = 0;
+
+int data_handler(const o2_message_ptr msg, const char *types,
+                 o2_arg_ptr *argv, int argc, void *user_data)
+{
+    int id = argv[0]->i32;
+    o2_blob_ptr blob = &argv[2]->b;
+    if (first_id < 0) first_id = id;
+    if (id != first_id) { // the second stream: leave without credit
+        printf("receiver got %lld bytes, %d errors\n", (long long) got,
+               errors);
+        exit(got == TOTAL && closed && errors == 0 ? 0 : 1);
+    }
+    if (closed || argv[1]->h != got) errors++;
+    for (int i = 0; i < (int) blob->size; i++) {
+        if ((unsigned char) blob->data[i] != (unsigned char) (got + i)) {
+            errors++;
+            break;
+        }
+    }
+    got += blob->size;
+    if (blob->size == 0) closed = TRUE;
+    return O2_SUCCESS;
+}
+
+
+void receiver()
+{
+    o2_initialize("streamtest");
+    o2_add_service("rcv");
+    o2_add_method("/rcv/data", "ihb", &data_handler, NULL, FALSE, TRUE);
+    double start = o2_local_time();
+    while (o2_local_time() - start < 10) {
+        o2_poll();
+        usleep(1000);
+    }
+    printf("receiver timed out\n");
+    exit(1);
+}
+
+
+void poll_for(double seconds)
+{
+    double start = o2_local_time();
+    while (o2_local_time() - start < seconds) {
+        o2_poll();
+        usleep(1000);
+    }
+}
+
+
+int main(int argc, const char * argv[])
+{
+    // fork before o2_initialize() so the receiver has its own sockets
+    pid_t pid = fork();
+    if (pid == 0) {
+        receiver();
+    } else if (pid < 0) {
+        perror("streamtest: fork");
+        return 1;
+    }
+    o2_initialize("streamtest");
+    o2_set_clock(NULL, NULL);
+
+    char *data = (char *) malloc(TOTAL);
+    for (int i = 0; i < TOTAL; i++) data[i] = (char) i;
+
+    // local: all at once
+    o2_add_service("loc");
+    o2_add_method("/loc/data", "ihb", &data_handler, NULL, FALSE, TRUE);
+    o2_stream_ptr stream = o2_stream_open("/loc/data");
+    check(o2_stream_write(stream, data, TOTAL) == TOTAL,
+          "a local stream is not limited");
+    check(o2_stream_close(stream) == O2_SUCCESS && got == TOTAL && closed &&
+          errors == 0, "a local stream arrives intact");
+
+    double start = o2_local_time();
+    while (o2_status("rcv") != O2_REMOTE && o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(o2_status("rcv") == O2_REMOTE, "rcv discovered");
+
+    stream = o2_stream_open("/rcv/data");
+    int n = o2_stream_write(stream, data, TOTAL);
+    check(n > 0 && n <= 65536, "a write is limited by credit");
+    check(o2_stream_space(stream) == 65536 - n, "the space is what is left");
+    int sent = n;
+    start = o2_local_time();
+    while (sent < TOTAL && n >= 0 && o2_local_time() - start < 5) {
+        o2_poll();
+        n = o2_stream_write(stream, data + sent, TOTAL - sent);
+        sent += n;
+    }
+    check(sent == TOTAL, "credit comes back");
+    check(o2_stream_close(stream) == O2_SUCCESS, "close");
+
+    // the receiver exits on the first chunk of this stream
+    stream = o2_stream_open("/rcv/data");
+    n = o2_stream_write(stream, data, TOTAL);
+    check(n > 0 && n < TOTAL, "a write to the second stream");
+    int status = 0;
+    start = o2_local_time();
+    while (waitpid(pid, &status, WNOHANG) == 0 &&
+           o2_local_time() - start < 12) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          "the receiver got the stream in order");
+    start = o2_local_time();
+    while (o2_status("rcv") != O2_FAIL && o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    poll_for(0.1);
+    check(o2_stream_write(stream, data, TOTAL) == O2_FAIL &&
+          o2_stream_space(stream) == O2_FAIL,
+          "a stream to a removed process fails");
+    check(o2_stream_close(stream) == O2_FAIL, "closing it fails");
+    free(data);
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
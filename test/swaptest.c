@@ -0,0 +1,233 @@
+//  swaptest.c - test receiving messages from a host with the other
+//               byte order
+//
+//  Like dispatchtest, this uses local services only. Each message is
+//  built as usual, then converted to the other byte order the way a
+//  sender on such a host would have built it: its arguments with
+//  o2_msg_swap_endian() and its timestamp by hand. The test then
+//  converts it back with o2_msg_swap_received(), as
+//  deliver_or_schedule() does for a peer marked with the other byte
+//  order, dispatches it, and checks that the handler gets the original
+//  timestamp and arguments. Messages have every argument type,
+//  including blobs and vectors, and are also sent in nested bundles.
+//  A message whose blob size is wrong once converted must be rejected,
+//  and so must bundles nested deeper than O2_MAX_BUNDLE_DEPTH.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include <stdio.h>
+#include <string.h>
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+float floats[5] = {0.5f, -1.25f, 3e10f, 0.0f, 7.0f};
+double doubles[3] = {1e-300, -2.5, 12345.678};
+int32_t ints[4] = {1, -2, 0x12345678, -0x7654321};
+int64_t longs[2] = {0x123456789ABCDEFLL, -5};
+uint8_t midi[4] = {0x90, 60, 100, 0};
+char blob_data[7] = {1, 2, 3, 4, 5, 6, 7};
+
+int all_count = 0;
+o2_time all_time = 0;
+
+// argv[0] is the message number
+int all_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    int k = argv[0]->i32;
+    int ok = argc == 16 && msg->data.timestamp == all_time &&
+             argv[1]->f == 2.5f * k && argv[2]->h == 0x100000000LL * k &&
+             argv[3]->d == -0.125 * k && argv[4]->t == 3.5 &&
+             strcmp(argv[5]->s, "hello") == 0 &&
+             argv[6]->b.size == sizeof(blob_data) &&
+             memcmp(argv[6]->b.data, blob_data, sizeof(blob_data)) == 0 &&
+             argv[7]->c == 'Z' && memcmp(argv[8]->m, midi, 4) == 0 &&
+             argv[9]->v.len == 4 &&
+             memcmp(argv[9]->v.vi, ints, sizeof(ints)) == 0 &&
+             argv[10]->v.len == 2 &&
+             memcmp(argv[10]->v.vh, longs, sizeof(longs)) == 0 &&
+             argv[11]->v.len == 5 &&
+             memcmp(argv[11]->v.vf, floats, sizeof(floats)) == 0 &&
+             argv[12]->v.len == 3 &&
+             memcmp(argv[12]->v.vd, doubles, sizeof(doubles)) == 0 &&
+             argv[13]->i32 == -k &&
+             strcmp(types, "ifhdtsbcmvivhvfvdiTF") == 0;
+    check(ok, "arguments after o2_msg_swap_received");
+    all_count++;
+    return O2_SUCCESS;
+}
+
+
+int order[10];
+int order_count = 0;
+
+int order_handler(const o2_message_ptr msg, const char *types,
+                  o2_arg_ptr *argv, int argc, void *user_data)
+{
+    if (order_count < 10) order[order_count] = argv[0]->i32;
+    order_count++;
+    return O2_SUCCESS;
+}
+
+
+o2_message_ptr build_all(int k, o2_time time)
+{
+    o2_start_send();
+    o2_add_int32(k);
+    o2_add_float(2.5f * k);
+    o2_add_int64(0x100000000LL * k);
+    o2_add_double(-0.125 * k);
+    o2_add_time(3.5);
+    o2_add_string("hello");
+    o2_add_blob_data(sizeof(blob_data), blob_data);
+    o2_add_char('Z');
+    o2_add_midi(midi);
+    o2_add_vector(O2_INT32, 4, ints);
+    o2_add_vector(O2_INT64, 2, longs);
+    o2_add_vector(O2_FLOAT, 5, floats);
+    o2_add_vector(O2_DOUBLE, 3, doubles);
+    o2_add_int32(-k);
+    o2_add_true();
+    o2_add_false();
+    return o2_finish_message(time, "/one/all");
+}
+
+
+o2_message_ptr build_order(int i)
+{
+    o2_start_send();
+    o2_add_int32(i);
+    return o2_finish_message(0, "/one/order");
+}
+
+
+void swap_timestamp(o2_message_ptr msg)
+{
+    uint64_t t;
+    memcpy(&t, &msg->data.timestamp, sizeof(t));
+    t = swap64(t);
+    memcpy(&msg->data.timestamp, &t, sizeof(t));
+}
+
+
+// convert msg, a message (not a bundle) in host order, to the other
+// byte order
+void to_other_order(o2_message_ptr msg)
+{
+    check(o2_msg_swap_endian(msg, FALSE) == O2_SUCCESS,
+          "o2_msg_swap_endian");
+    swap_timestamp(msg);
+}
+
+
+// bundles depth deep in the other byte order around a message
+o2_message_ptr nest_other_order(int depth)
+{
+    o2_message_ptr msg = build_order(0);
+    to_other_order(msg);
+    for (int i = 0; i < depth; i++) {
+        o2_start_bundle();
+        o2_add_message(msg);
+        msg = o2_finish_bundle_message(0);
+        swap_timestamp(msg);
+    }
+    return msg;
+}
+
+
+int main(int argc, const char * argv[])
+{
+    o2_initialize("test");
+    o2_add_service("one");
+    o2_add_method("/one/all", "ifhdtsbcmvivhvfvdiTF", &all_handler, NULL,
+                  FALSE, TRUE);
+    o2_add_method("/one/order", "i", &order_handler, NULL, FALSE, TRUE);
+    o2_set_clock(NULL, NULL);
+
+    // one message with every type, timed (in the past, so it is
+    // dispatched at once)
+    all_time = o2_get_time();
+    o2_message_ptr msg = build_all(1, all_time);
+    int length = msg->length;
+    to_other_order(msg);
+    check(msg->data.timestamp != all_time, "the timestamp was swapped");
+    check(o2_msg_swap_received(msg) == O2_SUCCESS, "o2_msg_swap_received");
+    check(msg->length == length, "the length is unchanged");
+    o2_send_message(msg, FALSE);
+    o2_poll();
+    check(all_count == 1, "message dispatched");
+
+    // a bundle holding a bundle and messages, all in the other order:
+    // the element lengths stay in network order
+    all_time = 0;
+    o2_start_bundle();
+    for (int i = 0; i < 3; i++) {
+        msg = build_order(i);
+        to_other_order(msg);
+        o2_add_message(msg);
+    }
+    o2_message_ptr inner = o2_finish_bundle_message(0);
+    swap_timestamp(inner);
+    o2_start_bundle();
+    o2_add_message(inner);
+    msg = build_all(2, 0);
+    to_other_order(msg);
+    o2_add_message(msg);
+    msg = build_order(3);
+    to_other_order(msg);
+    o2_add_message(msg);
+    o2_message_ptr outer = o2_finish_bundle_message(0);
+    swap_timestamp(outer);
+    check(o2_msg_swap_received(outer) == O2_SUCCESS,
+          "o2_msg_swap_received of nested bundles");
+    o2_send_message(outer, FALSE);
+    o2_poll();
+    check(all_count == 2, "bundled message dispatched");
+    check(order_count == 4, "bundle elements dispatched");
+    for (int i = 0; i < order_count && i < 4; i++) {
+        check(order[i] == i, "bundle elements in order");
+    }
+
+    // a blob size that is too large once converted
+    msg = build_all(3, 0);
+    to_other_order(msg);
+    char *types = WORD_ALIGN_PTR(msg->data.address +
+                                 strlen(msg->data.address) + 4);
+    char *blob = WORD_ALIGN_PTR(types + strlen(types) + 4) +
+                 4 + 4 + 8 + 8 + 8 + 8; // after i f h d t "hello"
+    int32_t huge = swap32(100000);
+    memcpy(blob, &huge, 4);
+    check(o2_msg_swap_received(msg) == O2_FAIL,
+          "o2_msg_swap_received rejects a bad blob size");
+    o2_free_message(msg);
+
+    // nesting: O2_MAX_BUNDLE_DEPTH bundles deep is the limit
+    msg = nest_other_order(O2_MAX_BUNDLE_DEPTH);
+    check(o2_msg_swap_received(msg) == O2_SUCCESS,
+          "bundles nested up to the limit are converted");
+    o2_free_message(msg);
+    msg = nest_other_order(O2_MAX_BUNDLE_DEPTH + 1);
+    check(o2_msg_swap_received(msg) == O2_FAIL,
+          "bundles nested too deep are rejected");
+    o2_free_message(msg);
+
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
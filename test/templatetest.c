@@ -0,0 +1,214 @@
+//  templatetest.c - test o2_template_create() and o2_template_send()
+//
+//  Local part: a template is sent many times to a local service with
+//  different arguments each time, and the handler checks that it sees
+//  every value, in order. Templates with types that are not allowed
+//  are refused, and a send whose arguments do not match the template
+//  fails without sending anything.
+//
+//  Remote part: this program forks a receiver process offering
+//  service "rcv". The sender sends one template by TCP and another by
+//  UDP, changing every argument each time, and the receiver checks
+//  each value. The receiver's exit status is the result.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#ifdef WIN32
+
+int main(int argc, const char * argv[])
+{
+    printf("templatetest needs fork() and is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#define N_SENDS 100
+#define TYPES "ifhdcmTt"
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+// the arguments of send k: k, k / 2, k << 33, k / 4, a letter, a
+// MIDI message with k, true, k + 0.5
+int args_ok(const char *types, o2_arg_ptr *argv, int argc, int k)
+{
+    return argc == 8 && strcmp(types, TYPES) == 0 && argv[0]->i32 == k &&
+           argv[1]->f == k * 0.5f && argv[2]->h == (int64_t) k << 33 &&
+           argv[3]->d == k * 0.25 && argv[4]->c == 'a' + k % 26 &&
+           argv[5]->m[0] == 0x90 && argv[5]->m[1] == (uint8_t) k &&
+           argv[7]->t == k + 0.5;
+}
+
+
+int send_k(o2_template_ptr tmpl, int k, int tcp)
+{
+    uint8_t midi[4] = {0x90, (uint8_t) k, 100, 0};
+    if (tcp) {
+        return o2_template_send_cmd(tmpl, 0.0, k, k * 0.5, (int64_t) k << 33,
+                                    k * 0.25, 'a' + k % 26, midi, k + 0.5);
+    }
+    return o2_template_send(tmpl, 0.0, k, k * 0.5, (int64_t) k << 33,
+                            k * 0.25, 'a' + k % 26, midi, k + 0.5);
+}
+
+
+int tcp_count = 0;
+int udp_count = 0;
+int errors = 0;
+
+// user_data points to the count of messages so far, which is the
+// value of k expected next
+int handler(const o2_message_ptr msg, const char *types,
+            o2_arg_ptr *argv, int argc, void *user_data)
+{
+    int *count = (int *) user_data;
+    if (!args_ok(types, argv, argc, *count)) errors++;
+    (*count)++;
+    return O2_SUCCESS;
+}
+
+
+int empty_count = 0;
+
+int empty_handler(const o2_message_ptr msg, const char *types,
+                  o2_arg_ptr *argv, int argc, void *user_data)
+{
+    empty_count++;
+    return O2_SUCCESS;
+}
+
+
+void local_tests()
+{
+    o2_add_service("one");
+    o2_add_method("/one/x", TYPES, &handler, &tcp_count, FALSE, TRUE);
+    o2_add_method("/one/empty", "", &empty_handler, NULL, FALSE, TRUE);
+
+    check(o2_template_create("/one/x", "is") == NULL,
+          "a template with a string is refused");
+    check(o2_template_create("/one/x", "vi") == NULL,
+          "a template with a vector is refused");
+    check(o2_template_create("one/x", "i") == NULL,
+          "a template without a '/' is refused");
+
+    o2_template_ptr tmpl = o2_template_create("/one/x", TYPES);
+    check(tmpl != NULL, "o2_template_create");
+    if (!tmpl) return;
+    for (int k = 0; k < N_SENDS; k++) {
+        check(send_k(tmpl, k, k & 1) == O2_SUCCESS, "o2_template_send");
+    }
+    o2_poll();
+    check(tcp_count == N_SENDS && errors == 0,
+          "the local handler saw every value");
+    o2_template_free(tmpl);
+
+    o2_template_ptr empty = o2_template_create("/one/empty", "");
+    check(empty && o2_template_send(empty, 0.0) == O2_SUCCESS &&
+          o2_template_send_cmd(empty, 0.0) == O2_SUCCESS,
+          "a template with no arguments");
+    o2_poll();
+    check(empty_count == 2, "the template with no arguments arrived");
+    // the wrong number of arguments: the markers do not match
+    o2_template_ptr two = o2_template_create("/one/empty", "ii");
+    fprintf(stderr, "(expect an error about mismatching data)\n");
+    check(o2_template_send(two, 0.0, 1) == O2_FAIL,
+          "a mismatched send fails");
+    o2_poll();
+    check(empty_count == 2, "a mismatched send sends nothing");
+    o2_template_free(two);
+    o2_template_free(empty);
+    tcp_count = 0;
+}
+
+
+void receiver()
+{
+    o2_initialize("templatetest");
+    o2_add_service("rcv");
+    o2_add_method("/rcv/tcp", TYPES, &handler, &tcp_count, FALSE, TRUE);
+    o2_add_method("/rcv/udp", TYPES, &handler, &udp_count, FALSE, TRUE);
+    double start = o2_local_time();
+    while ((tcp_count < N_SENDS || udp_count < N_SENDS) &&
+           o2_local_time() - start < 10) {
+        o2_poll();
+        usleep(1000);
+    }
+    printf("receiver got tcp %d/%d udp %d/%d, %d errors\n", tcp_count,
+           N_SENDS, udp_count, N_SENDS, errors);
+    exit(tcp_count == N_SENDS && udp_count == N_SENDS && errors == 0 ?
+         0 : 1);
+}
+
+
+void remote_tests(pid_t pid)
+{
+    double start = o2_local_time();
+    while (o2_status("rcv") != O2_REMOTE && o2_local_time() - start < 5) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(o2_status("rcv") == O2_REMOTE, "rcv discovered");
+    o2_template_ptr tcp = o2_template_create("/rcv/tcp", TYPES);
+    o2_template_ptr udp = o2_template_create("/rcv/udp", TYPES);
+    check(tcp && udp, "o2_template_create for rcv");
+    if (!tcp || !udp) return;
+    for (int k = 0; k < N_SENDS; k++) {
+        check(send_k(tcp, k, TRUE) == O2_SUCCESS, "o2_template_send_cmd");
+        check(send_k(udp, k, FALSE) == O2_SUCCESS, "o2_template_send");
+        if (k % 20 == 19) { // let the receiver keep up with UDP
+            o2_poll();
+            usleep(2000);
+        }
+    }
+    o2_template_free(tcp);
+    o2_template_free(udp);
+    int status = 0;
+    start = o2_local_time();
+    while (waitpid(pid, &status, WNOHANG) == 0 &&
+           o2_local_time() - start < 12) {
+        o2_poll();
+        usleep(1000);
+    }
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+          "receiver saw every value");
+}
+
+
+int main(int argc, const char * argv[])
+{
+    // fork before o2_initialize() so the receiver has its own sockets
+    pid_t pid = fork();
+    if (pid == 0) {
+        receiver();
+    } else if (pid < 0) {
+        perror("templatetest: fork");
+        return 1;
+    }
+    o2_initialize("templatetest");
+    o2_set_clock(NULL, NULL);
+    local_tests();
+    remote_tests(pid);
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
+
+#endif
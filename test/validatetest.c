@@ -0,0 +1,267 @@
+//  validatetest.c - test o2_msg_validate()
+//
+//  Messages are built as usual and then damaged: cut short in the
+//  address, given a string that does not end, a blob size or vector
+//  length larger than the message, or put in a bundle after such
+//  damage. o2_msg_validate() must accept the undamaged messages and
+//  reject every damaged one, and bundles nested deeper than
+//  O2_MAX_BUNDLE_DEPTH. Then damaged and good messages are sent to
+//  this process's own UDP port: only the good ones may reach the
+//  handler. Finally, TCP frames longer than O2_MAX_MSG_SIZE, plain
+//  and compact, are sent to this process's TCP port: each must close
+//  the connection.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include <stdio.h>
+#include <string.h>
+#include "o2.h"
+#include "o2_dynamic.h"
+#include "o2_socket.h"
+#include "o2_search.h"
+#include "o2_internal.h"
+#include "o2_message.h"
+
+#include "o2_compact.h"
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+int received = 0;
+
+int handler(const o2_message_ptr msg, const char *types,
+            o2_arg_ptr *argv, int argc, void *user_data)
+{
+    received++;
+    return O2_SUCCESS;
+}
+
+
+// a copy of the first length bytes of msg
+o2_message_ptr copy(o2_message_ptr msg, int length)
+{
+    o2_message_ptr c = alloc_size_message(length);
+    memcpy(&c->data, &msg->data, length);
+    c->length = length;
+    return c;
+}
+
+
+// a copy of msg with the int32 at offset (from the start of the
+// data) replaced by value
+o2_message_ptr with_int32(o2_message_ptr msg, int offset, int32_t value)
+{
+    o2_message_ptr c = copy(msg, msg->length);
+    memcpy(((char *) &c->data) + offset, &value, 4);
+    return c;
+}
+
+
+// TRUE if o2_msg_validate() accepts msg, which is freed
+int valid(o2_message_ptr msg)
+{
+    int ok = (o2_msg_validate(msg) == O2_SUCCESS);
+    o2_free_message(msg);
+    return ok;
+}
+
+
+// a bundle holding a bundle, and so on, depth deep, with msg inside
+o2_message_ptr nest(o2_message_ptr msg, int depth)
+{
+    for (int i = 0; i < depth; i++) {
+        o2_start_bundle();
+        o2_add_message(msg);
+        msg = o2_finish_bundle_message(0);
+    }
+    return msg;
+}
+
+
+#ifndef WIN32
+// the number of open TCP connections
+int tcp_connections()
+{
+    int count = 0;
+    for (int i = 0; i < o2_fds_info.length; i++) {
+        if (DA_GET(o2_fds_info, fds_info, i)->tag == TCP_SOCKET) count++;
+    }
+    return count;
+}
+
+
+// send the length of a frame (in host order) to this process's TCP
+// port; TRUE if the connection is closed
+int frame_refused(uint32_t length)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(0x7F000001);
+    sa.sin_port = htons(o2_local_tcp_port);
+    int before = tcp_connections();
+    if (connect(sock, (struct sockaddr *) &sa, sizeof(sa))) {
+        close(sock);
+        return FALSE;
+    }
+    for (int i = 0; i < 100 && tcp_connections() == before; i++) {
+        o2_poll(); // accept the connection
+        usleep(1000);
+    }
+    uint32_t len = htonl(length);
+    int refused = FALSE;
+    if (send(sock, &len, 4, 0) == 4) {
+        for (int i = 0; i < 100 && tcp_connections() > before; i++) {
+            o2_poll();
+            usleep(1000);
+        }
+        char c;
+        refused = (tcp_connections() == before && recv(sock, &c, 1, 0) <= 0);
+    }
+    close(sock);
+    return refused;
+}
+#endif
+
+
+// The messages below have a 4-byte address ("/v/x" and its padding
+// take 8 bytes) and a type string of up to 3 characters (4 bytes with
+// the ','), so their arguments start at ARGS.
+#define ARGS (8 + 8 + 4)
+
+int main(int argc, const char * argv[])
+{
+    o2_initialize("test");
+    o2_add_service("v");
+    o2_add_method("/v/x", "is", &handler, NULL, FALSE, TRUE);
+
+    // ",is": 1, "hello"
+    o2_start_send();
+    o2_add_int32(1);
+    o2_add_string("hello");
+    o2_message_ptr string_msg = o2_finish_message(0, "/v/x");
+    check(string_msg->length == ARGS + 4 + 8, "string message layout");
+    check(valid(copy(string_msg, string_msg->length)),
+          "a good message is accepted");
+    // truncated: every length short of the whole message
+    for (int length = 0; length < string_msg->length; length++) {
+        check(!valid(copy(string_msg, length)),
+              "a truncated message is rejected");
+    }
+    // the address does not end within the message
+    o2_message_ptr m = copy(string_msg, string_msg->length);
+    memset(m->data.address, 'a', m->length - sizeof(double));
+    check(!valid(m), "an address without its end is rejected");
+    // the string runs into the end: its padding is not zero
+    m = copy(string_msg, string_msg->length);
+    memset(((char *) &m->data) + ARGS + 4 + 5, 'x', 3);
+    check(!valid(m), "an unterminated string is rejected");
+
+    // ",ib": 1, a 4-byte blob
+    o2_start_send();
+    o2_add_int32(1);
+    o2_add_blob_data(4, "abcd");
+    o2_message_ptr blob_msg = o2_finish_message(0, "/v/x");
+    check(blob_msg->length == ARGS + 4 + 4 + 4, "blob message layout");
+    check(valid(with_int32(blob_msg, ARGS + 4, 4)),
+          "a good blob size is accepted");
+    int32_t blob_sizes[] = {5, 1000, 0x7FFFFFFF, -1};
+    for (int i = 0; i < 4; i++) {
+        check(!valid(with_int32(blob_msg, ARGS + 4, blob_sizes[i])),
+              "an oversized blob size is rejected");
+    }
+
+    // ",vi": a vector of 3 int32s (length, element type, elements)
+    int32_t ints[3] = {1, 2, 3};
+    o2_start_send();
+    o2_add_vector(O2_INT32, 3, ints);
+    o2_message_ptr vector_msg = o2_finish_message(0, "/v/x");
+    check(vector_msg->length == ARGS + 8 + 12, "vector message layout");
+    check(valid(with_int32(vector_msg, ARGS, 3)),
+          "a good vector length is accepted");
+    // 0x40000001 * 4 overflows an int32
+    int32_t vector_lengths[] = {4, 1000, 0x40000001, -1};
+    for (int i = 0; i < 4; i++) {
+        check(!valid(with_int32(vector_msg, ARGS, vector_lengths[i])),
+              "an oversized vector length is rejected");
+    }
+
+    // bundles: each element is checked
+    o2_start_bundle();
+    o2_add_message(copy(string_msg, string_msg->length));
+    o2_add_message(copy(blob_msg, blob_msg->length));
+    check(valid(o2_finish_bundle_message(0)), "a good bundle is accepted");
+    o2_start_bundle();
+    o2_add_message(copy(string_msg, string_msg->length));
+    o2_add_message(with_int32(blob_msg, ARGS + 4, 1000));
+    check(!valid(o2_finish_bundle_message(0)),
+          "a bundle with an oversized blob size is rejected");
+
+    // nesting: O2_MAX_BUNDLE_DEPTH bundles deep is the limit
+    m = nest(copy(string_msg, string_msg->length), O2_MAX_BUNDLE_DEPTH);
+    check(valid(m), "bundles nested up to the limit are accepted");
+    m = nest(copy(string_msg, string_msg->length), O2_MAX_BUNDLE_DEPTH + 1);
+    check(!valid(m), "bundles nested too deep are rejected");
+
+#ifndef WIN32
+    // end to end: damaged messages sent to our own UDP port are
+    // dropped, and good ones still arrive
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(0x7F000001);
+    sa.sin_port = htons(o2_process.udp_port);
+    o2_message_ptr bad[3];
+    bad[0] = copy(string_msg, string_msg->length - 4);
+    bad[1] = copy(string_msg, string_msg->length);
+    memset(((char *) &bad[1]->data) + ARGS + 4 + 5, 'x', 3);
+    bad[2] = copy(string_msg, string_msg->length);
+    memset(bad[2]->data.address, 'a', bad[2]->length - sizeof(double));
+    for (int i = 0; i < 3; i++) {
+        sendto(sock, (char *) &bad[i]->data, bad[i]->length, 0,
+               (struct sockaddr *) &sa, sizeof(sa));
+        o2_free_message(bad[i]);
+    }
+    sendto(sock, (char *) &string_msg->data, string_msg->length, 0,
+           (struct sockaddr *) &sa, sizeof(sa));
+    for (int i = 0; i < 100 && received == 0; i++) {
+        o2_poll();
+        usleep(1000);
+    }
+    for (int i = 0; i < 10; i++) {
+        o2_poll();
+    }
+    check(received == 1, "only the good message reaches the handler");
+    close(sock);
+
+    // frames too long to allocate: the connection is closed
+    check(frame_refused(O2_MAX_MSG_SIZE + 1),
+          "a frame over O2_MAX_MSG_SIZE closes the connection");
+    check(frame_refused(0x7FFFFFFF),
+          "a 2GB frame closes the connection");
+    check(frame_refused(O2_COMPACT_LENGTH | 0x7FFFFFFF),
+          "a 2GB compact frame closes the connection");
+#endif
+
+    o2_free_message(string_msg);
+    o2_free_message(blob_msg);
+    o2_free_message(vector_msg);
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}
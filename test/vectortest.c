@@ -0,0 +1,263 @@
+//  vectortest.c - test vector arguments (o2_add_vector())
+//
+//  Vectors of each element type ('i', 'h', 'f' and 'd') are sent to
+//  local handlers that ask for each element type, with coercion, so
+//  that every conversion runs. Lengths cover vectors shorter than,
+//  equal to and longer than the 4 or 2 elements that the SSE2 loops
+//  convert at a time, so the remainders are converted too. Converted
+//  elements must equal C casts of the originals, and an int32 sent
+//  after the vector must arrive, and so must a time taken as a double,
+//  and a vector must count as one argument. Vectors are also given to o2_send() as a length and a
+//  pointer, and converted by o2_get_next_vector() in a handler that
+//  does not parse arguments.
+//
+//  Errors: o2_add_vector() with a bad element type or length fails and
+//  leaves the message as it was, o2_send() with a bad element type
+//  sends nothing, a handler without coercion is not called for
+//  another element type, and a handler that asks for a vector gets
+//  NULL for an argument that is not one.
+//
+//  Prints "DONE" and returns 0 if all tests pass.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+
+#define MAX_LEN 512
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+
+const char *elem_types = "ihfd";
+
+int lengths[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 33, MAX_LEN };
+#define N_LENGTHS ((int) (sizeof(lengths) / sizeof(lengths[0])))
+
+// the vector being sent, with elements of every type
+char sent_type;
+int32_t sent_i[MAX_LEN];
+int64_t sent_h[MAX_LEN];
+float sent_f[MAX_LEN];
+double sent_d[MAX_LEN];
+
+void *sent_data(char typ)
+{
+    switch (typ) {
+      case 'i': return sent_i;
+      case 'h': return sent_h;
+      case 'f': return sent_f;
+      default: return sent_d;
+    }
+}
+
+
+// element k of the sent vector, cast to typ the way C does, as double
+double expected(int k, char typ)
+{
+    switch (sent_type) {
+      case 'i':
+        return typ == 'i' ? (int32_t) sent_i[k] : typ == 'h' ?
+               (int64_t) sent_i[k] : typ == 'f' ? (float) sent_i[k] :
+               (double) sent_i[k];
+      case 'h':
+        return typ == 'i' ? (int32_t) sent_h[k] : typ == 'h' ?
+               (int64_t) sent_h[k] : typ == 'f' ? (float) sent_h[k] :
+               (double) sent_h[k];
+      case 'f':
+        return typ == 'i' ? (int32_t) sent_f[k] : typ == 'h' ?
+               (int64_t) sent_f[k] : typ == 'f' ? (float) sent_f[k] :
+               (double) sent_f[k];
+      default:
+        return typ == 'i' ? (int32_t) sent_d[k] : typ == 'h' ?
+               (int64_t) sent_d[k] : typ == 'f' ? (float) sent_d[k] :
+               (double) sent_d[k];
+    }
+}
+
+
+double element(o2_vector_ptr v, int k)
+{
+    switch (v->typ) {
+      case 'i': return v->vi[k];
+      case 'h': return (double) v->vh[k];
+      case 'f': return v->vf[k];
+      default: return v->vd[k];
+    }
+}
+
+
+// fill the vectors to send with len values of both signs, some with
+//   fractions to truncate, of type typ
+void fill(char typ, int len)
+{
+    sent_type = typ;
+    for (int k = 0; k < len; k++) {
+        double x = (k - len / 2) * 1.25;
+        sent_i[k] = (int32_t) x * 3;
+        sent_h[k] = (int64_t) x * 100000;
+        sent_f[k] = (float) x;
+        sent_d[k] = x / 3;
+    }
+}
+
+
+int vector_ok(o2_vector_ptr v, char typ, int len)
+{
+    if (!v || v->typ != typ || v->len != len) return FALSE;
+    for (int k = 0; k < len; k++) {
+        if (element(v, k) != expected(k, typ)) return FALSE;
+    }
+    return TRUE;
+}
+
+
+int received = 0;
+int good = 0;
+
+// user_data is the element type that the handler asks for, and the
+//   int32 after the vector is its length
+int vec_handler(const o2_message_ptr msg, const char *types,
+                o2_arg_ptr *argv, int argc, void *user_data)
+{
+    received++;
+    char typ = *(char *) user_data;
+    if (argc == 2 && argv[1] &&
+        vector_ok(&argv[0]->v, typ, argv[1]->i32)) {
+        good++;
+    }
+    return O2_SUCCESS;
+}
+
+
+// converts the vector itself, to double and to a type that is not one
+int extract_handler(const o2_message_ptr msg, const char *types,
+                    o2_arg_ptr *argv, int argc, void *user_data)
+{
+    received++;
+    o2_start_extract(msg);
+    o2_arg_ptr v = o2_get_next_vector(O2_DOUBLE);
+    o2_arg_ptr len = o2_get_next(O2_INT32);
+    if (argv == NULL && argc == 2 && v && len &&
+        vector_ok(&v->v, 'd', len->i32)) {
+        good++;
+    }
+    o2_start_extract(msg);
+    if (o2_get_next_vector('x') == NULL) good++;
+    return O2_SUCCESS;
+}
+
+
+// a time after the vector, taken as a double, which needs no conversion
+int time_handler(const o2_message_ptr msg, const char *types,
+                 o2_arg_ptr *argv, int argc, void *user_data)
+{
+    received++;
+    if (argc == 2 && argv[0] && argv[1] && argv[1]->d == 9.5) good++;
+    return O2_SUCCESS;
+}
+
+
+int null_count = 0;
+
+// counts calls where the vector is missing
+int null_handler(const o2_message_ptr msg, const char *types,
+                 o2_arg_ptr *argv, int argc, void *user_data)
+{
+    received++;
+    if (argc == 2 && argv[0] == NULL) null_count++;
+    return O2_SUCCESS;
+}
+
+
+void send_vector(char from, int len, char *address)
+{
+    o2_start_send();
+    o2_add_vector(from, len, sent_data(from));
+    o2_add_int32(len);
+    o2_finish_send(0, address);
+}
+
+
+int main(int argc, const char * argv[])
+{
+    o2_initialize("test");
+    o2_add_service("vec");
+    char addresses[4][8];
+    for (int t = 0; t < 4; t++) {
+        char typespec[4] = { 'v', elem_types[t], 'i', 0 };
+        snprintf(addresses[t], sizeof(addresses[t]), "/vec/%c",
+                 elem_types[t]);
+        o2_add_method(addresses[t], typespec, &vec_handler,
+                      (void *) (elem_types + t), TRUE, TRUE);
+    }
+
+    // every conversion, at every length
+    int sends = 0;
+    for (int f = 0; f < 4; f++) {
+        for (int n = 0; n < N_LENGTHS; n++) {
+            fill(elem_types[f], lengths[n]);
+            for (int t = 0; t < 4; t++) {
+                send_vector(elem_types[f], lengths[n], addresses[t]);
+                sends++;
+            }
+        }
+    }
+    check(received == sends, "every vector is delivered");
+    check(good == sends, "every vector is converted");
+
+    // o2_send() takes a length and a pointer
+    received = good = 0;
+    fill('f', 100);
+    o2_send("/vec/d", 0, "vfi", 100, sent_f, 100);
+    o2_send("/vec/f", 0, "vfi", 100, sent_f, 100);
+    check(received == 2 && good == 2, "vectors given to o2_send()");
+    o2_add_method("/vec/time", "vfd", &time_handler, NULL, TRUE, TRUE);
+    o2_send("/vec/time", 0, "vft", 100, sent_f, 9.5);
+    check(received == 3 && good == 3, "a time after a vector, as a double");
+
+    o2_add_method("/vec/extract", NULL, &extract_handler, NULL, FALSE,
+                  FALSE);
+    received = good = 0;
+    fill('i', 9);
+    send_vector('i', 9, "/vec/extract");
+    check(received == 1 && good == 2, "o2_get_next_vector() in a handler");
+
+    // errors
+    received = good = 0;
+    fill('h', 5);
+    o2_start_send();
+    check(o2_add_vector('x', 5, sent_h) == O2_FAIL,
+          "o2_add_vector() with a bad element type");
+    check(o2_add_vector(O2_INT64, -1, sent_h) == O2_FAIL,
+          "o2_add_vector() with a negative length");
+    o2_add_vector(O2_INT64, 5, sent_h);
+    o2_add_int32(5);
+    o2_finish_send(0, "/vec/h");
+    check(received == 1 && good == 1, "failed additions leave no trace");
+
+    received = 0;
+    check(o2_send("/vec/f", 0, "vxi", 5, sent_h, 5) != O2_SUCCESS &&
+          received == 0, "o2_send() with a bad element type");
+
+    o2_add_method("/vec/exact", "vfi", &vec_handler, "f", FALSE, TRUE);
+    fill('d', 5);
+    send_vector('d', 5, "/vec/exact");
+    check(received == 0, "no coercion: another element type is not taken");
+
+    o2_add_method("/vec/null", "vfi", &null_handler, NULL, TRUE, TRUE);
+    o2_send("/vec/null", 0, "ii", 1, 2);
+    check(received == 1 && null_count == 1, "an argument that is not a vector");
+
+    if (failures == 0) {
+        printf("DONE\n");
+    }
+    return failures ? 1 : 0;
+}